@@ -19,7 +19,15 @@ set outDir=%rootDir%\out
 set emccDebugFlags=-O0 -g --emrun
 set emccReleaseFlags=-O3
 set emccConfigFlags=%emccDebugFlags%
-set emccFlags=-fno-exceptions -fno-rtti -Werror -I%rootDir% -s USE_WEBGL2=1 %emccConfigFlags%
+REM Asynchronous compilation lets the generated main.js compile main.wasm with
+REM WebAssembly.instantiateStreaming while it downloads. This only works if the
+REM server sends main.wasm as application/wasm.
+REM -msimd128 turns on the WASM SIMD instructions, which util.h uses for Mat4.
+REM -ffp-contract=off keeps multiplies and adds unfused, which the bit for bit
+REM promises in util_math.h rely on.
+REM ALLOW_MEMORY_GROWTH lets the heap grow past its initial size, for demos
+REM like webgl_instanced_cubes that allocate per-object arrays at runtime.
+set emccFlags=-fno-exceptions -fno-rtti -Werror -msimd128 -ffp-contract=off -I%rootDir% -s USE_WEBGL2=1 -s WASM_ASYNC_COMPILATION=1 -s ALLOW_MEMORY_GROWTH=1 %emccConfigFlags%
 
 if not exist %outDir% (mkdir %outDir%)
 pushd %rootDir%/%projectDir%
@@ -0,0 +1,5 @@
+#!/bin/sh
+mkdir -p out
+cd out || exit 1
+ccArgs="-std=gnu11 -Werror -g -O0 -o http-server ../tools/http_server.c -lpthread"
+cc $ccArgs && ./http-server --root .
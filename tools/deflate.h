@@ -0,0 +1,695 @@
+// DEFLATE (RFC 1951) compression, wrapped in the gzip format (RFC 1952).
+//
+// The server compresses each static file once and keeps the result, so this
+// favours compression ratio over speed: lazy LZ77 matching over hash chains,
+// like zlib's default level, and a dynamic Huffman code for every block. A
+// block falls back to the fixed code, or to being stored as is, whenever that
+// comes out smaller, so incompressible files only grow by a few bytes.
+//
+// There are no external dependencies, since the Windows build does not link
+// against anything but the C runtime. This file is meant to be included into
+// a single translation unit, after the basic types (u8, u16, u32, u64, uword,
+// b32) and checkOutOfMemory()/reallocSafe() have been defined.
+
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+// The match search settings of zlib's default level (6).
+#define DEFLATE_MAX_CHAIN 128
+// only look half as hard for a better match after a match this long
+#define DEFLATE_GOOD_MATCH 8
+// don't look for a better match at the next byte after a match this long
+#define DEFLATE_LAZY_MATCH 16
+// stop searching as soon as a match is this long
+#define DEFLATE_NICE_MATCH 128
+// a match of the minimum length that is further back than this usually costs
+// more bits than three literals
+#define DEFLATE_TOO_FAR 4096
+
+// symbols per block; a new Huffman code is built for each block
+#define DEFLATE_BLOCK_SYMBOL_COUNT 16384
+#define DEFLATE_MAX_STORED_SIZE 65535
+
+#define DEFLATE_LITERAL_LENGTH_COUNT 288
+#define DEFLATE_DISTANCE_COUNT 30
+#define DEFLATE_CODE_LENGTH_COUNT 19
+#define DEFLATE_END_OF_BLOCK 256
+
+static const u16 deflateLengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const u8 deflateLengthExtraBits[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const u16 deflateDistanceBase[DEFLATE_DISTANCE_COUNT] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const u8 deflateDistanceExtraBits[DEFLATE_DISTANCE_COUNT] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+// the order that code length code lengths are sent in
+static const u8 deflateCodeLengthOrder[DEFLATE_CODE_LENGTH_COUNT] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+inline static u32 deflateHighestSetBit(u32 value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return (u32) index;
+#else
+	return 31 - (u32) __builtin_clz(value);
+#endif
+}
+
+// Index into deflateLengthBase for a match length.
+inline static u32 deflateLengthCode(u32 length) {
+	u32 x = length - DEFLATE_MIN_MATCH;
+	if (x < 8) {
+		return x;
+	}
+	if (length == DEFLATE_MAX_MATCH) {
+		return 28;
+	}
+	u32 bit = deflateHighestSetBit(x);
+	return 4 * (bit - 1) + ((x >> (bit - 2)) & 3);
+}
+
+inline static u32 deflateDistanceCode(u32 distance) {
+	u32 x = distance - 1;
+	if (x < 4) {
+		return x;
+	}
+	u32 bit = deflateHighestSetBit(x);
+	return 2 * bit + ((x >> (bit - 1)) & 1);
+}
+
+// Bits are packed starting from the least significant bit of each byte.
+typedef struct DeflateWriter {
+	u8* data;
+	uword size;
+	uword capacity;
+	u64 bits;
+	u32 bitCount;
+} DeflateWriter;
+
+static void deflateWriterReserve(DeflateWriter* writer, uword byteCount) {
+	if (writer->size + byteCount <= writer->capacity) {
+		return;
+	}
+	uword newCapacity = (writer->capacity == 0) ? 4096 : writer->capacity;
+	while (newCapacity < writer->size + byteCount) {
+		newCapacity *= 2;
+	}
+	writer->data = reallocSafe(writer->data, newCapacity);
+	writer->capacity = newCapacity;
+}
+
+inline static void deflateWriteBits(DeflateWriter* writer, u32 value, u32 bitCount) {
+	writer->bits |= (u64) value << writer->bitCount;
+	writer->bitCount += bitCount;
+	if (writer->bitCount >= 32) {
+		deflateWriterReserve(writer, 4);
+		u8* out = writer->data + writer->size;
+		out[0] = (u8) writer->bits;
+		out[1] = (u8) (writer->bits >> 8);
+		out[2] = (u8) (writer->bits >> 16);
+		out[3] = (u8) (writer->bits >> 24);
+		writer->size += 4;
+		writer->bits >>= 32;
+		writer->bitCount -= 32;
+	}
+}
+
+// Pad to a byte boundary, and write out every complete byte.
+static void deflateAlignToByte(DeflateWriter* writer) {
+	deflateWriterReserve(writer, 8);
+	while (writer->bitCount > 0) {
+		writer->data[writer->size] = (u8) writer->bits;
+		++writer->size;
+		writer->bits >>= 8;
+		writer->bitCount = (writer->bitCount > 8) ? writer->bitCount - 8 : 0;
+	}
+	writer->bits = 0;
+}
+
+static void deflateWriteBytes(DeflateWriter* writer, const u8* bytes, uword byteCount) {
+	assert(writer->bitCount == 0);
+	deflateWriterReserve(writer, byteCount);
+	memcpy(writer->data + writer->size, bytes, byteCount);
+	writer->size += byteCount;
+}
+
+typedef struct DeflateLeaf {
+	u32 frequency;
+	u32 symbol;
+} DeflateLeaf;
+
+static int deflateCompareLeaves(const void* a, const void* b) {
+	const DeflateLeaf* leafA = a;
+	const DeflateLeaf* leafB = b;
+	if (leafA->frequency != leafB->frequency) {
+		return (leafA->frequency < leafB->frequency) ? -1 : 1;
+	}
+	return (leafA->symbol < leafB->symbol) ? -1 : 1;
+}
+
+// Build the code lengths of a Huffman code, with no code longer than
+// maxLength. The Huffman tree is built with the two-queue method; if it is too
+// deep, the number of codes of each length is adjusted as in the JPEG
+// specification (annex K.3), and the shortest lengths go to the most frequent
+// symbols. Every code has at least two symbols, since some decoders cannot
+// handle a code with only one.
+static void deflateBuildLengths(u32* frequencies, u32 symbolCount, u32 maxLength, u8* lengths) {
+	DeflateLeaf leaves[DEFLATE_LITERAL_LENGTH_COUNT];
+	u32 leafCount = 0;
+	for (u32 symbol = 0; symbol < symbolCount; ++symbol) {
+		if (frequencies[symbol] > 0) {
+			++leafCount;
+		}
+	}
+	for (u32 symbol = 0; leafCount < 2; ++symbol) {
+		if (frequencies[symbol] == 0) {
+			frequencies[symbol] = 1;
+			++leafCount;
+		}
+	}
+	leafCount = 0;
+	for (u32 symbol = 0; symbol < symbolCount; ++symbol) {
+		lengths[symbol] = 0;
+		if (frequencies[symbol] > 0) {
+			leaves[leafCount].frequency = frequencies[symbol];
+			leaves[leafCount].symbol = symbol;
+			++leafCount;
+		}
+	}
+	qsort(leaves, leafCount, sizeof(*leaves), deflateCompareLeaves);
+
+	// Nodes 0 to leafCount - 1 are the leaves, in order of frequency. Internal
+	// nodes are created in order of weight too, so the two lightest nodes are
+	// always at the front of one of the two queues.
+	u64 weights[2 * DEFLATE_LITERAL_LENGTH_COUNT];
+	u32 parents[2 * DEFLATE_LITERAL_LENGTH_COUNT];
+	u32 depths[2 * DEFLATE_LITERAL_LENGTH_COUNT];
+	for (u32 i = 0; i < leafCount; ++i) {
+		weights[i] = leaves[i].frequency;
+	}
+	u32 nextLeaf = 0;
+	u32 nextInternal = leafCount;
+	u32 nodeCount = leafCount;
+	while (nodeCount < 2 * leafCount - 1) {
+		u32 children[2];
+		for (u32 i = 0; i < 2; ++i) {
+			b32 takeLeaf = (nextLeaf < leafCount) &&
+				((nextInternal == nodeCount) || (weights[nextLeaf] <= weights[nextInternal]));
+			children[i] = takeLeaf ? nextLeaf++ : nextInternal++;
+		}
+		weights[nodeCount] = weights[children[0]] + weights[children[1]];
+		parents[children[0]] = nodeCount;
+		parents[children[1]] = nodeCount;
+		++nodeCount;
+	}
+	// parents are always created after their children
+	depths[nodeCount - 1] = 0;
+	for (u32 node = nodeCount - 1; node-- > 0;) {
+		depths[node] = depths[parents[node]] + 1;
+	}
+
+	u32 lengthCounts[DEFLATE_LITERAL_LENGTH_COUNT] = {0};
+	u32 maxDepth = 0;
+	for (u32 i = 0; i < leafCount; ++i) {
+		++lengthCounts[depths[i]];
+		if (depths[i] > maxDepth) {
+			maxDepth = depths[i];
+		}
+	}
+	for (u32 length = maxDepth; length > maxLength; --length) {
+		while (lengthCounts[length] > 0) {
+			// Move two leaves from this level up: one takes the place of
+			// their parent, and the other replaces a leaf at a shallower
+			// level, which moves down to become its sibling.
+			u32 shallower = length - 2;
+			while (lengthCounts[shallower] == 0) {
+				--shallower;
+			}
+			lengthCounts[length] -= 2;
+			lengthCounts[length - 1] += 1;
+			lengthCounts[shallower + 1] += 2;
+			lengthCounts[shallower] -= 1;
+		}
+	}
+
+	u32 leaf = 0;
+	for (u32 length = (maxDepth < maxLength) ? maxDepth : maxLength; length > 0; --length) {
+		for (u32 i = 0; i < lengthCounts[length]; ++i) {
+			lengths[leaves[leaf].symbol] = (u8) length;
+			++leaf;
+		}
+	}
+	assert(leaf == leafCount);
+}
+
+// Assign canonical codes to a set of code lengths, as described in RFC 1951
+// section 3.2.2. The codes are returned bit-reversed, ready to be written.
+static void deflateBuildCodes(const u8* lengths, u32 symbolCount, u16* codes) {
+	u32 lengthCounts[16] = {0};
+	for (u32 symbol = 0; symbol < symbolCount; ++symbol) {
+		++lengthCounts[lengths[symbol]];
+	}
+	lengthCounts[0] = 0;
+	u32 nextCodes[16];
+	u32 code = 0;
+	for (u32 length = 1; length < 16; ++length) {
+		code = (code + lengthCounts[length - 1]) << 1;
+		nextCodes[length] = code;
+	}
+	for (u32 symbol = 0; symbol < symbolCount; ++symbol) {
+		u32 length = lengths[symbol];
+		if (length == 0) {
+			codes[symbol] = 0;
+			continue;
+		}
+		u32 value = nextCodes[length]++;
+		u32 reversed = 0;
+		for (u32 i = 0; i < length; ++i) {
+			reversed = (reversed << 1) | ((value >> i) & 1);
+		}
+		codes[symbol] = (u16) reversed;
+	}
+}
+
+// A literal byte (distance 0), or a match of litLen bytes.
+typedef struct DeflateSymbol {
+	u16 litLen;
+	u16 distance;
+} DeflateSymbol;
+
+typedef struct DeflateCompressor {
+	const u8* data;
+	uword size;
+	DeflateWriter writer;
+
+	// Hash chains over the last DEFLATE_WINDOW_SIZE positions. Positions are
+	// stored plus one, so that zero means there is none.
+	u32* head;
+	u32* previous;
+
+	DeflateSymbol* symbols;
+	u32 symbolCount;
+	// the input that the buffered symbols cover
+	uword blockStart;
+	uword blockSize;
+} DeflateCompressor;
+
+inline static u32 deflateHash(const u8* bytes) {
+	u32 value = (u32) bytes[0] | ((u32) bytes[1] << 8) | ((u32) bytes[2] << 16);
+	return (value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+inline static void deflateInsert(DeflateCompressor* compressor, uword position) {
+	if (position + DEFLATE_MIN_MATCH > compressor->size) {
+		return;
+	}
+	u32 hash = deflateHash(compressor->data + position);
+	compressor->previous[position & DEFLATE_WINDOW_MASK] = compressor->head[hash];
+	compressor->head[hash] = (u32) position + 1;
+}
+
+// Find the longest earlier match for the bytes at position, which must already
+// have been inserted. Only matches longer than previousLength count. Returns
+// the match length, or 0 if there is no such match.
+static u32 deflateFindMatch(DeflateCompressor* compressor, uword position, u32 previousLength, u32* distance) {
+	const u8* data = compressor->data;
+	uword maxLength = compressor->size - position;
+	if (maxLength > DEFLATE_MAX_MATCH) {
+		maxLength = DEFLATE_MAX_MATCH;
+	}
+	if (maxLength < DEFLATE_MIN_MATCH) {
+		return 0;
+	}
+	u32 chainLength = DEFLATE_MAX_CHAIN;
+	if (previousLength >= DEFLATE_GOOD_MATCH) {
+		chainLength >>= 2;
+	}
+	u32 bestLength = (previousLength < DEFLATE_MIN_MATCH) ? DEFLATE_MIN_MATCH - 1 : previousLength;
+	if (bestLength >= maxLength) {
+		return 0;
+	}
+	u32 bestDistance = 0;
+	const u8* current = data + position;
+	u32 candidate = compressor->previous[position & DEFLATE_WINDOW_MASK];
+	while (candidate != 0 && chainLength-- > 0) {
+		uword candidatePosition = candidate - 1;
+		if (position - candidatePosition > DEFLATE_WINDOW_SIZE) {
+			break;
+		}
+		const u8* earlier = data + candidatePosition;
+		if (earlier[bestLength] == current[bestLength] && earlier[0] == current[0] && earlier[1] == current[1]) {
+			u32 length = 2;
+			while (length < maxLength && earlier[length] == current[length]) {
+				++length;
+			}
+			if (length > bestLength) {
+				bestLength = length;
+				bestDistance = (u32) (position - candidatePosition);
+				if (length >= DEFLATE_NICE_MATCH || length == maxLength) {
+					break;
+				}
+			}
+		}
+		u32 next = compressor->previous[candidatePosition & DEFLATE_WINDOW_MASK];
+		// the slot has been reused by a newer position; the chain ends here
+		if (next >= candidate) {
+			break;
+		}
+		candidate = next;
+	}
+	if (bestDistance == 0 || (bestLength == DEFLATE_MIN_MATCH && bestDistance > DEFLATE_TOO_FAR)) {
+		return 0;
+	}
+	*distance = bestDistance;
+	return bestLength;
+}
+
+static void deflateWriteSymbols(
+DeflateCompressor* compressor,
+const u16* literalCodes, const u8* literalLengths,
+const u16* distanceCodes, const u8* distanceLengths) {
+	DeflateWriter* writer = &compressor->writer;
+	for (u32 i = 0; i < compressor->symbolCount; ++i) {
+		DeflateSymbol symbol = compressor->symbols[i];
+		if (symbol.distance == 0) {
+			deflateWriteBits(writer, literalCodes[symbol.litLen], literalLengths[symbol.litLen]);
+			continue;
+		}
+		u32 lengthCode = deflateLengthCode(symbol.litLen);
+		u32 literal = 257 + lengthCode;
+		deflateWriteBits(writer, literalCodes[literal], literalLengths[literal]);
+		deflateWriteBits(writer, symbol.litLen - deflateLengthBase[lengthCode], deflateLengthExtraBits[lengthCode]);
+		u32 distanceCode = deflateDistanceCode(symbol.distance);
+		deflateWriteBits(writer, distanceCodes[distanceCode], distanceLengths[distanceCode]);
+		deflateWriteBits(
+			writer, symbol.distance - deflateDistanceBase[distanceCode], deflateDistanceExtraBits[distanceCode]);
+	}
+	deflateWriteBits(writer, literalCodes[DEFLATE_END_OF_BLOCK], literalLengths[DEFLATE_END_OF_BLOCK]);
+}
+
+// The code lengths of a dynamic block are themselves run-length encoded, and
+// sent with a third Huffman code. Symbols 16 to 18 repeat the previous length
+// or a zero; their repeat counts are stored next to them.
+static u32 deflateRunLengthEncode(const u8* lengths, u32 lengthCount, u8* symbols, u8* repeatCounts) {
+	u32 symbolCount = 0;
+	for (u32 i = 0; i < lengthCount;) {
+		u8 length = lengths[i];
+		u32 runLength = 1;
+		while (i + runLength < lengthCount && lengths[i + runLength] == length) {
+			++runLength;
+		}
+		i += runLength;
+		if (length == 0) {
+			while (runLength >= 11) {
+				u32 count = (runLength > 138) ? 138 : runLength;
+				symbols[symbolCount] = 18;
+				repeatCounts[symbolCount++] = (u8) (count - 11);
+				runLength -= count;
+			}
+			if (runLength >= 3) {
+				symbols[symbolCount] = 17;
+				repeatCounts[symbolCount++] = (u8) (runLength - 3);
+				runLength = 0;
+			}
+		} else {
+			symbols[symbolCount] = length;
+			repeatCounts[symbolCount++] = 0;
+			--runLength;
+			while (runLength >= 3) {
+				u32 count = (runLength > 6) ? 6 : runLength;
+				symbols[symbolCount] = 16;
+				repeatCounts[symbolCount++] = (u8) (count - 3);
+				runLength -= count;
+			}
+		}
+		while (runLength > 0) {
+			symbols[symbolCount] = length;
+			repeatCounts[symbolCount++] = 0;
+			--runLength;
+		}
+	}
+	return symbolCount;
+}
+
+// Write the buffered symbols as one block, in whichever of the three block
+// types is smallest.
+static void deflateFlushBlock(DeflateCompressor* compressor, b32 final) {
+	u32 literalFrequencies[DEFLATE_LITERAL_LENGTH_COUNT] = {0};
+	u32 distanceFrequencies[DEFLATE_DISTANCE_COUNT] = {0};
+	u64 extraBitCount = 0;
+	for (u32 i = 0; i < compressor->symbolCount; ++i) {
+		DeflateSymbol symbol = compressor->symbols[i];
+		if (symbol.distance == 0) {
+			++literalFrequencies[symbol.litLen];
+		} else {
+			u32 lengthCode = deflateLengthCode(symbol.litLen);
+			u32 distanceCode = deflateDistanceCode(symbol.distance);
+			++literalFrequencies[257 + lengthCode];
+			++distanceFrequencies[distanceCode];
+			extraBitCount += deflateLengthExtraBits[lengthCode] + deflateDistanceExtraBits[distanceCode];
+		}
+	}
+	literalFrequencies[DEFLATE_END_OF_BLOCK] = 1;
+
+	u8 literalLengths[DEFLATE_LITERAL_LENGTH_COUNT];
+	u8 distanceLengths[DEFLATE_DISTANCE_COUNT];
+	// symbols 286 and 287 are never used, but do have fixed codes
+	deflateBuildLengths(literalFrequencies, 286, 15, literalLengths);
+	literalLengths[286] = 0;
+	literalLengths[287] = 0;
+	deflateBuildLengths(distanceFrequencies, DEFLATE_DISTANCE_COUNT, 15, distanceLengths);
+
+	u32 literalCount = 286;
+	while (literalCount > 257 && literalLengths[literalCount - 1] == 0) {
+		--literalCount;
+	}
+	u32 distanceCount = DEFLATE_DISTANCE_COUNT;
+	while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) {
+		--distanceCount;
+	}
+	u8 allLengths[286 + DEFLATE_DISTANCE_COUNT];
+	memcpy(allLengths, literalLengths, literalCount);
+	memcpy(allLengths + literalCount, distanceLengths, distanceCount);
+	u8 codeLengthSymbols[286 + DEFLATE_DISTANCE_COUNT];
+	u8 repeatCounts[286 + DEFLATE_DISTANCE_COUNT];
+	u32 codeLengthSymbolCount = deflateRunLengthEncode(
+		allLengths, literalCount + distanceCount, codeLengthSymbols, repeatCounts);
+	u32 codeLengthFrequencies[DEFLATE_CODE_LENGTH_COUNT] = {0};
+	for (u32 i = 0; i < codeLengthSymbolCount; ++i) {
+		++codeLengthFrequencies[codeLengthSymbols[i]];
+	}
+	u8 codeLengthLengths[DEFLATE_CODE_LENGTH_COUNT];
+	deflateBuildLengths(codeLengthFrequencies, DEFLATE_CODE_LENGTH_COUNT, 7, codeLengthLengths);
+	u32 codeLengthCount = DEFLATE_CODE_LENGTH_COUNT;
+	while (codeLengthCount > 4 && codeLengthLengths[deflateCodeLengthOrder[codeLengthCount - 1]] == 0) {
+		--codeLengthCount;
+	}
+
+	u8 fixedLiteralLengths[DEFLATE_LITERAL_LENGTH_COUNT];
+	u8 fixedDistanceLengths[DEFLATE_DISTANCE_COUNT];
+	for (u32 i = 0; i < DEFLATE_LITERAL_LENGTH_COUNT; ++i) {
+		fixedLiteralLengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	for (u32 i = 0; i < DEFLATE_DISTANCE_COUNT; ++i) {
+		fixedDistanceLengths[i] = 5;
+	}
+
+	u64 dynamicBitCount = 3 + 5 + 5 + 4 + 3 * (u64) codeLengthCount + extraBitCount;
+	u64 fixedBitCount = 3 + extraBitCount;
+	for (u32 i = 0; i < codeLengthSymbolCount; ++i) {
+		static const u8 repeatExtraBits[3] = {2, 3, 7};
+		u32 symbol = codeLengthSymbols[i];
+		dynamicBitCount += codeLengthLengths[symbol] + ((symbol >= 16) ? repeatExtraBits[symbol - 16] : 0);
+	}
+	for (u32 i = 0; i < 286; ++i) {
+		dynamicBitCount += (u64) literalFrequencies[i] * literalLengths[i];
+		fixedBitCount += (u64) literalFrequencies[i] * fixedLiteralLengths[i];
+	}
+	for (u32 i = 0; i < DEFLATE_DISTANCE_COUNT; ++i) {
+		dynamicBitCount += (u64) distanceFrequencies[i] * distanceLengths[i];
+		fixedBitCount += (u64) distanceFrequencies[i] * 5;
+	}
+	uword storedBlockCount = (compressor->blockSize + DEFLATE_MAX_STORED_SIZE - 1) / DEFLATE_MAX_STORED_SIZE;
+	u64 storedBitCount = (u64) storedBlockCount * (3 + 7 + 32) + 8 * (u64) compressor->blockSize;
+
+	DeflateWriter* writer = &compressor->writer;
+	if (storedBlockCount > 0 && storedBitCount < dynamicBitCount && storedBitCount < fixedBitCount) {
+		const u8* bytes = compressor->data + compressor->blockStart;
+		uword remaining = compressor->blockSize;
+		while (remaining > 0) {
+			u32 chunkSize = (remaining > DEFLATE_MAX_STORED_SIZE) ? DEFLATE_MAX_STORED_SIZE : (u32) remaining;
+			remaining -= chunkSize;
+			deflateWriteBits(writer, (final && remaining == 0) ? 1 : 0, 1);
+			deflateWriteBits(writer, 0, 2);
+			deflateAlignToByte(writer);
+			u8 header[4] = {
+				(u8) chunkSize, (u8) (chunkSize >> 8),
+				(u8) ~chunkSize, (u8) (~chunkSize >> 8),
+			};
+			deflateWriteBytes(writer, header, sizeof(header));
+			deflateWriteBytes(writer, bytes, chunkSize);
+			bytes += chunkSize;
+		}
+	} else if (fixedBitCount <= dynamicBitCount) {
+		u16 literalCodes[DEFLATE_LITERAL_LENGTH_COUNT];
+		u16 distanceCodes[DEFLATE_DISTANCE_COUNT];
+		deflateBuildCodes(fixedLiteralLengths, DEFLATE_LITERAL_LENGTH_COUNT, literalCodes);
+		deflateBuildCodes(fixedDistanceLengths, DEFLATE_DISTANCE_COUNT, distanceCodes);
+		deflateWriteBits(writer, final ? 1 : 0, 1);
+		deflateWriteBits(writer, 1, 2);
+		deflateWriteSymbols(compressor, literalCodes, fixedLiteralLengths, distanceCodes, fixedDistanceLengths);
+	} else {
+		u16 literalCodes[DEFLATE_LITERAL_LENGTH_COUNT];
+		u16 distanceCodes[DEFLATE_DISTANCE_COUNT];
+		u16 codeLengthCodes[DEFLATE_CODE_LENGTH_COUNT];
+		deflateBuildCodes(literalLengths, DEFLATE_LITERAL_LENGTH_COUNT, literalCodes);
+		deflateBuildCodes(distanceLengths, DEFLATE_DISTANCE_COUNT, distanceCodes);
+		deflateBuildCodes(codeLengthLengths, DEFLATE_CODE_LENGTH_COUNT, codeLengthCodes);
+		deflateWriteBits(writer, final ? 1 : 0, 1);
+		deflateWriteBits(writer, 2, 2);
+		deflateWriteBits(writer, literalCount - 257, 5);
+		deflateWriteBits(writer, distanceCount - 1, 5);
+		deflateWriteBits(writer, codeLengthCount - 4, 4);
+		for (u32 i = 0; i < codeLengthCount; ++i) {
+			deflateWriteBits(writer, codeLengthLengths[deflateCodeLengthOrder[i]], 3);
+		}
+		for (u32 i = 0; i < codeLengthSymbolCount; ++i) {
+			u32 symbol = codeLengthSymbols[i];
+			deflateWriteBits(writer, codeLengthCodes[symbol], codeLengthLengths[symbol]);
+			if (symbol >= 16) {
+				static const u8 repeatExtraBits[3] = {2, 3, 7};
+				deflateWriteBits(writer, repeatCounts[i], repeatExtraBits[symbol - 16]);
+			}
+		}
+		deflateWriteSymbols(compressor, literalCodes, literalLengths, distanceCodes, distanceLengths);
+	}
+
+	compressor->blockStart += compressor->blockSize;
+	compressor->blockSize = 0;
+	compressor->symbolCount = 0;
+}
+
+inline static void deflatePushSymbol(DeflateCompressor* compressor, u32 litLen, u32 distance) {
+	DeflateSymbol* symbol = compressor->symbols + compressor->symbolCount;
+	symbol->litLen = (u16) litLen;
+	symbol->distance = (u16) distance;
+	++compressor->symbolCount;
+	compressor->blockSize += (distance == 0) ? 1 : litLen;
+	if (compressor->symbolCount == DEFLATE_BLOCK_SYMBOL_COUNT) {
+		deflateFlushBlock(compressor, FALSE);
+	}
+}
+
+// Compress into the writer as a raw DEFLATE stream.
+static void deflateCompress(DeflateWriter* writer, const u8* data, uword size) {
+	DeflateCompressor compressor;
+	memset(&compressor, 0, sizeof(compressor));
+	compressor.data = data;
+	compressor.size = size;
+	compressor.writer = *writer;
+	compressor.head = checkOutOfMemory(calloc(DEFLATE_HASH_SIZE, sizeof(u32)));
+	compressor.previous = checkOutOfMemory(calloc(DEFLATE_WINDOW_SIZE, sizeof(u32)));
+	compressor.symbols = checkOutOfMemory(malloc(DEFLATE_BLOCK_SYMBOL_COUNT * sizeof(DeflateSymbol)));
+
+	// Lazy matching: a match is only taken once the match starting at the
+	// next byte has been found to be no longer. Otherwise the byte is sent as
+	// a literal, and the longer match is considered in turn.
+	uword position = 0;
+	u32 previousLength = 0;
+	u32 previousDistance = 0;
+	b32 literalPending = FALSE;
+	while (position < size) {
+		deflateInsert(&compressor, position);
+		u32 length = 0;
+		u32 distance = 0;
+		if (previousLength < DEFLATE_LAZY_MATCH) {
+			length = deflateFindMatch(&compressor, position, previousLength, &distance);
+		}
+		if (previousLength >= DEFLATE_MIN_MATCH && length <= previousLength) {
+			// the match from the previous byte wins
+			deflatePushSymbol(&compressor, previousLength, previousDistance);
+			uword matchEnd = position - 1 + previousLength;
+			for (uword p = position + 1; p < matchEnd; ++p) {
+				deflateInsert(&compressor, p);
+			}
+			position = matchEnd;
+			previousLength = 0;
+			literalPending = FALSE;
+			continue;
+		}
+		if (literalPending) {
+			deflatePushSymbol(&compressor, data[position - 1], 0);
+		}
+		literalPending = TRUE;
+		previousLength = length;
+		previousDistance = distance;
+		++position;
+	}
+	if (literalPending) {
+		deflatePushSymbol(&compressor, data[size - 1], 0);
+	}
+	deflateFlushBlock(&compressor, TRUE);
+	deflateAlignToByte(&compressor.writer);
+
+	*writer = compressor.writer;
+	free(compressor.head);
+	free(compressor.previous);
+	free(compressor.symbols);
+}
+
+static u32 deflateCrc32(const u8* data, uword size) {
+	u32 table[256];
+	for (u32 i = 0; i < 256; ++i) {
+		u32 value = i;
+		for (u32 bit = 0; bit < 8; ++bit) {
+			value = (value >> 1) ^ ((value & 1) ? 0xEDB88320u : 0);
+		}
+		table[i] = value;
+	}
+	u32 crc = 0xFFFFFFFFu;
+	for (uword i = 0; i < size; ++i) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// Compress data into a newly allocated gzip stream, which the caller must
+// free.
+static void gzipCompress(const u8* data, uword size, u8** compressed, uword* compressedSize) {
+	DeflateWriter writer;
+	memset(&writer, 0, sizeof(writer));
+	static const u8 header[10] = {
+		0x1F, 0x8B, // magic number
+		8,          // compression method: deflate
+		0,          // no flags, so no file name or comment
+		0, 0, 0, 0, // no modification time
+		0,          // no extra flags
+		255,        // unknown operating system
+	};
+	deflateWriteBytes(&writer, header, sizeof(header));
+	deflateCompress(&writer, data, size);
+	u32 crc = deflateCrc32(data, size);
+	u32 sizeModulo = (u32) size;
+	u8 trailer[8] = {
+		(u8) crc, (u8) (crc >> 8), (u8) (crc >> 16), (u8) (crc >> 24),
+		(u8) sizeModulo, (u8) (sizeModulo >> 8), (u8) (sizeModulo >> 16), (u8) (sizeModulo >> 24),
+	};
+	deflateWriteBytes(&writer, trailer, sizeof(trailer));
+	*compressed = writer.data;
+	*compressedSize = writer.size;
+}
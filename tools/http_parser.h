@@ -0,0 +1,461 @@
+// HTTP/1.1 request header parsing (RFC 7230), straight from memory.
+//
+// Nothing in here touches a socket: the server finds a complete header in its
+// receive buffer, and hands it to httpParseRequest(). Parsing never reads
+// outside of the header it is given, never allocates, and takes time linear in
+// the length of the header, which is at most HTTP_MAX_HEADER_SIZE bytes.
+// Malformed input is reported as an HttpParseResult, so that
+// tools/http_parser_benchmark.c can throw anything at it.
+//
+// Like deflate.h, this file is meant to be included into a single translation
+// unit, after the basic types (u8, u32, u64, uword, b32, TRUE/FALSE),
+// ClearValueToZero() and the standard headers for assert(), strlen() and
+// UINT64_MAX.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_SSE2 1
+#endif
+
+typedef struct StringSlice {
+	const char* begin;
+	const char* end;
+} StringSlice;
+
+// for the "%.*s" format in printf
+#define StringSlicePrintf(S)  (int) stringSliceLength(S), (S).begin
+
+inline static StringSlice stringSlice(const char* begin, const char* end) {
+	StringSlice ss = {begin, end};
+	return ss;
+}
+
+inline static StringSlice stringSliceFromCString(const char* cs) {
+	StringSlice ss = {
+		.begin = cs,
+		.end = cs + strlen(cs),
+	};
+	return ss;
+}
+
+//TODO rename to stringSliceCount
+inline static uword stringSliceLength(StringSlice ss) {
+	return (uword) (ss.end - ss.begin);
+}
+
+inline static b32 stringSliceEmpty(StringSlice ss) {
+	return ss.begin == ss.end;
+}
+
+inline static b32 stringSlicesEqual(const StringSlice* a, const StringSlice* b) {
+	uword aLen = stringSliceLength(*a);
+	uword bLen = stringSliceLength(*b);
+	if (aLen != bLen) {
+		return FALSE;
+	}
+	const char* ap = a->begin;
+	const char* bp = b->begin;
+	while (ap != a->end) {
+		if (*ap != *bp) {
+			return FALSE;
+		}
+		++ap;
+		++bp;
+	}
+	return TRUE;
+}
+
+static b32 stringSliceEqualsCString(const StringSlice* ss, const char* cs) {
+	const char* begin = ss->begin;
+	for (;;) {
+		b32 end1 = (begin == ss->end);
+		b32 end2 = (*cs == '\0');
+		if (end1 | end2) {
+			return end1 & end2;
+		}
+		if (*begin != *cs) {
+			return FALSE;
+		}
+		++begin;
+		++cs;
+	}
+}
+
+inline static u32 countTrailingZeros32(u32 value) {
+	assert(value != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return (u32) index;
+#else
+	return (u32) __builtin_ctz(value);
+#endif
+}
+
+// Find the first occurrence of a byte, or return end if there is none. This is
+// the inner loop of all of the HTTP header parsing, so it compares 32 (AVX2) or
+// 16 (SSE2) bytes at a time, falling back to a plain loop for the last few
+// bytes, and on other targets. Which version is used is decided at compile
+// time; building with /arch:AVX2 or -mavx2 selects AVX2.
+static const char* scanForByte(const char* begin, const char* end, char byte) {
+	const char* cursor = begin;
+#if defined(SCAN_AVX2)
+	__m256i needle = _mm256_set1_epi8(byte);
+	while (end - cursor >= 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) cursor);
+		u32 mask = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+		if (mask) {
+			return cursor + countTrailingZeros32(mask);
+		}
+		cursor += 32;
+	}
+#elif defined(SCAN_SSE2)
+	__m128i needle = _mm_set1_epi8(byte);
+	while (end - cursor >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) cursor);
+		u32 mask = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		if (mask) {
+			return cursor + countTrailingZeros32(mask);
+		}
+		cursor += 16;
+	}
+#endif
+	while (cursor != end && *cursor != byte) {
+		++cursor;
+	}
+	return cursor;
+}
+
+inline static char asciiToLower(char c) {
+	return ((c >= 'A') & (c <= 'Z')) ? (char) (c + ('a' - 'A')) : c;
+}
+
+// Compare against a lowercase string, ignoring the case of the slice. HTTP
+// header names are case-insensitive, and some clients send lowercase methods.
+static b32 stringSliceEqualsCStringIgnoreCase(const StringSlice* ss, const char* lowercase) {
+	const char* begin = ss->begin;
+	for (;;) {
+		b32 end1 = (begin == ss->end);
+		b32 end2 = (*lowercase == '\0');
+		if (end1 | end2) {
+			return end1 & end2;
+		}
+		if (asciiToLower(*begin) != *lowercase) {
+			return FALSE;
+		}
+		++begin;
+		++lowercase;
+	}
+}
+
+inline static void skipSpaces(const char** cursor, const char* end) {
+	for (;;) {
+		if (*cursor == end || **cursor != ' ') {
+			return;
+		}
+		*cursor += 1;
+	}
+}
+
+// Check whether a comma-separated header value, such as the value of a
+// "Connection" option, contains a token. Tokens are compared ignoring case.
+static b32 httpValueHasToken(StringSlice value, const char* lowercaseToken) {
+	const char* cursor = value.begin;
+	while (cursor != value.end) {
+		const char* tokenEnd = scanForByte(cursor, value.end, ',');
+		StringSlice token = stringSlice(cursor, tokenEnd);
+		while (token.begin != token.end && (*token.begin == ' ' || *token.begin == '\t')) {
+			++token.begin;
+		}
+		while (token.end != token.begin && (token.end[-1] == ' ' || token.end[-1] == '\t')) {
+			--token.end;
+		}
+		if (stringSliceEqualsCStringIgnoreCase(&token, lowercaseToken)) {
+			return TRUE;
+		}
+		cursor = (tokenEnd == value.end) ? tokenEnd : tokenEnd + 1;
+	}
+	return FALSE;
+}
+
+// Check whether an Accept-Encoding value allows a content coding. A coding is
+// acceptable if it is listed, or covered by "*", without a quality of zero,
+// as in "gzip;q=0".
+static b32 httpAcceptsEncoding(StringSlice value, const char* lowercaseCoding) {
+	b32 wildcardAccepted = FALSE;
+	const char* cursor = value.begin;
+	while (cursor != value.end) {
+		const char* itemEnd = scanForByte(cursor, value.end, ',');
+		const char* codingEnd = scanForByte(cursor, itemEnd, ';');
+		StringSlice coding = stringSlice(cursor, codingEnd);
+		while (coding.begin != coding.end && (*coding.begin == ' ' || *coding.begin == '\t')) {
+			++coding.begin;
+		}
+		while (coding.end != coding.begin && (coding.end[-1] == ' ' || coding.end[-1] == '\t')) {
+			--coding.end;
+		}
+
+		b32 rejected = FALSE;
+		const char* parameter = codingEnd;
+		if (parameter != itemEnd) {
+			++parameter;
+			skipSpaces(&parameter, itemEnd);
+			if (itemEnd - parameter >= 2 && asciiToLower(parameter[0]) == 'q' && parameter[1] == '=') {
+				// a quality is "0", "1", or a decimal fraction with up to three
+				// digits; only all zeroes means "not acceptable"
+				rejected = TRUE;
+				for (const char* c = parameter + 2; c != itemEnd && *c != ' ' && *c != '\t'; ++c) {
+					if (*c != '0' && *c != '.') {
+						rejected = FALSE;
+					}
+				}
+			}
+		}
+
+		if (stringSliceEqualsCStringIgnoreCase(&coding, lowercaseCoding)) {
+			return !rejected;
+		}
+		if (stringSliceEqualsCString(&coding, "*")) {
+			wildcardAccepted = !rejected;
+		}
+		cursor = (itemEnd == value.end) ? itemEnd : itemEnd + 1;
+	}
+	return wildcardAccepted;
+}
+
+// Requests with a longer header than this are rejected, so a bad packet stream
+// cannot make a connection use more than a fixed amount of memory.
+#define HTTP_MAX_HEADER_SIZE 8192
+
+typedef struct HttpHeader {
+	uword charCount;
+	const char* chars;
+	const char* cursor;
+} HttpHeader;
+
+typedef struct HttpOption {
+	StringSlice key;
+	StringSlice value;
+} HttpOption;
+
+// Read the next line of a header, without the CRLF that ends it. Returns FALSE
+// if there is no complete line left, which only happens if the header does not
+// end in a blank line.
+static b32 httpHeaderNextLine(HttpHeader* header, StringSlice* line) {
+	const char* lineBegin = header->cursor;
+	const char* headerEnd = header->chars + header->charCount;
+	for (;;) {
+		header->cursor = scanForByte(header->cursor, headerEnd, '\r');
+		if (headerEnd - header->cursor < 2) {
+			header->cursor = headerEnd;
+			return FALSE;
+		}
+		if (header->cursor[1] == '\n') {
+			*line = stringSlice(lineBegin, header->cursor);
+			header->cursor += 2; // advance to the start of the next line
+			return TRUE;
+		}
+		++header->cursor;
+	}
+}
+
+// Read the next "Key: value" line of a header. The blank line at the end of
+// the header gives an option with an empty key. Returns FALSE if there is no
+// complete line left.
+static b32 httpHeaderNextOption(HttpHeader* header, HttpOption* option) {
+	StringSlice line;
+	if (!httpHeaderNextLine(header, &line)) {
+		return FALSE;
+	}
+	const char* lineCursor = scanForByte(line.begin, line.end, ':');
+	if (lineCursor == line.end) {
+		// No colon on this line. Set the key to the entire line; the value
+		// will end up being nothing. This also handles the blank line at the
+		// end of the header, without a special case.
+		option->key = line;
+	} else {
+		option->key = stringSlice(line.begin, lineCursor);
+		++lineCursor;
+	}
+	skipSpaces(&lineCursor, line.end);
+	option->value = stringSlice(lineCursor, line.end);
+	return TRUE;
+}
+
+// Look for the blank line that ends a header, in data from *scanIndex up to
+// scanEnd. *matchCount is the number of characters of "\r\n\r\n" that end at
+// *scanIndex, so a search can resume where the last one stopped once more
+// bytes have been received, and each byte is only examined once. Returns TRUE
+// if the blank line was found, with *scanIndex just past it.
+static b32 httpScanForHeaderEnd(const char* data, uword* scanIndex, uword scanEnd, u32* matchCount) {
+	const char* terminator = "\r\n\r\n";
+	uword index = *scanIndex;
+	u32 count = *matchCount;
+	while (index < scanEnd) {
+		if (count == 0) {
+			// nothing matched yet, so skip straight to the next '\r'
+			index = scanForByte(data + index, data + scanEnd, '\r') - data;
+			if (index == scanEnd) {
+				break;
+			}
+		}
+		char c = data[index];
+		++index;
+		if (c == terminator[count]) {
+			++count;
+			if (count == 4) {
+				*scanIndex = index;
+				*matchCount = 0;
+				return TRUE;
+			}
+		} else {
+			count = (c == '\r') ? 1 : 0;
+		}
+	}
+	*scanIndex = index;
+	*matchCount = count;
+	return FALSE;
+}
+
+static b32 httpParseDecimal(const char** cursor, const char* end, u64* value) {
+	u64 result = 0;
+	u32 digitCount = 0;
+	for (; *cursor != end && **cursor >= '0' && **cursor <= '9'; *cursor += 1) {
+		if (result > (UINT64_MAX - 9) / 10) {
+			return FALSE;
+		}
+		result = result * 10 + (u64) (**cursor - '0');
+		++digitCount;
+	}
+	*value = result;
+	return digitCount > 0;
+}
+
+// What the server needs to know about a request in order to answer it. The
+// slices point into the header the request was parsed from.
+typedef struct HttpRequest {
+	StringSlice url;
+	// a HEAD request, which gets the header of the response to a GET, and no body
+	b32 head;
+	b32 keepAlive;
+	// HTTP/1.1 clients can be sent a chunked body
+	b32 acceptsChunked;
+	b32 acceptsGzip;
+	// validators from a conditional request; empty if the option was not sent
+	StringSlice ifNoneMatch;
+	StringSlice ifModifiedSince;
+	// the byte ranges asked for, and the validator they depend on; empty if
+	// the option was not sent
+	StringSlice range;
+	StringSlice ifRange;
+	// the length of the request body, which is skipped
+	u64 contentLength;
+	// set if the client asks to switch the connection to the WebSocket
+	// protocol, with "Connection: Upgrade" and "Upgrade: websocket"; the key
+	// and version are empty if they were not sent
+	b32 upgradeWebSocket;
+	StringSlice webSocketKey;
+	StringSlice webSocketVersion;
+} HttpRequest;
+
+typedef enum HttpParseResult {
+	HTTP_PARSE_OK,
+	// a line does not end in CRLF, or the header does not end in a blank line
+	HTTP_PARSE_MALFORMED,
+	// anything but GET or HEAD
+	HTTP_PARSE_UNSUPPORTED_METHOD,
+	HTTP_PARSE_INVALID_CONTENT_LENGTH,
+	HTTP_PARSE_RESULT_COUNT,
+} HttpParseResult;
+
+inline static const char* httpParseResultName(HttpParseResult result) {
+	static const char* names[HTTP_PARSE_RESULT_COUNT] = {
+		"ok", "malformed header", "unsupported method", "invalid Content-Length",
+	};
+	return names[result];
+}
+
+// Parse a complete request header, such as one found by
+// httpScanForHeaderEnd(). Options that the server has no use for are skipped.
+static HttpParseResult httpParseRequest(HttpHeader* header, HttpRequest* request) {
+	ClearValueToZero(*request);
+	StringSlice requestLine;
+	if (!httpHeaderNextLine(header, &requestLine)) {
+		return HTTP_PARSE_MALFORMED;
+	}
+	const char* methodEnd = scanForByte(requestLine.begin, requestLine.end, ' ');
+	StringSlice method = stringSlice(requestLine.begin, methodEnd);
+	request->head = stringSliceEqualsCStringIgnoreCase(&method, "head");
+	if (!request->head && !stringSliceEqualsCStringIgnoreCase(&method, "get")) {
+		return HTTP_PARSE_UNSUPPORTED_METHOD;
+	}
+
+	const char* requestLineCursor = methodEnd;
+	skipSpaces(&requestLineCursor, requestLine.end);
+	const char* urlBegin = requestLineCursor;
+	const char* urlEnd = scanForByte(urlBegin, requestLine.end, ' ');
+	request->url = stringSlice(urlBegin, urlEnd);
+	requestLineCursor = urlEnd;
+	skipSpaces(&requestLineCursor, requestLine.end);
+	StringSlice version = stringSlice(requestLineCursor, requestLine.end);
+
+	// HTTP/1.1 connections are persistent unless the client says otherwise.
+	// Older clients have to ask for it.
+	b32 http11 = stringSliceEqualsCString(&version, "HTTP/1.1");
+	request->keepAlive = http11;
+	request->acceptsChunked = http11;
+	b32 http10 = stringSliceEqualsCString(&version, "HTTP/1.0");
+	b32 connectionUpgrade = FALSE;
+	b32 upgradeToWebSocket = FALSE;
+
+	// read through the rest of the HTTP options
+	for (;;) {
+		HttpOption option;
+		if (!httpHeaderNextOption(header, &option)) {
+			return HTTP_PARSE_MALFORMED;
+		}
+		// check for blank key - this marks the end of the HTTP header
+		if (stringSliceEmpty(option.key)) {
+			break;
+		}
+		if (stringSliceEqualsCStringIgnoreCase(&option.key, "connection")) {
+			if (httpValueHasToken(option.value, "close")) {
+				request->keepAlive = FALSE;
+			} else if (http10 && httpValueHasToken(option.value, "keep-alive")) {
+				request->keepAlive = TRUE;
+			}
+			connectionUpgrade |= httpValueHasToken(option.value, "upgrade");
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "upgrade")) {
+			upgradeToWebSocket = httpValueHasToken(option.value, "websocket");
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "sec-websocket-key")) {
+			request->webSocketKey = option.value;
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "sec-websocket-version")) {
+			request->webSocketVersion = option.value;
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "accept-encoding")) {
+			request->acceptsGzip = httpAcceptsEncoding(option.value, "gzip");
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "if-none-match")) {
+			request->ifNoneMatch = option.value;
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "if-modified-since")) {
+			request->ifModifiedSince = option.value;
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "range")) {
+			request->range = option.value;
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "if-range")) {
+			request->ifRange = option.value;
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "content-length")) {
+			const char* cursor = option.value.begin;
+			if (!httpParseDecimal(&cursor, option.value.end, &request->contentLength) || cursor != option.value.end) {
+				return HTTP_PARSE_INVALID_CONTENT_LENGTH;
+			}
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "transfer-encoding")) {
+			// the end of a chunked body is not worth finding, so the
+			// connection is closed after the response instead
+			request->keepAlive = FALSE;
+		}
+	}
+	// only HTTP/1.1 has upgrades, and only of GET requests
+	request->upgradeWebSocket = !request->head && http11 && connectionUpgrade && upgradeToWebSocket;
+	return HTTP_PARSE_OK;
+}
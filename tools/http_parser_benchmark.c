@@ -0,0 +1,298 @@
+// Throughput of the HTTP request parser in http_parser.h, without any sockets.
+//
+// Each header set is a request that a client really sends, or an input made to
+// be as slow to parse as possible within HTTP_MAX_HEADER_SIZE. A set is
+// repeated back to back in one buffer, like pipelined requests in a receive
+// buffer, and the benchmark finds and parses every header in it, over and over,
+// for a fixed time. Build with the same flags as the server, for example:
+//
+//   cc -std=gnu11 -O2 -o http-parser-benchmark tools/http_parser_benchmark.c
+//   cl /O2 /Fehttp-parser-benchmark tools/http_parser_benchmark.c
+//
+// and pass "--seconds N" to change how long each set runs (the default is 1).
+// "--write-seeds DIRECTORY" writes each set to a file in an existing directory
+// instead, as a corpus for tools/http_parser_fuzz.c. Each file starts with the
+// byte that fuzz target splits its input by, set so that the whole header
+// arrives at once.
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#define _GNU_SOURCE
+#include <time.h>
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef uintptr_t uword;
+typedef u32 b32;
+
+#define FALSE 0
+#define TRUE 1
+
+#define ArrayCount(A) (sizeof(A) / sizeof((A)[0]))
+#define ClearValueToZero(Value) memset(&(Value), 0, sizeof(Value))
+
+#include "http_parser.h"
+
+static u64 timeNowNanoseconds(void) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (u64) ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64) now.tv_sec * 1000000000 + (u64) now.tv_nsec;
+#endif
+}
+
+typedef struct HeaderSet {
+	const char* name;
+	// NULL for the sets that are built by makePathologicalHeaders()
+	const char* header;
+	HttpParseResult expectedResult;
+} HeaderSet;
+
+static HeaderSet headerSets[] = {
+	{
+		"chrome page load",
+		"GET /webgl_spinning_cube/index.html HTTP/1.1\r\n"
+		"Host: localhost:6931\r\n"
+		"Connection: keep-alive\r\n"
+		"sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+		"sec-ch-ua-mobile: ?0\r\n"
+		"sec-ch-ua-platform: \"Windows\"\r\n"
+		"Upgrade-Insecure-Requests: 1\r\n"
+		"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+		"Sec-Fetch-Site: none\r\n"
+		"Sec-Fetch-Mode: navigate\r\n"
+		"Sec-Fetch-User: ?1\r\n"
+		"Sec-Fetch-Dest: document\r\n"
+		"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+		"Accept-Language: en-US,en;q=0.9\r\n"
+		"\r\n",
+		HTTP_PARSE_OK,
+	},
+	{
+		"firefox wasm fetch",
+		"GET /main.wasm HTTP/1.1\r\n"
+		"Host: localhost:6931\r\n"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+		"Accept: */*\r\n"
+		"Accept-Language: en-US,en;q=0.5\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Referer: http://localhost:6931/index.html\r\n"
+		"Connection: keep-alive\r\n"
+		"Sec-Fetch-Dest: empty\r\n"
+		"Sec-Fetch-Mode: cors\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"\r\n",
+		HTTP_PARSE_OK,
+	},
+	{
+		"safari revalidation",
+		"GET /main.js HTTP/1.1\r\n"
+		"Host: localhost:6931\r\n"
+		"Accept: */*\r\n"
+		"If-None-Match: \"18c4f2a7b9e30d51-gzip\"\r\n"
+		"If-Modified-Since: Sat, 17 Oct 2026 20:56:51 GMT\r\n"
+		"User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4 Safari/605.1.15\r\n"
+		"Accept-Language: en-GB,en;q=0.9\r\n"
+		"Referer: http://localhost:6931/\r\n"
+		"Accept-Encoding: gzip, deflate\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n",
+		HTTP_PARSE_OK,
+	},
+	{
+		"curl range",
+		"GET /main.wasm HTTP/1.1\r\n"
+		"Host: localhost:6931\r\n"
+		"User-Agent: curl/8.5.0\r\n"
+		"Accept: */*\r\n"
+		"Range: bytes=0-1023,4096-\r\n"
+		"\r\n",
+		HTTP_PARSE_OK,
+	},
+	{"one 8 KB line", NULL, HTTP_PARSE_OK},
+	{"8 KB of bare CRs", NULL, HTTP_PARSE_OK},
+	{"1000 tiny options", NULL, HTTP_PARSE_OK},
+	{"8 KB Connection tokens", NULL, HTTP_PARSE_OK},
+	{"no blank line", NULL, HTTP_PARSE_MALFORMED},
+	{"unsupported method", "POST /upload HTTP/1.1\r\nHost: localhost:6931\r\nContent-Length: 5\r\n\r\n", HTTP_PARSE_UNSUPPORTED_METHOD},
+};
+
+// Build the inputs that are meant to be slow: every one of them fills most of
+// HTTP_MAX_HEADER_SIZE with whatever the parser has to look at byte by byte,
+// or call the most functions for.
+static char* makePathologicalHeader(const char* name) {
+	uword capacity = HTTP_MAX_HEADER_SIZE + 1;
+	char* header = malloc(capacity);
+	uword length = 0;
+	const char* start = "GET / HTTP/1.1\r\n";
+	memcpy(header, start, strlen(start));
+	length += strlen(start);
+	uword fillEnd = HTTP_MAX_HEADER_SIZE - 64;
+	if (strcmp(name, "one 8 KB line") == 0) {
+		memcpy(header + length, "X-Long: ", 8);
+		length += 8;
+		while (length < fillEnd) {
+			header[length++] = 'a';
+		}
+		memcpy(header + length, "\r\n", 2);
+		length += 2;
+	} else if (strcmp(name, "8 KB of bare CRs") == 0) {
+		memcpy(header + length, "X-Cr: ", 6);
+		length += 6;
+		while (length < fillEnd) {
+			header[length++] = '\r';
+		}
+		memcpy(header + length, "\r\n", 2);
+		length += 2;
+	} else if (strcmp(name, "1000 tiny options") == 0) {
+		while (length < fillEnd) {
+			memcpy(header + length, "a:b\r\n", 5);
+			length += 5;
+		}
+	} else if (strcmp(name, "8 KB Connection tokens") == 0) {
+		memcpy(header + length, "Connection: ", 12);
+		length += 12;
+		while (length < fillEnd) {
+			memcpy(header + length, "x,", 2);
+			length += 2;
+		}
+		memcpy(header + length, "close\r\n", 7);
+		length += 7;
+	} else {
+		// no blank line: the last line is cut short after its CR
+		memcpy(header + length, "Host: localhost\r\nX-Cut: a\r\r\n", 28);
+		length += 28;
+		header[length] = '\0';
+		return header;
+	}
+	memcpy(header + length, "\r\n", 2);
+	length += 2;
+	assert(length <= HTTP_MAX_HEADER_SIZE);
+	header[length] = '\0';
+	return header;
+}
+
+static int writeSeeds(const char* directory) {
+	for (u32 setIndex = 0; setIndex < ArrayCount(headerSets); ++setIndex) {
+		HeaderSet* set = headerSets + setIndex;
+		char* madeHeader = set->header ? NULL : makePathologicalHeader(set->name);
+		const char* oneHeader = set->header ? set->header : madeHeader;
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/seed-%02u", directory, setIndex);
+		FILE* file = fopen(path, "wb");
+		if (!file) {
+			fprintf(stderr, "Could not write '%s'\n", path);
+			free(madeHeader);
+			return 1;
+		}
+		fputc(0xff, file);
+		fwrite(oneHeader, 1, strlen(oneHeader), file);
+		fclose(file);
+		free(madeHeader);
+	}
+	printf("Wrote %u seeds to '%s'\n", (u32) ArrayCount(headerSets), directory);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	double secondsPerSet = 1.0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+			++i;
+			secondsPerSet = atof(argv[i]);
+		} else if (strcmp(argv[i], "--write-seeds") == 0 && i + 1 < argc) {
+			return writeSeeds(argv[i + 1]);
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+
+	printf("%-24s %8s %10s %14s\n", "header set", "bytes", "MB/s", "requests/s");
+	int result = 0;
+	for (u32 setIndex = 0; setIndex < ArrayCount(headerSets); ++setIndex) {
+		HeaderSet* set = headerSets + setIndex;
+		char* madeHeader = set->header ? NULL : makePathologicalHeader(set->name);
+		const char* oneHeader = set->header ? set->header : madeHeader;
+		uword headerLength = strlen(oneHeader);
+
+		// about 1 MB of back to back requests, the way they would sit in a
+		// receive buffer if a client pipelined them
+		uword copyCount = (1 << 20) / headerLength + 1;
+		uword bufferSize = copyCount * headerLength;
+		char* buffer = malloc(bufferSize);
+		for (uword i = 0; i < copyCount; ++i) {
+			memcpy(buffer + i * headerLength, oneHeader, headerLength);
+		}
+
+		u64 requestCount = 0;
+		u64 byteCount = 0;
+		HttpParseResult wrongResult = HTTP_PARSE_OK;
+		u64 startTime = timeNowNanoseconds();
+		u64 endTime = startTime + (u64) (secondsPerSet * 1e9);
+		u64 now = startTime;
+		b32 wrong = FALSE;
+		while (now < endTime && !wrong) {
+			uword readIndex = 0;
+			while (readIndex < bufferSize) {
+				// Look for the end of the header the way the server does,
+				// never past HTTP_MAX_HEADER_SIZE; a header without one is
+				// parsed as it is, which is what the parser has to survive.
+				uword scanIndex = readIndex;
+				u32 matchCount = 0;
+				uword scanEnd = readIndex + headerLength;
+				if (!httpScanForHeaderEnd(buffer, &scanIndex, scanEnd, &matchCount)) {
+					scanIndex = scanEnd;
+				}
+				HttpHeader header;
+				header.chars = buffer + readIndex;
+				header.charCount = scanIndex - readIndex;
+				header.cursor = header.chars;
+				HttpRequest request;
+				HttpParseResult parseResult = httpParseRequest(&header, &request);
+				if (parseResult != set->expectedResult) {
+					wrongResult = parseResult;
+					break;
+				}
+				readIndex = scanIndex;
+				++requestCount;
+			}
+			wrong = readIndex < bufferSize;
+			byteCount += bufferSize;
+			now = timeNowNanoseconds();
+		}
+		double seconds = (double) (now - startTime) / 1e9;
+		if (wrong) {
+			printf(
+				"%-24s parsed as %s instead of %s\n", set->name,
+				httpParseResultName(wrongResult), httpParseResultName(set->expectedResult));
+			result = 1;
+		} else {
+			printf(
+				"%-24s %8llu %10.1f %14.0f\n",
+				set->name, (unsigned long long) headerLength,
+				(double) byteCount / seconds / 1e6, (double) requestCount / seconds);
+		}
+		free(buffer);
+		free(madeHeader);
+	}
+	return result;
+}
@@ -0,0 +1,135 @@
+// A libFuzzer target for the HTTP request parser in http_parser.h.
+//
+// The input is treated like the server's receive buffer: it arrives in two
+// pieces, split at a point taken from its first byte, and every header in it
+// is found with httpScanForHeaderEnd(), never past HTTP_MAX_HEADER_SIZE, and
+// parsed with httpParseRequest(). Whatever the input, neither may read outside
+// of it, and every slice in a parsed request must point into its header.
+// Build and run with clang, seeding the corpus with the header sets of
+// tools/http_parser_benchmark.c:
+//
+//   clang -std=gnu11 -g -O1 -fsanitize=fuzzer,address,undefined -o http-parser-fuzz tools/http_parser_fuzz.c
+//   http-parser-benchmark --write-seeds http-parser-corpus
+//   ./http-parser-fuzz http-parser-corpus
+//
+// Compilers without libFuzzer can build a driver that runs the target once on
+// each file named on the command line, to replay a corpus or a crash:
+//
+//   cc -std=gnu11 -g -O1 -fsanitize=address,undefined -DHTTP_PARSER_FUZZ_MAIN -o http-parser-fuzz tools/http_parser_fuzz.c
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef uintptr_t uword;
+typedef u32 b32;
+
+#define FALSE 0
+#define TRUE 1
+
+#define ClearValueToZero(Value) memset(&(Value), 0, sizeof(Value))
+
+#include "http_parser.h"
+
+// Sanitizers only report a failed check if it crashes, so this works in
+// builds without assertions too.
+#define FuzzCheck(Condition) if (!(Condition)) { fprintf(stderr, "check failed: %s\n", #Condition); abort(); }
+
+static void checkSliceInHeader(StringSlice slice, const HttpHeader* header) {
+	if (slice.begin == NULL) {
+		FuzzCheck(slice.end == NULL);
+		return;
+	}
+	FuzzCheck(slice.begin <= slice.end);
+	FuzzCheck(slice.begin >= header->chars && slice.end <= header->chars + header->charCount);
+}
+
+static void checkHeader(const char* chars, uword charCount) {
+	HttpHeader header;
+	header.chars = chars;
+	header.charCount = charCount;
+	header.cursor = header.chars;
+	HttpRequest request;
+	HttpParseResult result = httpParseRequest(&header, &request);
+	FuzzCheck(result < HTTP_PARSE_RESULT_COUNT);
+	if (result != HTTP_PARSE_OK) {
+		return;
+	}
+	checkSliceInHeader(request.url, &header);
+	checkSliceInHeader(request.ifNoneMatch, &header);
+	checkSliceInHeader(request.ifModifiedSince, &header);
+	checkSliceInHeader(request.range, &header);
+	checkSliceInHeader(request.ifRange, &header);
+	checkSliceInHeader(request.webSocketKey, &header);
+	checkSliceInHeader(request.webSocketVersion, &header);
+	FuzzCheck(!(request.head && request.upgradeWebSocket));
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+	// a copy of exactly the input, so the sanitizers catch any read past it
+	uword byteCount = size - 1;
+	char* buffer = malloc(byteCount ? byteCount : 1);
+	memcpy(buffer, data + 1, byteCount);
+	uword firstPieceSize = byteCount * data[0] / 255;
+
+	uword readIndex = 0;
+	uword scanIndex = 0;
+	u32 matchCount = 0;
+	uword writeIndex = firstPieceSize;
+	for (;;) {
+		uword maxScanEnd = readIndex + HTTP_MAX_HEADER_SIZE;
+		uword scanEnd = (writeIndex < maxScanEnd) ? writeIndex : maxScanEnd;
+		if (httpScanForHeaderEnd(buffer, &scanIndex, scanEnd, &matchCount)) {
+			FuzzCheck(scanIndex > readIndex && scanIndex <= scanEnd);
+			FuzzCheck(matchCount == 0);
+			checkHeader(buffer + readIndex, scanIndex - readIndex);
+			readIndex = scanIndex;
+			continue;
+		}
+		FuzzCheck(scanIndex == scanEnd && matchCount < 4);
+		if (scanIndex == maxScanEnd) {
+			// the server answers 431 and stops reading here
+			break;
+		}
+		if (writeIndex == byteCount) {
+			// what is left never got a blank line, which the parser has to
+			// survive anyway, as the benchmark does
+			checkHeader(buffer + readIndex, byteCount - readIndex);
+			break;
+		}
+		// the second piece arrives, and the search resumes
+		writeIndex = byteCount;
+	}
+	free(buffer);
+	return 0;
+}
+
+#ifdef HTTP_PARSER_FUZZ_MAIN
+int main(int argc, char* argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		FILE* file = fopen(argv[i], "rb");
+		if (!file) {
+			fprintf(stderr, "Could not open '%s'\n", argv[i]);
+			return 1;
+		}
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		u8* data = malloc(size > 0 ? (size_t) size : 1);
+		size_t readSize = fread(data, 1, (size_t) size, file);
+		fclose(file);
+		LLVMFuzzerTestOneInput(data, readSize);
+		free(data);
+	}
+	printf("Ran %d inputs\n", argc - 1);
+	return 0;
+}
+#endif
@@ -1,3 +1,7 @@
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600 // WSAPoll() requires Vista or later
+#endif
 #pragma warning(push, 0)
 #define VC_EXTRALEAN
 #define WIN32_LEAN_AND_MEAN
@@ -6,11 +10,51 @@
 
 typedef struct addrinfo addrinfo;
 #pragma warning(pop)
+#else
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Map the handful of Winsock names used by this file onto their POSIX
+// equivalents, so that most of the code does not need to care which platform
+// it is running on.
+typedef struct addrinfo addrinfo;
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_SEND SHUT_WR
+#define closesocket(Socket) close(Socket)
+#define WSAGetLastError() errno
+#define ExitProcess(ExitCode) exit(ExitCode)
+
+// the io_uring backend talks to the kernel directly, rather than through liburing
+#define HTTP_SERVER_IO_URING 1
+#endif
 
 #include <assert.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 typedef int8_t i8;
 typedef uint8_t u8;
@@ -45,68 +89,18 @@ inline static void* reallocSafe(void* pointer, uword newSize) {
 	return checkOutOfMemory(realloc(pointer, newSize));
 }
 
-typedef struct StringSlice {
-	const char* begin;
-	const char* end;
-} StringSlice;
-
-// for the "%.*s" format in printf
-#define StringSlicePrintf(S)  (int) stringSliceLength(S), (S).begin
-
-inline static StringSlice stringSlice(const char* begin, const char* end) {
-	StringSlice ss = {begin, end};
-	return ss;
-}
-
-inline static StringSlice stringSliceFromCString(const char* cs) {
-	StringSlice ss = {
-		.begin = cs,
-		.end = cs + strlen(cs),
-	};
-	return ss;
-}
-
-//TODO rename to stringSliceCount
-inline static uword stringSliceLength(StringSlice ss) {
-	return (uword) (ss.end - ss.begin);
-}
-
-inline static b32 stringSliceEmpty(StringSlice ss) {
-	return ss.begin == ss.end;
-}
-
-static b32 stringSlicesEqual(const StringSlice* a, const StringSlice* b) {
-	uword aLen = stringSliceLength(*a);
-	uword bLen = stringSliceLength(*b);
-	if (aLen != bLen) {
-		return FALSE;
-	}
-	const char* ap = a->begin;
-	const char* bp = b->begin;
-	while (ap != a->end) {
-		if (*ap != *bp) {
-			return FALSE;
-		}
-		++ap;
-		++bp;
-	}
-	return TRUE;
-}
+#include "deflate.h"
+#include "http_parser.h"
 
-static b32 stringSliceEqualsCString(const StringSlice* ss, const char* cs) {
-	const char* begin = ss->begin;
-	for (;;) {
-		b32 end1 = (begin == ss->end);
-		b32 end2 = (*cs == '\0');
-		if (end1 | end2) {
-			return end1 & end2;
-		}
-		if (*begin != *cs) {
-			return FALSE;
-		}
-		++begin;
-		++cs;
-	}
+inline static u32 highestSetBit64(u64 value) {
+	assert(value != 0);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (u32) index;
+#else
+	return 63 - (u32) __builtin_clzll(value);
+#endif
 }
 
 const char* serverAddress = "127.0.0.1";
@@ -123,26 +117,174 @@ const char* index_html =
 	"	</body>\n"
 	"</html>\n";
 
+#ifdef _WIN32
+#define SOCKET_SEND_FLAGS 0
+#else
+// do not raise SIGPIPE when the client has already gone away
+#define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+static b32 socketsInit() {
+#ifdef _WIN32
+	WSADATA wsaData;
+	int wsResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
+	if (wsResult != 0) {
+		fprintf(stderr, "WSAStartup() failed: %d\n", wsResult);
+		return FALSE;
+	}
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	return TRUE;
+}
+
+static void socketsCleanup() {
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+// Returns TRUE if a socket error only means that the operation could not
+// complete without blocking, and should be retried later.
+inline static b32 socketErrorWouldBlock(int error) {
+#ifdef _WIN32
+	return error == WSAEWOULDBLOCK;
+#else
+	return (error == EAGAIN) | (error == EWOULDBLOCK) | (error == EINTR);
+#endif
+}
+
+// Returns TRUE if a socket error only means that the peer has closed or reset
+// the connection, which is an ordinary way for a connection to end.
+inline static b32 socketErrorDisconnected(int error) {
+#ifdef _WIN32
+	return (error == WSAECONNRESET) | (error == WSAECONNABORTED) | (error == WSAENOTCONN) | (error == WSAESHUTDOWN);
+#else
+	return (error == ECONNRESET) | (error == ENOTCONN) | (error == EPIPE);
+#endif
+}
+
+static b32 socketSetNonBlocking(SOCKET socket) {
+#ifdef _WIN32
+	u_long nonBlocking = 1;
+	return ioctlsocket(socket, FIONBIO, &nonBlocking) != SOCKET_ERROR;
+#else
+	int flags = fcntl(socket, F_GETFL, 0);
+	return (flags != -1) && (fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1);
+#endif
+}
+
+// Start connecting a non-blocking socket. The socket becomes writable once the
+// connection has been established or has failed; in the latter case, the
+// first send() reports the error.
+static b32 socketConnectNonBlocking(const char* context, SOCKET socket, const addrinfo* address) {
+	if (connect(socket, address->ai_addr, (int) address->ai_addrlen) == SOCKET_ERROR) {
+		int error = WSAGetLastError();
+#ifdef _WIN32
+		b32 inProgress = (error == WSAEWOULDBLOCK);
+#else
+		b32 inProgress = (error == EINPROGRESS);
+#endif
+		if (!inProgress) {
+			fprintf(stderr, "[%s] connect() failed: %d\n", context, error);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 static b32 socketSend(const char* context, SOCKET socket, uword byteCount, const void* bytes) {
 	while (byteCount > 0) {
-		int bytesSent = send(socket, (char*) bytes, byteCount, 0);
+		int bytesSent = send(socket, (char*) bytes, byteCount, SOCKET_SEND_FLAGS);
 		if (bytesSent == SOCKET_ERROR) {
 			fprintf(stderr, "[%s] sending data failed: %d\n", context, WSAGetLastError());
 			return FALSE;
 		}
+		bytes = (const u8*) bytes + bytesSent;
 		byteCount -= bytesSent;
 	}
 	return TRUE;
 }
 
+// Send as many bytes as a non-blocking socket will accept. The number of bytes
+// accepted, which may be zero, is written to sentByteCount. Returns FALSE on a
+// socket error, which is written to error for the caller to report.
+static b32 socketSendNonBlocking(
+SOCKET socket, uword byteCount, const void* bytes, uword* sentByteCount, int* error) {
+	*sentByteCount = 0;
+	int bytesSent = send(socket, (const char*) bytes, (int) byteCount, SOCKET_SEND_FLAGS);
+	if (bytesSent == SOCKET_ERROR) {
+		*error = WSAGetLastError();
+		return socketErrorWouldBlock(*error);
+	}
+	*sentByteCount = (uword) bytesSent;
+	return TRUE;
+}
+
+// One piece of a vectored send. The layout matches what the platform's
+// vectored send function takes, so an array of these can be passed straight
+// through.
+#ifdef _WIN32
+typedef WSABUF SocketBuffer;
+#else
+typedef struct iovec SocketBuffer;
+#endif
+
+inline static void socketBufferSet(SocketBuffer* buffer, const void* bytes, uword byteCount) {
+#ifdef _WIN32
+	buffer->buf = (CHAR*) bytes;
+	buffer->len = (ULONG) byteCount;
+#else
+	buffer->iov_base = (void*) bytes;
+	buffer->iov_len = byteCount;
+#endif
+}
+
+// Like socketSendNonBlocking(), but gathers several buffers into one system
+// call. If moreFollows is set, the kernel is told that more data is about to
+// be sent, so it can hold back a partially filled packet (where supported).
+static b32 socketSendVectorNonBlocking(
+SOCKET socket, SocketBuffer* buffers, uword bufferCount,
+b32 moreFollows, uword* sentByteCount, int* error) {
+	*sentByteCount = 0;
+#ifdef _WIN32
+	DWORD bytesSent;
+	if (WSASend(socket, buffers, (DWORD) bufferCount, &bytesSent, 0, NULL, NULL) == SOCKET_ERROR) {
+		*error = WSAGetLastError();
+		return socketErrorWouldBlock(*error);
+	}
+#else
+	struct msghdr message = {
+		.msg_iov = buffers,
+		.msg_iovlen = bufferCount,
+	};
+	int flags = SOCKET_SEND_FLAGS | (moreFollows ? MSG_MORE : 0);
+	ssize_t bytesSent = sendmsg(socket, &message, flags);
+	if (bytesSent == -1) {
+		*error = errno;
+		return socketErrorWouldBlock(*error);
+	}
+#endif
+	*sentByteCount = (uword) bytesSent;
+	return TRUE;
+}
+
+// Returns FALSE on a socket error, which is written to error for the caller to
+// report.
 static b32 socketReceive(
-const char* context, SOCKET socket, uword maxByteCount,
-void* bytes, uword* receivedByteCount, b32* connectionClosed) {
+SOCKET socket, uword maxByteCount, void* bytes,
+uword* receivedByteCount, b32* connectionClosed, b32* wouldBlock, int* error) {
 	*receivedByteCount = 0;
 	*connectionClosed = TRUE;
-	int receivedLength = recv(socket, bytes, maxByteCount, 0);
+	*wouldBlock = FALSE;
+	int receivedLength = recv(socket, bytes, (int) maxByteCount, 0);
 	if (receivedLength == SOCKET_ERROR) {
-		fprintf(stderr, "[%s] recv() failed: %d\n", context, WSAGetLastError());
+		*error = WSAGetLastError();
+		if (socketErrorWouldBlock(*error)) {
+			*connectionClosed = FALSE;
+			*wouldBlock = TRUE;
+			return TRUE;
+		}
 		return FALSE;
 	}
 	*connectionClosed = (receivedLength == 0);
@@ -155,472 +297,6688 @@ static b32 socketSendCString(const char* context, SOCKET socket, const char* str
 	return socketSend(context, socket, stringLength, string);
 }
 
-inline static void skipSpaces(const char** cursor, const char* end) {
-	for (;;) {
-		if (*cursor == end || **cursor != ' ') {
-			return;
-		}
-		*cursor += 1;
-	}
+typedef int (*ThreadFunction)(void* param);
+
+// The thread structure must stay alive until threadJoin() returns, because
+// the new thread stores its exit code in it.
+typedef struct Thread {
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	ThreadFunction function;
+	void* param;
+	int exitCode;
+} Thread;
+
+#ifdef _WIN32
+static DWORD WINAPI threadEntryPoint(void* param) {
+	Thread* thread = param;
+	thread->exitCode = thread->function(thread->param);
+	return (DWORD) thread->exitCode;
+}
+#else
+static void* threadEntryPoint(void* param) {
+	Thread* thread = param;
+	thread->exitCode = thread->function(thread->param);
+	return NULL;
 }
+#endif
 
-void httpServerExitError() {
-//TODO maybe attempt to automatically reboot the server?
-	ExitProcess(1);
+static b32 threadStart(Thread* thread, ThreadFunction function, void* param) {
+	thread->function = function;
+	thread->param = param;
+	thread->exitCode = 0;
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, threadEntryPoint, thread, 0, NULL);
+	return thread->handle != NULL;
+#else
+	return pthread_create(&thread->handle, NULL, threadEntryPoint, thread) == 0;
+#endif
 }
 
-typedef struct HttpHeader {
-	uword charCount;
-	const char* chars;
-	const char* cursor;
-} HttpHeader;
+static int threadJoin(Thread* thread) {
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	return thread->exitCode;
+}
 
-typedef struct HttpOption {
-	StringSlice key;
-	StringSlice value;
-} HttpOption;
+static void threadSleepMilliseconds(u32 milliseconds) {
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	struct timespec duration = {milliseconds / 1000, (long) (milliseconds % 1000) * 1000000};
+	nanosleep(&duration, NULL);
+#endif
+}
 
-// Read the next line from a buffered HTTP header. If this line is the end of
-// the header (a blank line), this function returns false. Otherwise, it
-// returns TRUE.
-static StringSlice httpHeaderNextLine(HttpHeader* header) {
-	const char* lineBegin = header->cursor;
-	const char* headerEnd = header->chars + header->charCount;
-	for (;;) {
-		uword remainingByteCount = headerEnd - header->cursor;
-		assert(remainingByteCount >= 2); // if this is false, we have not been given a valid HTTP header
-		if ((header->cursor[0] == '\r') & (header->cursor[1] == '\n')) {
-			StringSlice line = stringSlice(lineBegin, header->cursor);
-			header->cursor += 2; // advance to the start of the next line
-			return line;
-		}
-		++header->cursor;
-	}
+// A lock for the little data that threads share, such as WebSocket broadcasts.
+typedef struct Mutex {
+#ifdef _WIN32
+	SRWLOCK lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} Mutex;
+
+static void mutexInit(Mutex* mutex) {
+#ifdef _WIN32
+	InitializeSRWLock(&mutex->lock);
+#else
+	pthread_mutex_init(&mutex->lock, NULL);
+#endif
 }
 
-static HttpOption httpHeaderNextOption(HttpHeader* header) {
-	StringSlice line = httpHeaderNextLine(header);
-	uword lineLength = stringSliceLength(line);
+static void mutexDestroy(Mutex* mutex) {
+#ifndef _WIN32
+	pthread_mutex_destroy(&mutex->lock);
+#endif
+	ClearValueToZero(*mutex);
+}
 
-	HttpOption option;
-	const char* lineCursor = line.begin;
-	for (;;) {
-		// No colon on this line. Set the key to the entire line; the value
-		// will end up being nothing. This also handles the blank line at the
-		// end of the header, without a special case.
-		if (lineCursor == line.end) {
-			option.key = line;
-			break;
-		}
-		char c = *lineCursor;
-		++lineCursor;
-		if (c == ':') {
-			option.key = stringSlice(line.begin, lineCursor - 1);
-			break;
-		}
-	}
-	skipSpaces(&lineCursor, line.end);
-	option.value = stringSlice(lineCursor, line.end);
-	option.value.end = line.end;
-	return option;
+inline static void mutexLock(Mutex* mutex) {
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&mutex->lock);
+#else
+	pthread_mutex_lock(&mutex->lock);
+#endif
 }
 
-typedef struct HttpBuffer {
-	const char* name;
-	u8* data;
-	uword capacity;
-	uword size;
-	SOCKET socket;
+inline static void mutexUnlock(Mutex* mutex) {
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&mutex->lock);
+#else
+	pthread_mutex_unlock(&mutex->lock);
+#endif
+}
 
-//TODO could use a bitset for these flags. Since they are mutually exclusive, they could also be an enum.
-	b32 error;
-	b32 connectionClosed;
-} HttpBuffer;
+// For a thread to sleep until another one changes something guarded by a
+// Mutex, such as a job queue.
+typedef struct Condition {
+#ifdef _WIN32
+	CONDITION_VARIABLE variable;
+#else
+	pthread_cond_t variable;
+#endif
+} Condition;
 
-static void httpBufferInit(HttpBuffer* buffer, const char* name) {
-	ClearValueToZero(*buffer);
-	buffer->name = name;
+static void conditionInit(Condition* condition) {
+#ifdef _WIN32
+	InitializeConditionVariable(&condition->variable);
+#else
+	pthread_cond_init(&condition->variable, NULL);
+#endif
 }
 
-static void httpBufferGrow(HttpBuffer* buffer) {
-	uword newCapacity = (buffer->capacity == 0) ? 1024 : buffer->capacity * 2;
-	buffer->data = checkOutOfMemory(realloc(buffer->data, newCapacity));
-	buffer->capacity = newCapacity;
+static void conditionDestroy(Condition* condition) {
+#ifndef _WIN32
+	pthread_cond_destroy(&condition->variable);
+#endif
+	ClearValueToZero(*condition);
 }
 
-static void httpBufferReadBytes(HttpBuffer* buffer) {
-	if (buffer->capacity == buffer->size) {
-		httpBufferGrow(buffer);
-	}
-	uword remainingCapacity = buffer->capacity - buffer->size;
-	u8* receivePointer = buffer->data + buffer->size;
-	uword receivedByteCount;
-	buffer->error |= !socketReceive(
-		buffer->name, buffer->socket, remainingCapacity, receivePointer,
-		&receivedByteCount, &buffer->connectionClosed);
-	buffer->size += receivedByteCount;
+// Unlock the mutex, which must be locked, and sleep until the condition is
+// signalled, then lock it again. This can also return without a signal, so
+// check what is being waited for again.
+inline static void conditionWait(Condition* condition, Mutex* mutex) {
+#ifdef _WIN32
+	SleepConditionVariableSRW(&condition->variable, &mutex->lock, INFINITE, 0);
+#else
+	pthread_cond_wait(&condition->variable, &mutex->lock);
+#endif
 }
 
-static void httpBufferDiscardBytes(HttpBuffer* buffer, uword byteCount) {
-//TODO this isn't the most efficient way to discard information - a ring buffer would avoid copies
-	assert(byteCount <= buffer->size);
-	uword newSize = buffer->size - byteCount;
-	memmove(buffer->data, buffer->data + byteCount, newSize);
-	buffer->size = newSize;
-}
-
-//TODO in case of malicious/malformed packets, add a maxByteCount parameter; if
-// we do not find the end of the header before reaching this limit, log an
-// error message, send an error response to the client, and close the
-// connection to the client.
-static void httpBufferReadHeader(HttpBuffer* buffer, HttpHeader* header) {
-	uword cursor = 0;
-	for (;;) {
-		while (cursor < buffer->size) {
-			uword remainingByteCount = buffer->size - cursor;
-			if (remainingByteCount < 4) {
-				break;
-			}
-			b32 blankLine =
-				(buffer->data[cursor + 0] == '\r') &
-				(buffer->data[cursor + 1] == '\n') &
-				(buffer->data[cursor + 2] == '\r') &
-				(buffer->data[cursor + 3] == '\n');
-			if (blankLine) {
-				cursor += 4;
-				header->charCount = cursor;
-				header->chars = buffer->data;
-				header->cursor = buffer->data;
-				return;
-			}
-			++cursor;
-		}
-		httpBufferReadBytes(buffer);
-		if (buffer->error | buffer->connectionClosed) {
-			return;
-		}
+inline static void conditionSignal(Condition* condition) {
+#ifdef _WIN32
+	WakeConditionVariable(&condition->variable);
+#else
+	pthread_cond_signal(&condition->variable);
+#endif
+}
+
+// A monotonic clock, for measuring how long things take.
+static u64 timeNowNanoseconds() {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
 	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	u64 ticks = (u64) counter.QuadPart;
+	u64 ticksPerSecond = (u64) frequency.QuadPart;
+	// split the conversion so that it cannot overflow
+	return (ticks / ticksPerSecond) * 1000000000 + (ticks % ticksPerSecond) * 1000000000 / ticksPerSecond;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64) now.tv_sec * 1000000000 + (u64) now.tv_nsec;
+#endif
 }
 
-inline static void httpBufferReset(HttpBuffer* buffer) {
-	buffer->size = 0;
-	buffer->socket = INVALID_SOCKET;
-	buffer->error = FALSE;
-	buffer->connectionClosed = FALSE;
+// Loads and stores that order the memory accesses around them, for passing
+// data between threads without a lock.
+#ifdef _WIN32
+// MSVC gives volatile accesses acquire and release semantics on x86.
+inline static uword atomicLoadAcquire(volatile uword* value) {
+	return *value;
 }
 
-inline static void httpBufferDestroy(HttpBuffer* buffer) {
-	free(buffer->data);
-	ClearValueToZero(*buffer);
-	buffer->socket = INVALID_SOCKET;
+inline static void atomicStoreRelease(volatile uword* value, uword newValue) {
+	*value = newValue;
+}
+#else
+inline static uword atomicLoadAcquire(volatile uword* value) {
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
 }
 
-static b32 httpSendOkResponse(const char* context, SOCKET socket, uword contentLength, const void* content) {
-	char header[1024]; //TODO prune the size of this header
-	int headerLength = sprintf(
-		header,
-		"HTTP/1.1 200 OK\r\n"
-		"Connection: close\r\n"
-		"Content-Length: %llu\r\n"
-		"Content-Type: text/html\r\n"
-		"\r\n",
-		(unsigned long long) contentLength);
-	return
-		socketSend(context, socket, headerLength, header) &&
-		socketSend(context, socket, contentLength, content);
+inline static void atomicStoreRelease(volatile uword* value, uword newValue) {
+	__atomic_store_n(value, newValue, __ATOMIC_RELEASE);
 }
+#endif
 
-static b32 httpSend404Response(const char* context, SOCKET socket) {
-	const char* response =
-		"HTTP/1.1 404 NOT FOUND\r\n"
-		"Connection: close\r\n"
-		"Content-Length: 14\r\n"
-		"Content-Type: text/plain\r\n"
-		"\r\n"
-		"404 NOT FOUND\n";
-//TODO this string length could be precomputed
-	uword responseLength = strlen(response);
-	return socketSend(context, socket, responseLength, response);
+// Keeps the memory accesses before it from being reordered with those after
+// it, including a store with a later load, which acquire and release do not.
+inline static void atomicFence(void) {
+#ifdef _WIN32
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
 }
 
-static void serviceClient(HttpBuffer* buffer, SOCKET clientSocket) {
-//TODO need timeouts on waiting for data - is this built in to the socket somewhere?
+// Loads and stores of a 64-bit value that another thread may access at the
+// same time. They are never torn, even on 32-bit targets, but do not order
+// anything else.
+#ifdef _WIN32
+inline static u64 atomicLoadRelaxed64(const volatile u64* value) {
+	return (u64) __iso_volatile_load64((const volatile __int64*) value);
+}
 
-	httpBufferReset(buffer);
-//TODO it feels wrong to use the HTTP buffer's socket as the client socket
-	buffer->socket = clientSocket;
-	
-	for (;;) {
-		HttpHeader header;
-		httpBufferReadHeader(buffer, &header);
-		if (buffer->error) {
-			return;
-		}
-		if (buffer->connectionClosed) {
-			printf("[Server] Client closed connection.\n");
-			break;
-		}
+inline static void atomicStoreRelaxed64(volatile u64* value, u64 newValue) {
+	__iso_volatile_store64((volatile __int64*) value, (__int64) newValue);
+}
+#else
+inline static u64 atomicLoadRelaxed64(const volatile u64* value) {
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
 
-		StringSlice requestLine = httpHeaderNextLine(&header);
-		uword requestLineLength = stringSliceLength(requestLine);
-
-		const char* requestLineCursor = requestLine.begin;
-		b32 getRequest = requestLineLength >= 3 && (
-			((requestLineCursor[0] == 'g') | (requestLineCursor[0] == 'G')) &
-			((requestLineCursor[1] == 'e') | (requestLineCursor[1] == 'E')) &
-			((requestLineCursor[2] == 't') | (requestLineCursor[2] == 'T')));
-		if (getRequest) {
-			requestLineCursor += 3;
-			skipSpaces(&requestLineCursor, requestLine.end);
-			const char* urlBegin = requestLineCursor;
-			for (;;) {
-				if (requestLineCursor == requestLine.end || *requestLineCursor == ' ') {
-					break;
-				}
-				++requestLineCursor;
-			}
-			const char* urlEnd = requestLineCursor;
-			StringSlice url = stringSlice(urlBegin, urlEnd);
-			printf(
-				"[Server] Received GET request: '%.*s'\n",
-				StringSlicePrintf(url));
-
-			// read through the rest of the HTTP options
-			for (;;) {
-				HttpOption option = httpHeaderNextOption(&header);
-				// check for blank key - this marks the end of the HTTP header
-				if (stringSliceEmpty(option.key)) {
-					break;
-				}
-				printf("    %.*s: %.*s\n", StringSlicePrintf(option.key), StringSlicePrintf(option.value));
-			}
+inline static void atomicStoreRelaxed64(volatile u64* value, u64 newValue) {
+	__atomic_store_n(value, newValue, __ATOMIC_RELAXED);
+}
+#endif
 
-			b32 indexFileRequested =
-				stringSliceEmpty(url) ||
-				stringSliceEqualsCString(&url, "/") ||
-				stringSliceEqualsCString(&url, "/index.html");
-			if (indexFileRequested) {
-				printf("[Server] Sending index.html to client...\n");
-				if (!httpSendOkResponse("SERVER", clientSocket, strlen(index_html), index_html)) {
-					return;
-				}
-			} else {
-				printf(
-					"[Server] Sending 404 response for request 'GET %.*s'...\n",
-					StringSlicePrintf(url));
-				if (!httpSend404Response("Server", clientSocket)) {
-					return;
-				}
-			}
-		} else {
-//TODO send response stating the request was invalid, and close connection
-			fprintf(
-				stderr, "[Server] Unknown HTML request: '%.*s'\n",
-				StringSlicePrintf(requestLine));
-			return;
-		}
+// A hierarchical timer wheel, for deadlines that are mostly pushed back or
+// cancelled before they expire, such as connection timeouts. Time is counted
+// in ticks. Each level has TIMER_WHEEL_SLOT_COUNT slots, and a slot on level n
+// covers TIMER_WHEEL_SLOT_COUNT^n ticks; a timer goes in the slot of its
+// expiry tick on the lowest level that reaches that far. Whenever the current
+// tick enters a new slot of a higher level, the timers in that slot are moved
+// down to the levels below. Adding and removing a timer are O(1), and
+// advancing is O(1) for each tick plus the timers that expire or move down.
+#define TIMER_WHEEL_TICK_MILLISECONDS 100
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOT_COUNT (1 << TIMER_WHEEL_SLOT_BITS)
+// 64^3 ticks of 100 ms is about 7 hours. A timer further away than that is
+// put in the furthest slot, and is moved on again when that slot comes up.
+#define TIMER_WHEEL_LEVEL_COUNT 3
 
-		httpBufferDiscardBytes(buffer, header.charCount);
-	}
+// Meant to be embedded in the structure that it is the timer for.
+typedef struct Timer {
+	struct Timer* next;
+	// the pointer that points to this timer, or NULL if it is not scheduled
+	struct Timer** link;
+	u64 expiryTick;
+} Timer;
 
-	// shut down the client if the connection has not yet been closed
-	if (!buffer->connectionClosed) {
-		printf("[Server] Shutting down client.\n");
-		if (shutdown(clientSocket, SD_SEND) == SOCKET_ERROR) {
-			fprintf(stderr, "[Server] shutdown() failed: %d\n", WSAGetLastError());
-			return;
-		}
-	}
+typedef struct TimerWheel {
+	u64 startTime;
+	// every tick before this one has been processed
+	u64 currentTick;
+	uword timerCount;
+	Timer* slots[TIMER_WHEEL_LEVEL_COUNT][TIMER_WHEEL_SLOT_COUNT];
+} TimerWheel;
 
-	printf("[Server] Closing client socket.\n");
-	if (closesocket(clientSocket) == SOCKET_ERROR) {
-		fprintf(stderr, "[Server] closesocket() for client socket failed: %d\n", WSAGetLastError());
+static void timerWheelInit(TimerWheel* wheel, u64 now) {
+	ClearValueToZero(*wheel);
+	wheel->startTime = now;
+}
+
+// The first tick at or after a time from timeNowNanoseconds().
+static u64 timerWheelTickAt(const TimerWheel* wheel, u64 time) {
+	u64 tickNanoseconds = (u64) TIMER_WHEEL_TICK_MILLISECONDS * 1000000;
+	if (time <= wheel->startTime) {
+		return 0;
 	}
+	return (time - wheel->startTime + tickNanoseconds - 1) / tickNanoseconds;
 }
 
-static int runServer() {
-	int wsResult;
+inline static b32 timerScheduled(const Timer* timer) {
+	return timer->link != NULL;
+}
 
-	addrinfo addrHints = {
-		.ai_flags = AI_PASSIVE,
-		.ai_family = AF_INET,
-		.ai_socktype = SOCK_STREAM,
-		.ai_protocol = IPPROTO_TCP,
-	};
-	addrinfo* addr;
-	wsResult = getaddrinfo(NULL, port, &addrHints, &addr);
-	if (wsResult != 0) {
-		fprintf(stderr, "[Server] getaddrinfo() failed: %d\n", wsResult);
-		return 1;
+static void timerWheelLink(TimerWheel* wheel, Timer* timer) {
+	u64 tick = (timer->expiryTick > wheel->currentTick) ? timer->expiryTick : wheel->currentTick;
+	u64 delta = tick - wheel->currentTick;
+	u32 level = 0;
+	while (level + 1 < TIMER_WHEEL_LEVEL_COUNT && delta >> (TIMER_WHEEL_SLOT_BITS * (level + 1)) != 0) {
+		++level;
+	}
+	u64 maxDelta = ((u64) 1 << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVEL_COUNT)) - 1;
+	if (delta > maxDelta) {
+		tick = wheel->currentTick + maxDelta;
 	}
+	u32 slot = (u32) (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOT_COUNT - 1);
+	Timer** head = &wheel->slots[level][slot];
+	timer->next = *head;
+	if (timer->next) {
+		timer->next->link = &timer->next;
+	}
+	timer->link = head;
+	*head = timer;
+}
 
-	SOCKET listenSocket = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-	if (listenSocket == INVALID_SOCKET) {
-		fprintf(stderr, "[Server] socket() failed: %d\n", WSAGetLastError());
-		return 1;
+static void timerWheelUnlink(Timer* timer) {
+	*timer->link = timer->next;
+	if (timer->next) {
+		timer->next->link = timer->link;
 	}
+	timer->next = NULL;
+	timer->link = NULL;
+}
 
-	printf("[Server] Waiting for connection request...\n");
+static void timerWheelAdd(TimerWheel* wheel, Timer* timer, u64 expiryTick) {
+	assert(!timerScheduled(timer));
+	timer->expiryTick = expiryTick;
+	timerWheelLink(wheel, timer);
+	++wheel->timerCount;
+}
 
-	wsResult = bind(listenSocket, addr->ai_addr, (int) addr->ai_addrlen);
-	if (wsResult != 0) {
-		fprintf(stderr, "[Server] bind() failed: %d\n", wsResult);
-		return 1;
+static void timerWheelRemove(TimerWheel* wheel, Timer* timer) {
+	if (timerScheduled(timer)) {
+		timerWheelUnlink(timer);
+		--wheel->timerCount;
 	}
-	freeaddrinfo(addr);
+}
 
-	if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
-		fprintf(stderr, "[Server] listen() failed: %d\n", WSAGetLastError());
-		return 1;
+// Process every tick that has started by now. Returns the timers that have
+// expired, linked through their next pointers; they are no longer scheduled.
+static Timer* timerWheelAdvance(TimerWheel* wheel, u64 now) {
+	u64 tickNanoseconds = (u64) TIMER_WHEEL_TICK_MILLISECONDS * 1000000;
+	u64 nowTick = (now > wheel->startTime) ? (now - wheel->startTime) / tickNanoseconds : 0;
+	Timer* expired = NULL;
+	if (wheel->timerCount == 0 && wheel->currentTick <= nowTick) {
+		wheel->currentTick = nowTick + 1;
+		return NULL;
 	}
-
-//TODO this buffer could grow indefinitely if given a bad packet stream. Add some protections against this.
-	HttpBuffer httpBuffer;
-	httpBufferInit(&httpBuffer, "Server");
-
-//TODO provide some means of shutting down the server
-	for (;;)
-	{
-		SOCKET clientSocket = accept(listenSocket, NULL, NULL);
-		if (clientSocket == INVALID_SOCKET) {
-			fprintf(stderr, "[Server] accept() failed: %d\n", WSAGetLastError());
-			continue;
+	for (; wheel->currentTick <= nowTick; ++wheel->currentTick) {
+		u64 tick = wheel->currentTick;
+		// move timers down from the highest level first, so that a timer
+		// moved down more than one level still makes it to this tick
+		for (u32 level = TIMER_WHEEL_LEVEL_COUNT - 1; level > 0; --level) {
+			u64 levelTickMask = ((u64) 1 << (TIMER_WHEEL_SLOT_BITS * level)) - 1;
+			if ((tick & levelTickMask) != 0) {
+				continue;
+			}
+			u32 slot = (u32) (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOT_COUNT - 1);
+			Timer* timer = wheel->slots[level][slot];
+			wheel->slots[level][slot] = NULL;
+			while (timer) {
+				Timer* next = timer->next;
+				timerWheelLink(wheel, timer);
+				timer = next;
+			}
+		}
+		Timer** slot = &wheel->slots[0][tick & (TIMER_WHEEL_SLOT_COUNT - 1)];
+		while (*slot) {
+			Timer* timer = *slot;
+			timerWheelUnlink(timer);
+			--wheel->timerCount;
+			timer->next = expired;
+			expired = timer;
 		}
-		printf("[Server] Connected to client.\n");
-		serviceClient(&httpBuffer, clientSocket);
 	}
+	return expired;
+}
 
-	httpBufferDestroy(&httpBuffer);
+typedef struct SocketEvent {
+	void* userData;
+	b32 readable;
+	b32 writable;
+} SocketEvent;
+
+// Readiness notifications for a set of non-blocking sockets. Linux uses epoll;
+// Windows uses WSAPoll() over an array of the registered sockets.
+typedef struct EventLoop {
+#ifdef _WIN32
+	WSAPOLLFD* pollFds;
+	void** userData;
+	uword count;
+	uword capacity;
+#else
+	int epollFd;
+#endif
+} EventLoop;
 
-	printf("[Server] Closing listen socket.\n");
-	if (closesocket(listenSocket) == SOCKET_ERROR) {
-		fprintf(stderr, "[Server] closesocket() for listen socket failed: %d\n", WSAGetLastError());
+static b32 eventLoopInit(EventLoop* loop) {
+	ClearValueToZero(*loop);
+#ifndef _WIN32
+	loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epollFd == -1) {
+		fprintf(stderr, "[Server] epoll_create1() failed: %d\n", errno);
+		return FALSE;
 	}
+#endif
+	return TRUE;
+}
 
-	printf("[Server] Done.\n");
-	return 0;
+static void eventLoopDestroy(EventLoop* loop) {
+#ifdef _WIN32
+	free(loop->pollFds);
+	free(loop->userData);
+#else
+	close(loop->epollFd);
+#endif
+	ClearValueToZero(*loop);
 }
 
-static DWORD WINAPI runClient(void* param) {
-	int wsResult;
+#ifdef _WIN32
+static SHORT eventLoopPollEvents(b32 wantRead, b32 wantWrite) {
+	return (wantRead ? POLLRDNORM : 0) | (wantWrite ? POLLWRNORM : 0);
+}
 
-	addrinfo addrHints = {
-		.ai_family = AF_UNSPEC,
-		.ai_socktype = SOCK_STREAM,
-		.ai_protocol = IPPROTO_TCP,
+static uword eventLoopFind(EventLoop* loop, SOCKET socket) {
+	for (uword i = 0; i < loop->count; ++i) {
+		if (loop->pollFds[i].fd == socket) {
+			return i;
+		}
+	}
+	assert(0); // the socket was never added to the event loop
+	return 0;
+}
+#else
+static u32 eventLoopEpollEvents(b32 wantRead, b32 wantWrite) {
+	return (wantRead ? EPOLLIN : 0) | (wantWrite ? EPOLLOUT : 0) | EPOLLRDHUP;
+}
+#endif
+
+static b32 eventLoopAdd(EventLoop* loop, SOCKET socket, void* userData, b32 wantRead, b32 wantWrite) {
+#ifdef _WIN32
+	if (loop->count == loop->capacity) {
+		uword newCapacity = (loop->capacity == 0) ? 64 : loop->capacity * 2;
+		loop->pollFds = reallocSafe(loop->pollFds, newCapacity * sizeof(*loop->pollFds));
+		loop->userData = reallocSafe(loop->userData, newCapacity * sizeof(*loop->userData));
+		loop->capacity = newCapacity;
+	}
+	WSAPOLLFD* pollFd = loop->pollFds + loop->count;
+	pollFd->fd = socket;
+	pollFd->events = eventLoopPollEvents(wantRead, wantWrite);
+	pollFd->revents = 0;
+	loop->userData[loop->count] = userData;
+	++loop->count;
+	return TRUE;
+#else
+	struct epoll_event event = {
+		.events = eventLoopEpollEvents(wantRead, wantWrite),
+		.data.ptr = userData,
 	};
-	addrinfo* addr; //LEAK
-	wsResult = getaddrinfo(serverAddress, port, &addrHints, &addr);
-	if (wsResult != 0) {
-		fprintf(stderr, "[Client] getaddrinfo() failed: %d\n", wsResult);
-		return 1;
+	if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, socket, &event) == -1) {
+		fprintf(stderr, "[Server] epoll_ctl(EPOLL_CTL_ADD) failed: %d\n", errno);
+		return FALSE;
 	}
+	return TRUE;
+#endif
+}
 
-	SOCKET sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-	if (sock == INVALID_SOCKET) {
-		fprintf(stderr, "[Client] socket() failed: %d\n", WSAGetLastError());
-		return 1;
+static b32 eventLoopModify(EventLoop* loop, SOCKET socket, void* userData, b32 wantRead, b32 wantWrite) {
+#ifdef _WIN32
+	uword index = eventLoopFind(loop, socket);
+	loop->pollFds[index].events = eventLoopPollEvents(wantRead, wantWrite);
+	loop->userData[index] = userData;
+	return TRUE;
+#else
+	struct epoll_event event = {
+		.events = eventLoopEpollEvents(wantRead, wantWrite),
+		.data.ptr = userData,
+	};
+	if (epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, socket, &event) == -1) {
+		fprintf(stderr, "[Server] epoll_ctl(EPOLL_CTL_MOD) failed: %d\n", errno);
+		return FALSE;
 	}
+	return TRUE;
+#endif
+}
 
-	printf("[Client] Establishing connection to server...\n");
+static void eventLoopRemove(EventLoop* loop, SOCKET socket) {
+#ifdef _WIN32
+	uword index = eventLoopFind(loop, socket);
+	--loop->count;
+	loop->pollFds[index] = loop->pollFds[loop->count];
+	loop->userData[index] = loop->userData[loop->count];
+#else
+	epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, socket, NULL);
+#endif
+}
 
-	wsResult = connect(sock, addr->ai_addr, (int) addr->ai_addrlen);
-	if (wsResult == SOCKET_ERROR) {
-		fprintf(stderr, "[Client] connect() failed: %d\n", wsResult);
-		return 1;
+// Wait until at least one socket is ready, or until the timeout expires. A
+// negative timeout waits forever. Errors and hangups are reported as the
+// socket being both readable and writable, so that the next recv() or send()
+// on the socket reports what went wrong. Returns the number of events written
+// to the events array, or -1 on failure.
+static iword eventLoopWait(EventLoop* loop, SocketEvent* events, uword maxEventCount, int timeoutMillis) {
+#ifdef _WIN32
+	int readyCount = WSAPoll(loop->pollFds, (ULONG) loop->count, timeoutMillis);
+	if (readyCount == SOCKET_ERROR) {
+		fprintf(stderr, "[Server] WSAPoll() failed: %d\n", WSAGetLastError());
+		return -1;
 	}
-	freeaddrinfo(addr);
-	addr = NULL;
-
-	printf("[Client] Connected to server.\n");
-
-	const char* httpRequest =
-		"GET /index.html\r\n"
-		"Accept: text/html\r\n"
-		"Accept-Charset: utf-8\r\n"
-		"Accept-Encoding: gzip, deflate\r\n"
-		"\r\n";
-	uword stringLength = strlen(httpRequest);
-	if (!socketSend("Client", sock, stringLength, (char*) httpRequest)) {
-		return 1;
+	uword eventCount = 0;
+	for (uword i = 0; i < loop->count && eventCount < maxEventCount; ++i) {
+		SHORT revents = loop->pollFds[i].revents;
+		if (revents == 0) {
+			continue;
+		}
+		b32 hangup = (revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+		SocketEvent* event = events + eventCount;
+		event->userData = loop->userData[i];
+		event->readable = ((revents & POLLRDNORM) != 0) | hangup;
+		event->writable = ((revents & POLLWRNORM) != 0) | hangup;
+		++eventCount;
 	}
-	printf("[Client] Sent GET request to server.\n");
-
-	HttpBuffer buffer;
-	httpBufferInit(&buffer, "Client");
-	buffer.socket = sock;
-
-	HttpHeader header;
-	httpBufferReadHeader(&buffer, &header);
-	if (buffer.error) {
-		return 1;
+	return (iword) eventCount;
+#else
+	struct epoll_event epollEvents[256];
+	if (maxEventCount > ArrayCount(epollEvents)) {
+		maxEventCount = ArrayCount(epollEvents);
 	}
-	if (buffer.connectionClosed) {
-		printf("[Client] Server closed connection before it sent response.\n");
-		return 1;
+	int readyCount = epoll_wait(loop->epollFd, epollEvents, (int) maxEventCount, timeoutMillis);
+	if (readyCount == -1) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		fprintf(stderr, "[Server] epoll_wait() failed: %d\n", errno);
+		return -1;
 	}
+	for (int i = 0; i < readyCount; ++i) {
+		u32 flags = epollEvents[i].events;
+		b32 hangup = (flags & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+		events[i].userData = epollEvents[i].data.ptr;
+		events[i].readable = ((flags & EPOLLIN) != 0) | hangup;
+		events[i].writable = ((flags & EPOLLOUT) != 0) | hangup;
+	}
+	return readyCount;
+#endif
+}
 
-	printf(
-		"[Client] Received reponse from server:\n%.*s",
-		(int) header.charCount, header.chars);
+void httpServerExitError() {
+//TODO maybe attempt to automatically reboot the server?
+	ExitProcess(1);
+}
+
+#ifdef HTTP_SERVER_IO_URING
+// A minimal io_uring submission and completion queue, set up with raw system
+// calls. Operations are queued with ioRingGetSqe() and handed to the kernel,
+// all at once, by the next ioRingSubmitAndWait().
+typedef struct IoRing {
+	int fd;
+	u32 sqEntryCount;
+
+	void* sqRing;
+	uword sqRingSize;
+	u32* sqHead;
+	u32* sqTail;
+	u32* sqArray;
+	u32 sqMask;
+	struct io_uring_sqe* sqes;
+	uword sqesSize;
+	// entries written after the last submission
+	u32 unsubmittedCount;
+
+	void* cqRing;
+	uword cqRingSize;
+	u32* cqHead;
+	u32* cqTail;
+	u32 cqMask;
+	struct io_uring_cqe* cqes;
+} IoRing;
+
+static b32 ioRingInit(IoRing* ring, u32 entryCount) {
+	ClearValueToZero(*ring);
+	struct io_uring_params params;
+	ClearValueToZero(params);
+	ring->fd = (int) syscall(__NR_io_uring_setup, entryCount, &params);
+	if (ring->fd < 0) {
+		fprintf(stderr, "[Server] io_uring_setup() failed: %d\n", errno);
+		return FALSE;
+	}
+	ring->sqEntryCount = params.sq_entries;
+
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(u32);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqRing = mmap(
+		NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cqRing = mmap(
+		NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(
+		NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if ((ring->sqRing == MAP_FAILED) | (ring->cqRing == MAP_FAILED) | (ring->sqes == MAP_FAILED)) {
+		fprintf(stderr, "[Server] mapping the io_uring queues failed: %d\n", errno);
+		if (ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+		if (ring->cqRing != MAP_FAILED) munmap(ring->cqRing, ring->cqRingSize);
+		if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+		close(ring->fd);
+		ClearValueToZero(*ring);
+		return FALSE;
+	}
+
+	u8* sq = ring->sqRing;
+	ring->sqHead = (u32*) (sq + params.sq_off.head);
+	ring->sqTail = (u32*) (sq + params.sq_off.tail);
+	ring->sqArray = (u32*) (sq + params.sq_off.array);
+	ring->sqMask = *(u32*) (sq + params.sq_off.ring_mask);
+	u8* cq = ring->cqRing;
+	ring->cqHead = (u32*) (cq + params.cq_off.head);
+	ring->cqTail = (u32*) (cq + params.cq_off.tail);
+	ring->cqMask = *(u32*) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+	return TRUE;
+}
+
+static void ioRingDestroy(IoRing* ring) {
+	munmap(ring->sqRing, ring->sqRingSize);
+	munmap(ring->cqRing, ring->cqRingSize);
+	munmap(ring->sqes, ring->sqesSize);
+	close(ring->fd);
+	ClearValueToZero(*ring);
+}
+
+// Hand every queued entry to the kernel, and wait until at least waitCount
+// operations have completed.
+static b32 ioRingSubmitAndWait(IoRing* ring, u32 waitCount) {
+	for (;;) {
+		u32 flags = (waitCount > 0) ? IORING_ENTER_GETEVENTS : 0;
+		int result = (int) syscall(
+			__NR_io_uring_enter, ring->fd, ring->unsubmittedCount, waitCount, flags, NULL, 0);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "[Server] io_uring_enter() failed: %d\n", errno);
+			return FALSE;
+		}
+		ring->unsubmittedCount -= (u32) result;
+		return TRUE;
+	}
+}
+
+// Get a cleared submission queue entry. If the queue is full, the entries in
+// it are submitted first to make room.
+static struct io_uring_sqe* ioRingGetSqe(IoRing* ring) {
+	u32 tail = *ring->sqTail;
+	while (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntryCount) {
+		if (!ioRingSubmitAndWait(ring, 0)) {
+			httpServerExitError();
+		}
+	}
+	u32 index = tail & ring->sqMask;
+	struct io_uring_sqe* sqe = ring->sqes + index;
+	ClearValueToZero(*sqe);
+	ring->sqArray[index] = index;
+	__atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+	++ring->unsubmittedCount;
+	return sqe;
+}
+
+// Returns the oldest completion that has not been seen yet, or NULL. Each
+// completion must be passed to ioRingSeen() after it has been handled.
+static struct io_uring_cqe* ioRingPeekCqe(IoRing* ring) {
+	u32 head = *ring->cqHead;
+	if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return ring->cqes + (head & ring->cqMask);
+}
+
+inline static void ioRingSeen(IoRing* ring) {
+	__atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+// Room for one maximum size header, plus whatever the client has pipelined
+// behind it.
+#define HTTP_BUFFER_CAPACITY (2 * HTTP_MAX_HEADER_SIZE)
+
+// Connection memory is handed out in chunks of one fixed size, large enough
+// for a whole input buffer. Each worker keeps the chunks that connections give
+// back on a free list, so once a worker has seen its peak load, handling
+// requests does not call malloc() or free(), and since every block the
+// workers hold is the same size, the heap cannot fragment.
+#define ARENA_CHUNK_SIZE HTTP_BUFFER_CAPACITY
+
+typedef struct ArenaChunk {
+	struct ArenaChunk* next;
+	u64 bytes[ARENA_CHUNK_SIZE / sizeof(u64)];
+} ArenaChunk;
+
+typedef struct ArenaPool {
+	ArenaChunk* freeChunks;
+	// every chunk ever allocated, and how many of them are on the free list
+	uword chunkCount;
+	uword freeChunkCount;
+} ArenaPool;
+
+static ArenaChunk* arenaPoolTake(ArenaPool* pool) {
+	ArenaChunk* chunk = pool->freeChunks;
+	if (chunk) {
+		pool->freeChunks = chunk->next;
+		--pool->freeChunkCount;
+	} else {
+		chunk = checkOutOfMemory(malloc(sizeof(*chunk)));
+		++pool->chunkCount;
+	}
+	chunk->next = NULL;
+	return chunk;
+}
+
+// Give back a list of chunkCount chunks, from first to last.
+static void arenaPoolGive(ArenaPool* pool, ArenaChunk* first, ArenaChunk* last, uword chunkCount) {
+	last->next = pool->freeChunks;
+	pool->freeChunks = first;
+	pool->freeChunkCount += chunkCount;
+}
+
+static void arenaPoolDestroy(ArenaPool* pool) {
+	while (pool->freeChunks) {
+		ArenaChunk* chunk = pool->freeChunks;
+		pool->freeChunks = chunk->next;
+		free(chunk);
+	}
+	ClearValueToZero(*pool);
+}
+
+// A bump allocator over a list of chunks from a pool. Nothing is freed on its
+// own; resetting drops everything at once, keeping only the newest chunk, and
+// releasing gives every chunk back to the pool. No single reservation can be
+// larger than ARENA_CHUNK_SIZE.
+typedef struct Arena {
+	ArenaPool* pool;
+	// newest first; allocations come from the end of the newest chunk
+	ArenaChunk* chunks;
+	ArenaChunk* oldestChunk;
+	uword chunkCount;
+	uword usedByteCount;
+} Arena;
+
+static void arenaInit(Arena* arena, ArenaPool* pool) {
+	ClearValueToZero(*arena);
+	arena->pool = pool;
+}
+
+// Return where the next bytes go, making sure there is room for at least
+// minByteCount of them. *availableByteCount is set to all of the room there
+// is, which may be more; nothing is allocated until arenaCommit(). Reserved
+// bytes directly follow the last ones committed if they fit, so that text
+// written a piece at a time stays contiguous.
+static u8* arenaReserve(Arena* arena, uword minByteCount, uword* availableByteCount) {
+	assert(minByteCount <= ARENA_CHUNK_SIZE);
+	uword offset = arena->usedByteCount;
+	if (!arena->chunks || offset + minByteCount > ARENA_CHUNK_SIZE) {
+		ArenaChunk* chunk = arenaPoolTake(arena->pool);
+		chunk->next = arena->chunks;
+		if (!arena->chunks) {
+			arena->oldestChunk = chunk;
+		}
+		arena->chunks = chunk;
+		++arena->chunkCount;
+		offset = 0;
+	}
+	arena->usedByteCount = offset;
+	*availableByteCount = ARENA_CHUNK_SIZE - offset;
+	return (u8*) arena->chunks->bytes + offset;
+}
+
+inline static void arenaCommit(Arena* arena, uword byteCount) {
+	assert(arena->usedByteCount + byteCount <= ARENA_CHUNK_SIZE);
+	arena->usedByteCount += byteCount;
+}
+
+// Drop every allocation in constant time. The newest chunk is kept for the
+// next allocations, and any others go back to the pool.
+static void arenaReset(Arena* arena) {
+	if (arena->chunkCount > 1) {
+		arenaPoolGive(arena->pool, arena->chunks->next, arena->oldestChunk, arena->chunkCount - 1);
+		arena->chunks->next = NULL;
+		arena->oldestChunk = arena->chunks;
+		arena->chunkCount = 1;
+	}
+	arena->usedByteCount = 0;
+}
+
+static void arenaRelease(Arena* arena) {
+	if (arena->chunks) {
+		arenaPoolGive(arena->pool, arena->chunks, arena->oldestChunk, arena->chunkCount);
+	}
+	arenaInit(arena, arena->pool);
+}
+
+// A fixed-capacity queue of received bytes. Consuming a request only advances
+// readIndex. When writeIndex reaches the end of the buffer, the bytes that
+// have not been consumed yet (at most a few partial requests) are moved back
+// to the start, instead of wrapping around, so that every header stays
+// contiguous and can be handed out as StringSlices pointing into the buffer.
+typedef struct HttpBuffer {
+	const char* name;
+	u8* data;
+	// where data comes from when the buffer first needs it; the chunk is
+	// NULL if data was put in place by someone else
+	ArenaPool* pool;
+	ArenaChunk* chunk;
+	uword readIndex;
+	uword writeIndex;
+	SOCKET socket;
+
+	// The search for the end of the current header resumes from here, so each
+	// received byte is only examined once. matchCount is the number of
+	// characters of "\r\n\r\n" that end at scanIndex.
+	uword scanIndex;
+	u32 matchCount;
+
+//TODO could use a bitset for these flags. Since they are mutually exclusive, they could also be an enum.
+	b32 error;
+	// the socket error behind error, if it came from the socket
+	int socketError;
+	b32 connectionClosed;
+	b32 wouldBlock;
+	b32 headerTooLarge;
+	// An asynchronous receive into the space after writeIndex is in progress,
+	// so the buffered bytes must stay where they are.
+	b32 receivePending;
+} HttpBuffer;
+
+static void httpBufferInit(HttpBuffer* buffer, const char* name, ArenaPool* pool) {
+	ClearValueToZero(*buffer);
+	buffer->name = name;
+	buffer->pool = pool;
+}
+
+inline static uword httpBufferSize(const HttpBuffer* buffer) {
+	return buffer->writeIndex - buffer->readIndex;
+}
+
+// Make room for more bytes, and return where they should be received to.
+// Returns FALSE if there is no room, which is only possible if the caller did
+// not stop at headerTooLarge.
+static b32 httpBufferReserve(HttpBuffer* buffer, u8** receivePointer, uword* remainingCapacity) {
+	assert(!buffer->receivePending);
+	if (!buffer->data) {
+		buffer->chunk = arenaPoolTake(buffer->pool);
+		buffer->data = (u8*) buffer->chunk->bytes;
+	}
+	if (buffer->writeIndex == HTTP_BUFFER_CAPACITY) {
+		if (buffer->readIndex == 0) {
+			buffer->headerTooLarge = TRUE;
+			return FALSE;
+		}
+		// out of room at the end; move the unconsumed bytes back to the start
+		uword size = httpBufferSize(buffer);
+		memmove(buffer->data, buffer->data + buffer->readIndex, size);
+		buffer->scanIndex -= buffer->readIndex;
+		buffer->readIndex = 0;
+		buffer->writeIndex = size;
+	}
+	*receivePointer = buffer->data + buffer->writeIndex;
+	*remainingCapacity = HTTP_BUFFER_CAPACITY - buffer->writeIndex;
+	return TRUE;
+}
+
+static void httpBufferReadBytes(HttpBuffer* buffer) {
+	u8* receivePointer;
+	uword remainingCapacity;
+	if (!httpBufferReserve(buffer, &receivePointer, &remainingCapacity)) {
+		return;
+	}
+	uword receivedByteCount;
+	buffer->error |= !socketReceive(
+		buffer->socket, remainingCapacity, receivePointer, &receivedByteCount,
+		&buffer->connectionClosed, &buffer->wouldBlock, &buffer->socketError);
+	buffer->writeIndex += receivedByteCount;
+}
+
+// Consume a header that was returned by httpBufferFindHeader().
+static void httpBufferDiscardBytes(HttpBuffer* buffer, uword byteCount) {
+	assert(byteCount <= httpBufferSize(buffer));
+	buffer->readIndex += byteCount;
+	if (buffer->readIndex == buffer->writeIndex && !buffer->receivePending) {
+		// the buffer is empty, so the next request can start at the beginning
+		// for free
+		buffer->readIndex = 0;
+		buffer->writeIndex = 0;
+	}
+	buffer->scanIndex = buffer->readIndex;
+	buffer->matchCount = 0;
+}
+
+// Look for a complete HTTP header at the start of the buffered bytes, without
+// receiving anything more from the socket. Returns TRUE if the blank line that
+// ends the header has been buffered. If the header would be longer than
+// HTTP_MAX_HEADER_SIZE, headerTooLarge is set instead.
+static b32 httpBufferFindHeader(HttpBuffer* buffer, HttpHeader* header) {
+	uword scanEnd = buffer->writeIndex;
+	uword maxScanEnd = buffer->readIndex + HTTP_MAX_HEADER_SIZE;
+	if (scanEnd > maxScanEnd) {
+		scanEnd = maxScanEnd;
+	}
+	const char* data = (const char*) buffer->data;
+	if (httpScanForHeaderEnd(data, &buffer->scanIndex, scanEnd, &buffer->matchCount)) {
+		header->charCount = buffer->scanIndex - buffer->readIndex;
+		header->chars = data + buffer->readIndex;
+		header->cursor = header->chars;
+		return TRUE;
+	}
+	buffer->headerTooLarge = (buffer->scanIndex == maxScanEnd);
+	return FALSE;
+}
+
+inline static void httpBufferReset(HttpBuffer* buffer) {
+	buffer->readIndex = 0;
+	buffer->writeIndex = 0;
+	buffer->scanIndex = 0;
+	buffer->matchCount = 0;
+	buffer->socket = INVALID_SOCKET;
+	buffer->error = FALSE;
+	buffer->socketError = 0;
+	buffer->connectionClosed = FALSE;
+	buffer->wouldBlock = FALSE;
+	buffer->headerTooLarge = FALSE;
+	buffer->receivePending = FALSE;
+}
+
+// Give the buffer's memory back to the pool. Anything still buffered is lost.
+static void httpBufferRelease(HttpBuffer* buffer) {
+	if (buffer->chunk) {
+		arenaPoolGive(buffer->pool, buffer->chunk, buffer->chunk, 1);
+		buffer->chunk = NULL;
+		buffer->data = NULL;
+	}
+	httpBufferReset(buffer);
+}
+
+inline static void httpBufferDestroy(HttpBuffer* buffer) {
+	httpBufferRelease(buffer);
+	ClearValueToZero(*buffer);
+	buffer->socket = INVALID_SOCKET;
+}
+
+typedef struct FileInfo {
+	u64 size;
+	// together, these identify a particular version of a file
+	u64 modifiedTime;
+	u64 fileId;
+} FileInfo;
+
+// Returns FALSE if the path does not exist, or is not a regular file.
+static b32 fileInfoGet(const char* path, FileInfo* info) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes)) {
+		return FALSE;
+	}
+	if (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+		return FALSE;
+	}
+	info->size = ((u64) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	info->modifiedTime =
+		((u64) attributes.ftLastWriteTime.dwHighDateTime << 32) |
+		attributes.ftLastWriteTime.dwLowDateTime;
+	info->fileId = 0;
+#else
+	struct stat status;
+	if (stat(path, &status) == -1 || !S_ISREG(status.st_mode)) {
+		return FALSE;
+	}
+	info->size = (u64) status.st_size;
+	info->modifiedTime = (u64) status.st_mtim.tv_sec * 1000000000 + (u64) status.st_mtim.tv_nsec;
+	info->fileId = ((u64) status.st_dev << 32) ^ (u64) status.st_ino;
+#endif
+	return TRUE;
+}
+
+inline static b32 fileInfosEqual(const FileInfo* a, const FileInfo* b) {
+	return (a->size == b->size) & (a->modifiedTime == b->modifiedTime) & (a->fileId == b->fileId);
+}
+
+// The modification time in seconds since 1970, as used in HTTP dates.
+static u64 fileInfoUnixTime(const FileInfo* info) {
+#ifdef _WIN32
+	// FILETIME counts 100 nanosecond intervals since 1601
+	u64 seconds = info->modifiedTime / 10000000;
+	u64 secondsFrom1601To1970 = 11644473600ull;
+	return (seconds > secondsFrom1601To1970) ? seconds - secondsFrom1601To1970 : 0;
+#else
+	return info->modifiedTime / 1000000000;
+#endif
+}
+
+// "Sun, 06 Nov 1994 08:49:37 GMT", plus a terminating NUL
+#define HTTP_DATE_SIZE 30
+
+static const char* httpDateDayNames[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* httpDateMonthNames[12] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+};
+
+// Format a time as an HTTP date. The calendar conversion is done here, rather
+// than with gmtime(), which is not thread-safe on every platform.
+static void httpFormatDate(u64 unixTime, char* date) {
+	u64 days = unixTime / 86400;
+	u32 secondOfDay = (u32) (unixTime % 86400);
+	// civil date from a day number, in eras of 400 years starting in March
+	u64 z = days + 719468;
+	u64 era = z / 146097;
+	u64 dayOfEra = z - era * 146097;
+	u64 yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	u64 dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	u64 shiftedMonth = (5 * dayOfYear + 2) / 153;
+	u32 day = (u32) (dayOfYear - (153 * shiftedMonth + 2) / 5 + 1);
+	u32 month = (u32) ((shiftedMonth < 10) ? shiftedMonth + 3 : shiftedMonth - 9);
+	u64 year = yearOfEra + era * 400 + (month <= 2);
+	// 1970-01-01 was a Thursday
+	u32 weekDay = (u32) ((days + 4) % 7);
+	snprintf(
+		date, HTTP_DATE_SIZE, "%s, %02u %s %04u %02u:%02u:%02u GMT",
+		httpDateDayNames[weekDay], day % 100, httpDateMonthNames[month - 1], (u32) (year % 10000),
+		secondOfDay / 3600, secondOfDay / 60 % 60, secondOfDay % 60);
+}
+
+static b32 httpParseDigits(const char* digits, u32 digitCount, u32* value) {
+	*value = 0;
+	for (u32 i = 0; i < digitCount; ++i) {
+		if (digits[i] < '0' || digits[i] > '9') {
+			return FALSE;
+		}
+		*value = *value * 10 + (u32) (digits[i] - '0');
+	}
+	return TRUE;
+}
+
+// Parse an HTTP date in the preferred format. The two obsolete formats that
+// recipients are supposed to accept are not supported; a date in either of
+// them is treated as invalid, which only means a full response is sent.
+static b32 httpParseDate(StringSlice text, u64* unixTime) {
+	if (stringSliceLength(text) != HTTP_DATE_SIZE - 1) {
+		return FALSE;
+	}
+	const char* chars = text.begin;
+	u32 day, year, hour, minute, second;
+	b32 valid =
+		(chars[3] == ',') &&
+		httpParseDigits(chars + 5, 2, &day) &&
+		httpParseDigits(chars + 12, 4, &year) &&
+		httpParseDigits(chars + 17, 2, &hour) &&
+		httpParseDigits(chars + 20, 2, &minute) &&
+		httpParseDigits(chars + 23, 2, &second) &&
+		(memcmp(chars + 25, " GMT", 4) == 0);
+	if (!valid || year < 1970 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+		return FALSE;
+	}
+	u32 month = 0;
+	while (month < 12 && memcmp(chars + 8, httpDateMonthNames[month], 3) != 0) {
+		++month;
+	}
+	if (month == 12) {
+		return FALSE;
+	}
+	++month;
+	// day number from a civil date; the inverse of httpFormatDate()
+	u64 shiftedYear = year - (month <= 2);
+	u64 era = shiftedYear / 400;
+	u64 yearOfEra = shiftedYear - era * 400;
+	u64 dayOfYear = (153 * ((month > 2) ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	u64 dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	u64 days = era * 146097 + dayOfEra - 719468;
+	*unixTime = days * 86400 + hour * 3600 + minute * 60 + second;
+	return TRUE;
+}
+
+// Check an If-None-Match value against an entity tag, including its quotes.
+// Tags are compared the weak way, ignoring any "W/" prefix, as RFC 7232
+// requires for this option.
+static b32 httpEtagMatches(StringSlice ifNoneMatch, const char* etag) {
+	const char* cursor = ifNoneMatch.begin;
+	while (cursor != ifNoneMatch.end) {
+		const char* tagEnd = scanForByte(cursor, ifNoneMatch.end, ',');
+		StringSlice tag = stringSlice(cursor, tagEnd);
+		while (tag.begin != tag.end && (*tag.begin == ' ' || *tag.begin == '\t')) {
+			++tag.begin;
+		}
+		while (tag.end != tag.begin && (tag.end[-1] == ' ' || tag.end[-1] == '\t')) {
+			--tag.end;
+		}
+		if (stringSliceLength(tag) >= 2 && tag.begin[0] == 'W' && tag.begin[1] == '/') {
+			tag.begin += 2;
+		}
+		if (stringSliceEqualsCString(&tag, "*") || stringSliceEqualsCString(&tag, etag)) {
+			return TRUE;
+		}
+		cursor = (tagEnd == ifNoneMatch.end) ? tagEnd : tagEnd + 1;
+	}
+	return FALSE;
+}
+
+typedef struct MimeType {
+	const char* extension;
+	const char* contentType;
+	// Whether files of this type are worth compressing. Images and fonts
+	// already are compressed.
+	b32 compressible;
+} MimeType;
+
+// Browsers only compile WASM while it downloads (with
+// WebAssembly.instantiateStreaming) if it is served as application/wasm.
+static const MimeType mimeTypes[] = {
+	{".html",  "text/html; charset=utf-8",              TRUE},
+	{".htm",   "text/html; charset=utf-8",              TRUE},
+	{".js",    "application/javascript; charset=utf-8", TRUE},
+	{".mjs",   "application/javascript; charset=utf-8", TRUE},
+	{".wasm",  "application/wasm",                      TRUE},
+	{".css",   "text/css; charset=utf-8",               TRUE},
+	{".json",  "application/json",                      TRUE},
+	{".map",   "application/json",                      TRUE},
+	{".txt",   "text/plain; charset=utf-8",             TRUE},
+	{".png",   "image/png",                             FALSE},
+	{".jpg",   "image/jpeg",                            FALSE},
+	{".jpeg",  "image/jpeg",                            FALSE},
+	{".gif",   "image/gif",                             FALSE},
+	{".svg",   "image/svg+xml",                         TRUE},
+	{".ico",   "image/x-icon",                          TRUE},
+	{".woff2", "font/woff2",                            FALSE},
+	{".data",  "application/octet-stream",              TRUE}, // emscripten preloaded file packages
+};
+
+static const MimeType defaultMimeType = {"", "application/octet-stream", FALSE};
+
+static const MimeType* mimeTypeFromPath(StringSlice path) {
+	const char* extension = path.end;
+	while (extension != path.begin && extension[-1] != '.' && extension[-1] != '/') {
+		--extension;
+	}
+	if (extension == path.begin || extension[-1] != '.') {
+		return &defaultMimeType;
+	}
+	StringSlice extensionSlice = stringSlice(extension - 1, path.end);
+	for (uword i = 0; i < ArrayCount(mimeTypes); ++i) {
+		if (stringSliceEqualsCStringIgnoreCase(&extensionSlice, mimeTypes[i].extension)) {
+			return mimeTypes + i;
+		}
+	}
+	return &defaultMimeType;
+}
+
+typedef enum FileEncoding {
+	FILE_ENCODING_IDENTITY,
+	FILE_ENCODING_GZIP,
+	FILE_ENCODING_COUNT,
+} FileEncoding;
+
+// A file under the server's root directory, kept open between requests.
+//
+// On POSIX systems, the descriptor is handed straight to sendfile(), so file
+// contents never pass through user space. Windows does not allow a file to be
+// rewritten while it is mapped or being transmitted, which would break
+// rebuilding the demos while the server runs, so there the contents are read
+// into memory once, when the file is first opened, and sent from there.
+typedef struct CachedFile {
+	char* path; // the request path, such as "/main.wasm"
+	const MimeType* mimeType;
+	FileInfo info;
+#ifdef _WIN32
+	u8* contents;
+#else
+	int fd;
+	// the whole file, if it was mapped into memory by cachedFileMap()
+	u8* mapping;
+#endif
+	// The gzip-compressed contents, which belong to an entry in the GzipCache
+	// that all of the workers share, so each version of a file is compressed
+	// once. They are asked for the first time a client that accepts them asks
+	// for the file, and the file is sent uncompressed until they are ready.
+	// Since a file that changes on disk gets a new CachedFile, the compressed
+	// contents always match the file's current modification time.
+	// gzipContents stays NULL if compressing did not make the file smaller.
+	struct GzipCache* gzipCache;
+	struct GzipEntry* gzip;
+	b32 gzipAttempted;
+	u8* gzipContents;
+	u64 gzipSize;
+
+	// validators for conditional requests, one entity tag per encoding
+	char etags[FILE_ENCODING_COUNT][48];
+	char lastModified[HTTP_DATE_SIZE];
+	// Complete 200 responses for persistent connections, header and body,
+	// for files up to FILE_CACHE_MAX_SERIALIZED_SIZE. They are built the first
+	// time they are needed, after which answering a request for the file is a
+	// matter of queueing one block of memory.
+	u8* responses[FILE_ENCODING_COUNT];
+	uword responseSizes[FILE_ENCODING_COUNT];
+#ifndef _WIN32
+	// the cache is notified when the file changes, so it does not need to be
+	// checked on every request
+	b32 watched;
+#endif
+	// One reference belongs to the cache, the rest to queued responses. A file
+	// that changes on disk is dropped from the cache, but stays open until the
+	// last response using it has been sent.
+	u32 refCount;
+	struct CachedFile* nextInBucket;
+} CachedFile;
+
+#define FILE_CACHE_BUCKET_COUNT 256
+#define FILE_CACHE_MAX_PATH_LENGTH 1024
+// Files smaller than this are not worth compressing. The compressor thread
+// reads a whole file into memory to compress it, and works through one file at
+// a time, so there is an upper limit too.
+#define FILE_CACHE_MIN_COMPRESS_SIZE 256
+#define FILE_CACHE_MAX_COMPRESS_SIZE (32 * 1024 * 1024)
+#define FILE_CACHE_MAX_SERIALIZED_SIZE (64 * 1024)
+
+// The gzip-compressed contents of one version of a file. An entry is made when
+// the first worker asks for it, and queued for the compressor thread, so that
+// compressing never holds up a worker's connections. Every CachedFile using the
+// entry holds a reference, and so does the queue until the entry has been
+// compressed; the entry is freed with the last one.
+typedef struct GzipEntry {
+	char* path;
+	u32 pathHash;
+	FileInfo info;
+	// protected by the cache's mutex
+	u32 refCount;
+	// set by the compressor thread once contents and size are final; contents
+	// stays NULL if compressing did not make the file smaller, or if the file
+	// changed before it could be read
+	volatile uword ready;
+	u8* contents;
+	u64 size;
+	struct GzipEntry* nextInBucket;
+	struct GzipEntry* nextJob;
+} GzipEntry;
+
+// Compressed files shared by all of the workers, keyed by request path and
+// FileInfo, and the thread that compresses them.
+typedef struct GzipCache {
+	const char* rootDirectory;
+	Mutex mutex;
+	GzipEntry* buckets[FILE_CACHE_BUCKET_COUNT];
+	// entries waiting to be compressed, oldest first; the compressor thread
+	// sleeps on jobQueued while there are none
+	GzipEntry* firstJob;
+	GzipEntry* lastJob;
+	Condition jobQueued;
+	// the compressor thread's end of the request log
+	struct LogRing* log;
+	// guarded by mutex, like the queue
+	b32 stopping;
+	Thread thread;
+} GzipCache;
+
+#ifndef _WIN32
+typedef struct FileCacheWatch {
+	int descriptor;
+	// the request path of the watched directory, ending in '/'
+	char* directory;
+} FileCacheWatch;
+#endif
+
+typedef struct FileCache {
+	const char* rootDirectory;
+	CachedFile* buckets[FILE_CACHE_BUCKET_COUNT];
+	// where cached files get their compressed contents, or NULL
+	GzipCache* gzip;
+#ifndef _WIN32
+	// The directories of cached files are watched with inotify, and files are
+	// dropped from the cache as soon as they change, so a cache hit does not
+	// need a stat(). This is -1 if inotify is not available, in which case
+	// every request checks whether its file has changed.
+	//TODO use ReadDirectoryChangesW() to do the same on Windows
+	int changeFd;
+	FileCacheWatch* watches;
+	uword watchCount;
+	uword watchCapacity;
+#endif
+} FileCache;
+
+static u32 hashFnv1a(uword byteCount, const void* bytes) {
+	const u8* p = bytes;
+	u32 hash = 2166136261u;
+	for (uword i = 0; i < byteCount; ++i) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static u64 hashFnv1a64(uword byteCount, const void* bytes) {
+	const u8* p = bytes;
+	u64 hash = 14695981039346656037ull;
+	for (uword i = 0; i < byteCount; ++i) {
+		hash = (hash ^ p[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Get the entry for one version of a file, and queue it to be compressed if no
+// worker has asked for it yet. The entry is acquired for the caller, who must
+// release it.
+static GzipEntry* gzipCacheAcquire(GzipCache* cache, const char* path, const FileInfo* info) {
+	uword pathLength = strlen(path);
+	u32 hash = hashFnv1a(pathLength, path);
+	mutexLock(&cache->mutex);
+	GzipEntry** link = &cache->buckets[hash % FILE_CACHE_BUCKET_COUNT];
+	GzipEntry* entry = *link;
+	while (entry && !(strcmp(entry->path, path) == 0 && fileInfosEqual(&entry->info, info))) {
+		entry = entry->nextInBucket;
+	}
+	if (entry) {
+		++entry->refCount;
+	} else {
+		entry = checkOutOfMemory(calloc(1, sizeof(*entry)));
+		entry->path = checkOutOfMemory(malloc(pathLength + 1));
+		memcpy(entry->path, path, pathLength + 1);
+		entry->pathHash = hash;
+		entry->info = *info;
+		// one for the caller, one for the queue
+		entry->refCount = 2;
+		entry->nextInBucket = *link;
+		*link = entry;
+		if (cache->lastJob) {
+			cache->lastJob->nextJob = entry;
+		} else {
+			cache->firstJob = entry;
+			conditionSignal(&cache->jobQueued);
+		}
+		cache->lastJob = entry;
+	}
+	mutexUnlock(&cache->mutex);
+	return entry;
+}
+
+static void gzipCacheRelease(GzipCache* cache, GzipEntry* entry) {
+	mutexLock(&cache->mutex);
+	assert(entry->refCount > 0);
+	--entry->refCount;
+	b32 unused = (entry->refCount == 0);
+	if (unused) {
+		GzipEntry** link = &cache->buckets[entry->pathHash % FILE_CACHE_BUCKET_COUNT];
+		while (*link != entry) {
+			link = &(*link)->nextInBucket;
+		}
+		*link = entry->nextInBucket;
+	}
+	mutexUnlock(&cache->mutex);
+	if (unused) {
+		free(entry->contents);
+		free(entry->path);
+		free(entry);
+	}
+}
+
+static CachedFile* cachedFileOpen(const char* fullPath, StringSlice path, const FileInfo* info) {
+	CachedFile* file = checkOutOfMemory(calloc(1, sizeof(*file)));
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(
+		fullPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		free(file);
+		return NULL;
+	}
+	file->contents = checkOutOfMemory(malloc(info->size ? (uword) info->size : 1));
+	u64 readCount = 0;
+	while (readCount < info->size) {
+		DWORD chunkSize;
+		u64 remaining = info->size - readCount;
+		DWORD requestSize = (remaining > 0x40000000) ? 0x40000000 : (DWORD) remaining;
+		if (!ReadFile(handle, file->contents + readCount, requestSize, &chunkSize, NULL) || chunkSize == 0) {
+			break;
+		}
+		readCount += chunkSize;
+	}
+	CloseHandle(handle);
+	if (readCount != info->size) {
+		free(file->contents);
+		free(file);
+		return NULL;
+	}
+#else
+	file->fd = open(fullPath, O_RDONLY | O_CLOEXEC);
+	if (file->fd == -1) {
+		free(file);
+		return NULL;
+	}
+#endif
+	uword pathLength = stringSliceLength(path);
+	file->path = checkOutOfMemory(malloc(pathLength + 1));
+	memcpy(file->path, path.begin, pathLength);
+	file->path[pathLength] = '\0';
+	file->mimeType = mimeTypeFromPath(path);
+	file->info = *info;
+	file->refCount = 1;
+	snprintf(
+		file->etags[FILE_ENCODING_IDENTITY], sizeof(file->etags[0]), "\"%llx-%llx\"",
+		(unsigned long long) info->modifiedTime, (unsigned long long) info->size);
+	snprintf(
+		file->etags[FILE_ENCODING_GZIP], sizeof(file->etags[0]), "\"%llx-%llx-gzip\"",
+		(unsigned long long) info->modifiedTime, (unsigned long long) info->size);
+	httpFormatDate(fileInfoUnixTime(info), file->lastModified);
+	return file;
+}
+
+inline static void cachedFileAcquire(CachedFile* file) {
+	++file->refCount;
+}
+
+static void cachedFileRelease(CachedFile* file) {
+	assert(file->refCount > 0);
+	--file->refCount;
+	if (file->refCount > 0) {
+		return;
+	}
+#ifdef _WIN32
+	free(file->contents);
+#else
+	if (file->mapping) {
+		munmap(file->mapping, (uword) file->info.size);
+	}
+	close(file->fd);
+#endif
+	if (file->gzip) {
+		gzipCacheRelease(file->gzipCache, file->gzip);
+	}
+	for (u32 i = 0; i < FILE_ENCODING_COUNT; ++i) {
+		free(file->responses[i]);
+	}
+	free(file->path);
+	free(file);
+}
+
+// Get the whole contents of a file in memory. On Windows they already are;
+// elsewhere they are read into a buffer, which cachedFileUnloadContents()
+// frees. Returns NULL if reading the file failed.
+static u8* cachedFileLoadContents(CachedFile* file) {
+#ifdef _WIN32
+	return file->contents;
+#else
+	u64 size = file->info.size;
+	u8* contents = checkOutOfMemory(malloc(size ? (uword) size : 1));
+	u64 readCount = 0;
+	while (readCount < size) {
+		ssize_t chunkSize = pread(file->fd, contents + readCount, (uword) (size - readCount), (off_t) readCount);
+		if (chunkSize <= 0) {
+			break;
+		}
+		readCount += (u64) chunkSize;
+	}
+	if (readCount != size) {
+		fprintf(stderr, "[Server] Reading '%s' failed\n", file->path);
+		free(contents);
+		return NULL;
+	}
+	return contents;
+#endif
+}
+
+static void cachedFileUnloadContents(u8* contents) {
+#ifndef _WIN32
+	free(contents);
+#endif
+}
+
+// Get the whole contents of a file in memory until the file is released,
+// without reading them on platforms that can map the file instead. The file
+// must not be rewritten in place while it is mapped; replacing it with
+// rename() is fine.
+static const u8* cachedFileMap(CachedFile* file) {
+#ifdef _WIN32
+	return file->contents;
+#else
+	if (!file->mapping && file->info.size > 0) {
+		void* mapping = mmap(NULL, (uword) file->info.size, PROT_READ, MAP_SHARED, file->fd, 0);
+		if (mapping == MAP_FAILED) {
+			fprintf(stderr, "[Server] mmap() of '%s' failed: %d\n", file->path, errno);
+			return NULL;
+		}
+		file->mapping = mapping;
+	}
+	return file->mapping;
+#endif
+}
+
+// Compress an entry's version of its file, on the compressor thread. If the
+// file has changed on disk since, the entry is left without contents, and the
+// file is sent uncompressed until the workers notice the change. Returns TRUE
+// if the file was compressed, whether or not that made it smaller.
+static b32 gzipEntryCompress(GzipCache* cache, GzipEntry* entry, u64* compressedSize) {
+	b32 compressed = FALSE;
+	char fullPath[FILE_CACHE_MAX_PATH_LENGTH];
+	int fullPathLength = snprintf(fullPath, sizeof(fullPath), "%s%s", cache->rootDirectory, entry->path);
+	FileInfo info;
+	b32 unchanged = (fullPathLength > 0) && ((uword) fullPathLength < sizeof(fullPath)) &&
+		fileInfoGet(fullPath, &info) && fileInfosEqual(&info, &entry->info);
+	CachedFile* file = unchanged ? cachedFileOpen(fullPath, stringSliceFromCString(entry->path), &info) : NULL;
+	u8* contents = file ? cachedFileLoadContents(file) : NULL;
+	// the file must not have been rewritten while it was read, either
+	if (contents && fileInfoGet(fullPath, &info) && fileInfosEqual(&info, &entry->info)) {
+		u64 size = entry->info.size;
+		u8* gzipContents;
+		uword gzipSize;
+		gzipCompress(contents, (uword) size, &gzipContents, &gzipSize);
+		if (gzipSize < size) {
+			entry->contents = gzipContents;
+			entry->size = gzipSize;
+		} else {
+			free(gzipContents);
+		}
+		*compressedSize = gzipSize;
+		compressed = TRUE;
+	}
+	if (contents) {
+		cachedFileUnloadContents(contents);
+	}
+	if (file) {
+		cachedFileRelease(file);
+	}
+	atomicStoreRelease(&entry->ready, 1);
+	return compressed;
+}
+
+// Returns TRUE if there are gzip-compressed contents to send. The first call
+// for a file that is worth compressing asks the compressor thread for them, and
+// until they are ready this returns FALSE.
+static b32 cachedFileCompress(CachedFile* file) {
+	if (file->gzipAttempted) {
+		return file->gzipContents != NULL;
+	}
+	u64 size = file->info.size;
+	b32 worthCompressing = file->gzipCache && file->mimeType->compressible &&
+		(size >= FILE_CACHE_MIN_COMPRESS_SIZE) && (size <= FILE_CACHE_MAX_COMPRESS_SIZE);
+	if (!worthCompressing) {
+		file->gzipAttempted = TRUE;
+		return FALSE;
+	}
+	if (!file->gzip) {
+		file->gzip = gzipCacheAcquire(file->gzipCache, file->path, &file->info);
+	}
+	if (!atomicLoadAcquire(&file->gzip->ready)) {
+		return FALSE;
+	}
+	file->gzipAttempted = TRUE;
+	file->gzipContents = file->gzip->contents;
+	file->gzipSize = file->gzip->size;
+	return file->gzipContents != NULL;
+}
+
+static void fileCacheInit(FileCache* cache, const char* rootDirectory, GzipCache* gzip) {
+	ClearValueToZero(*cache);
+	cache->rootDirectory = rootDirectory;
+	cache->gzip = gzip;
+#ifndef _WIN32
+	cache->changeFd = -1;
+	if (rootDirectory) {
+		cache->changeFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (cache->changeFd == -1) {
+			fprintf(stderr, "[Server] inotify_init1() failed: %d; checking files on every request\n", errno);
+		}
+	}
+#endif
+}
+
+// Drop every file from the cache. Files that are still being sent stay open
+// until they have been sent.
+static void fileCacheClear(FileCache* cache) {
+	for (uword i = 0; i < ArrayCount(cache->buckets); ++i) {
+		CachedFile* file = cache->buckets[i];
+		while (file) {
+			CachedFile* next = file->nextInBucket;
+			cachedFileRelease(file);
+			file = next;
+		}
+		cache->buckets[i] = NULL;
+	}
+}
+
+static void fileCacheDestroy(FileCache* cache) {
+	fileCacheClear(cache);
+#ifndef _WIN32
+	if (cache->changeFd != -1) {
+		close(cache->changeFd);
+	}
+	for (uword i = 0; i < cache->watchCount; ++i) {
+		free(cache->watches[i].directory);
+	}
+	free(cache->watches);
+#endif
+	ClearValueToZero(*cache);
+}
+
+static CachedFile** fileCacheFind(FileCache* cache, StringSlice path) {
+	u32 hash = hashFnv1a(stringSliceLength(path), path.begin);
+	CachedFile** link = &cache->buckets[hash % FILE_CACHE_BUCKET_COUNT];
+	while (*link && !stringSliceEqualsCString(&path, (*link)->path)) {
+		link = &(*link)->nextInBucket;
+	}
+	return link;
+}
+
+#ifndef _WIN32
+static void fileCacheDrop(FileCache* cache, StringSlice path) {
+	CachedFile** link = fileCacheFind(cache, path);
+	CachedFile* file = *link;
+	if (file) {
+		*link = file->nextInBucket;
+		cachedFileRelease(file);
+	}
+}
+
+// Start watching the directory that a request path is in, if it is not
+// watched already. Returns FALSE if the directory cannot be watched.
+static b32 fileCacheWatchDirectory(FileCache* cache, StringSlice path) {
+	if (cache->changeFd == -1) {
+		return FALSE;
+	}
+	const char* directoryEnd = path.end;
+	while (directoryEnd != path.begin && directoryEnd[-1] != '/') {
+		--directoryEnd;
+	}
+	StringSlice directory = stringSlice(path.begin, directoryEnd);
+	for (uword i = 0; i < cache->watchCount; ++i) {
+		if (stringSliceEqualsCString(&directory, cache->watches[i].directory)) {
+			return TRUE;
+		}
+	}
+
+	char fullPath[FILE_CACHE_MAX_PATH_LENGTH];
+	int fullPathLength = snprintf(
+		fullPath, sizeof(fullPath), "%s%.*s",
+		cache->rootDirectory, StringSlicePrintf(directory));
+	if (fullPathLength < 0 || (uword) fullPathLength >= sizeof(fullPath)) {
+		return FALSE;
+	}
+	u32 events =
+		IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY |
+		IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+	int descriptor = inotify_add_watch(cache->changeFd, fullPath, events);
+	if (descriptor == -1) {
+		return FALSE;
+	}
+
+	if (cache->watchCount == cache->watchCapacity) {
+		uword newCapacity = (cache->watchCapacity == 0) ? 16 : cache->watchCapacity * 2;
+		cache->watches = reallocSafe(cache->watches, newCapacity * sizeof(*cache->watches));
+		cache->watchCapacity = newCapacity;
+	}
+	// Different spellings of one directory, such as "/a/" and "/a//", share a
+	// descriptor, so each of them gets a record.
+	FileCacheWatch* watch = cache->watches + cache->watchCount;
+	++cache->watchCount;
+	uword directoryLength = stringSliceLength(directory);
+	watch->descriptor = descriptor;
+	watch->directory = checkOutOfMemory(malloc(directoryLength + 1));
+	memcpy(watch->directory, directory.begin, directoryLength);
+	watch->directory[directoryLength] = '\0';
+	return TRUE;
+}
+
+// Drop cached files that have changed on disk, according to the change
+// notifications that have arrived since the last call.
+static void fileCacheProcessChanges(FileCache* cache) {
+	union {
+		struct inotify_event event;
+		char bytes[4096];
+	} buffer;
+	for (;;) {
+		ssize_t length = read(cache->changeFd, buffer.bytes, sizeof(buffer.bytes));
+		if (length == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN) {
+				fprintf(stderr, "[Server] reading file change notifications failed: %d\n", errno);
+			}
+			return;
+		}
+		const char* cursor = buffer.bytes;
+		const char* end = buffer.bytes + length;
+		while (cursor < end) {
+			const struct inotify_event* event = (const struct inotify_event*) cursor;
+			cursor += sizeof(*event) + event->len;
+
+			if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT)) {
+				// Either notifications were lost, or a whole directory went
+				// away. Both are rare enough to just start over.
+				fileCacheClear(cache);
+				if (event->mask & IN_IGNORED) {
+					// the kernel has removed the watch
+					for (uword i = 0; i < cache->watchCount;) {
+						if (cache->watches[i].descriptor == event->wd) {
+							free(cache->watches[i].directory);
+							--cache->watchCount;
+							cache->watches[i] = cache->watches[cache->watchCount];
+						} else {
+							++i;
+						}
+					}
+				}
+				continue;
+			}
+			if (event->len == 0) {
+				continue;
+			}
+			for (uword i = 0; i < cache->watchCount; ++i) {
+				FileCacheWatch* watch = cache->watches + i;
+				if (watch->descriptor != event->wd) {
+					continue;
+				}
+				char path[FILE_CACHE_MAX_PATH_LENGTH];
+				int pathLength = snprintf(path, sizeof(path), "%s%s", watch->directory, event->name);
+				if (pathLength > 0 && (uword) pathLength < sizeof(path)) {
+					fileCacheDrop(cache, stringSlice(path, path + pathLength));
+				}
+			}
+		}
+	}
+}
+#endif
+
+// Find the file for a request path, opening it if it is not cached yet. The
+// returned file has been acquired for the caller, who must release it. Files
+// that have changed on disk since they were cached are reopened, whether that
+// is found out from a change notification or by checking the file. Returns
+// NULL if there is no such file.
+static CachedFile* fileCacheGet(FileCache* cache, StringSlice path) {
+	char fullPath[FILE_CACHE_MAX_PATH_LENGTH];
+	int fullPathLength = snprintf(
+		fullPath, sizeof(fullPath), "%s%.*s",
+		cache->rootDirectory, StringSlicePrintf(path));
+	if (fullPathLength < 0 || (uword) fullPathLength >= sizeof(fullPath)) {
+		return NULL;
+	}
+
+	CachedFile** link = fileCacheFind(cache, path);
+	CachedFile* file = *link;
+#ifndef _WIN32
+	if (file && file->watched) {
+		cachedFileAcquire(file);
+		return file;
+	}
+	// Watch the directory before looking at the file, so that a change right
+	// after the file has been looked at is not missed.
+	b32 watched = fileCacheWatchDirectory(cache, path);
+#endif
+
+	FileInfo info;
+	b32 exists = fileInfoGet(fullPath, &info);
+	if (file) {
+		if (exists && fileInfosEqual(&info, &file->info)) {
+			cachedFileAcquire(file);
+			return file;
+		}
+		// the file was deleted or rewritten since it was cached
+		*link = file->nextInBucket;
+		cachedFileRelease(file);
+	}
+	if (!exists) {
+		return NULL;
+	}
+
+	file = cachedFileOpen(fullPath, path, &info);
+	if (!file) {
+		return NULL;
+	}
+#ifndef _WIN32
+	file->watched = watched;
+#endif
+	file->gzipCache = cache->gzip;
+	file->nextInBucket = *link;
+	*link = file;
+	cachedFileAcquire(file);
+	return file;
+}
+
+// Send part of a cached file on a non-blocking socket, without copying the
+// file contents through user space where the platform allows it. Errors are
+// handled like in socketSendNonBlocking(); error is 0 if the file, rather than
+// the socket, was the problem, which has been reported already.
+static b32 cachedFileSendNonBlocking(
+SOCKET socket, CachedFile* file, u64 offset, u64 byteCount, uword* sentByteCount, int* error) {
+#ifdef _WIN32
+	uword chunkSize = (byteCount > 0x40000000) ? 0x40000000 : (uword) byteCount;
+	return socketSendNonBlocking(socket, chunkSize, file->contents + offset, sentByteCount, error);
+#else
+	*sentByteCount = 0;
+	off_t fileOffset = (off_t) offset;
+	uword chunkSize = (byteCount > 0x40000000) ? 0x40000000 : (uword) byteCount;
+	ssize_t bytesSent = sendfile(socket, file->fd, &fileOffset, chunkSize);
+	if (bytesSent == -1) {
+		*error = errno;
+		return socketErrorWouldBlock(*error);
+	}
+	if (bytesSent == 0) {
+		// the file was truncated after it was opened
+		fprintf(stderr, "[Server] sendfile() reached the end of '%s' early\n", file->path);
+		*error = 0;
+		return FALSE;
+	}
+	*sentByteCount = (uword) bytesSent;
+	return TRUE;
+#endif
+}
+
+static const char httpIndexFileName[] = "index.html";
+
+// Convert the URL from a request line into a path under the root directory.
+// The query string is dropped, percent-escapes are decoded, and a directory
+// path gets "index.html" appended, in which case isDirectory is set. Returns
+// FALSE for paths that could escape the root directory, or that are too long.
+static b32 httpUrlToFilePath(
+StringSlice url, char* path, uword maxPathLength, StringSlice* result, b32* isDirectory) {
+	uword length = 0;
+	const char* cursor = url.begin;
+	if (cursor == url.end || *cursor != '/') {
+		path[length++] = '/';
+	}
+	for (; cursor != url.end; ++cursor) {
+		char c = *cursor;
+		if ((c == '?') | (c == '#')) {
+			break;
+		}
+		if (c == '%') {
+			if (url.end - cursor < 3) {
+				return FALSE;
+			}
+			char hex[3] = {cursor[1], cursor[2], '\0'};
+			char* hexEnd;
+			c = (char) strtol(hex, &hexEnd, 16);
+			if (hexEnd != hex + 2) {
+				return FALSE;
+			}
+			cursor += 2;
+		}
+		if ((c == '\0') | (c == '\\') | (c == ':')) {
+			return FALSE;
+		}
+		if (length + 1 >= maxPathLength) {
+			return FALSE;
+		}
+		path[length++] = c;
+	}
+
+	// reject any ".." path segment
+	for (uword i = 0; i + 1 < length; ++i) {
+		b32 segmentStart = (i == 0) || (path[i - 1] == '/');
+		b32 segmentEnd = (i + 2 == length) || (path[i + 2] == '/');
+		if (segmentStart & segmentEnd & (path[i] == '.') & (path[i + 1] == '.')) {
+			return FALSE;
+		}
+	}
+
+	b32 directory = path[length - 1] == '/';
+	if (directory) {
+		uword indexFileLength = strlen(httpIndexFileName);
+		if (length + indexFileLength >= maxPathLength) {
+			return FALSE;
+		}
+		memcpy(path + length, httpIndexFileName, indexFileLength);
+		length += indexFileLength;
+	}
+	path[length] = '\0';
+	*result = stringSlice(path, path + length);
+	*isDirectory = directory;
+	return TRUE;
+}
+
+typedef enum HttpOutputSegmentType {
+	HTTP_OUTPUT_SEGMENT_BUFFER, // bytes copied into the output's arena
+	HTTP_OUTPUT_SEGMENT_FILE,   // a range of a cached file
+	HTTP_OUTPUT_SEGMENT_MEMORY, // bytes owned by a cached file, such as its compressed contents
+} HttpOutputSegmentType;
+
+typedef struct HttpOutputSegment {
+	HttpOutputSegmentType type;
+	// offset into the file, or into bytes
+	u64 offset;
+	u64 size;
+	// file and memory segments keep a reference to their file
+	CachedFile* file;
+	const u8* bytes;
+} HttpOutputSegment;
+
+// Response data queued on a connection that the socket has not accepted yet.
+// Small pieces, such as response headers, are copied into an arena, which is
+// reset whenever everything queued has been sent; file contents are
+// referenced, and never copied.
+typedef struct HttpOutput {
+	Arena arena;
+	// the bytes copied into the arena since it was last reset
+	uword size;
+
+	HttpOutputSegment* segments;
+	uword segmentCapacity;
+	uword segmentCount;
+	// the first segment that has not been completely sent, and how much of it
+	// has been sent
+	uword segmentIndex;
+	u64 segmentSentCount;
+	// everything that has ever been queued, for the request log, and
+	// everything that has ever been sent
+	u64 queuedByteCount;
+	u64 sentByteCount;
+} HttpOutput;
+
+static HttpOutputSegment* httpOutputPushSegment(HttpOutput* output, HttpOutputSegmentType type) {
+	if (output->segmentCount == output->segmentCapacity) {
+		uword newCapacity = (output->segmentCapacity == 0) ? 16 : output->segmentCapacity * 2;
+		output->segments = reallocSafe(output->segments, newCapacity * sizeof(*output->segments));
+		output->segmentCapacity = newCapacity;
+	}
+	HttpOutputSegment* segment = output->segments + output->segmentCount;
+	++output->segmentCount;
+	ClearValueToZero(*segment);
+	segment->type = type;
+	return segment;
+}
+
+// The most bytes that a response header can take, which is reserved in the
+// output to format the header in place.
+#define HTTP_MAX_RESPONSE_HEADER_SIZE 1024
+
+// Return room for up to byteCount bytes to be written straight into the
+// output. Nothing is queued until httpOutputCommit() is called.
+inline static char* httpOutputReserve(HttpOutput* output, uword byteCount) {
+	uword availableByteCount;
+	return (char*) arenaReserve(&output->arena, byteCount, &availableByteCount);
+}
+
+// Queue bytes that were written to the space returned by httpOutputReserve().
+static void httpOutputCommit(HttpOutput* output, const void* bytes, uword byteCount) {
+	arenaCommit(&output->arena, byteCount);
+	// extend the last segment if these bytes directly follow it
+	HttpOutputSegment* last = (output->segmentCount > output->segmentIndex)
+		? output->segments + output->segmentCount - 1
+		: NULL;
+	b32 contiguous = last &&
+		(last->type == HTTP_OUTPUT_SEGMENT_BUFFER) &&
+		(last->bytes + last->size == (const u8*) bytes);
+	if (!contiguous) {
+		last = httpOutputPushSegment(output, HTTP_OUTPUT_SEGMENT_BUFFER);
+		last->bytes = bytes;
+	}
+	last->size += byteCount;
+	output->size += byteCount;
+	output->queuedByteCount += byteCount;
+}
+
+// Copy bytes into the output, spreading them over as many arena chunks as
+// it takes.
+static void httpOutputAppend(HttpOutput* output, uword byteCount, const void* bytes) {
+	const u8* source = bytes;
+	while (byteCount > 0) {
+		uword availableByteCount;
+		u8* destination = arenaReserve(&output->arena, 1, &availableByteCount);
+		uword copyCount = (byteCount < availableByteCount) ? byteCount : availableByteCount;
+		memcpy(destination, source, copyCount);
+		httpOutputCommit(output, destination, copyCount);
+		source += copyCount;
+		byteCount -= copyCount;
+	}
+}
+
+static void httpOutputAppendFile(HttpOutput* output, CachedFile* file, u64 offset, u64 byteCount) {
+	if (byteCount == 0) {
+		return;
+	}
+	HttpOutputSegment* segment = httpOutputPushSegment(output, HTTP_OUTPUT_SEGMENT_FILE);
+	segment->offset = offset;
+	segment->size = byteCount;
+	segment->file = file;
+	cachedFileAcquire(file);
+	output->queuedByteCount += byteCount;
+}
+
+static void httpOutputAppendFileMemory(HttpOutput* output, CachedFile* file, const u8* bytes, u64 byteCount) {
+	if (byteCount == 0) {
+		return;
+	}
+	HttpOutputSegment* segment = httpOutputPushSegment(output, HTTP_OUTPUT_SEGMENT_MEMORY);
+	segment->size = byteCount;
+	segment->file = file;
+	segment->bytes = bytes;
+	cachedFileAcquire(file);
+	output->queuedByteCount += byteCount;
+}
+
+// Where the next response starts in the output, so that it can be found again
+// once it has been queued.
+typedef struct HttpOutputMark {
+	uword segmentIndex;
+	u64 offset;
+} HttpOutputMark;
+
+inline static HttpOutputMark httpOutputMark(const HttpOutput* output) {
+	HttpOutputMark mark = {output->segmentCount, 0};
+	// the next bytes may be added to the end of the last segment
+	if (output->segmentCount > output->segmentIndex) {
+		mark.segmentIndex = output->segmentCount - 1;
+		mark.offset = output->segments[mark.segmentIndex].size;
+	}
+	return mark;
+}
+
+// Drop the body of the response queued since mark, and keep its header, which
+// is what a HEAD request gets. A header is never in a file segment, but may be
+// spread over several buffer segments.
+static void httpOutputDropBody(HttpOutput* output, HttpOutputMark mark) {
+	u32 matchCount = 0;
+	uword segmentIndex = mark.segmentIndex;
+	u64 offset = mark.offset;
+	for (; segmentIndex < output->segmentCount; ++segmentIndex, offset = 0) {
+		HttpOutputSegment* segment = output->segments + segmentIndex;
+		assert(segment->type != HTTP_OUTPUT_SEGMENT_FILE || offset == segment->size);
+		const u8* bytes = segment->bytes + segment->offset;
+		while (offset < segment->size && matchCount < 4) {
+			u8 c = bytes[offset];
+			++offset;
+			matchCount = (c == "\r\n\r\n"[matchCount]) ? matchCount + 1 : (c == '\r');
+		}
+		if (matchCount == 4) {
+			break;
+		}
+	}
+	assert(matchCount == 4);
+	if (segmentIndex == output->segmentCount) {
+		return;
+	}
+
+	HttpOutputSegment* segment = output->segments + segmentIndex;
+	u64 droppedByteCount = segment->size - offset;
+	segment->size = offset;
+	for (uword i = segmentIndex + 1; i < output->segmentCount; ++i) {
+		HttpOutputSegment* dropped = output->segments + i;
+		droppedByteCount += dropped->size;
+		if (dropped->file) {
+			cachedFileRelease(dropped->file);
+		}
+	}
+	output->segmentCount = segmentIndex + 1;
+	output->queuedByteCount -= droppedByteCount;
+}
+
+inline static b32 httpOutputPending(const HttpOutput* output) {
+	return output->segmentIndex < output->segmentCount;
+}
+
+// Drop everything queued, including output that has not been sent yet.
+static void httpOutputReset(HttpOutput* output) {
+	for (uword i = output->segmentIndex; i < output->segmentCount; ++i) {
+		HttpOutputSegment* segment = output->segments + i;
+		if (segment->file) {
+			cachedFileRelease(segment->file);
+		}
+	}
+	arenaReset(&output->arena);
+	output->size = 0;
+	output->segmentCount = 0;
+	output->segmentIndex = 0;
+	output->segmentSentCount = 0;
+}
+
+// Once this many segments, or this many buffered bytes, are waiting to be
+// sent, no more requests are handled on the connection until the client
+// catches up. This bounds the memory a client can make the server use by
+// pipelining requests without reading the responses.
+#define HTTP_OUTPUT_MAX_PENDING_SEGMENTS 64
+#define HTTP_OUTPUT_MAX_PENDING_BYTES (64 * 1024)
+
+inline static b32 httpOutputBacklogged(const HttpOutput* output) {
+	uword pendingSegmentCount = output->segmentCount - output->segmentIndex;
+	return (pendingSegmentCount >= HTTP_OUTPUT_MAX_PENDING_SEGMENTS) | (output->size >= HTTP_OUTPUT_MAX_PENDING_BYTES);
+}
+
+// Mark bytes as sent, releasing any files that have been sent completely.
+static void httpOutputAdvance(HttpOutput* output, u64 byteCount) {
+	output->sentByteCount += byteCount;
+	while (byteCount > 0) {
+		assert(httpOutputPending(output));
+		HttpOutputSegment* segment = output->segments + output->segmentIndex;
+		u64 remaining = segment->size - output->segmentSentCount;
+		if (byteCount < remaining) {
+			output->segmentSentCount += byteCount;
+			return;
+		}
+		byteCount -= remaining;
+		if (segment->file) {
+			cachedFileRelease(segment->file);
+		}
+		++output->segmentIndex;
+		output->segmentSentCount = 0;
+	}
+	// once everything has been sent, the buffer can be reused from the start
+	if (!httpOutputPending(output)) {
+		httpOutputReset(output);
+	}
+}
+
+// Point socket buffers at the in-memory segments at the front of the queue, up
+// to the first file segment. moreFollows is set if anything is queued after
+// the gathered segments.
+static uword httpOutputGatherBuffers(
+HttpOutput* output, SocketBuffer* buffers, uword maxBufferCount, b32* moreFollows) {
+	uword bufferCount = 0;
+	uword segmentIndex = output->segmentIndex;
+	u64 skipCount = output->segmentSentCount;
+	while (segmentIndex < output->segmentCount && bufferCount < maxBufferCount) {
+		HttpOutputSegment* segment = output->segments + segmentIndex;
+		if (segment->type == HTTP_OUTPUT_SEGMENT_FILE) {
+			break;
+		}
+		socketBufferSet(
+			buffers + bufferCount,
+			(u8*) segment->bytes + segment->offset + skipCount,
+			(uword) (segment->size - skipCount));
+		skipCount = 0;
+		++bufferCount;
+		++segmentIndex;
+	}
+	*moreFollows = segmentIndex < output->segmentCount;
+	return bufferCount;
+}
+
+// Send queued data until the queue is empty or the socket would block.
+// Consecutive buffered segments, such as the responses to several pipelined
+// requests, go out in a single vectored send. Returns FALSE if the socket
+// reported an error, which is written to error, as in cachedFileSendNonBlocking().
+static b32 httpOutputFlush(HttpOutput* output, SOCKET socket, int* error) {
+	while (httpOutputPending(output)) {
+		HttpOutputSegment* segment = output->segments + output->segmentIndex;
+		uword sentByteCount;
+		b32 success;
+		if (segment->type == HTTP_OUTPUT_SEGMENT_FILE) {
+			success = cachedFileSendNonBlocking(
+				socket, segment->file,
+				segment->offset + output->segmentSentCount,
+				segment->size - output->segmentSentCount,
+				&sentByteCount, error);
+		} else {
+			SocketBuffer buffers[HTTP_OUTPUT_MAX_PENDING_SEGMENTS];
+			b32 moreFollows;
+			uword bufferCount = httpOutputGatherBuffers(output, buffers, ArrayCount(buffers), &moreFollows);
+			success = socketSendVectorNonBlocking(
+				socket, buffers, bufferCount, moreFollows, &sentByteCount, error);
+		}
+		if (!success) {
+			return FALSE;
+		}
+		if (sentByteCount == 0) {
+			return TRUE;
+		}
+		httpOutputAdvance(output, sentByteCount);
+	}
+	httpOutputReset(output);
+	return TRUE;
+}
+
+// Give the output's memory back to the pool. Anything still queued is dropped.
+static void httpOutputRelease(HttpOutput* output) {
+	httpOutputReset(output);
+	arenaRelease(&output->arena);
+}
+
+inline static void httpOutputDestroy(HttpOutput* output) {
+	httpOutputRelease(output);
+	free(output->segments);
+	ClearValueToZero(*output);
+}
+
+// Special values for the length of a response body that is generated while it
+// is sent, so its length is not known up front. A chunked body marks its own
+// end; anything else ends when the connection is closed.
+#define HTTP_CONTENT_LENGTH_CHUNKED UINT64_MAX
+#define HTTP_CONTENT_LENGTH_UNTIL_CLOSE (UINT64_MAX - 1)
+
+// Every response says how long its body is, so that on a persistent
+// connection the client can tell where one response ends and the next one
+// begins. Any other header lines go in extraHeaders, each one ending in
+// "\r\n". Returns the length of the header.
+static uword httpFormatResponseHeader(
+char* header, uword capacity, const char* status, u64 contentLength,
+const char* contentType, const char* extraHeaders, b32 keepAlive) {
+	char lengthLine[48] = "";
+	if (contentLength == HTTP_CONTENT_LENGTH_CHUNKED) {
+		snprintf(lengthLine, sizeof(lengthLine), "Transfer-Encoding: chunked\r\n");
+	} else if (contentLength != HTTP_CONTENT_LENGTH_UNTIL_CLOSE) {
+		snprintf(lengthLine, sizeof(lengthLine), "Content-Length: %llu\r\n", (unsigned long long) contentLength);
+	}
+	int headerLength = snprintf(
+		header, capacity,
+		"HTTP/1.1 %s\r\n"
+		"Connection: %s\r\n"
+		"%s"
+		"Content-Type: %s\r\n"
+		"%s"
+		"\r\n",
+		status, keepAlive ? "keep-alive" : "close",
+		lengthLine, contentType, extraHeaders);
+	assert(headerLength > 0 && (uword) headerLength < capacity);
+	return (uword) headerLength;
+}
+
+static void httpQueueResponseHeader(
+HttpOutput* output, const char* status, u64 contentLength,
+const char* contentType, const char* extraHeaders, b32 keepAlive) {
+	char* header = httpOutputReserve(output, HTTP_MAX_RESPONSE_HEADER_SIZE);
+	uword headerLength = httpFormatResponseHeader(
+		header, HTTP_MAX_RESPONSE_HEADER_SIZE, status, contentLength, contentType, extraHeaders, keepAlive);
+	httpOutputCommit(output, header, headerLength);
+}
+
+// A 304 response has no body, so unlike every other response it has no
+// Content-Length. lastModified may be NULL.
+static void httpQueueNotModifiedResponse(
+HttpOutput* output, const char* etag, const char* lastModified,
+const char* extraHeaders, b32 keepAlive) {
+	char* header = httpOutputReserve(output, HTTP_MAX_RESPONSE_HEADER_SIZE);
+	int headerLength = snprintf(
+		header, HTTP_MAX_RESPONSE_HEADER_SIZE,
+		"HTTP/1.1 304 NOT MODIFIED\r\n"
+		"Connection: %s\r\n"
+		"ETag: %s\r\n"
+		"%s%s%s"
+		"%s"
+		"\r\n",
+		keepAlive ? "keep-alive" : "close", etag,
+		lastModified ? "Last-Modified: " : "", lastModified ? lastModified : "", lastModified ? "\r\n" : "",
+		extraHeaders);
+	assert(headerLength > 0 && (uword) headerLength < HTTP_MAX_RESPONSE_HEADER_SIZE);
+	httpOutputCommit(output, header, (uword) headerLength);
+}
+
+// Whether the client's copy is still current, so a 304 response will do. If
+// the client sent an If-None-Match option, If-Modified-Since is ignored.
+static b32 httpRequestIsNotModified(const HttpRequest* request, const char* etag, u64 lastModifiedTime) {
+	if (!stringSliceEmpty(request->ifNoneMatch)) {
+		return httpEtagMatches(request->ifNoneMatch, etag);
+	}
+	u64 modifiedSince;
+	if (!stringSliceEmpty(request->ifModifiedSince) && httpParseDate(request->ifModifiedSince, &modifiedSince)) {
+		return lastModifiedTime <= modifiedSince;
+	}
+	return FALSE;
+}
+
+// A byte range of a file, as in a Range option, so last is inclusive.
+typedef struct HttpByteRange {
+	u64 first;
+	u64 last;
+} HttpByteRange;
+
+// A multipart response queues two segments for each range, so the number of
+// ranges is limited to keep the response within what one connection may
+// queue. A Range option that asks for more is ignored.
+#define HTTP_MAX_RANGE_COUNT 16
+
+typedef enum HttpRangeResult {
+	HTTP_RANGE_IGNORED,       // send the whole file instead
+	HTTP_RANGE_UNSATISFIABLE, // none of the ranges overlap the file
+	HTTP_RANGE_SATISFIABLE,
+} HttpRangeResult;
+
+// Parse a Range option such as "bytes=0-99, 200-, -500" for a file of the
+// given size. Ranges that start past the end of the file are dropped, and the
+// others are clipped to it. An option that is malformed, asks for too many
+// ranges, or asks for ranges that overlap is ignored, as RFC 7233 allows;
+// overlapping ranges could otherwise make a small request send a large file
+// many times over.
+static HttpRangeResult httpParseRanges(
+StringSlice value, u64 fileSize, HttpByteRange* ranges, uword* rangeCount) {
+	const char* cursor = value.begin;
+	const char* end = value.end;
+	StringSlice unit = stringSlice(cursor, (end - cursor < 6) ? end : cursor + 6);
+	if (!stringSliceEqualsCStringIgnoreCase(&unit, "bytes=")) {
+		return HTTP_RANGE_IGNORED;
+	}
+	cursor = unit.end;
+
+	uword count = 0;
+	uword specCount = 0;
+	for (;;) {
+		skipSpaces(&cursor, end);
+		if (cursor == end) {
+			break;
+		}
+		if (*cursor == ',') {
+			++cursor;
+			continue;
+		}
+		if (specCount == HTTP_MAX_RANGE_COUNT) {
+			return HTTP_RANGE_IGNORED;
+		}
+		++specCount;
+
+		HttpByteRange range;
+		b32 satisfiable;
+		if (*cursor == '-') {
+			// the last suffixLength bytes
+			++cursor;
+			u64 suffixLength;
+			if (!httpParseDecimal(&cursor, end, &suffixLength)) {
+				return HTTP_RANGE_IGNORED;
+			}
+			satisfiable = (suffixLength > 0) & (fileSize > 0);
+			range.first = (suffixLength < fileSize) ? fileSize - suffixLength : 0;
+			range.last = fileSize - 1;
+		} else {
+			if (!httpParseDecimal(&cursor, end, &range.first) || cursor == end || *cursor != '-') {
+				return HTTP_RANGE_IGNORED;
+			}
+			++cursor;
+			range.last = UINT64_MAX;
+			if (cursor != end && *cursor >= '0' && *cursor <= '9') {
+				if (!httpParseDecimal(&cursor, end, &range.last) || range.last < range.first) {
+					return HTTP_RANGE_IGNORED;
+				}
+			}
+			satisfiable = range.first < fileSize;
+			if (range.last >= fileSize) {
+				range.last = fileSize - 1;
+			}
+		}
+		skipSpaces(&cursor, end);
+		if (cursor != end && *cursor != ',') {
+			return HTTP_RANGE_IGNORED;
+		}
+
+		if (satisfiable) {
+			for (uword i = 0; i < count; ++i) {
+				if (range.first <= ranges[i].last && ranges[i].first <= range.last) {
+					return HTTP_RANGE_IGNORED;
+				}
+			}
+			ranges[count] = range;
+			++count;
+		}
+	}
+	if (specCount == 0) {
+		return HTTP_RANGE_IGNORED;
+	}
+	*rangeCount = count;
+	return (count > 0) ? HTTP_RANGE_SATISFIABLE : HTTP_RANGE_UNSATISFIABLE;
+}
+
+// A range request with an If-Range option only gets the ranges if the file
+// has not changed since the client got the part it already has; otherwise it
+// gets the whole file. An entity tag has to match exactly, so a weak one
+// never does, and a date has to be the file's modification time.
+static b32 httpIfRangeMatches(StringSlice ifRange, const char* etag, u64 lastModifiedTime) {
+	if (stringSliceEmpty(ifRange)) {
+		return TRUE;
+	}
+	if (*ifRange.begin == '"') {
+		return stringSliceEqualsCString(&ifRange, etag);
+	}
+	u64 date;
+	return httpParseDate(ifRange, &date) && date == lastModifiedTime;
+}
+
+// The header of a response with (part of) a file as its body. Any header lines
+// in moreHeaders are added to the ones every file response has.
+static uword cachedFileFormatResponseHeader(
+CachedFile* file, FileEncoding encoding, const char* status, u64 contentLength,
+const char* contentType, const char* moreHeaders, char* header, uword capacity, b32 keepAlive) {
+	// Compressible files say that they vary with Accept-Encoding whether they
+	// are compressed or not, so that a cache does not hand the compressed
+	// version to a client that cannot use it.
+	char extraHeaders[512];
+	snprintf(
+		extraHeaders, sizeof(extraHeaders),
+		"ETag: %s\r\n"
+		"Last-Modified: %s\r\n"
+		"Accept-Ranges: bytes\r\n"
+		"%s%s%s",
+		file->etags[encoding], file->lastModified,
+		(encoding == FILE_ENCODING_GZIP) ? "Content-Encoding: gzip\r\n" : "",
+		file->mimeType->compressible ? "Vary: Accept-Encoding\r\n" : "",
+		moreHeaders);
+	return httpFormatResponseHeader(
+		header, capacity, status, contentLength, contentType, extraHeaders, keepAlive);
+}
+
+static uword cachedFileFormatOkResponseHeader(
+CachedFile* file, FileEncoding encoding, char* header, uword capacity, b32 keepAlive) {
+	u64 contentLength = (encoding == FILE_ENCODING_GZIP) ? file->gzipSize : file->info.size;
+	return cachedFileFormatResponseHeader(
+		file, encoding, "200 OK", contentLength, file->mimeType->contentType, "", header, capacity, keepAlive);
+}
+
+// Build the complete keep-alive response for a small file, if that has not
+// been done yet. Returns FALSE if the file is too large, or cannot be read.
+static b32 cachedFileSerializeResponse(CachedFile* file, FileEncoding encoding) {
+	if (file->responses[encoding]) {
+		return TRUE;
+	}
+	u64 bodySize = (encoding == FILE_ENCODING_GZIP) ? file->gzipSize : file->info.size;
+	if (bodySize > FILE_CACHE_MAX_SERIALIZED_SIZE) {
+		return FALSE;
+	}
+	u8* contents = (encoding == FILE_ENCODING_GZIP) ? file->gzipContents : cachedFileLoadContents(file);
+	if (!contents) {
+		return FALSE;
+	}
+	char header[HTTP_MAX_RESPONSE_HEADER_SIZE];
+	uword headerLength = cachedFileFormatOkResponseHeader(file, encoding, header, sizeof(header), TRUE);
+	u8* response = checkOutOfMemory(malloc(headerLength + (uword) bodySize));
+	memcpy(response, header, headerLength);
+	memcpy(response + headerLength, contents, (uword) bodySize);
+	if (encoding == FILE_ENCODING_IDENTITY) {
+		cachedFileUnloadContents(contents);
+	}
+	file->responses[encoding] = response;
+	file->responseSizes[encoding] = headerLength + (uword) bodySize;
+	return TRUE;
+}
+
+// Queue a response whose body is just the status line, such as "404 NOT FOUND".
+static void httpQueueStatusResponse(HttpOutput* output, const char* status, const char* extraHeaders, b32 keepAlive) {
+	uword statusLength = strlen(status);
+	httpQueueResponseHeader(output, status, statusLength + 1, "text/plain", extraHeaders, keepAlive);
+	httpOutputAppend(output, statusLength, status);
+	httpOutputAppend(output, 1, "\n");
+}
+
+// A single range is sent as it is. Several ranges are sent as the parts of a
+// multipart/byteranges body, each with its own header saying which range it
+// is; the file contents are never copied.
+static void httpQueueRangeResponse(
+HttpOutput* output, CachedFile* file, const HttpByteRange* ranges, uword rangeCount, b32 keepAlive) {
+	unsigned long long fileSize = file->info.size;
+	char* header;
+	uword headerLength;
+	if (rangeCount == 1) {
+		char contentRange[96];
+		snprintf(
+			contentRange, sizeof(contentRange), "Content-Range: bytes %llu-%llu/%llu\r\n",
+			(unsigned long long) ranges[0].first, (unsigned long long) ranges[0].last, fileSize);
+		header = httpOutputReserve(output, HTTP_MAX_RESPONSE_HEADER_SIZE);
+		headerLength = cachedFileFormatResponseHeader(
+			file, FILE_ENCODING_IDENTITY, "206 PARTIAL CONTENT", ranges[0].last - ranges[0].first + 1,
+			file->mimeType->contentType, contentRange, header, HTTP_MAX_RESPONSE_HEADER_SIZE, keepAlive);
+		httpOutputCommit(output, header, headerLength);
+		httpOutputAppendFile(output, file, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+		return;
+	}
+
+	// The boundary must not turn up in the ranges that are sent. Nothing
+	// checks that: it is made from the file's entity tag, without the quotes,
+	// and relies on that string being unlikely to appear in the file itself.
+	char boundary[64];
+	snprintf(
+		boundary, sizeof(boundary), "byteranges-%.*s",
+		(int) strlen(file->etags[FILE_ENCODING_IDENTITY]) - 2, file->etags[FILE_ENCODING_IDENTITY] + 1);
+
+	char partHeaders[HTTP_MAX_RANGE_COUNT][192];
+	uword partHeaderLengths[HTTP_MAX_RANGE_COUNT];
+	u64 contentLength = 0;
+	for (uword i = 0; i < rangeCount; ++i) {
+		int partHeaderLength = snprintf(
+			partHeaders[i], sizeof(partHeaders[i]),
+			"\r\n--%s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Range: bytes %llu-%llu/%llu\r\n"
+			"\r\n",
+			boundary, file->mimeType->contentType,
+			(unsigned long long) ranges[i].first, (unsigned long long) ranges[i].last, fileSize);
+		assert(partHeaderLength > 0 && (uword) partHeaderLength < sizeof(partHeaders[i]));
+		partHeaderLengths[i] = (uword) partHeaderLength;
+		contentLength += partHeaderLengths[i] + (ranges[i].last - ranges[i].first + 1);
+	}
+	char closingBoundary[80];
+	int closingBoundaryLength = snprintf(closingBoundary, sizeof(closingBoundary), "\r\n--%s--\r\n", boundary);
+	contentLength += (u64) closingBoundaryLength;
+
+	char contentType[96];
+	snprintf(contentType, sizeof(contentType), "multipart/byteranges; boundary=%s", boundary);
+	header = httpOutputReserve(output, HTTP_MAX_RESPONSE_HEADER_SIZE);
+	headerLength = cachedFileFormatResponseHeader(
+		file, FILE_ENCODING_IDENTITY, "206 PARTIAL CONTENT", contentLength,
+		contentType, "", header, HTTP_MAX_RESPONSE_HEADER_SIZE, keepAlive);
+	httpOutputCommit(output, header, headerLength);
+	for (uword i = 0; i < rangeCount; ++i) {
+		httpOutputAppend(output, partHeaderLengths[i], partHeaders[i]);
+		httpOutputAppendFile(output, file, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+	}
+	httpOutputAppend(output, (uword) closingBoundaryLength, closingBoundary);
+}
+
+// Files that can be compressed are sent compressed if the client accepts
+// gzip, unless the client asks for byte ranges, which are always ranges of
+// the uncompressed file. Returns the status code of the response.
+static u32 httpQueueFileResponse(HttpOutput* output, CachedFile* file, const HttpRequest* request) {
+	b32 rangeRequested = !stringSliceEmpty(request->range);
+	FileEncoding encoding = FILE_ENCODING_IDENTITY;
+	if (!rangeRequested && file->mimeType->compressible && request->acceptsGzip && cachedFileCompress(file)) {
+		encoding = FILE_ENCODING_GZIP;
+	}
+
+	const char* etag = file->etags[encoding];
+	u64 lastModifiedTime = fileInfoUnixTime(&file->info);
+	if (httpRequestIsNotModified(request, etag, lastModifiedTime)) {
+		const char* vary = file->mimeType->compressible ? "Vary: Accept-Encoding\r\n" : "";
+		httpQueueNotModifiedResponse(output, etag, file->lastModified, vary, request->keepAlive);
+		return 304;
+	}
+
+	if (rangeRequested && httpIfRangeMatches(request->ifRange, etag, lastModifiedTime)) {
+		HttpByteRange ranges[HTTP_MAX_RANGE_COUNT];
+		uword rangeCount;
+		HttpRangeResult result = httpParseRanges(request->range, file->info.size, ranges, &rangeCount);
+		if (result == HTTP_RANGE_UNSATISFIABLE) {
+			char contentRange[64];
+			snprintf(
+				contentRange, sizeof(contentRange), "Content-Range: bytes */%llu\r\n",
+				(unsigned long long) file->info.size);
+			httpQueueStatusResponse(output, "416 RANGE NOT SATISFIABLE", contentRange, request->keepAlive);
+			return 416;
+		}
+		if (result == HTTP_RANGE_SATISFIABLE) {
+			httpQueueRangeResponse(output, file, ranges, rangeCount, request->keepAlive);
+			return 206;
+		}
+	}
+
+	if (request->keepAlive && cachedFileSerializeResponse(file, encoding)) {
+		httpOutputAppendFileMemory(output, file, file->responses[encoding], file->responseSizes[encoding]);
+		return 200;
+	}
+
+	char* header = httpOutputReserve(output, HTTP_MAX_RESPONSE_HEADER_SIZE);
+	uword headerLength = cachedFileFormatOkResponseHeader(
+		file, encoding, header, HTTP_MAX_RESPONSE_HEADER_SIZE, request->keepAlive);
+	httpOutputCommit(output, header, headerLength);
+	if (encoding == FILE_ENCODING_GZIP) {
+		httpOutputAppendFileMemory(output, file, file->gzipContents, file->gzipSize);
+	} else {
+		httpOutputAppendFile(output, file, 0, file->info.size);
+	}
+	return 200;
+}
+
+// A response body that is generated while it is sent, such as a directory
+// listing. It is produced in pieces of at most HTTP_STREAM_PIECE_SIZE bytes,
+// and the next piece is only produced once the output has room for it, so the
+// whole body is never in memory at once.
+typedef struct HttpStream {
+	// Write the next piece of the body into buffer, and return its length.
+	// Sets *finished once the whole body has been written.
+	uword (*produce)(struct HttpStream* stream, u8* buffer, uword capacity, b32* finished);
+	void (*destroy)(struct HttpStream* stream);
+	// HTTP/1.1 clients get the body in chunks, so the connection can be kept
+	// open. For older clients, the body ends when the connection is closed.
+	b32 chunked;
+} HttpStream;
+
+#define HTTP_STREAM_PIECE_SIZE (16 * 1024)
+
+// Queue pieces of a stream until it is finished or the output backs up.
+// Returns the stream, or NULL once it has been finished and destroyed.
+static HttpStream* httpStreamPump(HttpStream* stream, HttpOutput* output) {
+	while (stream && !httpOutputBacklogged(output)) {
+		u8 piece[HTTP_STREAM_PIECE_SIZE];
+		b32 finished = FALSE;
+		uword pieceSize = stream->produce(stream, piece, sizeof(piece), &finished);
+		if (pieceSize > 0 && stream->chunked) {
+			char chunkHeader[24];
+			int chunkHeaderLength = snprintf(chunkHeader, sizeof(chunkHeader), "%llx\r\n", (unsigned long long) pieceSize);
+			httpOutputAppend(output, (uword) chunkHeaderLength, chunkHeader);
+			httpOutputAppend(output, pieceSize, piece);
+			httpOutputAppend(output, 2, "\r\n");
+		} else if (pieceSize > 0) {
+			httpOutputAppend(output, pieceSize, piece);
+		}
+		if (finished) {
+			if (stream->chunked) {
+				// the last chunk, with no trailer
+				httpOutputAppend(output, 5, "0\r\n\r\n");
+			}
+			stream->destroy(stream);
+			stream = NULL;
+		}
+	}
+	return stream;
+}
+
+// Write text to out, escaped so that it can go in an HTML document. out needs
+// room for 6 characters for each one in text. Returns the escaped length.
+static uword htmlEscape(char* out, const char* text, uword length) {
+	uword outLength = 0;
+	for (uword i = 0; i < length; ++i) {
+		const char* escape;
+		switch (text[i]) {
+			case '&': escape = "&amp;"; break;
+			case '<': escape = "&lt;"; break;
+			case '>': escape = "&gt;"; break;
+			case '"': escape = "&quot;"; break;
+			case '\'': escape = "&#39;"; break;
+			default: out[outLength++] = text[i]; continue;
+		}
+		uword escapeLength = strlen(escape);
+		memcpy(out + outLength, escape, escapeLength);
+		outLength += escapeLength;
+	}
+	return outLength;
+}
+
+// Write text to out with everything but unreserved characters percent-escaped,
+// so that it can be used as a relative URL. out needs room for 3 characters
+// for each one in text. Returns the escaped length.
+static uword urlEscape(char* out, const char* text, uword length) {
+	const char* hexDigits = "0123456789ABCDEF";
+	uword outLength = 0;
+	for (uword i = 0; i < length; ++i) {
+		u8 c = (u8) text[i];
+		b32 unreserved =
+			(c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+			(c == '-') || (c == '.') || (c == '_') || (c == '~');
+		if (unreserved) {
+			out[outLength++] = (char) c;
+		} else {
+			out[outLength++] = '%';
+			out[outLength++] = hexDigits[c >> 4];
+			out[outLength++] = hexDigits[c & 15];
+		}
+	}
+	return outLength;
+}
+
+// Each entry of a directory listing is only written if there is at least this
+// much room left for it. File names are at most 255 bytes on every platform
+// the server runs on.
+#define DIRECTORY_LISTING_MAX_ENTRY_SIZE 4096
+
+// A generated page listing the files in a directory that has no index.html.
+// Entries are read from the directory as the page is sent, so they are listed
+// in whatever order the file system returns them.
+typedef struct DirectoryListing {
+	HttpStream stream;
+	// the request path of the directory, which ends in '/'
+	char path[FILE_CACHE_MAX_PATH_LENGTH];
+	b32 startWritten;
+#ifdef _WIN32
+	HANDLE find;
+	WIN32_FIND_DATAA findData;
+	b32 findDataUsed;
+#else
+	DIR* directory;
+#endif
+} DirectoryListing;
+
+// Get the name of the next file in the directory, skipping "." and "..".
+// Returns FALSE at the end of the directory.
+static b32 directoryListingNextEntry(DirectoryListing* listing, const char** name, b32* isDirectory) {
+	for (;;) {
+#ifdef _WIN32
+		if (listing->findDataUsed && !FindNextFileA(listing->find, &listing->findData)) {
+			return FALSE;
+		}
+		listing->findDataUsed = TRUE;
+		*name = listing->findData.cFileName;
+		*isDirectory = (listing->findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+		struct dirent* entry = readdir(listing->directory);
+		if (!entry) {
+			return FALSE;
+		}
+		*name = entry->d_name;
+		*isDirectory = entry->d_type == DT_DIR;
+		if ((entry->d_type == DT_UNKNOWN) | (entry->d_type == DT_LNK)) {
+			struct stat status;
+			*isDirectory =
+				fstatat(dirfd(listing->directory), entry->d_name, &status, 0) == 0 && S_ISDIR(status.st_mode);
+		}
+#endif
+		if (strcmp(*name, ".") != 0 && strcmp(*name, "..") != 0) {
+			return TRUE;
+		}
+	}
+}
+
+static uword directoryListingProduce(HttpStream* stream, u8* buffer, uword capacity, b32* finished) {
+	DirectoryListing* listing = (DirectoryListing*) stream;
+	char* out = (char*) buffer;
+	uword size = 0;
+	if (!listing->startWritten) {
+		// the escaped path is at most 6 KB, and it appears twice
+		char title[6 * FILE_CACHE_MAX_PATH_LENGTH];
+		uword titleLength = htmlEscape(title, listing->path, strlen(listing->path));
+		int startLength = snprintf(
+			out, capacity,
+			"<!DOCTYPE html>\n"
+			"<html>\n"
+			"<head><meta charset=\"utf-8\"><title>Index of %.*s</title></head>\n"
+			"<body>\n"
+			"<h1>Index of %.*s</h1>\n"
+			"<ul>\n"
+			"%s",
+			(int) titleLength, title, (int) titleLength, title,
+			(strcmp(listing->path, "/") != 0) ? "<li><a href=\"../\">../</a></li>\n" : "");
+		assert(startLength > 0 && (uword) startLength < capacity);
+		size = (uword) startLength;
+		listing->startWritten = TRUE;
+	}
+	while (capacity - size >= DIRECTORY_LISTING_MAX_ENTRY_SIZE) {
+		const char* name;
+		b32 isDirectory;
+		if (!directoryListingNextEntry(listing, &name, &isDirectory)) {
+			const char* end = "</ul>\n</body>\n</html>\n";
+			memcpy(out + size, end, strlen(end));
+			size += strlen(end);
+			*finished = TRUE;
+			break;
+		}
+		uword nameLength = strlen(name);
+		const char* suffix = isDirectory ? "/" : "";
+		memcpy(out + size, "<li><a href=\"", 13);
+		size += 13;
+		size += urlEscape(out + size, name, nameLength);
+		size += (uword) sprintf(out + size, "%s\">", suffix);
+		size += htmlEscape(out + size, name, nameLength);
+		size += (uword) sprintf(out + size, "%s</a></li>\n", suffix);
+	}
+	return size;
+}
+
+static void directoryListingDestroy(HttpStream* stream) {
+	DirectoryListing* listing = (DirectoryListing*) stream;
+#ifdef _WIN32
+	FindClose(listing->find);
+#else
+	closedir(listing->directory);
+#endif
+	free(listing);
+}
+
+// Start listing a directory under the root directory. path is the request
+// path of the directory, ending in '/'. Returns NULL if there is no such
+// directory.
+static HttpStream* directoryListingOpen(const char* rootDirectory, StringSlice path, b32 chunked) {
+	char fullPath[FILE_CACHE_MAX_PATH_LENGTH];
+#ifdef _WIN32
+	const char* pattern = "*";
+#else
+	const char* pattern = "";
+#endif
+	int fullPathLength = snprintf(
+		fullPath, sizeof(fullPath), "%s%.*s%s",
+		rootDirectory, StringSlicePrintf(path), pattern);
+	if (fullPathLength < 0 || (uword) fullPathLength >= sizeof(fullPath)) {
+		return NULL;
+	}
+
+	DirectoryListing* listing = checkOutOfMemory(calloc(1, sizeof(*listing)));
+#ifdef _WIN32
+	listing->find = FindFirstFileA(fullPath, &listing->findData);
+	if (listing->find == INVALID_HANDLE_VALUE) {
+		free(listing);
+		return NULL;
+	}
+#else
+	listing->directory = opendir(fullPath);
+	if (!listing->directory) {
+		free(listing);
+		return NULL;
+	}
+#endif
+	snprintf(listing->path, sizeof(listing->path), "%.*s", StringSlicePrintf(path));
+	listing->stream.produce = directoryListingProduce;
+	listing->stream.destroy = directoryListingDestroy;
+	listing->stream.chunked = chunked;
+	return &listing->stream;
+}
+
+// An asset archive packs a directory, such as a demo's build output, into one
+// file that the server maps into memory. Every file in it has its complete
+// keep-alive 200 response built ahead of time, header and body, for each
+// encoding, so answering a request for it takes a binary search and one
+// vectored send. A new build is deployed by packing it next to the old
+// archive and renaming it over the old one; each worker notices within a
+// second, and responses that are already queued keep the old archive mapped
+// until they have been sent.
+//
+// The layout is an AssetArchiveHeader, then the entries sorted by path, then
+// the paths, then the responses. Integers are stored in the byte order of the
+// machine that packed the archive, which is little-endian everywhere this
+// server runs.
+#define ASSET_ARCHIVE_MAGIC "WASMPAK1"
+
+typedef struct AssetArchiveHeader {
+	char magic[8];
+	u64 entryCount;
+	// the size of the whole archive, so that a truncated one is rejected
+	u64 size;
+} AssetArchiveHeader;
+
+typedef struct AssetArchiveResponse {
+	u64 offset;
+	// headerSize is 0 if there is no response for this encoding, which only
+	// happens for files that gzip does not make smaller
+	u64 headerSize;
+	u64 bodySize;
+} AssetArchiveResponse;
+
+typedef struct AssetArchiveEntry {
+	// the request path, such as "/main.wasm", which is not NUL-terminated
+	u64 pathOffset;
+	u64 pathLength;
+	// a hash of the uncompressed contents, so that the entity tags stay the
+	// same when an unchanged file is packed again
+	u64 contentHash;
+	// in seconds since 1970
+	u64 lastModifiedTime;
+	// whether the responses vary with Accept-Encoding
+	u64 compressible;
+	AssetArchiveResponse responses[FILE_ENCODING_COUNT];
+} AssetArchiveEntry;
+
+// Every response in an archive starts with the keep-alive status and
+// connection lines. Responses on other connections send the close lines
+// instead, followed by the rest of the packed response.
+static const char assetArchiveKeepAlivePrefix[] = "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n";
+static const char assetArchiveClosePrefix[] = "HTTP/1.1 200 OK\r\nConnection: close\r\n";
+
+typedef struct AssetArchive {
+	// The archive file, which owns the memory the entries point into.
+	// Responses queued from the archive hold references to it, like they do
+	// to any other cached file. NULL if no archive is loaded.
+	CachedFile* file;
+	const u8* bytes;
+	const AssetArchiveEntry* entries;
+	u32 entryCount;
+} AssetArchive;
+
+static void assetArchiveFormatEtag(const AssetArchiveEntry* entry, FileEncoding encoding, char* etag, uword capacity) {
+	snprintf(
+		etag, capacity, "\"%016llx%s\"",
+		(unsigned long long) entry->contentHash, (encoding == FILE_ENCODING_GZIP) ? "-gzip" : "");
+}
+
+// The order of the entries in an archive: bytewise, with a path that is a
+// prefix of another one first, which is the order strcmp() sorts them in when
+// they are packed. Returns less than, equal to or greater than 0, like memcmp().
+static int assetArchiveComparePaths(const char* a, uword aLength, const char* b, uword bLength) {
+	uword commonLength = (aLength < bLength) ? aLength : bLength;
+	int order = memcmp(a, b, commonLength);
+	if (order == 0) {
+		order = (aLength > bLength) - (aLength < bLength);
+	}
+	return order;
+}
+
+// Check that everything the entries point at is inside the archive, so that a
+// damaged archive cannot make the server read outside of it, and that the
+// entries are sorted by path without duplicates, which assetArchiveFind()
+// relies on.
+static b32 assetArchiveValidate(const u8* bytes, u64 size) {
+	if (size < sizeof(AssetArchiveHeader)) {
+		return FALSE;
+	}
+	const AssetArchiveHeader* header = (const AssetArchiveHeader*) bytes;
+	if (memcmp(header->magic, ASSET_ARCHIVE_MAGIC, sizeof(header->magic)) != 0 || header->size != size) {
+		return FALSE;
+	}
+	u64 entriesEnd = sizeof(*header) + header->entryCount * sizeof(AssetArchiveEntry);
+	if (header->entryCount > UINT32_MAX || entriesEnd > size) {
+		return FALSE;
+	}
+	const AssetArchiveEntry* entries = (const AssetArchiveEntry*) (bytes + sizeof(*header));
+	uword keepAlivePrefixLength = strlen(assetArchiveKeepAlivePrefix);
+	for (u64 i = 0; i < header->entryCount; ++i) {
+		const AssetArchiveEntry* entry = entries + i;
+		if (entry->pathOffset > size || entry->pathLength > size - entry->pathOffset) {
+			return FALSE;
+		}
+		if (i > 0) {
+			const AssetArchiveEntry* previous = entry - 1;
+			int order = assetArchiveComparePaths(
+				(const char*) bytes + previous->pathOffset, (uword) previous->pathLength,
+				(const char*) bytes + entry->pathOffset, (uword) entry->pathLength);
+			if (order >= 0) {
+				return FALSE;
+			}
+		}
+		for (u32 encoding = 0; encoding < FILE_ENCODING_COUNT; ++encoding) {
+			const AssetArchiveResponse* response = entry->responses + encoding;
+			if (response->headerSize == 0) {
+				continue;
+			}
+			b32 inside =
+				(response->offset <= size) &&
+				(response->headerSize <= size - response->offset) &&
+				(response->bodySize <= size - response->offset - response->headerSize);
+			if (!inside || response->headerSize < keepAlivePrefixLength ||
+				memcmp(bytes + response->offset, assetArchiveKeepAlivePrefix, keepAlivePrefixLength) != 0) {
+				return FALSE;
+			}
+		}
+		if (entry->responses[FILE_ENCODING_IDENTITY].headerSize == 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// Map an archive into memory. Returns FALSE if it cannot be read, or is not
+// an archive.
+static b32 assetArchiveOpen(AssetArchive* archive, const char* path) {
+	ClearValueToZero(*archive);
+	FileInfo info;
+	if (!fileInfoGet(path, &info)) {
+		fprintf(stderr, "[Server] Archive '%s' does not exist\n", path);
+		return FALSE;
+	}
+	CachedFile* file = cachedFileOpen(path, stringSliceFromCString(path), &info);
+	if (!file) {
+		fprintf(stderr, "[Server] Failed to open archive '%s'\n", path);
+		return FALSE;
+	}
+	const u8* bytes = cachedFileMap(file);
+	if (!bytes || !assetArchiveValidate(bytes, info.size)) {
+		fprintf(stderr, "[Server] '%s' is not a valid archive\n", path);
+		cachedFileRelease(file);
+		return FALSE;
+	}
+	archive->file = file;
+	archive->bytes = bytes;
+	archive->entries = (const AssetArchiveEntry*) (bytes + sizeof(AssetArchiveHeader));
+	archive->entryCount = (u32) ((const AssetArchiveHeader*) bytes)->entryCount;
+	return TRUE;
+}
+
+static void assetArchiveClose(AssetArchive* archive) {
+	if (archive->file) {
+		cachedFileRelease(archive->file);
+	}
+	ClearValueToZero(*archive);
+}
+
+// Find the entry for a request path, such as "/main.wasm". Returns NULL if
+// the archive does not have the file.
+static const AssetArchiveEntry* assetArchiveFind(const AssetArchive* archive, StringSlice path) {
+	uword pathLength = stringSliceLength(path);
+	u32 low = 0;
+	u32 high = archive->entryCount;
+	while (low < high) {
+		u32 middle = low + (high - low) / 2;
+		const AssetArchiveEntry* entry = archive->entries + middle;
+		const char* entryPath = (const char*) archive->bytes + entry->pathOffset;
+		int order = assetArchiveComparePaths(entryPath, (uword) entry->pathLength, path.begin, pathLength);
+		if (order == 0) {
+			return entry;
+		}
+		if (order < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return NULL;
+}
+
+// Queue the packed response for an archive entry, or a 304 response. Byte
+// ranges are not offered for files in an archive, so a Range option is
+// ignored. Returns the status code of the response.
+static u32 httpQueueArchiveResponse(
+HttpOutput* output, const AssetArchive* archive, const AssetArchiveEntry* entry, const HttpRequest* request) {
+	FileEncoding encoding = FILE_ENCODING_IDENTITY;
+	if (request->acceptsGzip && entry->responses[FILE_ENCODING_GZIP].headerSize > 0) {
+		encoding = FILE_ENCODING_GZIP;
+	}
+	char etag[32];
+	assetArchiveFormatEtag(entry, encoding, etag, sizeof(etag));
+	if (httpRequestIsNotModified(request, etag, entry->lastModifiedTime)) {
+		char lastModified[HTTP_DATE_SIZE];
+		httpFormatDate(entry->lastModifiedTime, lastModified);
+		const char* vary = entry->compressible ? "Vary: Accept-Encoding\r\n" : "";
+		httpQueueNotModifiedResponse(output, etag, lastModified, vary, request->keepAlive);
+		return 304;
+	}
+
+	const AssetArchiveResponse* response = entry->responses + encoding;
+	const u8* bytes = archive->bytes + response->offset;
+	u64 size = response->headerSize + response->bodySize;
+	if (!request->keepAlive) {
+		uword keepAlivePrefixLength = strlen(assetArchiveKeepAlivePrefix);
+		httpOutputAppend(output, strlen(assetArchiveClosePrefix), assetArchiveClosePrefix);
+		bytes += keepAlivePrefixLength;
+		size -= keepAlivePrefixLength;
+	}
+	httpOutputAppendFileMemory(output, archive->file, bytes, size);
+	return 200;
+}
+
+// A file that is going into an archive.
+typedef struct PackedFile {
+	char* path;
+	FileInfo info;
+} PackedFile;
+
+typedef struct PackedFileList {
+	PackedFile* files;
+	uword count;
+	uword capacity;
+} PackedFileList;
+
+// Add every file under a directory to the list, including the files in its
+// subdirectories. path is the request path of the directory, ending in '/'.
+// Names that start with '.' are skipped.
+static b32 packCollectFiles(const char* rootDirectory, const char* path, PackedFileList* list) {
+	HttpStream* stream = directoryListingOpen(rootDirectory, stringSliceFromCString(path), FALSE);
+	if (!stream) {
+		fprintf(stderr, "[Pack] Failed to open directory '%s%s'\n", rootDirectory, path);
+		return FALSE;
+	}
+	DirectoryListing* listing = (DirectoryListing*) stream;
+	b32 success = TRUE;
+	const char* name;
+	b32 isDirectory;
+	while (success && directoryListingNextEntry(listing, &name, &isDirectory)) {
+		if (name[0] == '.') {
+			continue;
+		}
+		char childPath[FILE_CACHE_MAX_PATH_LENGTH];
+		int childPathLength = snprintf(childPath, sizeof(childPath), "%s%s%s", path, name, isDirectory ? "/" : "");
+		if (childPathLength < 0 || (uword) childPathLength >= sizeof(childPath)) {
+			fprintf(stderr, "[Pack] Path is too long: '%s%s'\n", path, name);
+			success = FALSE;
+			break;
+		}
+		if (isDirectory) {
+			success = packCollectFiles(rootDirectory, childPath, list);
+			continue;
+		}
+		char fullPath[FILE_CACHE_MAX_PATH_LENGTH];
+		snprintf(fullPath, sizeof(fullPath), "%s%s", rootDirectory, childPath);
+		FileInfo info;
+		if (!fileInfoGet(fullPath, &info)) {
+			// not a regular file
+			continue;
+		}
+		if (list->count == list->capacity) {
+			list->capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+			list->files = reallocSafe(list->files, list->capacity * sizeof(*list->files));
+		}
+		PackedFile* file = list->files + list->count;
+		++list->count;
+		file->path = checkOutOfMemory(malloc((uword) childPathLength + 1));
+		memcpy(file->path, childPath, (uword) childPathLength + 1);
+		file->info = info;
+	}
+	stream->destroy(stream);
+	return success;
+}
+
+static int packedFileCompare(const void* a, const void* b) {
+	return strcmp(((const PackedFile*) a)->path, ((const PackedFile*) b)->path);
+}
+
+static b32 packWrite(FILE* out, const void* bytes, uword byteCount) {
+	return fwrite(bytes, 1, byteCount, out) == byteCount;
+}
+
+// Pack every file under a directory into an archive for --archive. The
+// archive is written next to archivePath and then renamed over it, so a
+// server that is using the old archive never sees a partly written one.
+static int packAssets(const char* directory, const char* archivePath) {
+	PackedFileList list;
+	ClearValueToZero(list);
+	if (!packCollectFiles(directory, "/", &list)) {
+		return 1;
+	}
+	qsort(list.files, list.count, sizeof(*list.files), packedFileCompare);
+
+	// Build every response in memory first, since the index has to say where
+	// each one goes. Build outputs are small enough for that.
+	AssetArchiveEntry* entries = checkOutOfMemory(calloc(list.count ? list.count : 1, sizeof(*entries)));
+	u8* (*bodies)[FILE_ENCODING_COUNT] = checkOutOfMemory(calloc(list.count ? list.count : 1, sizeof(*bodies)));
+	char (*headers)[FILE_ENCODING_COUNT][HTTP_MAX_RESPONSE_HEADER_SIZE] =
+		checkOutOfMemory(calloc(list.count ? list.count : 1, sizeof(*headers)));
+	u64 offset = sizeof(AssetArchiveHeader) + list.count * sizeof(*entries);
+	for (uword i = 0; i < list.count; ++i) {
+		entries[i].pathOffset = offset;
+		entries[i].pathLength = strlen(list.files[i].path);
+		offset += entries[i].pathLength;
+	}
+
+	int result = 0;
+	u64 totalSizes[FILE_ENCODING_COUNT] = {0};
+	for (uword i = 0; i < list.count && result == 0; ++i) {
+		PackedFile* packed = list.files + i;
+		AssetArchiveEntry* entry = entries + i;
+		char fullPath[FILE_CACHE_MAX_PATH_LENGTH];
+		snprintf(fullPath, sizeof(fullPath), "%s%s", directory, packed->path);
+		StringSlice path = stringSliceFromCString(packed->path);
+		CachedFile* file = cachedFileOpen(fullPath, path, &packed->info);
+		u8* contents = file ? cachedFileLoadContents(file) : NULL;
+		if (!contents) {
+			fprintf(stderr, "[Pack] Failed to read '%s'\n", fullPath);
+			if (file) {
+				cachedFileRelease(file);
+			}
+			result = 1;
+			break;
+		}
+		u64 size = packed->info.size;
+		entry->contentHash = hashFnv1a64((uword) size, contents);
+		entry->lastModifiedTime = fileInfoUnixTime(&packed->info);
+		entry->compressible = file->mimeType->compressible;
+
+		bodies[i][FILE_ENCODING_IDENTITY] = checkOutOfMemory(malloc(size ? (uword) size : 1));
+		memcpy(bodies[i][FILE_ENCODING_IDENTITY], contents, (uword) size);
+		entry->responses[FILE_ENCODING_IDENTITY].bodySize = size;
+		if (entry->compressible && size >= FILE_CACHE_MIN_COMPRESS_SIZE) {
+			u8* compressed;
+			uword compressedSize;
+			gzipCompress(contents, (uword) size, &compressed, &compressedSize);
+			if (compressedSize < size) {
+				bodies[i][FILE_ENCODING_GZIP] = compressed;
+				entry->responses[FILE_ENCODING_GZIP].bodySize = compressedSize;
+			} else {
+				free(compressed);
+			}
+		}
+		cachedFileUnloadContents(contents);
+
+		for (u32 encoding = 0; encoding < FILE_ENCODING_COUNT; ++encoding) {
+			AssetArchiveResponse* response = entry->responses + encoding;
+			if (!bodies[i][encoding]) {
+				continue;
+			}
+			char etag[32];
+			assetArchiveFormatEtag(entry, encoding, etag, sizeof(etag));
+			char extraHeaders[256];
+			snprintf(
+				extraHeaders, sizeof(extraHeaders),
+				"ETag: %s\r\n"
+				"Last-Modified: %s\r\n"
+				"%s%s",
+				etag, file->lastModified,
+				(encoding == FILE_ENCODING_GZIP) ? "Content-Encoding: gzip\r\n" : "",
+				entry->compressible ? "Vary: Accept-Encoding\r\n" : "");
+			response->headerSize = httpFormatResponseHeader(
+				headers[i][encoding], sizeof(headers[i][encoding]), "200 OK", response->bodySize,
+				file->mimeType->contentType, extraHeaders, TRUE);
+			response->offset = offset;
+			offset += response->headerSize + response->bodySize;
+			totalSizes[encoding] += response->bodySize;
+		}
+		cachedFileRelease(file);
+	}
+
+	char temporaryPath[FILE_CACHE_MAX_PATH_LENGTH];
+	snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", archivePath);
+	FILE* out = NULL;
+	if (result == 0) {
+		out = fopen(temporaryPath, "wb");
+		if (!out) {
+			fprintf(stderr, "[Pack] Failed to create '%s'\n", temporaryPath);
+			result = 1;
+		}
+	}
+	if (out) {
+		AssetArchiveHeader header;
+		ClearValueToZero(header);
+		memcpy(header.magic, ASSET_ARCHIVE_MAGIC, sizeof(header.magic));
+		header.entryCount = list.count;
+		header.size = offset;
+		b32 written = packWrite(out, &header, sizeof(header)) && packWrite(out, entries, list.count * sizeof(*entries));
+		for (uword i = 0; i < list.count && written; ++i) {
+			written = packWrite(out, list.files[i].path, (uword) entries[i].pathLength);
+		}
+		for (uword i = 0; i < list.count && written; ++i) {
+			for (u32 encoding = 0; encoding < FILE_ENCODING_COUNT && written; ++encoding) {
+				const AssetArchiveResponse* response = entries[i].responses + encoding;
+				if (bodies[i][encoding]) {
+					written =
+						packWrite(out, headers[i][encoding], (uword) response->headerSize) &&
+						packWrite(out, bodies[i][encoding], (uword) response->bodySize);
+				}
+			}
+		}
+		written &= fclose(out) == 0;
+#ifdef _WIN32
+		b32 renamed = written && MoveFileExA(temporaryPath, archivePath, MOVEFILE_REPLACE_EXISTING);
+#else
+		b32 renamed = written && rename(temporaryPath, archivePath) == 0;
+#endif
+		if (renamed) {
+			printf(
+				"[Pack] Packed %llu files into '%s': %llu bytes of files, %llu bytes gzip-compressed, %llu bytes in all\n",
+				(unsigned long long) list.count, archivePath,
+				(unsigned long long) totalSizes[FILE_ENCODING_IDENTITY],
+				(unsigned long long) totalSizes[FILE_ENCODING_GZIP], (unsigned long long) offset);
+		} else {
+			fprintf(stderr, "[Pack] Failed to write '%s'\n", archivePath);
+			remove(temporaryPath);
+			result = 1;
+		}
+	}
+
+	for (uword i = 0; i < list.count; ++i) {
+		free(list.files[i].path);
+		for (u32 encoding = 0; encoding < FILE_ENCODING_COUNT; ++encoding) {
+			free(bodies[i][encoding]);
+		}
+	}
+	free(list.files);
+	free(entries);
+	free(bodies);
+	free(headers);
+	return result;
+}
+
+inline static u32 rotateLeft32(u32 value, u32 count) {
+	return (value << count) | (value >> (32 - count));
+}
+
+// SHA-1 of a short message. The WebSocket handshake requires it; nothing else
+// uses it, and nothing relies on it being secure.
+static void sha1(uword byteCount, const void* bytes, u8* digest) {
+	const u8* input = bytes;
+	u32 state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	// the message is followed by a 1 bit, zeroes, and its length in bits, up
+	// to a whole number of 64-byte blocks
+	u64 bitCount = (u64) byteCount * 8;
+	uword paddedCount = (byteCount + 9 + 63) & ~(uword) 63;
+	for (uword blockStart = 0; blockStart < paddedCount; blockStart += 64) {
+		u8 block[64];
+		for (uword i = 0; i < 64; ++i) {
+			uword index = blockStart + i;
+			if (index < byteCount) {
+				block[i] = input[index];
+			} else if (index == byteCount) {
+				block[i] = 0x80;
+			} else if (index >= paddedCount - 8) {
+				block[i] = (u8) (bitCount >> (8 * (paddedCount - 1 - index)));
+			} else {
+				block[i] = 0;
+			}
+		}
+		u32 words[80];
+		for (u32 i = 0; i < 16; ++i) {
+			const u8* word = block + 4 * i;
+			words[i] = (u32) word[0] << 24 | (u32) word[1] << 16 | (u32) word[2] << 8 | (u32) word[3];
+		}
+		for (u32 i = 16; i < 80; ++i) {
+			words[i] = rotateLeft32(words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+		}
+		u32 a = state[0];
+		u32 b = state[1];
+		u32 c = state[2];
+		u32 d = state[3];
+		u32 e = state[4];
+		for (u32 i = 0; i < 80; ++i) {
+			u32 f;
+			u32 k;
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+			u32 temp = rotateLeft32(a, 5) + f + e + k + words[i];
+			e = d;
+			d = c;
+			c = rotateLeft32(b, 30);
+			b = a;
+			a = temp;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+	for (u32 i = 0; i < 5; ++i) {
+		digest[4 * i + 0] = (u8) (state[i] >> 24);
+		digest[4 * i + 1] = (u8) (state[i] >> 16);
+		digest[4 * i + 2] = (u8) (state[i] >> 8);
+		digest[4 * i + 3] = (u8) state[i];
+	}
+}
+
+// Encode bytes as base64, with padding. text needs room for 4 characters for
+// every 3 bytes, rounded up, and a terminating zero. Returns the length of the
+// text.
+static uword base64Encode(uword byteCount, const u8* bytes, char* text) {
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uword length = 0;
+	for (uword i = 0; i < byteCount; i += 3) {
+		uword remaining = byteCount - i;
+		u32 group = (u32) bytes[i] << 16;
+		if (remaining > 1) {
+			group |= (u32) bytes[i + 1] << 8;
+		}
+		if (remaining > 2) {
+			group |= bytes[i + 2];
+		}
+		text[length++] = digits[(group >> 18) & 63];
+		text[length++] = digits[(group >> 12) & 63];
+		text[length++] = (remaining > 1) ? digits[(group >> 6) & 63] : '=';
+		text[length++] = (remaining > 2) ? digits[group & 63] : '=';
+	}
+	text[length] = '\0';
+	return length;
+}
+
+// Check that text is well-formed UTF-8, which the WebSocket protocol requires
+// of text messages: no overlong encodings, surrogates, or code points past
+// U+10FFFF.
+static b32 utf8Valid(uword byteCount, const u8* bytes) {
+	uword i = 0;
+	while (i < byteCount) {
+		u8 lead = bytes[i];
+		if (lead < 0x80) {
+			++i;
+			continue;
+		}
+		u32 length;
+		u32 codePoint;
+		u32 minCodePoint;
+		if ((lead & 0xE0) == 0xC0) {
+			length = 2;
+			codePoint = lead & 0x1F;
+			minCodePoint = 0x80;
+		} else if ((lead & 0xF0) == 0xE0) {
+			length = 3;
+			codePoint = lead & 0x0F;
+			minCodePoint = 0x800;
+		} else if ((lead & 0xF8) == 0xF0) {
+			length = 4;
+			codePoint = lead & 0x07;
+			minCodePoint = 0x10000;
+		} else {
+			return FALSE;
+		}
+		if (byteCount - i < length) {
+			return FALSE;
+		}
+		for (u32 j = 1; j < length; ++j) {
+			u8 continuation = bytes[i + j];
+			if ((continuation & 0xC0) != 0x80) {
+				return FALSE;
+			}
+			codePoint = (codePoint << 6) | (continuation & 0x3F);
+		}
+		if (codePoint < minCodePoint || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) {
+			return FALSE;
+		}
+		i += length;
+	}
+	return TRUE;
+}
+
+// The WebSocket protocol (RFC 6455). A client asks to switch a connection over
+// with an ordinary GET request, which is answered with "101 SWITCHING
+// PROTOCOLS"; from then on, both sides send frames. Frames from clients are
+// masked with a key that changes from frame to frame, and frames from the
+// server are not.
+typedef enum WebSocketOpcode {
+	WEBSOCKET_OPCODE_CONTINUATION = 0x0,
+	WEBSOCKET_OPCODE_TEXT = 0x1,
+	WEBSOCKET_OPCODE_BINARY = 0x2,
+	WEBSOCKET_OPCODE_CLOSE = 0x8,
+	WEBSOCKET_OPCODE_PING = 0x9,
+	WEBSOCKET_OPCODE_PONG = 0xA,
+} WebSocketOpcode;
+
+// status codes sent in close frames
+#define WEBSOCKET_CLOSE_NORMAL 1000
+#define WEBSOCKET_CLOSE_PROTOCOL_ERROR 1002
+#define WEBSOCKET_CLOSE_INVALID_DATA 1007
+#define WEBSOCKET_CLOSE_MESSAGE_TOO_BIG 1009
+
+#define WEBSOCKET_MAX_FRAME_HEADER_SIZE 14
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD_SIZE 125
+// A frame from a client has to fit in the connection's input buffer, and a
+// message that is split into several frames is put back together in an arena
+// chunk, so this is as long as a message from a client can be.
+#define WEBSOCKET_MAX_MESSAGE_SIZE (HTTP_BUFFER_CAPACITY - WEBSOCKET_MAX_FRAME_HEADER_SIZE)
+
+// the length of Sec-WebSocket-Key, which is 16 bytes in base64
+#define WEBSOCKET_KEY_LENGTH 24
+// room for Sec-WebSocket-Accept, which is 20 bytes in base64
+#define WEBSOCKET_ACCEPT_SIZE 29
+
+static const char webSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Work out the Sec-WebSocket-Accept value that proves to the client that the
+// server understood its handshake. The key must be WEBSOCKET_KEY_LENGTH long.
+static void webSocketAcceptKey(StringSlice key, char* accept) {
+	assert(stringSliceLength(key) == WEBSOCKET_KEY_LENGTH);
+	u8 text[WEBSOCKET_KEY_LENGTH + sizeof(webSocketGuid) - 1];
+	memcpy(text, key.begin, WEBSOCKET_KEY_LENGTH);
+	memcpy(text + WEBSOCKET_KEY_LENGTH, webSocketGuid, sizeof(webSocketGuid) - 1);
+	u8 digest[20];
+	sha1(sizeof(text), text, digest);
+	base64Encode(sizeof(digest), digest, accept);
+}
+
+typedef struct WebSocketFrame {
+	b32 final;
+	// the three bits reserved for extensions, none of which are supported
+	u32 reserved;
+	WebSocketOpcode opcode;
+	b32 masked;
+	u8 mask[4];
+	u64 payloadSize;
+	uword headerSize;
+} WebSocketFrame;
+
+// Read the header of the frame at the start of bytes. Returns FALSE if not all
+// of it is there yet.
+static b32 webSocketParseFrameHeader(const u8* bytes, uword byteCount, WebSocketFrame* frame) {
+	if (byteCount < 2) {
+		return FALSE;
+	}
+	frame->final = (bytes[0] & 0x80) != 0;
+	frame->reserved = (bytes[0] >> 4) & 7;
+	frame->opcode = (WebSocketOpcode) (bytes[0] & 0x0F);
+	frame->masked = (bytes[1] & 0x80) != 0;
+	u32 lengthCode = bytes[1] & 0x7F;
+	uword lengthSize = (lengthCode == 127) ? 8 : (lengthCode == 126) ? 2 : 0;
+	frame->headerSize = 2 + lengthSize + (frame->masked ? 4 : 0);
+	if (byteCount < frame->headerSize) {
+		return FALSE;
+	}
+	frame->payloadSize = lengthCode;
+	if (lengthSize > 0) {
+		frame->payloadSize = 0;
+		for (uword i = 0; i < lengthSize; ++i) {
+			frame->payloadSize = (frame->payloadSize << 8) | bytes[2 + i];
+		}
+	}
+	if (frame->masked) {
+		memcpy(frame->mask, bytes + 2 + lengthSize, 4);
+	}
+	return TRUE;
+}
+
+// Write the header of an unmasked frame that is a whole message, and return
+// its length, which is at most WEBSOCKET_MAX_FRAME_HEADER_SIZE.
+static uword webSocketFormatFrameHeader(u8* header, WebSocketOpcode opcode, u64 payloadSize) {
+	header[0] = (u8) (0x80 | opcode);
+	if (payloadSize < 126) {
+		header[1] = (u8) payloadSize;
+		return 2;
+	}
+	if (payloadSize <= 0xFFFF) {
+		header[1] = 126;
+		header[2] = (u8) (payloadSize >> 8);
+		header[3] = (u8) payloadSize;
+		return 4;
+	}
+	header[1] = 127;
+	for (u32 i = 0; i < 8; ++i) {
+		header[2 + i] = (u8) (payloadSize >> (8 * (7 - i)));
+	}
+	return 10;
+}
+
+// Undo a client's masking in place, 8 bytes at a time.
+static void webSocketUnmask(u8* bytes, uword byteCount, const u8* mask) {
+	u32 mask32;
+	memcpy(&mask32, mask, 4);
+	u64 mask64 = (u64) mask32 << 32 | mask32;
+	uword i = 0;
+	for (; i + 8 <= byteCount; i += 8) {
+		u64 word;
+		memcpy(&word, bytes + i, 8);
+		word ^= mask64;
+		memcpy(bytes + i, &word, 8);
+	}
+	for (; i < byteCount; ++i) {
+		bytes[i] ^= mask[i & 3];
+	}
+}
+
+// must be a power of two
+#define WEBSOCKET_HUB_CAPACITY (1 << 20)
+// so that a broadcast never takes up more than a small part of the hub
+#define WEBSOCKET_MAX_BROADCAST_SIZE (WEBSOCKET_HUB_CAPACITY / 4)
+
+typedef struct WebSocketHubWorker {
+	// the worker has WebSocket connections, so it wants to know about
+	// broadcasts
+	b32 wakeWanted;
+	// the worker has been woken up, and has not read the hub since
+	b32 wakePending;
+#ifndef _WIN32
+	int wakeFd;
+#endif
+} WebSocketHubWorker;
+
+// Binary and text messages that are broadcast to every WebSocket connection,
+// on every worker. A message is framed once, when it is broadcast, into a ring
+// that holds the frames back to back: byte n of everything ever broadcast is at
+// bytes[n % WEBSOCKET_HUB_CAPACITY]. Nothing is ever taken out of the ring.
+// Each worker remembers how far it has read, copies out what has been
+// broadcast since, and queues all of it on each of its connections in one go,
+// so a burst of messages goes out in one send. A worker that falls more than
+// the capacity behind skips ahead to the newest message. Broadcasting takes a
+// lock, but never allocates. On Linux, workers with WebSocket connections are
+// woken up through an eventfd when there is something new; on Windows, they
+// check every WEBSOCKET_POLL_MILLISECONDS instead.
+typedef struct WebSocketHub {
+	Mutex lock;
+	u8* bytes;
+	u64 writeCount;
+	WebSocketHubWorker* workers;
+	u32 workerCount;
+} WebSocketHub;
+
+#define WEBSOCKET_POLL_MILLISECONDS 5
+
+static b32 webSocketHubInit(WebSocketHub* hub, u32 workerCount) {
+	ClearValueToZero(*hub);
+	mutexInit(&hub->lock);
+	hub->bytes = checkOutOfMemory(malloc(WEBSOCKET_HUB_CAPACITY));
+	hub->workers = checkOutOfMemory(calloc(workerCount, sizeof(*hub->workers)));
+	hub->workerCount = workerCount;
+#ifndef _WIN32
+	for (u32 i = 0; i < workerCount; ++i) {
+		hub->workers[i].wakeFd = -1;
+	}
+	for (u32 i = 0; i < workerCount; ++i) {
+		hub->workers[i].wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (hub->workers[i].wakeFd == -1) {
+			fprintf(stderr, "[Server] eventfd() failed: %d\n", errno);
+			return FALSE;
+		}
+	}
+#endif
+	return TRUE;
+}
+
+static void webSocketHubDestroy(WebSocketHub* hub) {
+#ifndef _WIN32
+	for (u32 i = 0; i < hub->workerCount; ++i) {
+		if (hub->workers[i].wakeFd != -1) {
+			close(hub->workers[i].wakeFd);
+		}
+	}
+#endif
+	free(hub->workers);
+	free(hub->bytes);
+	mutexDestroy(&hub->lock);
+	ClearValueToZero(*hub);
+}
+
+static void webSocketHubWrite(WebSocketHub* hub, uword byteCount, const void* bytes) {
+	uword offset = (uword) (hub->writeCount & (WEBSOCKET_HUB_CAPACITY - 1));
+	uword firstCount = WEBSOCKET_HUB_CAPACITY - offset;
+	if (firstCount > byteCount) {
+		firstCount = byteCount;
+	}
+	memcpy(hub->bytes + offset, bytes, firstCount);
+	memcpy(hub->bytes, (const u8*) bytes + firstCount, byteCount - firstCount);
+	hub->writeCount += byteCount;
+}
+
+// Send a message to every WebSocket connection. This can be called from any
+// thread. Returns FALSE if the message is longer than
+// WEBSOCKET_MAX_BROADCAST_SIZE.
+static b32 webSocketHubBroadcast(WebSocketHub* hub, WebSocketOpcode opcode, uword byteCount, const void* bytes) {
+	if (byteCount > WEBSOCKET_MAX_BROADCAST_SIZE) {
+		return FALSE;
+	}
+	u8 header[WEBSOCKET_MAX_FRAME_HEADER_SIZE];
+	uword headerSize = webSocketFormatFrameHeader(header, opcode, byteCount);
+	mutexLock(&hub->lock);
+	webSocketHubWrite(hub, headerSize, header);
+	webSocketHubWrite(hub, byteCount, bytes);
+	// only wake up workers that are not already awake, so that a burst of
+	// messages costs each of them one wakeup
+	for (u32 i = 0; i < hub->workerCount; ++i) {
+		WebSocketHubWorker* worker = hub->workers + i;
+		if (!worker->wakeWanted || worker->wakePending) {
+			continue;
+		}
+		worker->wakePending = TRUE;
+#ifndef _WIN32
+		u64 one = 1;
+		if (write(worker->wakeFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+			fprintf(stderr, "[Server] waking worker %u failed: %d\n", i, errno);
+		}
+#endif
+	}
+	mutexUnlock(&hub->lock);
+	return TRUE;
+}
+
+// Start or stop waking a worker up for broadcasts. When a worker starts,
+// anything that was broadcast before is skipped.
+static void webSocketHubListen(WebSocketHub* hub, u32 workerIndex, b32 listen, u64* readCount) {
+	mutexLock(&hub->lock);
+	hub->workers[workerIndex].wakeWanted = listen;
+	hub->workers[workerIndex].wakePending = FALSE;
+	*readCount = hub->writeCount;
+	mutexUnlock(&hub->lock);
+}
+
+#ifndef _WIN32
+// Reset a worker's eventfd once it has woken up.
+static void webSocketHubClearWakeup(WebSocketHub* hub, u32 workerIndex) {
+	u64 count;
+	if (read(hub->workers[workerIndex].wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+		fprintf(stderr, "[Server] reading wakeups failed: %d\n", errno);
+	}
+}
+#endif
+
+// Copy everything broadcast since readCount to batch, which must have room
+// for WEBSOCKET_HUB_CAPACITY bytes, and return how much that is. The batch
+// always ends at the end of a frame. If the worker has fallen too far behind,
+// nothing is copied, and droppedByteCount says how much has been skipped.
+static uword webSocketHubRead(WebSocketHub* hub, u32 workerIndex, u64* readCount, u8* batch, u64* droppedByteCount) {
+	*droppedByteCount = 0;
+	mutexLock(&hub->lock);
+	hub->workers[workerIndex].wakePending = FALSE;
+	u64 byteCount = hub->writeCount - *readCount;
+	if (byteCount > WEBSOCKET_HUB_CAPACITY) {
+		*droppedByteCount = byteCount;
+		byteCount = 0;
+	} else {
+		uword offset = (uword) (*readCount & (WEBSOCKET_HUB_CAPACITY - 1));
+		uword firstCount = WEBSOCKET_HUB_CAPACITY - offset;
+		if (firstCount > byteCount) {
+			firstCount = (uword) byteCount;
+		}
+		memcpy(batch, hub->bytes + offset, firstCount);
+		memcpy(batch + firstCount, hub->bytes, (uword) byteCount - firstCount);
+	}
+	*readCount = hub->writeCount;
+	mutexUnlock(&hub->lock);
+	return (uword) byteCount;
+}
+
+// What a connection can be waiting for, each with its own time limit. A
+// connection that goes over the limit is closed, so that clients that are
+// idle, or that send or receive very slowly on purpose, cannot hold on to
+// connections and their buffers forever.
+typedef enum ConnectionTimeout {
+	// the header of a request, from its first byte, or from when the
+	// connection was opened
+	CONNECTION_TIMEOUT_HEADER,
+	// the body of a request, which is read and skipped
+	CONNECTION_TIMEOUT_BODY,
+	// the next request on a persistent connection
+	CONNECTION_TIMEOUT_IDLE,
+	// the client making room for more of a response; starts over whenever
+	// some of the response is sent
+	CONNECTION_TIMEOUT_WRITE,
+	// any frame from a WebSocket client; the first time this runs out, the
+	// client is sent a ping, and has as long again to answer
+	CONNECTION_TIMEOUT_WEBSOCKET,
+	CONNECTION_TIMEOUT_COUNT,
+} ConnectionTimeout;
+
+static const u32 connectionTimeoutMilliseconds[CONNECTION_TIMEOUT_COUNT] = {
+	10000, 30000, 15000, 30000, 30000,
+};
+
+static const char* connectionTimeoutNames[CONNECTION_TIMEOUT_COUNT] = {
+	"header", "body", "idle", "write", "websocket",
+};
+
+// How much the request log shows. Each level includes the ones before it.
+typedef enum LogLevel {
+	LOG_LEVEL_QUIET,
+	LOG_LEVEL_ERRORS,      // requests answered with a 4xx or 5xx status
+	LOG_LEVEL_REQUESTS,
+	LOG_LEVEL_CONNECTIONS, // connections being opened and closed
+} LogLevel;
+
+typedef enum LogRecordType {
+	LOG_RECORD_REQUEST,
+	LOG_RECORD_CONNECTION_OPENED,
+	LOG_RECORD_CONNECTION_CLOSED,
+	// status is the ConnectionTimeout
+	LOG_RECORD_CONNECTION_TIMED_OUT,
+	// from the compressor thread; byteCount is the compressed size
+	LOG_RECORD_FILE_COMPRESSED,
+	// status is the socket error and path the operation that failed
+	LOG_RECORD_CONNECTION_ERROR,
+} LogRecordType;
+
+#define LOG_RECORD_PATH_SIZE 36
+
+// Workers log what they do in fixed-size records, which a background thread
+// turns into text. A record takes one cache line.
+typedef struct LogRecord {
+	// timeNowNanoseconds() once the request was handled
+	u64 time;
+	// response bytes queued for the request, including the header, but not
+	// including any body that is generated while it is sent
+	u64 byteCount;
+	// nanoseconds spent handling the request, saturated at about 4 seconds
+	u32 latency;
+	u32 pathHash;
+	u16 status;
+	u8 type;
+	// the length of the whole path, saturated at 255; only the start of it is
+	// kept in path
+	u8 pathLength;
+	char path[LOG_RECORD_PATH_SIZE];
+} LogRecord;
+
+#define CACHE_LINE_SIZE 64
+// must be a power of two
+#define LOG_RING_CAPACITY 4096
+
+// The log thread sleeps while every ring is empty. It sets sleeping before it
+// looks at the rings for the last time, and a worker looks at sleeping after
+// it has added a record, with a full fence on both sides, so either the log
+// thread sees the record or the worker sees that it has to wake the thread.
+// The mutex makes sure that the wakeup cannot come between the log thread's
+// last look and its wait.
+typedef struct LogWakeup {
+	Mutex mutex;
+	Condition recordWritten;
+	volatile uword sleeping;
+} LogWakeup;
+
+// Records passed from one worker to the log thread, without locks: only the
+// worker moves head, and only the log thread moves tail. Each index is on its
+// own cache line, so the two threads only share one when there is something
+// to pass along. When the log thread falls behind and the ring fills up, new
+// records are counted and dropped rather than holding up the worker.
+typedef struct LogRing {
+	volatile uword head;
+	volatile uword droppedCount;
+	// the worker's last look at tail, so it does not have to read the log
+	// thread's cache line for every record
+	uword cachedTail;
+	LogWakeup* wakeup;
+	u8 headPadding[CACHE_LINE_SIZE - 4 * sizeof(uword)];
+	volatile uword tail;
+	uword reportedDroppedCount;
+	u8 tailPadding[CACHE_LINE_SIZE - 2 * sizeof(uword)];
+	LogRecord records[LOG_RING_CAPACITY];
+} LogRing;
+
+static void logRingWrite(LogRing* ring, const LogRecord* record) {
+	uword head = ring->head;
+	if (head - ring->cachedTail == LOG_RING_CAPACITY) {
+		ring->cachedTail = atomicLoadAcquire(&ring->tail);
+		if (head - ring->cachedTail == LOG_RING_CAPACITY) {
+			atomicStoreRelease(&ring->droppedCount, ring->droppedCount + 1);
+			return;
+		}
+	}
+	ring->records[head & (LOG_RING_CAPACITY - 1)] = *record;
+	atomicStoreRelease(&ring->head, head + 1);
+	atomicFence();
+	if (atomicLoadAcquire(&ring->wakeup->sleeping)) {
+		mutexLock(&ring->wakeup->mutex);
+		conditionSignal(&ring->wakeup->recordWritten);
+		mutexUnlock(&ring->wakeup->mutex);
+	}
+}
+
+static void logPathRecord(
+LogRing* ring, LogRecordType type, StringSlice path, u32 status, u64 byteCount, u64 startTime) {
+	LogRecord record;
+	record.time = timeNowNanoseconds();
+	record.byteCount = byteCount;
+	u64 latency = record.time - startTime;
+	record.latency = (latency > UINT32_MAX) ? UINT32_MAX : (u32) latency;
+	uword pathLength = stringSliceLength(path);
+	record.pathHash = hashFnv1a(pathLength, path.begin);
+	record.status = (u16) status;
+	record.type = (u8) type;
+	record.pathLength = (pathLength > 255) ? 255 : (u8) pathLength;
+	memcpy(record.path, path.begin, (pathLength < LOG_RECORD_PATH_SIZE) ? pathLength : LOG_RECORD_PATH_SIZE);
+	logRingWrite(ring, &record);
+}
+
+static void logRequest(
+LogRing* ring, StringSlice path, u32 status, u64 byteCount, u64 startTime) {
+	logPathRecord(ring, LOG_RECORD_REQUEST, path, status, byteCount, startTime);
+}
+
+static void logConnectionError(LogRing* ring, const char* operation, int error) {
+	u64 now = timeNowNanoseconds();
+	logPathRecord(ring, LOG_RECORD_CONNECTION_ERROR, stringSliceFromCString(operation), (u32) error, 0, now);
+}
+
+static void logConnectionEvent(LogRing* ring, LogRecordType type, u32 status) {
+	LogRecord record;
+	ClearValueToZero(record);
+	record.time = timeNowNanoseconds();
+	record.type = (u8) type;
+	record.status = (u16) status;
+	logRingWrite(ring, &record);
+}
+
+// The log thread, and one ring for each worker.
+typedef struct RequestLog {
+	LogLevel level;
+	LogRing* rings;
+	u32 ringCount;
+	// set once the workers have stopped, so the thread should write what is
+	// left and stop too
+	volatile uword stopping;
+	LogWakeup wakeup;
+	u64 startTime;
+	Thread thread;
+} RequestLog;
+
+static uword logRecordFormat(const RequestLog* log, u32 ringIndex, const LogRecord* record, char* text, uword capacity) {
+	double seconds = (double) (record->time - log->startTime) / 1e9;
+	int length;
+	if ((record->type == LOG_RECORD_REQUEST) | (record->type == LOG_RECORD_FILE_COMPRESSED)) {
+		// a path that did not fit in the record is told apart by its hash
+		uword pathLength = (record->pathLength < LOG_RECORD_PATH_SIZE) ? record->pathLength : LOG_RECORD_PATH_SIZE;
+		char hash[16] = "";
+		if (record->pathLength > LOG_RECORD_PATH_SIZE) {
+			snprintf(hash, sizeof(hash), "... #%08x", record->pathHash);
+		}
+		if (record->type == LOG_RECORD_REQUEST) {
+			length = snprintf(
+				text, capacity, "[Server] %12.6f worker %u: %u %.*s%s %llu bytes %.1f us\n",
+				seconds, ringIndex, record->status, (int) pathLength, record->path, hash,
+				(unsigned long long) record->byteCount, (double) record->latency / 1000.0);
+		} else {
+			length = snprintf(
+				text, capacity, "[Server] %12.6f compressor: %.*s%s to %llu bytes in %.1f ms\n",
+				seconds, (int) pathLength, record->path, hash,
+				(unsigned long long) record->byteCount, (double) record->latency / 1e6);
+		}
+	} else if (record->type == LOG_RECORD_CONNECTION_ERROR) {
+		uword operationLength = (record->pathLength < LOG_RECORD_PATH_SIZE) ? record->pathLength : LOG_RECORD_PATH_SIZE;
+		length = snprintf(
+			text, capacity, "[Server] %12.6f worker %u: %.*s failed: %u\n",
+			seconds, ringIndex, (int) operationLength, record->path, record->status);
+	} else if (record->type == LOG_RECORD_CONNECTION_TIMED_OUT) {
+		length = snprintf(
+			text, capacity, "[Server] %12.6f worker %u: connection timed out (%s)\n",
+			seconds, ringIndex, connectionTimeoutNames[record->status % CONNECTION_TIMEOUT_COUNT]);
+	} else {
+		length = snprintf(
+			text, capacity, "[Server] %12.6f worker %u: connection %s\n",
+			seconds, ringIndex, (record->type == LOG_RECORD_CONNECTION_OPENED) ? "opened" : "closed");
+	}
+	return (length > 0 && (uword) length < capacity) ? (uword) length : 0;
+}
+
+static b32 logRecordShown(LogLevel level, const LogRecord* record) {
+	if ((record->type == LOG_RECORD_CONNECTION_TIMED_OUT) | (record->type == LOG_RECORD_CONNECTION_ERROR)) {
+		return level >= LOG_LEVEL_ERRORS;
+	}
+	if (record->type == LOG_RECORD_FILE_COMPRESSED) {
+		return level >= LOG_LEVEL_REQUESTS;
+	}
+	if (record->type != LOG_RECORD_REQUEST) {
+		return level >= LOG_LEVEL_CONNECTIONS;
+	}
+	return (level >= LOG_LEVEL_REQUESTS) || (level >= LOG_LEVEL_ERRORS && record->status >= 400);
+}
+
+// Move everything in the rings to stdout. Returns FALSE if there was nothing.
+static b32 requestLogDrain(RequestLog* log) {
+	char text[64 * 1024];
+	uword textLength = 0;
+	b32 drainedAny = FALSE;
+	for (u32 i = 0; i < log->ringCount; ++i) {
+		LogRing* ring = log->rings + i;
+		uword tail = ring->tail;
+		uword head = atomicLoadAcquire(&ring->head);
+		drainedAny |= (tail != head);
+		for (; tail != head; ++tail) {
+			const LogRecord* record = ring->records + (tail & (LOG_RING_CAPACITY - 1));
+			if (!logRecordShown(log->level, record)) {
+				continue;
+			}
+			if (sizeof(text) - textLength < 512) {
+				fwrite(text, 1, textLength, stdout);
+				textLength = 0;
+			}
+			textLength += logRecordFormat(log, i, record, text + textLength, sizeof(text) - textLength);
+		}
+		atomicStoreRelease(&ring->tail, tail);
+
+		uword droppedCount = atomicLoadAcquire(&ring->droppedCount);
+		if (droppedCount != ring->reportedDroppedCount && log->level != LOG_LEVEL_QUIET) {
+			fprintf(
+				stderr, "[Server] Request log for worker %u fell behind; dropped %llu records\n",
+				i, (unsigned long long) (droppedCount - ring->reportedDroppedCount));
+			ring->reportedDroppedCount = droppedCount;
+		}
+	}
+	if (textLength > 0) {
+		fwrite(text, 1, textLength, stdout);
+		fflush(stdout);
+	}
+	return drainedAny;
+}
+
+static b32 requestLogEmpty(RequestLog* log) {
+	for (u32 i = 0; i < log->ringCount; ++i) {
+		LogRing* ring = log->rings + i;
+		if (atomicLoadAcquire(&ring->head) != ring->tail) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static int requestLogRun(void* param) {
+	RequestLog* log = param;
+	LogWakeup* wakeup = &log->wakeup;
+	for (;;) {
+		// read the flag first, so nothing written before it was set is missed
+		b32 stopping = atomicLoadAcquire(&log->stopping) != 0;
+		if (requestLogDrain(log)) {
+			continue;
+		}
+		if (stopping) {
+			return 0;
+		}
+		mutexLock(&wakeup->mutex);
+		atomicStoreRelease(&wakeup->sleeping, 1);
+		atomicFence();
+		if (requestLogEmpty(log) && !atomicLoadAcquire(&log->stopping)) {
+			conditionWait(&wakeup->recordWritten, &wakeup->mutex);
+		}
+		atomicStoreRelease(&wakeup->sleeping, 0);
+		mutexUnlock(&wakeup->mutex);
+	}
+}
+
+static b32 requestLogStart(RequestLog* log, LogLevel level, u32 ringCount) {
+	ClearValueToZero(*log);
+	log->level = level;
+	log->rings = checkOutOfMemory(calloc(ringCount, sizeof(*log->rings)));
+	log->ringCount = ringCount;
+	for (u32 i = 0; i < ringCount; ++i) {
+		log->rings[i].wakeup = &log->wakeup;
+	}
+	mutexInit(&log->wakeup.mutex);
+	conditionInit(&log->wakeup.recordWritten);
+	log->startTime = timeNowNanoseconds();
+	if (!threadStart(&log->thread, requestLogRun, log)) {
+		conditionDestroy(&log->wakeup.recordWritten);
+		mutexDestroy(&log->wakeup.mutex);
+		free(log->rings);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void requestLogStop(RequestLog* log) {
+	atomicStoreRelease(&log->stopping, 1);
+	mutexLock(&log->wakeup.mutex);
+	conditionSignal(&log->wakeup.recordWritten);
+	mutexUnlock(&log->wakeup.mutex);
+	threadJoin(&log->thread);
+	conditionDestroy(&log->wakeup.recordWritten);
+	mutexDestroy(&log->wakeup.mutex);
+	free(log->rings);
+}
+
+// The compressor thread: compress queued entries one at a time, oldest first,
+// and sleep while there are none. Once the cache is stopping, what is left in
+// the queue is dropped.
+static int gzipCacheRun(void* param) {
+	GzipCache* cache = param;
+	for (;;) {
+		mutexLock(&cache->mutex);
+		while (!cache->firstJob && !cache->stopping) {
+			conditionWait(&cache->jobQueued, &cache->mutex);
+		}
+		b32 stopping = cache->stopping;
+		GzipEntry* entry = cache->firstJob;
+		if (entry) {
+			cache->firstJob = entry->nextJob;
+			if (!cache->firstJob) {
+				cache->lastJob = NULL;
+			}
+		}
+		mutexUnlock(&cache->mutex);
+		if (!entry) {
+			return 0;
+		}
+		if (!stopping) {
+			u64 startTime = timeNowNanoseconds();
+			u64 compressedSize;
+			if (gzipEntryCompress(cache, entry, &compressedSize)) {
+				logPathRecord(
+					cache->log, LOG_RECORD_FILE_COMPRESSED, stringSliceFromCString(entry->path),
+					0, compressedSize, startTime);
+			}
+		}
+		gzipCacheRelease(cache, entry);
+	}
+}
+
+static b32 gzipCacheStart(GzipCache* cache, const char* rootDirectory, LogRing* log) {
+	ClearValueToZero(*cache);
+	cache->rootDirectory = rootDirectory;
+	cache->log = log;
+	mutexInit(&cache->mutex);
+	conditionInit(&cache->jobQueued);
+	if (!threadStart(&cache->thread, gzipCacheRun, cache)) {
+		conditionDestroy(&cache->jobQueued);
+		mutexDestroy(&cache->mutex);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Call once the workers have stopped, and so released their files.
+static void gzipCacheStop(GzipCache* cache) {
+	mutexLock(&cache->mutex);
+	cache->stopping = TRUE;
+	conditionSignal(&cache->jobQueued);
+	mutexUnlock(&cache->mutex);
+	threadJoin(&cache->thread);
+	for (uword i = 0; i < ArrayCount(cache->buckets); ++i) {
+		assert(!cache->buckets[i]);
+	}
+	conditionDestroy(&cache->jobQueued);
+	mutexDestroy(&cache->mutex);
+}
+
+// What a request was answered with, for the metrics.
+typedef enum MetricsRoute {
+	METRICS_ROUTE_FILE,
+	METRICS_ROUTE_ARCHIVE,
+	METRICS_ROUTE_DIRECTORY,
+	METRICS_ROUTE_INDEX,
+	METRICS_ROUTE_METRICS,
+	METRICS_ROUTE_WEBSOCKET,
+	// no route matched the request, or it could not be read
+	METRICS_ROUTE_UNMATCHED,
+	METRICS_ROUTE_COUNT,
+} MetricsRoute;
+
+static const char* metricsRouteNames[METRICS_ROUTE_COUNT] = {
+	"file", "archive", "directory", "index", "metrics", "websocket", "unmatched",
+};
+
+// Every status the server sends has its own counters, and anything else is
+// counted as "other".
+static const u32 metricsStatusCodes[] = {101, 200, 206, 304, 400, 404, 416, 426, 431, 501};
+#define METRICS_STATUS_COUNT (ArrayCount(metricsStatusCodes) + 1)
+
+static u32 metricsStatusIndex(u32 status) {
+	u32 index = 0;
+	while (index < ArrayCount(metricsStatusCodes) && metricsStatusCodes[index] != status) {
+		++index;
+	}
+	return index;
+}
+
+// Bucket i counts durations of at most 2^i microseconds, except for the last
+// one, which counts everything longer than that.
+#define METRICS_HISTOGRAM_BUCKET_COUNT 24
+
+typedef struct MetricsHistogram {
+	u64 counts[METRICS_HISTOGRAM_BUCKET_COUNT];
+	u64 totalNanoseconds;
+} MetricsHistogram;
+
+// Only the worker that owns a counter changes it, so a separate load and store
+// is enough to add to it.
+inline static void metricsAdd(u64* counter, u64 amount) {
+	atomicStoreRelaxed64(counter, atomicLoadRelaxed64(counter) + amount);
+}
+
+inline static void metricsSubtract(u64* counter, u64 amount) {
+	atomicStoreRelaxed64(counter, atomicLoadRelaxed64(counter) - amount);
+}
+
+static void metricsHistogramRecord(MetricsHistogram* histogram, u64 nanoseconds) {
+	u64 microseconds = nanoseconds / 1000;
+	u32 bucket = 0;
+	if (microseconds > 0) {
+		bucket = highestSetBit64(microseconds) + 1;
+		if (bucket >= METRICS_HISTOGRAM_BUCKET_COUNT) {
+			bucket = METRICS_HISTOGRAM_BUCKET_COUNT - 1;
+		}
+	}
+	metricsAdd(&histogram->counts[bucket], 1);
+	metricsAdd(&histogram->totalNanoseconds, nanoseconds);
+}
+
+// Counters for one worker. Only the worker writes to them, so it needs no
+// locks or read-modify-write operations, but a worker answering /metrics reads
+// every worker's counters while they change. Both sides therefore go through
+// relaxed atomic loads and stores, and the reader may see some counters
+// slightly out of date relative to others.
+typedef struct ServerMetrics {
+	// The workers' counters are allocated next to each other, so this keeps
+	// them from sharing a cache line with the previous worker's.
+	u8 padding[CACHE_LINE_SIZE];
+	u64 activeConnections;
+	u64 totalConnections;
+	u64 requests[METRICS_ROUTE_COUNT][METRICS_STATUS_COUNT];
+	u64 responseBytes[METRICS_ROUTE_COUNT][METRICS_STATUS_COUNT];
+	// from the start of a request until its header has been parsed
+	MetricsHistogram parseTimes[METRICS_ROUTE_COUNT];
+	// from queueing a response until the connection's output has been sent,
+	// which includes any responses to pipelined requests queued after it
+	MetricsHistogram sendTimes[METRICS_ROUTE_COUNT];
+	// the most bytes any connection has had buffered
+	u64 inputHighWaterMark;
+	u64 outputHighWaterMark;
+	// connections closed for going over a time limit
+	u64 timeouts[CONNECTION_TIMEOUT_COUNT];
+	u64 webSocketConnections;
+	u64 webSocketMessagesReceived;
+	// broadcast frames queued on WebSocket connections, and those that were
+	// not, because the connection was too far behind
+	u64 webSocketBroadcastBytes;
+	u64 webSocketDroppedBytes;
+} ServerMetrics;
+
+inline static void metricsNoteHighWaterMark(u64* highWaterMark, u64 size) {
+	if (size > atomicLoadRelaxed64(highWaterMark)) {
+		atomicStoreRelaxed64(highWaterMark, size);
+	}
+}
+
+// A growing buffer of text.
+typedef struct TextBuilder {
+	char* data;
+	uword size;
+	uword capacity;
+} TextBuilder;
+
+static void textBuilderPrintf(TextBuilder* builder, const char* format, ...) {
+	for (;;) {
+		va_list args;
+		va_start(args, format);
+		int length = vsnprintf(builder->data + builder->size, builder->capacity - builder->size, format, args);
+		va_end(args);
+		assert(length >= 0);
+		if (builder->size + (uword) length < builder->capacity) {
+			builder->size += (uword) length;
+			return;
+		}
+		builder->capacity = (builder->capacity == 0) ? 4096 : builder->capacity * 2;
+		builder->data = reallocSafe(builder->data, builder->capacity);
+	}
+}
+
+static void metricsFormatHistograms(
+TextBuilder* text, const char* name, const char* help, const MetricsHistogram* histograms) {
+	textBuilderPrintf(text, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	for (u32 route = 0; route < METRICS_ROUTE_COUNT; ++route) {
+		const MetricsHistogram* histogram = histograms + route;
+		u64 count = 0;
+		for (u32 bucket = 0; bucket < METRICS_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+			count += histogram->counts[bucket];
+		}
+		if (count == 0) {
+			continue;
+		}
+		const char* routeName = metricsRouteNames[route];
+		u64 cumulativeCount = 0;
+		for (u32 bucket = 0; bucket + 1 < METRICS_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+			cumulativeCount += histogram->counts[bucket];
+			textBuilderPrintf(
+				text, "%s_bucket{route=\"%s\",le=\"%.6f\"} %llu\n",
+				name, routeName, (double) ((u64) 1 << bucket) / 1e6, (unsigned long long) cumulativeCount);
+		}
+		textBuilderPrintf(
+			text,
+			"%s_bucket{route=\"%s\",le=\"+Inf\"} %llu\n"
+			"%s_sum{route=\"%s\"} %.9f\n"
+			"%s_count{route=\"%s\"} %llu\n",
+			name, routeName, (unsigned long long) count,
+			name, routeName, (double) histogram->totalNanoseconds / 1e9,
+			name, routeName, (unsigned long long) count);
+	}
+}
+
+// Add up the counters of all of the workers, in the Prometheus text format.
+static void metricsFormat(TextBuilder* text, const ServerMetrics* workerMetrics, u32 workerCount) {
+	ServerMetrics* total = checkOutOfMemory(calloc(1, sizeof(*total)));
+	for (u32 i = 0; i < workerCount; ++i) {
+		const ServerMetrics* metrics = workerMetrics + i;
+		total->activeConnections += atomicLoadRelaxed64(&metrics->activeConnections);
+		total->totalConnections += atomicLoadRelaxed64(&metrics->totalConnections);
+		for (u32 route = 0; route < METRICS_ROUTE_COUNT; ++route) {
+			for (u32 status = 0; status < METRICS_STATUS_COUNT; ++status) {
+				total->requests[route][status] += atomicLoadRelaxed64(&metrics->requests[route][status]);
+				total->responseBytes[route][status] += atomicLoadRelaxed64(&metrics->responseBytes[route][status]);
+			}
+			for (u32 bucket = 0; bucket < METRICS_HISTOGRAM_BUCKET_COUNT; ++bucket) {
+				total->parseTimes[route].counts[bucket] += atomicLoadRelaxed64(&metrics->parseTimes[route].counts[bucket]);
+				total->sendTimes[route].counts[bucket] += atomicLoadRelaxed64(&metrics->sendTimes[route].counts[bucket]);
+			}
+			total->parseTimes[route].totalNanoseconds += atomicLoadRelaxed64(&metrics->parseTimes[route].totalNanoseconds);
+			total->sendTimes[route].totalNanoseconds += atomicLoadRelaxed64(&metrics->sendTimes[route].totalNanoseconds);
+		}
+		for (u32 timeout = 0; timeout < CONNECTION_TIMEOUT_COUNT; ++timeout) {
+			total->timeouts[timeout] += atomicLoadRelaxed64(&metrics->timeouts[timeout]);
+		}
+		metricsNoteHighWaterMark(&total->inputHighWaterMark, atomicLoadRelaxed64(&metrics->inputHighWaterMark));
+		metricsNoteHighWaterMark(&total->outputHighWaterMark, atomicLoadRelaxed64(&metrics->outputHighWaterMark));
+		total->webSocketConnections += atomicLoadRelaxed64(&metrics->webSocketConnections);
+		total->webSocketMessagesReceived += atomicLoadRelaxed64(&metrics->webSocketMessagesReceived);
+		total->webSocketBroadcastBytes += atomicLoadRelaxed64(&metrics->webSocketBroadcastBytes);
+		total->webSocketDroppedBytes += atomicLoadRelaxed64(&metrics->webSocketDroppedBytes);
+	}
+
+	textBuilderPrintf(
+		text,
+		"# HELP http_server_connections_active Client connections that are open.\n"
+		"# TYPE http_server_connections_active gauge\n"
+		"http_server_connections_active %llu\n"
+		"# HELP http_server_connections_total Client connections accepted.\n"
+		"# TYPE http_server_connections_total counter\n"
+		"http_server_connections_total %llu\n",
+		(unsigned long long) total->activeConnections, (unsigned long long) total->totalConnections);
+	textBuilderPrintf(
+		text,
+		"# HELP http_server_timeouts_total Connections closed for going over a time limit.\n"
+		"# TYPE http_server_timeouts_total counter\n");
+	for (u32 timeout = 0; timeout < CONNECTION_TIMEOUT_COUNT; ++timeout) {
+		textBuilderPrintf(
+			text, "http_server_timeouts_total{timeout=\"%s\"} %llu\n",
+			connectionTimeoutNames[timeout], (unsigned long long) total->timeouts[timeout]);
+	}
+
+	const char* counterNames[2] = {"http_server_requests_total", "http_server_response_bytes_total"};
+	const char* counterHelp[2] = {"Requests answered.", "Response bytes queued, headers included."};
+	for (u32 counter = 0; counter < 2; ++counter) {
+		textBuilderPrintf(
+			text, "# HELP %s %s\n# TYPE %s counter\n",
+			counterNames[counter], counterHelp[counter], counterNames[counter]);
+		for (u32 route = 0; route < METRICS_ROUTE_COUNT; ++route) {
+			for (u32 status = 0; status < METRICS_STATUS_COUNT; ++status) {
+				u64 value = (counter == 0) ? total->requests[route][status] : total->responseBytes[route][status];
+				if (total->requests[route][status] == 0) {
+					continue;
+				}
+				char statusName[16] = "other";
+				if (status < ArrayCount(metricsStatusCodes)) {
+					snprintf(statusName, sizeof(statusName), "%u", metricsStatusCodes[status]);
+				}
+				textBuilderPrintf(
+					text, "%s{route=\"%s\",status=\"%s\"} %llu\n",
+					counterNames[counter], metricsRouteNames[route], statusName, (unsigned long long) value);
+			}
+		}
+	}
+
+	metricsFormatHistograms(
+		text, "http_server_parse_seconds", "Time spent parsing request headers.", total->parseTimes);
+	metricsFormatHistograms(
+		text, "http_server_send_seconds", "Time from queueing a response until it has been sent.", total->sendTimes);
+
+	textBuilderPrintf(
+		text,
+		"# HELP http_server_input_buffer_high_water_bytes The most request bytes a connection has had buffered.\n"
+		"# TYPE http_server_input_buffer_high_water_bytes gauge\n"
+		"http_server_input_buffer_high_water_bytes %llu\n"
+		"# HELP http_server_output_buffer_high_water_bytes The most response bytes a connection has had buffered.\n"
+		"# TYPE http_server_output_buffer_high_water_bytes gauge\n"
+		"http_server_output_buffer_high_water_bytes %llu\n",
+		(unsigned long long) total->inputHighWaterMark, (unsigned long long) total->outputHighWaterMark);
+	textBuilderPrintf(
+		text,
+		"# HELP http_server_websocket_connections_active WebSocket connections that are open.\n"
+		"# TYPE http_server_websocket_connections_active gauge\n"
+		"http_server_websocket_connections_active %llu\n"
+		"# HELP http_server_websocket_messages_received_total Messages received from WebSocket clients.\n"
+		"# TYPE http_server_websocket_messages_received_total counter\n"
+		"http_server_websocket_messages_received_total %llu\n"
+		"# HELP http_server_websocket_broadcast_bytes_total Broadcast bytes queued on WebSocket connections.\n"
+		"# TYPE http_server_websocket_broadcast_bytes_total counter\n"
+		"http_server_websocket_broadcast_bytes_total %llu\n"
+		"# HELP http_server_websocket_dropped_bytes_total Broadcast bytes skipped for connections that fell behind.\n"
+		"# TYPE http_server_websocket_dropped_bytes_total counter\n"
+		"http_server_websocket_dropped_bytes_total %llu\n",
+		(unsigned long long) total->webSocketConnections, (unsigned long long) total->webSocketMessagesReceived,
+		(unsigned long long) total->webSocketBroadcastBytes, (unsigned long long) total->webSocketDroppedBytes);
+	free(total);
+}
+
+#ifdef HTTP_SERVER_IO_URING
+// Per-connection state for the io_uring backend. The kernel uses a
+// connection's buffers while its operations are in flight, so a connection
+// is only released once it has no operations left.
+typedef struct IoRingConnection {
+	u32 pendingOpCount;
+	b32 sendPending;
+	// waiting for the socket to become readable or writable again, after an
+	// operation reported EAGAIN
+	b32 readPollPending;
+	b32 writePollPending;
+	b32 closing;
+	// which of the worker's registered receive buffers the connection's input
+	// uses, or -1 if it has an ordinary buffer
+	i32 fixedBufferIndex;
+	// the send in flight points at these
+	struct msghdr message;
+	SocketBuffer buffers[HTTP_OUTPUT_MAX_PENDING_SEGMENTS];
+} IoRingConnection;
+#endif
+
+// All of the state for one client. Each connection has its own buffers, so a
+// slow client only ever delays itself.
+typedef struct HttpConnection {
+	SOCKET socket;
+	HttpBuffer input;
+	HttpOutput output;
+	// the events this connection is currently registered for
+	b32 wantRead;
+	b32 wantWrite;
+	// set when a request asks for the connection to be closed; the connection
+	// is closed as soon as the queued responses have been sent
+	b32 closeAfterOutput;
+	// the body of the last response, if it is still being generated; no more
+	// requests are handled until it is finished
+	HttpStream* stream;
+	// when the oldest response that has not been completely sent was queued,
+	// and its route, for the metrics; 0 if everything has been sent
+	u64 sendStartTime;
+	MetricsRoute sendRoute;
+	// bytes of a request body that still have to be received and skipped
+	u64 requestBodyRemaining;
+	b32 handledRequest;
+	// The time limit that applies to what the connection is waiting for,
+	// when it started waiting, and when the limit runs out. Pushing the
+	// deadline back does not move the timer, which is rescheduled when it
+	// goes off instead.
+	ConnectionTimeout timeout;
+	u64 timeoutStartTime;
+	u64 deadline;
+	u64 lastSentByteCount;
+	Timer timer;
+	// Set once the connection has switched to the WebSocket protocol, and is
+	// in the worker's list of WebSocket connections. From then on, its input
+	// is frames instead of requests.
+	b32 webSocket;
+	b32 webSocketPingSent;
+	b32 webSocketCloseSent;
+	// a message that arrives in several frames is put back together here
+	ArenaChunk* webSocketMessage;
+	uword webSocketMessageSize;
+	WebSocketOpcode webSocketMessageOpcode;
+	struct HttpConnection* nextWebSocket;
+	struct HttpConnection** webSocketLink;
+#ifdef HTTP_SERVER_IO_URING
+	IoRingConnection ringState;
+#endif
+	struct HttpConnection* nextFree;
+} HttpConnection;
+
+typedef struct HttpServerOptions {
+	// If this is not NULL, files are served from this directory. Otherwise,
+	// the server only answers with a built-in index page.
+	const char* rootDirectory;
+	// If this is not NULL, files in this asset archive are served before any
+	// in the root directory.
+	const char* archivePath;
+	u32 threadCount;
+	// use io_uring instead of epoll, where the kernel supports it
+	b32 useIoRing;
+	// answer requests for directories without an index.html with a list of
+	// their files
+	b32 listDirectories;
+	LogLevel logLevel;
+} HttpServerOptions;
+
+typedef struct HttpServer {
+	const HttpServerOptions* options;
+	SOCKET listenSocket;
+	EventLoop loop;
+	// this worker's end of the request log
+	LogRing* log;
+	// every worker's metrics, this worker's first among them
+	ServerMetrics* metrics;
+	ServerMetrics* allMetrics;
+	u32 workerCount;
+	// a timer for each connection, for its current time limit
+	TimerWheel timers;
+	// files are only served if the cache has a root directory
+	FileCache files;
+	// the asset archive, if there is one, and when to check next whether it
+	// has been replaced
+	AssetArchive archive;
+	u64 archiveCheckTime;
+	// where connection buffers come from; a connection gives its chunks back
+	// when it is closed
+	ArenaPool memory;
+	// WebSocket broadcasts, which are shared with the other workers, and this
+	// worker's WebSocket connections, which get everything that is broadcast.
+	// hubReadCount is how far into the hub the worker has sent, and hubBatch
+	// is where broadcasts are copied out of the hub to.
+	WebSocketHub* hub;
+	u32 workerIndex;
+	HttpConnection* webSockets;
+	uword webSocketCount;
+	u64 hubReadCount;
+	u8* hubBatch;
+	// closed connections are kept here, so they can be reused
+	HttpConnection* freeConnections;
+	uword connectionCount;
+	// The built-in index page never changes, so its responses are only built
+	// once. There is one for persistent connections and one for others.
+	char indexEtag[16];
+	u8* indexResponses[2];
+	uword indexResponseSizes[2];
+#ifdef HTTP_SERVER_IO_URING
+	// only used when the worker runs on io_uring instead of the event loop
+	b32 useIoRing;
+	IoRing ring;
+	// registered with the ring, HTTP_BUFFER_CAPACITY bytes for each connection
+	u8* fixedBuffers;
+	uword fixedBuffersSize;
+	i32* freeFixedBuffers;
+	u32 freeFixedBufferCount;
+	// a timeout operation is queued, which waits for this long
+	b32 timerOpPending;
+	struct __kernel_timespec timerInterval;
+#endif
+} HttpServer;
+
+// Work out which time limit applies to a connection now, and make sure that
+// its timer goes off no later than the deadline. outputBusy is set if the
+// connection has output that has not been sent yet.
+static void httpServerUpdateTimeout(HttpServer* server, HttpConnection* connection, b32 outputBusy) {
+	ConnectionTimeout timeout;
+	if (outputBusy) {
+		timeout = CONNECTION_TIMEOUT_WRITE;
+	} else if (connection->webSocket) {
+		timeout = CONNECTION_TIMEOUT_WEBSOCKET;
+	} else if (connection->requestBodyRemaining > 0) {
+		timeout = CONNECTION_TIMEOUT_BODY;
+	} else if (httpBufferSize(&connection->input) > 0 || !connection->handledRequest) {
+		timeout = CONNECTION_TIMEOUT_HEADER;
+	} else {
+		timeout = CONNECTION_TIMEOUT_IDLE;
+	}
+	u64 sentByteCount = connection->output.sentByteCount;
+	b32 sendProgress = sentByteCount != connection->lastSentByteCount;
+	connection->lastSentByteCount = sentByteCount;
+	if (timeout == connection->timeout && !(timeout == CONNECTION_TIMEOUT_WRITE && sendProgress)) {
+		return;
+	}
+	connection->timeout = timeout;
+	connection->timeoutStartTime = timeNowNanoseconds();
+	connection->deadline = connection->timeoutStartTime + (u64) connectionTimeoutMilliseconds[timeout] * 1000000;
+
+	u64 expiryTick = timerWheelTickAt(&server->timers, connection->deadline);
+	Timer* timer = &connection->timer;
+	if (!timerScheduled(timer) || timer->expiryTick > expiryTick) {
+		timerWheelRemove(&server->timers, timer);
+		timerWheelAdd(&server->timers, timer, expiryTick);
+	}
+}
+
+static HttpConnection* httpServerAcquireConnection(HttpServer* server, SOCKET socket) {
+	HttpConnection* connection = server->freeConnections;
+	if (connection) {
+		server->freeConnections = connection->nextFree;
+	} else {
+		connection = checkOutOfMemory(calloc(1, sizeof(*connection)));
+		httpBufferInit(&connection->input, "Server", &server->memory);
+		arenaInit(&connection->output.arena, &server->memory);
+#ifdef HTTP_SERVER_IO_URING
+		connection->ringState.fixedBufferIndex = -1;
+#endif
+	}
+	httpBufferReset(&connection->input);
+//TODO it feels wrong to use the HTTP buffer's socket as the client socket
+	connection->input.socket = socket;
+	httpOutputReset(&connection->output);
+	connection->socket = socket;
+	connection->wantRead = TRUE;
+	connection->wantWrite = FALSE;
+	connection->closeAfterOutput = FALSE;
+	connection->stream = NULL;
+	connection->sendStartTime = 0;
+	connection->requestBodyRemaining = 0;
+	connection->handledRequest = FALSE;
+	connection->webSocket = FALSE;
+#ifdef HTTP_SERVER_IO_URING
+	IoRingConnection* ringState = &connection->ringState;
+	assert(ringState->fixedBufferIndex == -1);
+	ringState->pendingOpCount = 0;
+	ringState->sendPending = FALSE;
+	ringState->readPollPending = FALSE;
+	ringState->writePollPending = FALSE;
+	ringState->closing = FALSE;
+	if (server->useIoRing && !connection->input.data && server->freeFixedBufferCount > 0) {
+		--server->freeFixedBufferCount;
+		i32 index = server->freeFixedBuffers[server->freeFixedBufferCount];
+		ringState->fixedBufferIndex = index;
+		connection->input.data = server->fixedBuffers + (uword) index * HTTP_BUFFER_CAPACITY;
+	}
+#endif
+	connection->nextFree = NULL;
+	++server->connectionCount;
+	metricsAdd(&server->metrics->activeConnections, 1);
+	metricsAdd(&server->metrics->totalConnections, 1);
+	// a new connection is waiting for its first request header
+	connection->timeout = CONNECTION_TIMEOUT_COUNT;
+	connection->lastSentByteCount = connection->output.sentByteCount;
+	httpServerUpdateTimeout(server, connection, FALSE);
+	return connection;
+}
+
+// Switch a connection over to the WebSocket protocol, once the response to its
+// upgrade request has been queued.
+static void httpServerStartWebSocket(HttpServer* server, HttpConnection* connection) {
+	connection->webSocket = TRUE;
+	connection->webSocketPingSent = FALSE;
+	connection->webSocketCloseSent = FALSE;
+	connection->webSocketMessage = NULL;
+	connection->webSocketMessageSize = 0;
+	connection->nextWebSocket = server->webSockets;
+	if (connection->nextWebSocket) {
+		connection->nextWebSocket->webSocketLink = &connection->nextWebSocket;
+	}
+	connection->webSocketLink = &server->webSockets;
+	server->webSockets = connection;
+	if (server->webSocketCount == 0) {
+		webSocketHubListen(server->hub, server->workerIndex, TRUE, &server->hubReadCount);
+	}
+	++server->webSocketCount;
+	metricsAdd(&server->metrics->webSocketConnections, 1);
+}
+
+static void httpServerEndWebSocket(HttpServer* server, HttpConnection* connection) {
+	if (!connection->webSocket) {
+		return;
+	}
+	*connection->webSocketLink = connection->nextWebSocket;
+	if (connection->nextWebSocket) {
+		connection->nextWebSocket->webSocketLink = connection->webSocketLink;
+	}
+	connection->nextWebSocket = NULL;
+	connection->webSocketLink = NULL;
+	connection->webSocket = FALSE;
+	if (connection->webSocketMessage) {
+		arenaPoolGive(&server->memory, connection->webSocketMessage, connection->webSocketMessage, 1);
+		connection->webSocketMessage = NULL;
+	}
+	--server->webSocketCount;
+	metricsSubtract(&server->metrics->webSocketConnections, 1);
+	if (server->webSocketCount == 0) {
+		webSocketHubListen(server->hub, server->workerIndex, FALSE, &server->hubReadCount);
+	}
+}
+
+// Log a socket error, unless it only means that the client went away, which is
+// how many connections end. An error of 0 has been reported already.
+static void httpServerNoteSocketError(HttpServer* server, const char* operation, int error) {
+	if (error != 0 && !socketErrorDisconnected(error)) {
+		logConnectionError(server->log, operation, error);
+	}
+}
+
+static void httpServerCloseConnection(HttpServer* server, HttpConnection* connection) {
+	timerWheelRemove(&server->timers, &connection->timer);
+	httpServerEndWebSocket(server, connection);
+	SOCKET clientSocket = connection->socket;
+	b32 shutDown = connection->input.connectionClosed | connection->input.error;
+
+#ifdef HTTP_SERVER_IO_URING
+	if (server->useIoRing) {
+		IoRingConnection* ringState = &connection->ringState;
+		if (ringState->pendingOpCount > 0) {
+			// Operations in flight still refer to the connection, so it is
+			// released when the last one completes. Shutting the socket down
+			// in both directions makes them complete right away.
+			if (!ringState->closing) {
+				ringState->closing = TRUE;
+				if (!shutDown) {
+					shutdown(clientSocket, SHUT_RDWR);
+				}
+			}
+			return;
+		}
+		shutDown |= ringState->closing;
+		if (ringState->fixedBufferIndex >= 0) {
+			server->freeFixedBuffers[server->freeFixedBufferCount] = ringState->fixedBufferIndex;
+			++server->freeFixedBufferCount;
+			ringState->fixedBufferIndex = -1;
+			connection->input.data = NULL;
+		}
+	} else
+#endif
+	{
+		eventLoopRemove(&server->loop, clientSocket);
+	}
+
+	// shut down the client if the connection has not yet been closed
+	if (!shutDown) {
+		if (shutdown(clientSocket, SD_SEND) == SOCKET_ERROR) {
+			httpServerNoteSocketError(server, "shutdown()", WSAGetLastError());
+		}
+	}
+
+	logConnectionEvent(server->log, LOG_RECORD_CONNECTION_CLOSED, 0);
+	if (closesocket(clientSocket) == SOCKET_ERROR) {
+		httpServerNoteSocketError(server, "closesocket()", WSAGetLastError());
+	}
+
+	if (connection->stream) {
+		connection->stream->destroy(connection->stream);
+		connection->stream = NULL;
+	}
+	httpBufferRelease(&connection->input);
+	httpOutputRelease(&connection->output);
+	connection->socket = INVALID_SOCKET;
+	connection->input.socket = INVALID_SOCKET;
+	connection->nextFree = server->freeConnections;
+	server->freeConnections = connection;
+	--server->connectionCount;
+	metricsSubtract(&server->metrics->activeConnections, 1);
+}
+
+static void httpServerServiceConnection(HttpServer* server, HttpConnection* connection, const SocketEvent* event);
+#ifdef HTTP_SERVER_IO_URING
+static void ioRingServiceConnection(HttpServer* server, HttpConnection* connection);
+#endif
+
+// Start sending output that was queued on a connection by something other
+// than its own input, such as a broadcast.
+static void httpServerServiceOutput(HttpServer* server, HttpConnection* connection) {
+#ifdef HTTP_SERVER_IO_URING
+	if (server->useIoRing) {
+		ioRingServiceConnection(server, connection);
+		return;
+	}
+#endif
+	SocketEvent event = {connection, FALSE, FALSE};
+	httpServerServiceConnection(server, connection, &event);
+}
+
+static void webSocketQueueFrame(HttpOutput* output, WebSocketOpcode opcode, uword payloadSize, const void* payload) {
+	u8 header[WEBSOCKET_MAX_FRAME_HEADER_SIZE];
+	uword headerSize = webSocketFormatFrameHeader(header, opcode, payloadSize);
+	httpOutputAppend(output, headerSize, header);
+	httpOutputAppend(output, payloadSize, payload);
+}
+
+// Close the connections that have gone over their time limits, and
+// reschedule the timers of those whose deadlines have been pushed back.
+static void httpServerExpireTimeouts(HttpServer* server) {
+	u64 now = timeNowNanoseconds();
+	Timer* timer = timerWheelAdvance(&server->timers, now);
+	while (timer) {
+		Timer* next = timer->next;
+		HttpConnection* connection = (HttpConnection*) ((u8*) timer - offsetof(HttpConnection, timer));
+		if (connection->deadline > now) {
+			timerWheelAdd(&server->timers, timer, timerWheelTickAt(&server->timers, connection->deadline));
+		} else if (connection->timeout == CONNECTION_TIMEOUT_WEBSOCKET && !connection->webSocketPingSent) {
+			// a quiet WebSocket client may just have nothing to say, so
+			// check that it is still there
+			connection->webSocketPingSent = TRUE;
+			connection->deadline = now + (u64) connectionTimeoutMilliseconds[CONNECTION_TIMEOUT_WEBSOCKET] * 1000000;
+			timerWheelAdd(&server->timers, timer, timerWheelTickAt(&server->timers, connection->deadline));
+			webSocketQueueFrame(&connection->output, WEBSOCKET_OPCODE_PING, 0, NULL);
+			httpServerServiceOutput(server, connection);
+		} else {
+			metricsAdd(&server->metrics->timeouts[connection->timeout], 1);
+			logConnectionEvent(server->log, LOG_RECORD_CONNECTION_TIMED_OUT, connection->timeout);
+			httpServerCloseConnection(server, connection);
+		}
+		timer = next;
+	}
+}
+
+// Log and count a request once its response has been queued, and start timing
+// how long the response takes to send.
+static void httpServerNoteRequest(
+HttpServer* server, HttpConnection* connection, StringSlice url, MetricsRoute route, u32 status,
+u64 startTime, u64 parseTime, u64 startByteCount) {
+	ServerMetrics* metrics = server->metrics;
+	HttpOutput* output = &connection->output;
+	u64 byteCount = output->queuedByteCount - startByteCount;
+	u32 statusIndex = metricsStatusIndex(status);
+	metricsAdd(&metrics->requests[route][statusIndex], 1);
+	metricsAdd(&metrics->responseBytes[route][statusIndex], byteCount);
+	metricsHistogramRecord(&metrics->parseTimes[route], parseTime);
+	metricsNoteHighWaterMark(&metrics->outputHighWaterMark, output->size);
+	if (connection->sendStartTime == 0) {
+		connection->sendStartTime = timeNowNanoseconds();
+		connection->sendRoute = route;
+	}
+	logRequest(server->log, url, status, byteCount, startTime);
+}
+
+// Call when a connection has nothing left to send.
+static void httpServerNoteOutputSent(HttpServer* server, HttpConnection* connection) {
+	if (connection->sendStartTime != 0 && !connection->stream) {
+		u64 sendTime = timeNowNanoseconds() - connection->sendStartTime;
+		metricsHistogramRecord(&server->metrics->sendTimes[connection->sendRoute], sendTime);
+		connection->sendStartTime = 0;
+	}
+}
+
+static void httpServerQueueMetricsResponse(HttpServer* server, HttpOutput* output, b32 keepAlive) {
+	TextBuilder text;
+	ClearValueToZero(text);
+	metricsFormat(&text, server->allMetrics, server->workerCount);
+	httpQueueResponseHeader(
+		output, "200 OK", text.size, "text/plain; version=0.0.4; charset=utf-8",
+		"Cache-Control: no-store\r\n", keepAlive);
+	httpOutputAppend(output, text.size, text.data);
+	free(text.data);
+}
+
+// WebSocket clients connect to this path.
+static const char webSocketPath[] = "/ws";
+
+// Answer a request for webSocketPath, switching the connection over to the
+// WebSocket protocol if the request asks for it properly. Returns the status.
+static u32 httpServerQueueWebSocketUpgrade(HttpServer* server, HttpConnection* connection, const HttpRequest* request) {
+	HttpOutput* output = &connection->output;
+	if (!request->upgradeWebSocket || !stringSliceEqualsCString(&request->webSocketVersion, "13")) {
+		httpQueueStatusResponse(
+			output, "426 UPGRADE REQUIRED", "Upgrade: websocket\r\nSec-WebSocket-Version: 13\r\n", request->keepAlive);
+		return 426;
+	}
+	if (stringSliceLength(request->webSocketKey) != WEBSOCKET_KEY_LENGTH) {
+		httpQueueStatusResponse(output, "400 BAD REQUEST", "", request->keepAlive);
+		return 400;
+	}
+	char accept[WEBSOCKET_ACCEPT_SIZE];
+	webSocketAcceptKey(request->webSocketKey, accept);
+	char* header = httpOutputReserve(output, HTTP_MAX_RESPONSE_HEADER_SIZE);
+	int headerLength = snprintf(
+		header, HTTP_MAX_RESPONSE_HEADER_SIZE,
+		"HTTP/1.1 101 SWITCHING PROTOCOLS\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %s\r\n"
+		"\r\n",
+		accept);
+	assert(headerLength > 0 && headerLength < HTTP_MAX_RESPONSE_HEADER_SIZE);
+	httpOutputCommit(output, header, (uword) headerLength);
+	httpServerStartWebSocket(server, connection);
+	return 101;
+}
+
+// Send a close frame, unless one has been sent already, and close the
+// connection once it has gone out. The server closes the TCP connection
+// first, as the protocol suggests, without waiting for the client's reply.
+static void webSocketQueueClose(HttpConnection* connection, u32 statusCode) {
+	if (!connection->webSocketCloseSent) {
+		u8 payload[2] = {(u8) (statusCode >> 8), (u8) statusCode};
+		webSocketQueueFrame(&connection->output, WEBSOCKET_OPCODE_CLOSE, sizeof(payload), payload);
+		connection->webSocketCloseSent = TRUE;
+	}
+	connection->closeAfterOutput = TRUE;
+}
+
+// Pass a complete message from a client on to every WebSocket connection,
+// including the client's own. Returns a close status code if the message is
+// not valid, or 0.
+static u32 httpServerBroadcastMessage(HttpServer* server, WebSocketOpcode opcode, uword byteCount, const u8* bytes) {
+	if (opcode == WEBSOCKET_OPCODE_TEXT && !utf8Valid(byteCount, bytes)) {
+		return WEBSOCKET_CLOSE_INVALID_DATA;
+	}
+	metricsAdd(&server->metrics->webSocketMessagesReceived, 1);
+	b32 broadcast = webSocketHubBroadcast(server->hub, opcode, byteCount, bytes);
+	assert(broadcast); // client messages are never longer than WEBSOCKET_MAX_BROADCAST_SIZE
+	(void) broadcast;
+	return 0;
+}
+
+// Act on one unmasked frame from a client. Returns a close status code if the
+// frame breaks the protocol, or 0.
+static u32 httpServerHandleWebSocketFrame(
+HttpServer* server, HttpConnection* connection, const WebSocketFrame* frame, const u8* payload) {
+	uword payloadSize = (uword) frame->payloadSize;
+	switch (frame->opcode) {
+	case WEBSOCKET_OPCODE_PING:
+		webSocketQueueFrame(&connection->output, WEBSOCKET_OPCODE_PONG, payloadSize, payload);
+		return 0;
+	case WEBSOCKET_OPCODE_PONG:
+		return 0;
+	case WEBSOCKET_OPCODE_CLOSE:
+		// answer with the client's own status code
+		if (payloadSize == 1) {
+			return WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+		}
+		webSocketQueueClose(connection, (payloadSize >= 2) ? ((u32) payload[0] << 8 | payload[1]) : WEBSOCKET_CLOSE_NORMAL);
+		return 0;
+	case WEBSOCKET_OPCODE_TEXT:
+	case WEBSOCKET_OPCODE_BINARY:
+		if (connection->webSocketMessage) {
+			// the previous message has not been finished
+			return WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+		}
+		if (frame->final) {
+			return httpServerBroadcastMessage(server, frame->opcode, payloadSize, payload);
+		}
+		connection->webSocketMessage = arenaPoolTake(&server->memory);
+		connection->webSocketMessageOpcode = frame->opcode;
+		memcpy(connection->webSocketMessage->bytes, payload, payloadSize);
+		connection->webSocketMessageSize = payloadSize;
+		return 0;
+	case WEBSOCKET_OPCODE_CONTINUATION: {
+		ArenaChunk* message = connection->webSocketMessage;
+		if (!message) {
+			return WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+		}
+		if (payloadSize > WEBSOCKET_MAX_MESSAGE_SIZE - connection->webSocketMessageSize) {
+			return WEBSOCKET_CLOSE_MESSAGE_TOO_BIG;
+		}
+		memcpy((u8*) message->bytes + connection->webSocketMessageSize, payload, payloadSize);
+		connection->webSocketMessageSize += payloadSize;
+		if (!frame->final) {
+			return 0;
+		}
+		u32 result = httpServerBroadcastMessage(
+			server, connection->webSocketMessageOpcode, connection->webSocketMessageSize, (const u8*) message->bytes);
+		arenaPoolGive(&server->memory, message, message, 1);
+		connection->webSocketMessage = NULL;
+		connection->webSocketMessageSize = 0;
+		return result;
+	}
+	default:
+		return WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+	}
+}
+
+// Handle the complete frames in a WebSocket connection's input buffer. Each
+// frame is unmasked where it is, and a message that fits in one frame is
+// broadcast straight from the input buffer. Once something is wrong with the
+// input, a close frame is queued and nothing more is read.
+static void httpServerHandleWebSocketFrames(HttpServer* server, HttpConnection* connection) {
+	HttpBuffer* input = &connection->input;
+	while (!connection->closeAfterOutput && !httpOutputBacklogged(&connection->output)) {
+		uword byteCount = httpBufferSize(input);
+		if (byteCount == 0) {
+			break;
+		}
+		u8* bytes = input->data + input->readIndex;
+		WebSocketFrame frame;
+		if (!webSocketParseFrameHeader(bytes, byteCount, &frame)) {
+			break;
+		}
+		b32 control = (frame.opcode & 0x8) != 0;
+		u32 closeCode = 0;
+		if (!frame.masked || frame.reserved != 0) {
+			closeCode = WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+		} else if (control && (!frame.final || frame.payloadSize > WEBSOCKET_MAX_CONTROL_PAYLOAD_SIZE)) {
+			closeCode = WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+		} else if (frame.payloadSize > WEBSOCKET_MAX_MESSAGE_SIZE) {
+			closeCode = WEBSOCKET_CLOSE_MESSAGE_TOO_BIG;
+		} else if (byteCount - frame.headerSize < frame.payloadSize) {
+			// the rest of the frame has not arrived yet
+			break;
+		} else {
+			u8* payload = bytes + frame.headerSize;
+			webSocketUnmask(payload, (uword) frame.payloadSize, frame.mask);
+			closeCode = httpServerHandleWebSocketFrame(server, connection, &frame, payload);
+			httpBufferDiscardBytes(input, frame.headerSize + (uword) frame.payloadSize);
+			// hearing from the client at all pushes the deadline back
+			connection->webSocketPingSent = FALSE;
+			if (connection->timeout == CONNECTION_TIMEOUT_WEBSOCKET) {
+				connection->deadline = timeNowNanoseconds() +
+					(u64) connectionTimeoutMilliseconds[CONNECTION_TIMEOUT_WEBSOCKET] * 1000000;
+			}
+		}
+		if (closeCode != 0) {
+			webSocketQueueClose(connection, closeCode);
+		}
+	}
+}
+
+// A WebSocket connection that has more than this queued misses out on
+// broadcasts until it catches up, rather than making the server buffer more
+// and more for it.
+#define WEBSOCKET_MAX_PENDING_BYTES (256 * 1024)
+
+// Queue everything that has been broadcast since the last call on each of the
+// worker's WebSocket connections, and start sending it.
+static void httpServerSendBroadcasts(HttpServer* server) {
+	if (server->webSocketCount == 0) {
+		return;
+	}
+	if (!server->hubBatch) {
+		server->hubBatch = checkOutOfMemory(malloc(WEBSOCKET_HUB_CAPACITY));
+	}
+	ServerMetrics* metrics = server->metrics;
+	u64 droppedByteCount;
+	uword byteCount = webSocketHubRead(
+		server->hub, server->workerIndex, &server->hubReadCount, server->hubBatch, &droppedByteCount);
+	metricsAdd(&metrics->webSocketDroppedBytes, droppedByteCount * server->webSocketCount);
+	if (byteCount == 0) {
+		return;
+	}
+	HttpConnection* connection = server->webSockets;
+	while (connection) {
+		// sending can close the connection
+		HttpConnection* next = connection->nextWebSocket;
+		HttpOutput* output = &connection->output;
+		u64 pendingByteCount = output->queuedByteCount - output->sentByteCount;
+		if (connection->webSocketCloseSent || pendingByteCount > WEBSOCKET_MAX_PENDING_BYTES) {
+			metricsAdd(&metrics->webSocketDroppedBytes, byteCount);
+		} else {
+			httpOutputAppend(output, byteCount, server->hubBatch);
+			metricsAdd(&metrics->webSocketBroadcastBytes, byteCount);
+			httpServerServiceOutput(server, connection);
+		}
+		connection = next;
+	}
+}
+
+// Switch to a new asset archive if the file has been replaced since it was
+// last checked, which happens at most once a second. If the new archive
+// cannot be loaded, the old one stays in use.
+static void httpServerRefreshArchive(HttpServer* server, u64 now) {
+	if (now < server->archiveCheckTime) {
+		return;
+	}
+	server->archiveCheckTime = now + 1000000000;
+	FileInfo info;
+	const char* path = server->options->archivePath;
+	if (!fileInfoGet(path, &info) || fileInfosEqual(&info, &server->archive.file->info)) {
+		return;
+	}
+	AssetArchive archive;
+	if (assetArchiveOpen(&archive, path)) {
+		assetArchiveClose(&server->archive);
+		server->archive = archive;
+		printf("[Server] Loaded archive '%s' with %u files\n", path, archive.entryCount);
+	}
+}
+
+// Handle one complete request, queueing the response on the connection. A
+// request that cannot be parsed is answered with 400, or 501 for a method
+// other than GET or HEAD, and the connection is closed once that is sent: the
+// end of the request cannot be trusted, so neither can anything after it.
+static void httpServerHandleRequest(HttpServer* server, HttpConnection* connection, HttpHeader* header) {
+	u64 startTime = timeNowNanoseconds();
+	u64 startByteCount = connection->output.queuedByteCount;
+	HttpOutputMark responseStart = httpOutputMark(&connection->output);
+	HttpRequest request;
+	HttpParseResult parseResult = httpParseRequest(header, &request);
+	if (parseResult != HTTP_PARSE_OK) {
+		// the request line goes in the log in place of the URL
+		StringSlice requestLine = stringSlice(header->chars, scanForByte(header->chars, header->cursor, '\r'));
+		b32 unsupportedMethod = (parseResult == HTTP_PARSE_UNSUPPORTED_METHOD);
+		httpQueueStatusResponse(
+			&connection->output, unsupportedMethod ? "501 NOT IMPLEMENTED" : "400 BAD REQUEST", "", FALSE);
+		connection->closeAfterOutput = TRUE;
+		httpServerNoteRequest(
+			server, connection, requestLine, METRICS_ROUTE_UNMATCHED, unsupportedMethod ? 501 : 400,
+			startTime, timeNowNanoseconds() - startTime, startByteCount);
+		return;
+	}
+	StringSlice url = request.url;
+	b32 keepAlive = request.keepAlive;
+	u64 parseTime = timeNowNanoseconds() - startTime;
+
+	// The metrics route comes before any files, so a file called "metrics"
+	// in the root directory cannot be fetched.
+	StringSlice urlPath = stringSlice(url.begin, scanForByte(url.begin, url.end, '?'));
+	char pathChars[FILE_CACHE_MAX_PATH_LENGTH];
+	StringSlice path = stringSlice(pathChars, pathChars);
+	b32 isDirectory = FALSE;
+	b32 validPath = httpUrlToFilePath(url, pathChars, sizeof(pathChars), &path, &isDirectory);
+	const AssetArchiveEntry* archiveEntry = NULL;
+	if (server->archive.file && validPath) {
+		httpServerRefreshArchive(server, startTime);
+		archiveEntry = assetArchiveFind(&server->archive, path);
+	}
+	MetricsRoute route = METRICS_ROUTE_UNMATCHED;
+	u32 status;
+	if (stringSliceEqualsCString(&urlPath, "/metrics")) {
+		route = METRICS_ROUTE_METRICS;
+		status = 200;
+		httpServerQueueMetricsResponse(server, &connection->output, keepAlive);
+	} else if (stringSliceEqualsCString(&urlPath, webSocketPath)) {
+		route = METRICS_ROUTE_WEBSOCKET;
+		status = httpServerQueueWebSocketUpgrade(server, connection, &request);
+		if (status == 101) {
+			// whatever follows the request is frames
+			keepAlive = TRUE;
+			request.contentLength = 0;
+		}
+	} else if (archiveEntry) {
+		route = METRICS_ROUTE_ARCHIVE;
+		status = httpQueueArchiveResponse(&connection->output, &server->archive, archiveEntry, &request);
+	} else if (server->files.rootDirectory) {
+		CachedFile* file = NULL;
+		HttpStream* listing = NULL;
+		if (validPath) {
+			file = fileCacheGet(&server->files, path);
+		}
+		if (!file && isDirectory && server->options->listDirectories) {
+			StringSlice directoryPath = stringSlice(path.begin, path.end - strlen(httpIndexFileName));
+			listing = directoryListingOpen(server->files.rootDirectory, directoryPath, request.acceptsChunked);
+		}
+		if (file) {
+			route = METRICS_ROUTE_FILE;
+			status = httpQueueFileResponse(&connection->output, file, &request);
+			cachedFileRelease(file);
+		} else if (listing) {
+			route = METRICS_ROUTE_DIRECTORY;
+			status = 200;
+			keepAlive &= listing->chunked;
+			httpQueueResponseHeader(
+				&connection->output, "200 OK",
+				listing->chunked ? HTTP_CONTENT_LENGTH_CHUNKED : HTTP_CONTENT_LENGTH_UNTIL_CLOSE,
+				"text/html; charset=utf-8", "", keepAlive);
+			if (request.head) {
+				listing->destroy(listing);
+			} else {
+				connection->stream = listing;
+			}
+		} else {
+			status = 404;
+			httpQueueStatusResponse(&connection->output, "404 NOT FOUND", "", keepAlive);
+		}
+	} else {
+		b32 indexFileRequested =
+			stringSliceEmpty(url) ||
+			stringSliceEqualsCString(&url, "/") ||
+			stringSliceEqualsCString(&url, "/index.html");
+		if (indexFileRequested) {
+			route = METRICS_ROUTE_INDEX;
+		}
+		if (indexFileRequested && httpRequestIsNotModified(&request, server->indexEtag, 0)) {
+			status = 304;
+			httpQueueNotModifiedResponse(&connection->output, server->indexEtag, NULL, "", keepAlive);
+		} else if (indexFileRequested) {
+			status = 200;
+			httpOutputAppend(
+				&connection->output, server->indexResponseSizes[keepAlive], server->indexResponses[keepAlive]);
+		} else {
+			status = 404;
+			httpQueueStatusResponse(&connection->output, "404 NOT FOUND", "", keepAlive);
+		}
+	}
+	if (request.head) {
+		httpOutputDropBody(&connection->output, responseStart);
+	}
+	connection->closeAfterOutput = !keepAlive;
+	connection->requestBodyRemaining = keepAlive ? request.contentLength : 0;
+	connection->handledRequest = TRUE;
+	httpServerNoteRequest(server, connection, url, route, status, startTime, parseTime, startByteCount);
+}
+
+static void httpServerAcceptConnections(HttpServer* server) {
+	for (;;) {
+		SOCKET clientSocket = accept(server->listenSocket, NULL, NULL);
+		if (clientSocket == INVALID_SOCKET) {
+			int error = WSAGetLastError();
+			if (!socketErrorWouldBlock(error)) {
+				fprintf(stderr, "[Server] accept() failed: %d\n", error);
+			}
+			return;
+		}
+		if (!socketSetNonBlocking(clientSocket)) {
+			fprintf(stderr, "[Server] failed to make client socket non-blocking: %d\n", WSAGetLastError());
+			closesocket(clientSocket);
+			continue;
+		}
+		HttpConnection* connection = httpServerAcquireConnection(server, clientSocket);
+		if (!eventLoopAdd(&server->loop, clientSocket, connection, TRUE, FALSE)) {
+			closesocket(clientSocket);
+			timerWheelRemove(&server->timers, &connection->timer);
+			connection->nextFree = server->freeConnections;
+			server->freeConnections = connection;
+			--server->connectionCount;
+			metricsSubtract(&server->metrics->activeConnections, 1);
+			continue;
+		}
+		logConnectionEvent(server->log, LOG_RECORD_CONNECTION_OPENED, 0);
+	}
+}
+
+// Handle the complete requests in a connection's input buffer, in order, until
+// the buffer runs out of complete requests or the output backs up. A response
+// that is being generated is continued first.
+static void httpServerHandleRequests(HttpServer* server, HttpConnection* connection) {
+	HttpBuffer* input = &connection->input;
+	for (;;) {
+		if (connection->webSocket) {
+			httpServerHandleWebSocketFrames(server, connection);
+			break;
+		}
+		connection->stream = httpStreamPump(connection->stream, &connection->output);
+		if (connection->stream || connection->closeAfterOutput || httpOutputBacklogged(&connection->output)) {
+			break;
+		}
+		if (connection->requestBodyRemaining > 0) {
+			uword byteCount = httpBufferSize(input);
+			if (byteCount > connection->requestBodyRemaining) {
+				byteCount = (uword) connection->requestBodyRemaining;
+			}
+			httpBufferDiscardBytes(input, byteCount);
+			connection->requestBodyRemaining -= byteCount;
+			if (connection->requestBodyRemaining > 0) {
+				break;
+			}
+		}
+		HttpHeader header;
+		if (!httpBufferFindHeader(input, &header)) {
+			if (input->headerTooLarge) {
+				u64 startTime = timeNowNanoseconds();
+				u64 startByteCount = connection->output.queuedByteCount;
+				httpQueueStatusResponse(&connection->output, "431 REQUEST HEADER FIELDS TOO LARGE", "", FALSE);
+				httpServerNoteRequest(
+					server, connection, stringSlice("", ""), METRICS_ROUTE_UNMATCHED, 431,
+					startTime, 0, startByteCount);
+				connection->closeAfterOutput = TRUE;
+			}
+			break;
+		}
+		httpServerHandleRequest(server, connection, &header);
+		httpBufferDiscardBytes(input, header.charCount);
+	}
+}
+
+// Make as much progress on a connection as possible without blocking: read
+// whatever the client has sent, queue responses for every complete request,
+// and send as much of the queued output as the socket will take.
+static void httpServerServiceConnection(HttpServer* server, HttpConnection* connection, const SocketEvent* event) {
+	HttpBuffer* input = &connection->input;
+	HttpOutput* output = &connection->output;
+
+	if (event->readable && connection->wantRead) {
+		httpBufferReadBytes(input);
+		if (input->error) {
+			httpServerNoteSocketError(server, "recv()", input->socketError);
+			httpServerCloseConnection(server, connection);
+			return;
+		}
+		metricsNoteHighWaterMark(&server->metrics->inputHighWaterMark, httpBufferSize(input));
+	}
+
+	// Pipelined requests may have been left in the input buffer while the
+	// output was backed up, so keep going for as long as the socket accepts
+	// everything that is queued.
+	for (;;) {
+		httpServerHandleRequests(server, connection);
+		b32 backlogged = httpOutputBacklogged(output);
+		int error;
+		if (!httpOutputFlush(output, connection->socket, &error)) {
+			httpServerNoteSocketError(server, "send()", error);
+			httpServerCloseConnection(server, connection);
+			return;
+		}
+		if (!backlogged || httpOutputPending(output)) {
+			break;
+		}
+	}
+
+	b32 outputPending = httpOutputPending(output);
+	if (!outputPending) {
+		httpServerNoteOutputSent(server, connection);
+	}
+	b32 doneReading = input->connectionClosed | connection->closeAfterOutput;
+	if (doneReading && !outputPending) {
+		httpServerCloseConnection(server, connection);
+		return;
+	}
+
+	b32 wantRead = !doneReading && !httpOutputBacklogged(output);
+	b32 wantWrite = outputPending;
+	if ((wantRead != connection->wantRead) | (wantWrite != connection->wantWrite)) {
+		connection->wantRead = wantRead;
+		connection->wantWrite = wantWrite;
+		if (!eventLoopModify(&server->loop, connection->socket, connection, wantRead, wantWrite)) {
+			httpServerCloseConnection(server, connection);
+			return;
+		}
+	}
+	httpServerUpdateTimeout(server, connection, outputPending);
+}
+
+// Create a non-blocking socket listening on the server port. With reusePort,
+// several sockets can listen on the same port at once, and the kernel spreads
+// incoming connections across them.
+static SOCKET httpServerOpenListenSocket(b32 reusePort) {
+	int wsResult;
+
+	addrinfo addrHints = {
+		.ai_flags = AI_PASSIVE,
+		.ai_family = AF_INET,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	};
+	addrinfo* addr;
+	wsResult = getaddrinfo(NULL, port, &addrHints, &addr);
+	if (wsResult != 0) {
+		fprintf(stderr, "[Server] getaddrinfo() failed: %d\n", wsResult);
+		return INVALID_SOCKET;
+	}
+
+	SOCKET listenSocket = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+	if (listenSocket == INVALID_SOCKET) {
+		fprintf(stderr, "[Server] socket() failed: %d\n", WSAGetLastError());
+		freeaddrinfo(addr);
+		return INVALID_SOCKET;
+	}
+
+#ifndef _WIN32
+	// allow restarting the server while old connections are in TIME_WAIT
+	int enable = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	if (reusePort && setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) {
+		fprintf(stderr, "[Server] setsockopt(SO_REUSEPORT) failed: %d\n", errno);
+		freeaddrinfo(addr);
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+#else
+	assert(!reusePort); // Windows workers share one listen socket instead
+#endif
+
+	wsResult = bind(listenSocket, addr->ai_addr, (int) addr->ai_addrlen);
+	freeaddrinfo(addr);
+	if (wsResult != 0) {
+		fprintf(stderr, "[Server] bind() failed: %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+
+	if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
+		fprintf(stderr, "[Server] listen() failed: %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+
+	if (!socketSetNonBlocking(listenSocket)) {
+		fprintf(stderr, "[Server] failed to make listen socket non-blocking: %d\n", WSAGetLastError());
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+
+	return listenSocket;
+}
+
+// Each worker runs a complete server: its own listen socket, event loop,
+// connections and file cache. Nothing is shared between workers while
+// requests are handled, so there are no locks to contend on. On Linux, each
+// worker listens on its own SO_REUSEPORT socket, and the kernel balances new
+// connections between them. Windows has no equivalent, so there all of the
+// workers poll one shared listen socket, and whichever accept() gets a
+// connection first handles it.
+typedef struct HttpServerWorker {
+	const HttpServerOptions* options;
+	// INVALID_SOCKET if the worker should open its own listen socket
+	SOCKET sharedListenSocket;
+	b32 reusePort;
+	LogRing* log;
+	ServerMetrics* allMetrics;
+	WebSocketHub* hub;
+	// NULL if there is no root directory
+	GzipCache* gzip;
+	u32 workerIndex;
+	u32 workerCount;
+	Thread thread;
+} HttpServerWorker;
+
+static void httpServerSerializeIndex(HttpServer* server) {
+	uword bodySize = strlen(index_html);
+	snprintf(
+		server->indexEtag, sizeof(server->indexEtag), "\"%08x\"",
+		hashFnv1a(bodySize, index_html));
+	char extraHeaders[64];
+	snprintf(extraHeaders, sizeof(extraHeaders), "ETag: %s\r\n", server->indexEtag);
+	for (u32 keepAlive = 0; keepAlive < 2; ++keepAlive) {
+		char header[HTTP_MAX_RESPONSE_HEADER_SIZE];
+		uword headerLength = httpFormatResponseHeader(
+			header, sizeof(header), "200 OK", bodySize,
+			"text/html; charset=utf-8", extraHeaders, keepAlive);
+		u8* response = checkOutOfMemory(malloc(headerLength + bodySize));
+		memcpy(response, header, headerLength);
+		memcpy(response + headerLength, index_html, bodySize);
+		server->indexResponses[keepAlive] = response;
+		server->indexResponseSizes[keepAlive] = headerLength + bodySize;
+	}
+}
+
+static int httpServerRunEventLoop(HttpServer* server) {
+	if (!eventLoopInit(&server->loop)) {
+		return 1;
+	}
+	// the listen socket is told apart from client connections by its user data
+	if (!eventLoopAdd(&server->loop, server->listenSocket, &server->listenSocket, TRUE, FALSE)) {
+		eventLoopDestroy(&server->loop);
+		return 1;
+	}
+#ifndef _WIN32
+	// file change notifications are told apart by their user data too
+	if (server->files.changeFd != -1 &&
+		!eventLoopAdd(&server->loop, server->files.changeFd, &server->files, TRUE, FALSE)) {
+		eventLoopDestroy(&server->loop);
+		return 1;
+	}
+	// and so are wakeups for WebSocket broadcasts
+	if (!eventLoopAdd(&server->loop, server->hub->workers[server->workerIndex].wakeFd, server->hub, TRUE, FALSE)) {
+		eventLoopDestroy(&server->loop);
+		return 1;
+	}
+#endif
+
+	SocketEvent events[256];
+
+//TODO provide some means of shutting down the server
+	for (;;)
+	{
+		// only wake up to check for timeouts while there are connections
+		int timeoutMillis = (server->timers.timerCount > 0) ? TIMER_WHEEL_TICK_MILLISECONDS : -1;
+#ifdef _WIN32
+//TODO wake workers up for broadcasts, instead of checking for them this often
+		if (server->webSocketCount > 0) {
+			timeoutMillis = WEBSOCKET_POLL_MILLISECONDS;
+		}
+#endif
+		iword eventCount = eventLoopWait(&server->loop, events, ArrayCount(events), timeoutMillis);
+		if (eventCount < 0) {
+			break;
+		}
+		for (iword i = 0; i < eventCount; ++i) {
+			SocketEvent* event = events + i;
+			if (event->userData == &server->listenSocket) {
+				httpServerAcceptConnections(server);
+#ifndef _WIN32
+			} else if (event->userData == &server->files) {
+				fileCacheProcessChanges(&server->files);
+			} else if (event->userData == server->hub) {
+				webSocketHubClearWakeup(server->hub, server->workerIndex);
+				httpServerSendBroadcasts(server);
+#endif
+			} else {
+				httpServerServiceConnection(server, event->userData, event);
+			}
+		}
+#ifdef _WIN32
+		httpServerSendBroadcasts(server);
+#endif
+		httpServerExpireTimeouts(server);
+	}
+
+	eventLoopDestroy(&server->loop);
+	return 1;
+}
+
+#ifdef HTTP_SERVER_IO_URING
+// The io_uring backend. Instead of waiting for a socket to become ready and
+// then making a system call for each receive and send, every connection keeps
+// a receive (and, while it has output, a send) queued in the ring. All of the
+// operations queued while handling one batch of completions are submitted
+// together by a single io_uring_enter(). Receives go straight into buffers
+// that are registered with the kernel up front. File contents still go out
+// with sendfile(), which io_uring cannot do without an intermediate pipe.
+//
+// The low bits of an operation's user data say what kind of operation it is;
+// the rest is the connection it belongs to, or NULL for the listen socket and
+// the file cache's change notifications.
+typedef enum IoRingOp {
+	IO_RING_OP_ACCEPT,
+	IO_RING_OP_RECEIVE,
+	IO_RING_OP_SEND,
+	IO_RING_OP_POLL_READ,
+	IO_RING_OP_POLL_WRITE,
+	// file change notifications have arrived
+	IO_RING_OP_FILE_CHANGES,
+	// a timer tick has passed
+	IO_RING_OP_TIMER,
+	// something has been broadcast to the WebSocket connections
+	IO_RING_OP_WAKEUP,
+} IoRingOp;
+
+#define IO_RING_OP_MASK 7
+#define IO_RING_ENTRY_COUNT 1024
+#define IO_RING_FIXED_BUFFER_COUNT 256
+// accepts kept queued on the listen socket, so a burst of new connections is
+// picked up in one batch
+#define IO_RING_ACCEPT_DEPTH 4
+
+static struct io_uring_sqe* ioRingQueueOp(HttpServer* server, HttpConnection* connection, IoRingOp op) {
+	assert(((uword) connection & IO_RING_OP_MASK) == 0);
+	struct io_uring_sqe* sqe = ioRingGetSqe(&server->ring);
+	sqe->user_data = (u64) (uword) connection | op;
+	if (connection) {
+		++connection->ringState.pendingOpCount;
+	}
+	return sqe;
+}
+
+static void ioRingQueueAccept(HttpServer* server) {
+	struct io_uring_sqe* sqe = ioRingQueueOp(server, NULL, IO_RING_OP_ACCEPT);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = server->listenSocket;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+static void ioRingQueuePoll(HttpServer* server, HttpConnection* connection, SOCKET socket, IoRingOp op) {
+	struct io_uring_sqe* sqe = ioRingQueueOp(server, connection, op);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = socket;
+	sqe->poll32_events = (op == IO_RING_OP_POLL_WRITE) ? POLLOUT : POLLIN;
+}
+
+static void ioRingQueueFileChangesPoll(HttpServer* server) {
+	if (server->files.changeFd != -1) {
+		ioRingQueuePoll(server, NULL, server->files.changeFd, IO_RING_OP_FILE_CHANGES);
+	}
+}
+
+static void ioRingQueueWakeupPoll(HttpServer* server) {
+	ioRingQueuePoll(server, NULL, server->hub->workers[server->workerIndex].wakeFd, IO_RING_OP_WAKEUP);
+}
+
+// Keep a timeout queued while there are timers, so that the worker wakes up
+// to close connections that have gone over their time limits.
+static void ioRingQueueTimer(HttpServer* server) {
+	if (server->timerOpPending || server->timers.timerCount == 0) {
+		return;
+	}
+	server->timerInterval.tv_sec = 0;
+	server->timerInterval.tv_nsec = (long long) TIMER_WHEEL_TICK_MILLISECONDS * 1000000;
+	struct io_uring_sqe* sqe = ioRingQueueOp(server, NULL, IO_RING_OP_TIMER);
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (u64) (uword) &server->timerInterval;
+	sqe->len = 1;
+	server->timerOpPending = TRUE;
+}
+
+static void ioRingQueueReceive(HttpServer* server, HttpConnection* connection) {
+	HttpBuffer* input = &connection->input;
+	u8* receivePointer;
+	uword remainingCapacity;
+	if (!httpBufferReserve(input, &receivePointer, &remainingCapacity)) {
+		return;
+	}
+	struct io_uring_sqe* sqe = ioRingQueueOp(server, connection, IO_RING_OP_RECEIVE);
+	if (connection->ringState.fixedBufferIndex >= 0) {
+		// all of the fixed buffers are registered as one region, index 0
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->buf_index = 0;
+	} else {
+		sqe->opcode = IORING_OP_RECV;
+	}
+	sqe->fd = connection->socket;
+	sqe->addr = (u64) (uword) receivePointer;
+	sqe->len = (u32) remainingCapacity;
+	input->receivePending = TRUE;
+}
+
+// Start sending a connection's queued output. Files are sent right away with
+// sendfile(); buffered segments are queued as a single vectored send. Returns
+// FALSE on a socket error.
+static b32 ioRingStartOutput(HttpServer* server, HttpConnection* connection) {
+	HttpOutput* output = &connection->output;
+	IoRingConnection* ringState = &connection->ringState;
+	while (httpOutputPending(output)) {
+		HttpOutputSegment* segment = output->segments + output->segmentIndex;
+		if (segment->type == HTTP_OUTPUT_SEGMENT_FILE) {
+			uword sentByteCount;
+			int error;
+			b32 success = cachedFileSendNonBlocking(
+				connection->socket, segment->file,
+				segment->offset + output->segmentSentCount,
+				segment->size - output->segmentSentCount,
+				&sentByteCount, &error);
+			if (!success) {
+				httpServerNoteSocketError(server, "sendfile()", error);
+				return FALSE;
+			}
+			if (sentByteCount == 0) {
+				ioRingQueuePoll(server, connection, connection->socket, IO_RING_OP_POLL_WRITE);
+				ringState->writePollPending = TRUE;
+				return TRUE;
+			}
+			httpOutputAdvance(output, sentByteCount);
+			continue;
+		}
+
+		b32 moreFollows;
+		uword bufferCount = httpOutputGatherBuffers(
+			output, ringState->buffers, ArrayCount(ringState->buffers), &moreFollows);
+		ClearValueToZero(ringState->message);
+		ringState->message.msg_iov = ringState->buffers;
+		ringState->message.msg_iovlen = bufferCount;
+		struct io_uring_sqe* sqe = ioRingQueueOp(server, connection, IO_RING_OP_SEND);
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = connection->socket;
+		sqe->addr = (u64) (uword) &ringState->message;
+		sqe->msg_flags = SOCKET_SEND_FLAGS | (moreFollows ? MSG_MORE : 0);
+		ringState->sendPending = TRUE;
+		return TRUE;
+	}
+	httpOutputReset(output);
+	return TRUE;
+}
+
+// The io_uring counterpart of httpServerServiceConnection(): handle buffered
+// requests, start sending their responses, and keep a receive queued.
+static void ioRingServiceConnection(HttpServer* server, HttpConnection* connection) {
+	IoRingConnection* ringState = &connection->ringState;
+	HttpBuffer* input = &connection->input;
+	HttpOutput* output = &connection->output;
+
+	// The output buffer must not move while a send is reading from it, so
+	// requests are only handled between sends.
+	while (!ringState->sendPending && !ringState->writePollPending) {
+		httpServerHandleRequests(server, connection);
+		if (!httpOutputPending(output)) {
+			break;
+		}
+		if (!ioRingStartOutput(server, connection)) {
+			httpServerCloseConnection(server, connection);
+			return;
+		}
+	}
+
+	b32 doneReading = input->connectionClosed | connection->closeAfterOutput;
+	b32 outputBusy = httpOutputPending(output) | ringState->sendPending | ringState->writePollPending;
+	if (!outputBusy) {
+		httpServerNoteOutputSent(server, connection);
+	}
+	if (doneReading && !outputBusy) {
+		httpServerCloseConnection(server, connection);
+		return;
+	}
+
+	b32 receiveIdle = !input->receivePending && !ringState->readPollPending;
+	if (!doneReading && receiveIdle && !httpOutputBacklogged(output)) {
+		ioRingQueueReceive(server, connection);
+	}
+	httpServerUpdateTimeout(server, connection, outputBusy);
+}
+
+static void ioRingHandleCompletion(HttpServer* server, const struct io_uring_cqe* cqe) {
+	IoRingOp op = (IoRingOp) (cqe->user_data & IO_RING_OP_MASK);
+	HttpConnection* connection = (HttpConnection*) (uword) (cqe->user_data & ~(u64) IO_RING_OP_MASK);
+	int result = cqe->res;
+
+	if (!connection && op == IO_RING_OP_FILE_CHANGES) {
+		fileCacheProcessChanges(&server->files);
+		ioRingQueueFileChangesPoll(server);
+		return;
+	}
+	if (!connection && op == IO_RING_OP_WAKEUP) {
+		webSocketHubClearWakeup(server->hub, server->workerIndex);
+		httpServerSendBroadcasts(server);
+		ioRingQueueWakeupPoll(server);
+		return;
+	}
+	if (!connection && op == IO_RING_OP_TIMER) {
+		// the timers themselves are checked after every batch of completions
+		server->timerOpPending = FALSE;
+		return;
+	}
+	if (!connection) {
+		// an accept, or a poll waiting for the listen socket to be readable
+		if (op == IO_RING_OP_ACCEPT) {
+			if (result >= 0) {
+				connection = httpServerAcquireConnection(server, result);
+				logConnectionEvent(server->log, LOG_RECORD_CONNECTION_OPENED, 0);
+				ioRingServiceConnection(server, connection);
+			} else if (result == -EAGAIN) {
+				ioRingQueuePoll(server, NULL, server->listenSocket, IO_RING_OP_POLL_READ);
+				return;
+			} else if (result != -ECONNABORTED && result != -EINTR) {
+				fprintf(stderr, "[Server] accept() failed: %d\n", -result);
+			}
+		}
+		ioRingQueueAccept(server);
+		return;
+	}
+
+	IoRingConnection* ringState = &connection->ringState;
+	HttpBuffer* input = &connection->input;
+	assert(ringState->pendingOpCount > 0);
+	--ringState->pendingOpCount;
+
+	switch (op) {
+	case IO_RING_OP_RECEIVE:
+		input->receivePending = FALSE;
+		if (ringState->closing) {
+			break;
+		}
+		if (result > 0) {
+			input->writeIndex += (uword) result;
+			metricsNoteHighWaterMark(&server->metrics->inputHighWaterMark, httpBufferSize(input));
+		} else if (result == 0) {
+			input->connectionClosed = TRUE;
+		} else if (result == -EAGAIN || result == -EINTR) {
+			ioRingQueuePoll(server, connection, connection->socket, IO_RING_OP_POLL_READ);
+			ringState->readPollPending = TRUE;
+		} else {
+			httpServerNoteSocketError(server, "recv()", -result);
+			input->error = TRUE;
+		}
+		break;
+	case IO_RING_OP_SEND:
+		ringState->sendPending = FALSE;
+		if (ringState->closing) {
+			break;
+		}
+		if (result >= 0) {
+			httpOutputAdvance(&connection->output, (u64) result);
+		} else if (result != -EAGAIN && result != -EINTR) {
+			httpServerNoteSocketError(server, "send()", -result);
+			input->error = TRUE;
+		}
+		break;
+	case IO_RING_OP_POLL_READ:
+		ringState->readPollPending = FALSE;
+		break;
+	case IO_RING_OP_POLL_WRITE:
+		ringState->writePollPending = FALSE;
+		break;
+	default:
+		assert(0);
+	}
+
+	if (ringState->closing | input->error) {
+		httpServerCloseConnection(server, connection);
+	} else {
+		ioRingServiceConnection(server, connection);
+	}
+}
+
+// Returns FALSE if io_uring is not available, in which case the worker should
+// fall back to the epoll event loop.
+static b32 ioRingServerInit(HttpServer* server) {
+	if (!ioRingInit(&server->ring, IO_RING_ENTRY_COUNT)) {
+		return FALSE;
+	}
+
+	// Registering the receive buffers saves the kernel from mapping them for
+	// every receive. This can fail if the process may not lock enough memory,
+	// in which case connections fall back to ordinary buffers.
+	server->fixedBuffersSize = IO_RING_FIXED_BUFFER_COUNT * HTTP_BUFFER_CAPACITY;
+	server->fixedBuffers = mmap(
+		NULL, server->fixedBuffersSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (server->fixedBuffers == MAP_FAILED) {
+		server->fixedBuffers = NULL;
+	} else {
+		struct iovec region = {server->fixedBuffers, server->fixedBuffersSize};
+		if (syscall(__NR_io_uring_register, server->ring.fd, IORING_REGISTER_BUFFERS, &region, 1) < 0) {
+			fprintf(stderr, "[Server] registering receive buffers failed: %d\n", errno);
+			munmap(server->fixedBuffers, server->fixedBuffersSize);
+			server->fixedBuffers = NULL;
+		}
+	}
+	if (server->fixedBuffers) {
+		server->freeFixedBuffers = checkOutOfMemory(malloc(IO_RING_FIXED_BUFFER_COUNT * sizeof(i32)));
+		for (u32 i = 0; i < IO_RING_FIXED_BUFFER_COUNT; ++i) {
+			// hand out the lowest addresses first
+			server->freeFixedBuffers[i] = (i32) (IO_RING_FIXED_BUFFER_COUNT - 1 - i);
+		}
+		server->freeFixedBufferCount = IO_RING_FIXED_BUFFER_COUNT;
+	}
+
+	server->useIoRing = TRUE;
+	return TRUE;
+}
+
+static void ioRingServerDestroy(HttpServer* server) {
+	ioRingDestroy(&server->ring);
+	if (server->fixedBuffers) {
+		munmap(server->fixedBuffers, server->fixedBuffersSize);
+		free(server->freeFixedBuffers);
+	}
+	server->fixedBuffers = NULL;
+	server->freeFixedBuffers = NULL;
+	server->freeFixedBufferCount = 0;
+	server->useIoRing = FALSE;
+}
+
+static int ioRingServerRun(HttpServer* server) {
+	for (u32 i = 0; i < IO_RING_ACCEPT_DEPTH; ++i) {
+		ioRingQueueAccept(server);
+	}
+	ioRingQueueFileChangesPoll(server);
+	ioRingQueueWakeupPoll(server);
+
+//TODO provide some means of shutting down the server
+	for (;;) {
+		if (!ioRingSubmitAndWait(&server->ring, 1)) {
+			return 1;
+		}
+		for (;;) {
+			struct io_uring_cqe* cqe = ioRingPeekCqe(&server->ring);
+			if (!cqe) {
+				break;
+			}
+			struct io_uring_cqe completion = *cqe;
+			ioRingSeen(&server->ring);
+			ioRingHandleCompletion(server, &completion);
+		}
+		httpServerExpireTimeouts(server);
+		ioRingQueueTimer(server);
+	}
+}
+#endif
+
+static int runServerWorker(void* param) {
+	HttpServerWorker* worker = param;
+
+	HttpServer server;
+	ClearValueToZero(server);
+	server.options = worker->options;
+	server.log = worker->log;
+	server.metrics = worker->allMetrics + worker->workerIndex;
+	server.allMetrics = worker->allMetrics;
+	server.workerCount = worker->workerCount;
+	server.hub = worker->hub;
+	server.workerIndex = worker->workerIndex;
+	fileCacheInit(&server.files, worker->options->rootDirectory, worker->gzip);
+	if (worker->options->archivePath && !assetArchiveOpen(&server.archive, worker->options->archivePath)) {
+		fileCacheDestroy(&server.files);
+		return 1;
+	}
+	httpServerSerializeIndex(&server);
+	timerWheelInit(&server.timers, timeNowNanoseconds());
+
+	b32 ownsListenSocket = (worker->sharedListenSocket == INVALID_SOCKET);
+	server.listenSocket = ownsListenSocket
+		? httpServerOpenListenSocket(worker->reusePort)
+		: worker->sharedListenSocket;
+	if (server.listenSocket == INVALID_SOCKET) {
+		return 1;
+	}
+
+	int result;
+#ifdef HTTP_SERVER_IO_URING
+	if (worker->options->useIoRing && ioRingServerInit(&server)) {
+		result = ioRingServerRun(&server);
+		ioRingServerDestroy(&server);
+	} else {
+		if (worker->options->useIoRing) {
+			printf("[Server] io_uring is not available; using epoll instead.\n");
+		}
+		result = httpServerRunEventLoop(&server);
+	}
+#else
+	result = httpServerRunEventLoop(&server);
+#endif
+
+	while (server.freeConnections) {
+		HttpConnection* connection = server.freeConnections;
+		server.freeConnections = connection->nextFree;
+		httpBufferDestroy(&connection->input);
+		httpOutputDestroy(&connection->output);
+		free(connection);
+	}
+	arenaPoolDestroy(&server.memory);
+	free(server.hubBatch);
+	fileCacheDestroy(&server.files);
+	assetArchiveClose(&server.archive);
+	for (u32 i = 0; i < ArrayCount(server.indexResponses); ++i) {
+		free(server.indexResponses[i]);
+	}
+
+	if (ownsListenSocket) {
+		printf("[Server] Closing listen socket.\n");
+		if (closesocket(server.listenSocket) == SOCKET_ERROR) {
+			fprintf(stderr, "[Server] closesocket() for listen socket failed: %d\n", WSAGetLastError());
+		}
+	}
+	return result;
+}
 
-//TODO log response from server
+// The first worker runs on the calling thread.
+static int runServer(const HttpServerOptions* options) {
+	u32 threadCount = options->threadCount;
+	assert(threadCount > 0);
+	HttpServerWorker* workers = checkOutOfMemory(calloc(threadCount, sizeof(*workers)));
 
-	if (shutdown(sock, SD_SEND) == SOCKET_ERROR) {
-		fprintf(stderr, "[Client] shutdown() failed: %d\n", WSAGetLastError());
+	SOCKET sharedListenSocket = INVALID_SOCKET;
+#ifdef _WIN32
+	sharedListenSocket = httpServerOpenListenSocket(FALSE);
+	if (sharedListenSocket == INVALID_SOCKET) {
+		free(workers);
 		return 1;
 	}
+#endif
 
-	if (closesocket(sock) == SOCKET_ERROR) {
-		fprintf(stderr, "[Client] closesocket() failed: %d\n", WSAGetLastError());
+	// one ring for each worker, and one for the compressor thread
+	RequestLog log;
+	if (!requestLogStart(&log, options->logLevel, threadCount + 1)) {
+		fprintf(stderr, "[Server] Failed to create request log thread\n");
+		free(workers);
+		return 1;
 	}
 
-	printf("[Client] Done.\n");
+	ServerMetrics* metrics = checkOutOfMemory(calloc(threadCount, sizeof(*metrics)));
+	WebSocketHub hub;
+	if (!webSocketHubInit(&hub, threadCount)) {
+		webSocketHubDestroy(&hub);
+		requestLogStop(&log);
+		free(metrics);
+		free(workers);
+		return 1;
+	}
+
+	GzipCache gzip;
+	b32 compressing = (options->rootDirectory != NULL);
+	if (compressing && !gzipCacheStart(&gzip, options->rootDirectory, log.rings + threadCount)) {
+		fprintf(stderr, "[Server] Failed to create compressor thread; files are sent uncompressed\n");
+		compressing = FALSE;
+	}
+
+	printf("[Server] Waiting for connection request...\n");
+	fflush(stdout);
+
+	u32 startedCount = 1;
+	for (u32 i = 0; i < threadCount; ++i) {
+		HttpServerWorker* worker = workers + i;
+		worker->options = options;
+		worker->sharedListenSocket = sharedListenSocket;
+		// only opt in to port sharing when it is needed, so that starting a
+		// second server by accident still fails to bind
+		worker->reusePort = (threadCount > 1) && (sharedListenSocket == INVALID_SOCKET);
+		worker->log = log.rings + i;
+		worker->allMetrics = metrics;
+		worker->hub = &hub;
+		worker->gzip = compressing ? &gzip : NULL;
+		worker->workerIndex = i;
+		worker->workerCount = threadCount;
+	}
+	for (u32 i = 1; i < threadCount; ++i) {
+		if (!threadStart(&workers[i].thread, runServerWorker, workers + i)) {
+			fprintf(stderr, "[Server] Failed to create worker thread %u\n", i);
+			break;
+		}
+		++startedCount;
+	}
+
+	int result = runServerWorker(workers);
+	for (u32 i = 1; i < startedCount; ++i) {
+		if (threadJoin(&workers[i].thread) != 0) {
+			result = 1;
+		}
+	}
+	free(workers);
+	free(metrics);
+	webSocketHubDestroy(&hub);
+	if (compressing) {
+		gzipCacheStop(&gzip);
+	}
+	requestLogStop(&log);
+
+	if (sharedListenSocket != INVALID_SOCKET) {
+		printf("[Server] Closing listen socket.\n");
+		if (closesocket(sharedListenSocket) == SOCKET_ERROR) {
+			fprintf(stderr, "[Server] closesocket() for listen socket failed: %d\n", WSAGetLastError());
+		}
+	}
+
+	printf("[Server] Done.\n");
+	return result;
+}
+
+// Latencies are recorded in a histogram in the style of HdrHistogram: each
+// power of two range of values is split into LATENCY_SUB_BUCKET_HALF_COUNT
+// linear sub-buckets, so every value is kept with a relative error below
+// 1 / LATENCY_SUB_BUCKET_HALF_COUNT, in a fixed amount of memory. Histograms
+// from several threads are combined by adding up their counts.
+#define LATENCY_SUB_BUCKET_BITS 8
+#define LATENCY_SUB_BUCKET_COUNT (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_SUB_BUCKET_HALF_COUNT (LATENCY_SUB_BUCKET_COUNT / 2)
+#define LATENCY_BUCKET_COUNT ((64 - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKET_HALF_COUNT)
+
+typedef struct LatencyHistogram {
+	u64 counts[LATENCY_BUCKET_COUNT];
+	u64 totalCount;
+	u64 minValue;
+	u64 maxValue;
+} LatencyHistogram;
+
+static u32 latencyBucketIndex(u64 value) {
+	if (value < LATENCY_SUB_BUCKET_COUNT) {
+		return (u32) value;
+	}
+	u32 shift = highestSetBit64(value) - (LATENCY_SUB_BUCKET_BITS - 1);
+	return shift * LATENCY_SUB_BUCKET_HALF_COUNT + (u32) (value >> shift);
+}
+
+// the largest value that ends up in the given bucket
+static u64 latencyBucketHighestValue(u32 index) {
+	if (index < LATENCY_SUB_BUCKET_COUNT) {
+		return index;
+	}
+	u32 shift = index / LATENCY_SUB_BUCKET_HALF_COUNT - 1;
+	u64 subBucket = index - shift * LATENCY_SUB_BUCKET_HALF_COUNT;
+	return ((subBucket + 1) << shift) - 1;
+}
+
+static void latencyHistogramInit(LatencyHistogram* histogram) {
+	ClearValueToZero(*histogram);
+	histogram->minValue = UINT64_MAX;
+}
+
+static void latencyHistogramRecord(LatencyHistogram* histogram, u64 value) {
+	++histogram->counts[latencyBucketIndex(value)];
+	++histogram->totalCount;
+	if (value < histogram->minValue) {
+		histogram->minValue = value;
+	}
+	if (value > histogram->maxValue) {
+		histogram->maxValue = value;
+	}
+}
+
+static void latencyHistogramAdd(LatencyHistogram* histogram, const LatencyHistogram* other) {
+	for (u32 i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+		histogram->counts[i] += other->counts[i];
+	}
+	histogram->totalCount += other->totalCount;
+	if (other->minValue < histogram->minValue) {
+		histogram->minValue = other->minValue;
+	}
+	if (other->maxValue > histogram->maxValue) {
+		histogram->maxValue = other->maxValue;
+	}
+}
+
+// The smallest recorded value that percentile percent of all values are less
+// than or equal to, rounded up to the end of its bucket.
+static u64 latencyHistogramPercentile(const LatencyHistogram* histogram, double percentile) {
+	if (histogram->totalCount == 0) {
+		return 0;
+	}
+	u64 targetCount = (u64) (percentile / 100.0 * (double) histogram->totalCount + 0.5);
+	if (targetCount == 0) {
+		targetCount = 1;
+	}
+	u64 count = 0;
+	for (u32 i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+		count += histogram->counts[i];
+		if (count >= targetCount) {
+			u64 value = latencyBucketHighestValue(i);
+			return (value < histogram->maxValue) ? value : histogram->maxValue;
+		}
+	}
+	return histogram->maxValue;
+}
+
+// The load generator that --test-client runs. Each client thread keeps its
+// share of the connections busy with one request at a time, for a fixed
+// amount of time, cycling through a list of paths. A request's latency is
+// measured from when it starts being sent until its response has been read
+// in full; without keep-alive this includes connecting to the server.
+typedef struct LoadOptions {
+	u32 connectionCount;
+	u32 threadCount;
+	u32 durationSeconds;
+	b32 keepAlive;
+	const char** paths;
+	u32 pathCount;
+	// The server runs in this process, and has no way of shutting down yet,
+	// so the process exits once the results have been printed.
+	b32 exitProcessWhenDone;
+} LoadOptions;
+
+typedef enum LoadConnectionState {
+	LOAD_CONNECTION_CLOSED,
+	LOAD_CONNECTION_SENDING,
+	LOAD_CONNECTION_READING_HEADER,
+	LOAD_CONNECTION_READING_BODY,
+	// the parts of a chunked body: the line with the size of a chunk, the
+	// chunk itself with the line break after it, and the trailer after the
+	// last chunk
+	LOAD_CONNECTION_READING_CHUNK_SIZE,
+	LOAD_CONNECTION_READING_CHUNK,
+	LOAD_CONNECTION_READING_TRAILER,
+} LoadConnectionState;
+
+typedef struct LoadConnection {
+	SOCKET socket;
+	LoadConnectionState state;
+	HttpBuffer input;
+	StringSlice request;
+	uword requestSentCount;
+	u32 nextPathIndex;
+	u64 requestStartTime;
+	u64 remainingBodySize;
+	// the response has no Content-Length, so its body ends when the server
+	// closes the connection
+	b32 bodyEndsAtClose;
+	b32 bodyChunked;
+	b32 closeAfterResponse;
+	// whether the event loop is waiting for the socket to become writable,
+	// rather than readable
+	b32 waitingToWrite;
+} LoadConnection;
+
+typedef struct LoadWorker {
+	const LoadOptions* options;
+	const addrinfo* address;
+	// one ready-made request for each path
+	const StringSlice* requests;
+	u32 connectionCount;
+	u32 firstPathIndex;
+	u64 endTime;
+	EventLoop loop;
+
+	u64 requestCount;
+	u64 receivedByteCount;
+	u64 errorCount;
+	// responses with a status other than 2xx or 3xx
+	u64 unexpectedStatusCount;
+	LatencyHistogram latencies;
+	ArenaPool memory;
+	Thread thread;
+} LoadWorker;
+
+static void loadConnectionClose(LoadWorker* worker, LoadConnection* connection) {
+	if (connection->socket != INVALID_SOCKET) {
+		eventLoopRemove(&worker->loop, connection->socket);
+		closesocket(connection->socket);
+	}
+	connection->socket = INVALID_SOCKET;
+	connection->state = LOAD_CONNECTION_CLOSED;
+}
+
+static void loadConnectionFail(LoadWorker* worker, LoadConnection* connection) {
+	++worker->errorCount;
+	loadConnectionClose(worker, connection);
+}
+
+static void loadConnectionStartRequest(LoadWorker* worker, LoadConnection* connection) {
+	connection->request = worker->requests[connection->nextPathIndex];
+	connection->nextPathIndex = (connection->nextPathIndex + 1) % worker->options->pathCount;
+	connection->requestSentCount = 0;
+	connection->requestStartTime = timeNowNanoseconds();
+	connection->state = LOAD_CONNECTION_SENDING;
+}
+
+// Start connecting to the server. The first request is sent as soon as the
+// socket becomes writable.
+static void loadConnectionOpen(LoadWorker* worker, LoadConnection* connection) {
+	const addrinfo* address = worker->address;
+	SOCKET sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+	if (sock == INVALID_SOCKET) {
+		fprintf(stderr, "[Client] socket() failed: %d\n", WSAGetLastError());
+		++worker->errorCount;
+		return;
+	}
+	if (!socketSetNonBlocking(sock) || !socketConnectNonBlocking("Client", sock, address)) {
+		closesocket(sock);
+		++worker->errorCount;
+		return;
+	}
+	if (!eventLoopAdd(&worker->loop, sock, connection, FALSE, TRUE)) {
+		closesocket(sock);
+		++worker->errorCount;
+		return;
+	}
+	connection->socket = sock;
+	connection->waitingToWrite = TRUE;
+	httpBufferReset(&connection->input);
+	connection->input.socket = sock;
+	loadConnectionStartRequest(worker, connection);
+}
+
+static void loadConnectionWaitFor(LoadWorker* worker, LoadConnection* connection, b32 write) {
+	if (connection->waitingToWrite != write) {
+		eventLoopModify(&worker->loop, connection->socket, connection, !write, write);
+		connection->waitingToWrite = write;
+	}
+}
+
+static void loadConnectionSend(LoadWorker* worker, LoadConnection* connection) {
+	uword sentByteCount;
+	int error;
+	b32 success = socketSendNonBlocking(
+		connection->socket,
+		stringSliceLength(connection->request) - connection->requestSentCount,
+		connection->request.begin + connection->requestSentCount,
+		&sentByteCount, &error);
+	if (!success) {
+		loadConnectionFail(worker, connection);
+		return;
+	}
+	connection->requestSentCount += sentByteCount;
+	if (connection->requestSentCount == stringSliceLength(connection->request)) {
+		connection->state = LOAD_CONNECTION_READING_HEADER;
+		loadConnectionWaitFor(worker, connection, FALSE);
+	} else {
+		loadConnectionWaitFor(worker, connection, TRUE);
+	}
+}
+
+static void loadConnectionFinishResponse(LoadWorker* worker, LoadConnection* connection) {
+	u64 now = timeNowNanoseconds();
+	latencyHistogramRecord(&worker->latencies, now - connection->requestStartTime);
+	++worker->requestCount;
+	if (connection->closeAfterResponse) {
+		loadConnectionClose(worker, connection);
+		return;
+	}
+	loadConnectionStartRequest(worker, connection);
+}
+
+// Parse the parts of a response header that say how long the response is.
+// Returns FALSE if the header is not a valid response.
+static b32 loadConnectionParseHeader(LoadWorker* worker, LoadConnection* connection, HttpHeader* header) {
+	StringSlice statusLine;
+	if (!httpHeaderNextLine(header, &statusLine)) {
+		fprintf(stderr, "[Client] Invalid response header\n");
+		return FALSE;
+	}
+	const char* versionEnd = scanForByte(statusLine.begin, statusLine.end, ' ');
+	StringSlice version = stringSlice(statusLine.begin, versionEnd);
+	const char* cursor = versionEnd;
+	skipSpaces(&cursor, statusLine.end);
+	u32 status = 0;
+	u32 digitCount = 0;
+	for (; cursor != statusLine.end && *cursor >= '0' && *cursor <= '9'; ++cursor) {
+		status = status * 10 + (u32) (*cursor - '0');
+		++digitCount;
+	}
+	if (digitCount != 3) {
+		fprintf(stderr, "[Client] Invalid response: '%.*s'\n", StringSlicePrintf(statusLine));
+		return FALSE;
+	}
+	if (status < 200 || status >= 400) {
+		++worker->unexpectedStatusCount;
+	}
+
+	connection->closeAfterResponse =
+		!worker->options->keepAlive || !stringSliceEqualsCString(&version, "HTTP/1.1");
+	connection->bodyEndsAtClose = TRUE;
+	connection->bodyChunked = FALSE;
+	connection->remainingBodySize = 0;
+	for (;;) {
+		HttpOption option;
+		if (!httpHeaderNextOption(header, &option)) {
+			fprintf(stderr, "[Client] Invalid response header\n");
+			return FALSE;
+		}
+		if (stringSliceEmpty(option.key)) {
+			break;
+		}
+		if (stringSliceEqualsCStringIgnoreCase(&option.key, "content-length")) {
+			u64 size = 0;
+			for (const char* c = option.value.begin; c != option.value.end && *c >= '0' && *c <= '9'; ++c) {
+				size = size * 10 + (u64) (*c - '0');
+			}
+			connection->remainingBodySize = size;
+			connection->bodyEndsAtClose = FALSE;
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "transfer-encoding")) {
+			connection->bodyChunked = httpValueHasToken(option.value, "chunked");
+		} else if (stringSliceEqualsCStringIgnoreCase(&option.key, "connection")) {
+			if (httpValueHasToken(option.value, "close")) {
+				connection->closeAfterResponse = TRUE;
+			}
+		}
+	}
+	// a chunked body marks its own end, whatever the Content-Length says
+	if (connection->bodyChunked) {
+		connection->bodyEndsAtClose = FALSE;
+	}
+	return TRUE;
+}
+
+// Take one line of a chunked body out of the buffer, if all of it has been
+// received.
+static b32 loadConnectionTakeLine(LoadWorker* worker, HttpBuffer* input, StringSlice* line) {
+	const char* begin = (const char*) input->data + input->readIndex;
+	const char* end = (const char*) input->data + input->writeIndex;
+	const char* lineEnd = scanForByte(begin, end, '\n');
+	if (lineEnd == end) {
+		return FALSE;
+	}
+	*line = stringSlice(begin, lineEnd);
+	uword lineLength = (uword) (lineEnd - begin) + 1;
+	worker->receivedByteCount += lineLength;
+	httpBufferDiscardBytes(input, lineLength);
+	return TRUE;
+}
+
+// Consume as much of a chunked body as has been received. Returns FALSE if
+// the body is malformed.
+static b32 loadConnectionReadChunks(LoadWorker* worker, LoadConnection* connection, b32* finished) {
+	HttpBuffer* input = &connection->input;
+	for (;;) {
+		StringSlice line;
+		if (connection->state == LOAD_CONNECTION_READING_CHUNK_SIZE) {
+			if (!loadConnectionTakeLine(worker, input, &line)) {
+				return TRUE;
+			}
+			u64 size = 0;
+			u32 digitCount = 0;
+			for (const char* c = line.begin; c != line.end && digitCount < 16; ++c, ++digitCount) {
+				char lower = asciiToLower(*c);
+				if (lower >= '0' && lower <= '9') {
+					size = size * 16 + (u64) (lower - '0');
+				} else if (lower >= 'a' && lower <= 'f') {
+					size = size * 16 + (u64) (lower - 'a' + 10);
+				} else {
+					break;
+				}
+			}
+			if (digitCount == 0) {
+				fprintf(stderr, "[Client] Invalid chunk size: '%.*s'\n", StringSlicePrintf(line));
+				return FALSE;
+			}
+			if (size == 0) {
+				connection->state = LOAD_CONNECTION_READING_TRAILER;
+			} else {
+				// the line break after the chunk is consumed along with it
+				connection->remainingBodySize = size + 2;
+				connection->state = LOAD_CONNECTION_READING_CHUNK;
+			}
+		} else if (connection->state == LOAD_CONNECTION_READING_CHUNK) {
+			uword byteCount = httpBufferSize(input);
+			if (byteCount == 0) {
+				return TRUE;
+			}
+			if (byteCount > connection->remainingBodySize) {
+				byteCount = (uword) connection->remainingBodySize;
+			}
+			worker->receivedByteCount += byteCount;
+			httpBufferDiscardBytes(input, byteCount);
+			connection->remainingBodySize -= byteCount;
+			if (connection->remainingBodySize == 0) {
+				connection->state = LOAD_CONNECTION_READING_CHUNK_SIZE;
+			}
+		} else {
+			if (!loadConnectionTakeLine(worker, input, &line)) {
+				return TRUE;
+			}
+			// the trailer ends with a blank line
+			if (stringSliceLength(line) <= 1) {
+				*finished = TRUE;
+				return TRUE;
+			}
+		}
+	}
+}
+
+// Consume as much of the response as has been received, receiving more until
+// the socket would block.
+static void loadConnectionReceive(LoadWorker* worker, LoadConnection* connection) {
+	HttpBuffer* input = &connection->input;
+	for (;;) {
+		if (connection->state == LOAD_CONNECTION_READING_HEADER) {
+			HttpHeader header;
+			if (httpBufferFindHeader(input, &header)) {
+				if (!loadConnectionParseHeader(worker, connection, &header)) {
+					loadConnectionFail(worker, connection);
+					return;
+				}
+				worker->receivedByteCount += header.charCount;
+				httpBufferDiscardBytes(input, header.charCount);
+				connection->state = connection->bodyChunked
+					? LOAD_CONNECTION_READING_CHUNK_SIZE
+					: LOAD_CONNECTION_READING_BODY;
+			} else if (input->headerTooLarge) {
+				fprintf(stderr, "[Client] HTTP header is too large\n");
+				loadConnectionFail(worker, connection);
+				return;
+			}
+		}
+		if (connection->state >= LOAD_CONNECTION_READING_CHUNK_SIZE) {
+			b32 finished = FALSE;
+			if (!loadConnectionReadChunks(worker, connection, &finished)) {
+				loadConnectionFail(worker, connection);
+				return;
+			}
+			if (finished) {
+				loadConnectionFinishResponse(worker, connection);
+				if (connection->state == LOAD_CONNECTION_SENDING) {
+					loadConnectionSend(worker, connection);
+				}
+				return;
+			}
+			if (input->headerTooLarge) {
+				fprintf(stderr, "[Client] Chunk size line is too long\n");
+				loadConnectionFail(worker, connection);
+				return;
+			}
+		}
+		if (connection->state == LOAD_CONNECTION_READING_BODY) {
+			uword byteCount = httpBufferSize(input);
+			if (!connection->bodyEndsAtClose && byteCount > connection->remainingBodySize) {
+				byteCount = (uword) connection->remainingBodySize;
+			}
+			worker->receivedByteCount += byteCount;
+			httpBufferDiscardBytes(input, byteCount);
+			connection->remainingBodySize -= connection->bodyEndsAtClose ? 0 : byteCount;
+			if (!connection->bodyEndsAtClose && connection->remainingBodySize == 0) {
+				loadConnectionFinishResponse(worker, connection);
+				if (connection->state == LOAD_CONNECTION_SENDING) {
+					loadConnectionSend(worker, connection);
+				}
+				return;
+			}
+		}
+
+		httpBufferReadBytes(input);
+		if (input->error) {
+			loadConnectionFail(worker, connection);
+			return;
+		}
+		if (input->wouldBlock) {
+			return;
+		}
+		if (input->connectionClosed) {
+			if (connection->state == LOAD_CONNECTION_READING_BODY && connection->bodyEndsAtClose) {
+				connection->closeAfterResponse = TRUE;
+				loadConnectionFinishResponse(worker, connection);
+			} else {
+				fprintf(stderr, "[Client] Server closed connection before it sent response.\n");
+				loadConnectionFail(worker, connection);
+			}
+			return;
+		}
+	}
+}
+
+static void loadConnectionService(LoadWorker* worker, LoadConnection* connection, const SocketEvent* event) {
+	if (connection->state == LOAD_CONNECTION_SENDING && event->writable) {
+		loadConnectionSend(worker, connection);
+		return;
+	}
+	if (connection->state >= LOAD_CONNECTION_READING_HEADER && event->readable) {
+		loadConnectionReceive(worker, connection);
+	}
+}
+
+static int runLoadWorker(void* param) {
+	LoadWorker* worker = param;
+	latencyHistogramInit(&worker->latencies);
+	if (!eventLoopInit(&worker->loop)) {
+		return 1;
+	}
+
+	LoadConnection* connections = checkOutOfMemory(calloc(worker->connectionCount, sizeof(*connections)));
+	for (u32 i = 0; i < worker->connectionCount; ++i) {
+		LoadConnection* connection = connections + i;
+		connection->socket = INVALID_SOCKET;
+		httpBufferInit(&connection->input, "Client", &worker->memory);
+		connection->nextPathIndex = (worker->firstPathIndex + i) % worker->options->pathCount;
+	}
+
+	SocketEvent events[256];
+	for (;;) {
+		u64 now = timeNowNanoseconds();
+		if (now >= worker->endTime) {
+			break;
+		}
+		// reconnect anything that was closed since the last time around
+		for (u32 i = 0; i < worker->connectionCount; ++i) {
+			if (connections[i].state == LOAD_CONNECTION_CLOSED) {
+				loadConnectionOpen(worker, connections + i);
+			}
+		}
+
+		u64 timeoutMillis = (worker->endTime - now) / 1000000 + 1;
+		if (timeoutMillis > 100) {
+			timeoutMillis = 100;
+		}
+		iword eventCount = eventLoopWait(&worker->loop, events, ArrayCount(events), (int) timeoutMillis);
+		if (eventCount < 0) {
+			break;
+		}
+		for (iword i = 0; i < eventCount; ++i) {
+			loadConnectionService(worker, events[i].userData, events + i);
+		}
+	}
+
+	// requests that are still in flight when time runs out are not counted
+	for (u32 i = 0; i < worker->connectionCount; ++i) {
+		loadConnectionClose(worker, connections + i);
+		httpBufferDestroy(&connections[i].input);
+	}
+	free(connections);
+	arenaPoolDestroy(&worker->memory);
+	eventLoopDestroy(&worker->loop);
 	return 0;
 }
 
-int main(int argc, char* argv[]) {
-	WSADATA wsaData;
-	int wsResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
+// Wait up to a few seconds for the server to accept connections, since a
+// server in the same process starts listening at the same time as the client
+// starts.
+static b32 loadWaitForServer(const addrinfo* address) {
+	for (u32 attempt = 0; attempt < 100; ++attempt) {
+		SOCKET sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (sock == INVALID_SOCKET) {
+			fprintf(stderr, "[Client] socket() failed: %d\n", WSAGetLastError());
+			return FALSE;
+		}
+		int wsResult = connect(sock, address->ai_addr, (int) address->ai_addrlen);
+		closesocket(sock);
+		if (wsResult != SOCKET_ERROR) {
+			return TRUE;
+		}
+		threadSleepMilliseconds(20);
+	}
+	fprintf(stderr, "[Client] Could not connect to server at %s:%s\n", serverAddress, port);
+	return FALSE;
+}
+
+static void printByteRate(const char* label, double byteCount) {
+	const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+	u32 unit = 0;
+	while (byteCount >= 1024.0 && unit + 1 < ArrayCount(units)) {
+		byteCount /= 1024.0;
+		++unit;
+	}
+	printf("[Client] %s%.2f %s\n", label, byteCount, units[unit]);
+}
+
+static int runClient(void* param) {
+	const LoadOptions* options = param;
+	int wsResult;
+
+	addrinfo addrHints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_protocol = IPPROTO_TCP,
+	};
+	addrinfo* addr;
+	wsResult = getaddrinfo(serverAddress, port, &addrHints, &addr);
 	if (wsResult != 0) {
-		fprintf(stderr, "WSAStartup() failed: %d\n", wsResult);
+		fprintf(stderr, "[Client] getaddrinfo() failed: %d\n", wsResult);
+		return 1;
+	}
+
+	printf("[Client] Establishing connection to server...\n");
+	if (!loadWaitForServer(addr)) {
+		freeaddrinfo(addr);
+		return 1;
+	}
+
+	// build every request up front, so that sending one is a single send()
+	StringSlice* requests = checkOutOfMemory(calloc(options->pathCount, sizeof(*requests)));
+	for (u32 i = 0; i < options->pathCount; ++i) {
+		const char* format =
+			"GET %s HTTP/1.1\r\n"
+			"Host: %s:%s\r\n"
+			"%s"
+			"\r\n";
+		const char* connection = options->keepAlive ? "" : "Connection: close\r\n";
+		int length = snprintf(NULL, 0, format, options->paths[i], serverAddress, port, connection);
+		char* request = checkOutOfMemory(malloc((uword) length + 1));
+		snprintf(request, (uword) length + 1, format, options->paths[i], serverAddress, port, connection);
+		requests[i] = stringSlice(request, request + length);
+	}
+
+	u32 threadCount = options->threadCount;
+	if (threadCount > options->connectionCount) {
+		threadCount = options->connectionCount;
+	}
+	printf(
+		"[Client] Running for %u seconds with %u connections on %u threads, keep-alive %s...\n",
+		options->durationSeconds, options->connectionCount, threadCount,
+		options->keepAlive ? "on" : "off");
+
+	LoadWorker* workers = checkOutOfMemory(calloc(threadCount, sizeof(*workers)));
+	u64 startTime = timeNowNanoseconds();
+	u64 endTime = startTime + (u64) options->durationSeconds * 1000000000;
+	u32 firstConnection = 0;
+	for (u32 i = 0; i < threadCount; ++i) {
+		LoadWorker* worker = workers + i;
+		worker->options = options;
+		worker->address = addr;
+		worker->requests = requests;
+		worker->connectionCount =
+			options->connectionCount / threadCount + (i < options->connectionCount % threadCount);
+		worker->firstPathIndex = firstConnection % options->pathCount;
+		worker->endTime = endTime;
+		firstConnection += worker->connectionCount;
+	}
+	// the first worker runs on this thread
+	u32 startedCount = 1;
+	for (; startedCount < threadCount; ++startedCount) {
+		if (!threadStart(&workers[startedCount].thread, runLoadWorker, workers + startedCount)) {
+			fprintf(stderr, "[Client] Failed to create client thread\n");
+			break;
+		}
+	}
+	int result = runLoadWorker(workers);
+	for (u32 i = 1; i < startedCount; ++i) {
+		if (threadJoin(&workers[i].thread) != 0) {
+			result = 1;
+		}
+	}
+	double seconds = (double) (timeNowNanoseconds() - startTime) / 1e9;
+
+	// a histogram is too big to live on the stack
+	LatencyHistogram* latencies = checkOutOfMemory(malloc(sizeof(*latencies)));
+	latencyHistogramInit(latencies);
+	u64 requestCount = 0;
+	u64 receivedByteCount = 0;
+	u64 errorCount = 0;
+	u64 unexpectedStatusCount = 0;
+	for (u32 i = 0; i < startedCount; ++i) {
+		latencyHistogramAdd(latencies, &workers[i].latencies);
+		requestCount += workers[i].requestCount;
+		receivedByteCount += workers[i].receivedByteCount;
+		errorCount += workers[i].errorCount;
+		unexpectedStatusCount += workers[i].unexpectedStatusCount;
+	}
+
+	printf(
+		"[Client] %llu requests in %.2f s, %llu errors, %llu non-2xx/3xx responses\n",
+		(unsigned long long) requestCount, seconds,
+		(unsigned long long) errorCount, (unsigned long long) unexpectedStatusCount);
+	printf("[Client] Requests/sec: %.2f\n", (double) requestCount / seconds);
+	printByteRate("Received/sec: ", (double) receivedByteCount / seconds);
+	printf("[Client] Latency (us):\n");
+	struct {
+		const char* label;
+		u64 value;
+	} latencyRows[] = {
+		{"min", (latencies->totalCount > 0) ? latencies->minValue : 0},
+		{"p50", latencyHistogramPercentile(latencies, 50.0)},
+		{"p90", latencyHistogramPercentile(latencies, 90.0)},
+		{"p99", latencyHistogramPercentile(latencies, 99.0)},
+		{"p99.9", latencyHistogramPercentile(latencies, 99.9)},
+		{"max", latencies->maxValue},
+	};
+	for (u32 i = 0; i < ArrayCount(latencyRows); ++i) {
+		printf("    %-6s %10.1f\n", latencyRows[i].label, (double) latencyRows[i].value / 1000.0);
+	}
+
+	free(latencies);
+	free(workers);
+	for (u32 i = 0; i < options->pathCount; ++i) {
+		free((char*) requests[i].begin);
+	}
+	free(requests);
+	freeaddrinfo(addr);
+
+	printf("[Client] Done.\n");
+	if (options->exitProcessWhenDone) {
+		fflush(stdout);
+		ExitProcess(result);
+	}
+	return result;
+}
+
+int main(int argc, char* argv[]) {
+	if (!socketsInit()) {
 		return 1;
 	}
 
 	b32 runTestClient = FALSE;
+	b32 runServerInProcess = TRUE;
+	LoadOptions loadOptions = {
+		.connectionCount = 1,
+		.threadCount = 1,
+		.durationSeconds = 10,
+		.keepAlive = TRUE,
+		.paths = checkOutOfMemory(calloc((uword) argc, sizeof(const char*))),
+		.pathCount = 0,
+	};
+	HttpServerOptions options = {
+		.rootDirectory = NULL,
+		.archivePath = NULL,
+		.threadCount = 1,
+		.useIoRing = FALSE,
+		.listDirectories = FALSE,
+		.logLevel = LOG_LEVEL_REQUESTS,
+	};
 	for (int i = 1; i < argc; ++i) {
 		const char* arg = argv[i];
 		if (strcmp(arg, "--test-client") == 0) {
 			runTestClient = TRUE;
+		} else if (strcmp(arg, "--no-server") == 0) {
+			runTestClient = TRUE;
+			runServerInProcess = FALSE;
+		} else if (strcmp(arg, "--no-keep-alive") == 0) {
+			loadOptions.keepAlive = FALSE;
+		} else if (strcmp(arg, "--path") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing URL path after '--path'\n");
+				return 1;
+			}
+			++i;
+			loadOptions.paths[loadOptions.pathCount] = argv[i];
+			++loadOptions.pathCount;
+		} else if (
+			strcmp(arg, "--connections") == 0 ||
+			strcmp(arg, "--client-threads") == 0 ||
+			strcmp(arg, "--duration") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing number after '%s'\n", arg);
+				return 1;
+			}
+			++i;
+			u32 value = (u32) strtoul(argv[i], NULL, 10);
+			if (value == 0) {
+				fprintf(stderr, "Invalid number '%s' for '%s'\n", argv[i], arg);
+				return 1;
+			}
+			if (strcmp(arg, "--connections") == 0) {
+				loadOptions.connectionCount = value;
+			} else if (strcmp(arg, "--client-threads") == 0) {
+				loadOptions.threadCount = value;
+			} else {
+				loadOptions.durationSeconds = value;
+			}
+		} else if (strcmp(arg, "--root") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing directory after '--root'\n");
+				return 1;
+			}
+			++i;
+			options.rootDirectory = argv[i];
+		} else if (strcmp(arg, "--archive") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing file after '--archive'\n");
+				return 1;
+			}
+			++i;
+			options.archivePath = argv[i];
+		} else if (strcmp(arg, "--pack") == 0) {
+			if (i + 2 >= argc) {
+				fprintf(stderr, "Expected a directory and an archive file after '--pack'\n");
+				return 1;
+			}
+			int packResult = packAssets(argv[i + 1], argv[i + 2]);
+			free(loadOptions.paths);
+			socketsCleanup();
+			return packResult;
+		} else if (strcmp(arg, "--log") == 0) {
+			const char* levels[] = {"quiet", "errors", "requests", "connections"};
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing level after '--log'\n");
+				return 1;
+			}
+			++i;
+			u32 level = 0;
+			while (level < ArrayCount(levels) && strcmp(argv[i], levels[level]) != 0) {
+				++level;
+			}
+			if (level == ArrayCount(levels)) {
+				fprintf(stderr, "Invalid log level '%s'; expected quiet, errors, requests or connections\n", argv[i]);
+				return 1;
+			}
+			options.logLevel = (LogLevel) level;
+		} else if (strcmp(arg, "--list-directories") == 0) {
+			options.listDirectories = TRUE;
+		} else if (strcmp(arg, "--threads") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Missing thread count after '--threads'\n");
+				return 1;
+			}
+			++i;
+			options.threadCount = (u32) strtoul(argv[i], NULL, 10);
+			if (options.threadCount == 0) {
+				fprintf(stderr, "Invalid thread count '%s'\n", argv[i]);
+				return 1;
+			}
+#ifdef HTTP_SERVER_IO_URING
+		} else if (strcmp(arg, "--io-uring") == 0) {
+			options.useIoRing = TRUE;
+#endif
 		} else {
 			fprintf(stderr, "Unknown option '%s'\n", arg);
 			return 1;
 		}
 	}
 
-	HANDLE clientThread = NULL;
-	if (runTestClient) {
-		printf("[Client] Starting test client...\n");
-		clientThread = CreateThread(NULL, 0, runClient, NULL, 0, NULL);
-		if (clientThread == NULL) {
-			fprintf(stderr, "Failed to create test client thread\n");
-			return 1;
-		}
+	if (loadOptions.pathCount == 0) {
+		loadOptions.paths[0] = "/";
+		loadOptions.pathCount = 1;
 	}
 
-	int mainResult = runServer();
+	int mainResult;
+	if (!runServerInProcess) {
+		mainResult = runClient(&loadOptions);
+	} else {
+		Thread clientThread;
+		if (runTestClient) {
+			printf("[Client] Starting test client...\n");
+			loadOptions.exitProcessWhenDone = TRUE;
+			if (!threadStart(&clientThread, runClient, &loadOptions)) {
+				fprintf(stderr, "Failed to create test client thread\n");
+				return 1;
+			}
+		}
+
+		mainResult = runServer(&options);
 
-	if (runTestClient) {
-		assert(clientThread);
-		WaitForSingleObject(clientThread, INFINITE);
-		DWORD clientExitCode;
-		GetExitCodeThread(clientThread, &clientExitCode);
-		CloseHandle(clientThread);
-		if (clientExitCode != 0) {
-			mainResult = 1;
+		if (runTestClient) {
+			if (threadJoin(&clientThread) != 0) {
+				mainResult = 1;
+			}
 		}
 	}
+	free(loadOptions.paths);
 
-	WSACleanup();
+	socketsCleanup();
 	return mainResult;
 }
@@ -0,0 +1,375 @@
+// Speed of every vector and matrix function in util_math.h, natively, without
+// emscripten. Each function runs over arrays of random inputs for a fixed time,
+// and the benchmark prints the time per call and calls per second. Functions
+// with a scalar reference version are listed next to it. To time the F32x4
+// fallback instead of SSE, build with -DUT_NO_SIMD. For example:
+//
+//   cc -std=gnu11 -O2 -ffp-contract=off -o math-benchmark tools/math_benchmark.c -lm
+//   cl /O2 /Femath-benchmark tools/math_benchmark.c
+//
+// Pass "--seconds N" to change how long each function runs (the default is
+// 0.5), and "--only <text>" to run just the functions whose names contain it,
+// which keeps perf profiles down to one function.
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <string.h>
+
+#include "../util_math.h"
+
+#define ArrayCount(A) (sizeof(A) / sizeof((A)[0]))
+
+static u64 timeNowNanoseconds(void) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (u64) ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64) now.tv_sec * 1000000000 + (u64) now.tv_nsec;
+#endif
+}
+
+// Every benchmark function makes this many calls, one per input, and writes
+// every result out, so that none of the work can be optimized away. The inputs
+// and outputs together stay within the L2 cache.
+#define VALUE_COUNT 256
+
+static Mat4 inputMatrices[VALUE_COUNT];
+static Mat4 otherMatrices[VALUE_COUNT];
+static Vec4 inputVectors[VALUE_COUNT];
+static f32 inputAngles[VALUE_COUNT];
+static f32 inputX[VALUE_COUNT];
+static f32 inputY[VALUE_COUNT];
+static f32 inputZ[VALUE_COUNT];
+static Mat34 inputAffines[VALUE_COUNT];
+static Mat34 otherAffines[VALUE_COUNT];
+static Transform inputTransforms[VALUE_COUNT];
+static Transform otherTransforms[VALUE_COUNT];
+
+static Mat4 outputMatrices[VALUE_COUNT];
+static Vec4 outputVectors[VALUE_COUNT];
+static f32 outputX[VALUE_COUNT];
+static f32 outputY[VALUE_COUNT];
+static f32 outputZ[VALUE_COUNT];
+static Mat34 outputAffines[VALUE_COUNT];
+static Transform outputTransforms[VALUE_COUNT];
+
+static void runDotV4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputX[i] = dotV4(inputVectors[i], inputVectors[VALUE_COUNT - 1 - i]);
+	}
+}
+
+static void runMulM4Scalar(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = mulM4Scalar(inputMatrices[i], otherMatrices[i]);
+	}
+}
+
+static void runMulM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = mulM4(inputMatrices[i], otherMatrices[i]);
+	}
+}
+
+static void runMulM4Batch(void) {
+	mulM4Batch(&inputMatrices[0], otherMatrices, outputMatrices, VALUE_COUNT);
+}
+
+static void runMulM4V4Scalar(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputVectors[i] = mulM4V4Scalar(inputMatrices[i], inputVectors[i]);
+	}
+}
+
+static void runMulM4V4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputVectors[i] = mulM4V4(inputMatrices[i], inputVectors[i]);
+	}
+}
+
+static void runTransformPointsM4(void) {
+	transformPointsM4(
+		&inputMatrices[0], vec3Streams(inputX, inputY, inputZ),
+		vec3Streams(outputX, outputY, outputZ), VALUE_COUNT);
+}
+
+static void runTransformDirectionsM4(void) {
+	transformDirectionsM4(
+		&inputMatrices[0], vec3Streams(inputX, inputY, inputZ),
+		vec3Streams(outputX, outputY, outputZ), VALUE_COUNT);
+}
+
+static void runTransposeM4Scalar(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = transposeM4Scalar(inputMatrices[i]);
+	}
+}
+
+static void runTransposeM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = transposeM4(inputMatrices[i]);
+	}
+}
+
+static void runInverseM4Scalar(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = inverseM4Scalar(inputMatrices[i]);
+	}
+}
+
+static void runInverseM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = inverseM4(inputMatrices[i]);
+	}
+}
+
+static void runMulM34(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputAffines[i] = mulM34(&inputAffines[i], &otherAffines[i]);
+	}
+}
+
+static void runMulM4M34(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = mulM4M34(&inputMatrices[i], &inputAffines[i]);
+	}
+}
+
+static void runMulTransform(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputTransforms[i] = mulTransform(&inputTransforms[i], &otherTransforms[i]);
+	}
+}
+
+static void runM34FromTransform(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputAffines[i] = m34FromTransform(&inputTransforms[i]);
+	}
+}
+
+static void runTransformPointM34(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		Vec3 p = transformPointM34(&inputAffines[i], vec3(inputX[i], inputY[i], inputZ[i]));
+		outputX[i] = p.x;
+		outputY[i] = p.y;
+		outputZ[i] = p.z;
+	}
+}
+
+static void runTransformPoint(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		Vec3 p = transformPoint(&inputTransforms[i], vec3(inputX[i], inputY[i], inputZ[i]));
+		outputX[i] = p.x;
+		outputY[i] = p.y;
+		outputZ[i] = p.z;
+	}
+}
+
+static void runTranslateM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		Vec4 v = inputVectors[i];
+		outputMatrices[i] = translateM4(vec3(v.x, v.y, v.z));
+	}
+}
+
+static void runRotationXAxisM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = rotationXAxisM4(inputAngles[i]);
+	}
+}
+
+static void runRotationYAxisM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = rotationYAxisM4(inputAngles[i]);
+	}
+}
+
+static void runRotationZAxisM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputMatrices[i] = rotationZAxisM4(inputAngles[i]);
+	}
+}
+
+static void runPerspectiveM4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		// a field of view between 45 and 135 degrees
+		f32 fieldOfView = 0.5f * (f32) PI + 0.125f * inputAngles[i];
+		outputMatrices[i] = perspectiveM4(fieldOfView, 16.0f / 9.0f, 0.1f, 100.0f);
+	}
+}
+
+static void runSinfCosf(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		outputX[i] = sinf(inputAngles[i]);
+		outputY[i] = cosf(inputAngles[i]);
+	}
+}
+
+static void runSinCosF32(void) {
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		sinCosF32(inputAngles[i], &outputX[i], &outputY[i]);
+	}
+}
+
+static void runSinCosF32x4(void) {
+	for (u32 i = 0; i < VALUE_COUNT; i += 4) {
+		F32x4 s, c;
+		sinCosF32x4(f32x4Load(inputAngles + i), &s, &c);
+		f32x4Store(outputX + i, s);
+		f32x4Store(outputY + i, c);
+	}
+}
+
+static void runSinCosBatch(void) {
+	sinCosBatch(inputAngles, outputX, outputY, VALUE_COUNT);
+}
+
+typedef struct Benchmark {
+	const char* name;
+	void (*run)(void);
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+	{"dotV4", runDotV4},
+	{"mulM4Scalar", runMulM4Scalar},
+	{"mulM4", runMulM4},
+	{"mulM4Batch", runMulM4Batch},
+	{"mulM4V4Scalar", runMulM4V4Scalar},
+	{"mulM4V4", runMulM4V4},
+	{"transformPointsM4", runTransformPointsM4},
+	{"transformDirectionsM4", runTransformDirectionsM4},
+	{"transposeM4Scalar", runTransposeM4Scalar},
+	{"transposeM4", runTransposeM4},
+	{"inverseM4Scalar", runInverseM4Scalar},
+	{"inverseM4", runInverseM4},
+	{"mulM34", runMulM34},
+	{"mulM4M34", runMulM4M34},
+	{"mulTransform", runMulTransform},
+	{"m34FromTransform", runM34FromTransform},
+	{"transformPointM34", runTransformPointM34},
+	{"transformPoint", runTransformPoint},
+	{"translateM4", runTranslateM4},
+	{"rotationXAxisM4", runRotationXAxisM4},
+	{"rotationYAxisM4", runRotationYAxisM4},
+	{"rotationZAxisM4", runRotationZAxisM4},
+	{"perspectiveM4", runPerspectiveM4},
+	{"sinf + cosf", runSinfCosf},
+	{"sinCosF32", runSinCosF32},
+	{"sinCosF32x4", runSinCosF32x4},
+	{"sinCosBatch", runSinCosBatch},
+};
+
+static u32 randomState = 0x2545f491;
+
+// a float in [-1, 1), from a fixed sequence so every run times the same inputs
+static f32 randomUnit(void) {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return (f32) (randomState >> 8) * (2.0f / (f32) (1 << 24)) - 1.0f;
+}
+
+// Mix every output into one number, and print it, so the compiler has to
+// produce them all.
+static u32 checksumOutputs(void) {
+	u32 checksum = 0;
+	const u8* regions[] = {
+		(const u8*) outputMatrices, (const u8*) outputVectors,
+		(const u8*) outputX, (const u8*) outputY, (const u8*) outputZ,
+		(const u8*) outputAffines, (const u8*) outputTransforms,
+	};
+	size_t sizes[] = {
+		sizeof(outputMatrices), sizeof(outputVectors),
+		sizeof(outputX), sizeof(outputY), sizeof(outputZ),
+		sizeof(outputAffines), sizeof(outputTransforms),
+	};
+	for (u32 r = 0; r < ArrayCount(regions); ++r) {
+		for (size_t i = 0; i < sizes[r]; ++i) {
+			checksum = checksum * 31 + regions[r][i];
+		}
+	}
+	return checksum;
+}
+
+int main(int argc, char* argv[]) {
+	double secondsPerBenchmark = 0.5;
+	const char* only = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+			++i;
+			secondsPerBenchmark = atof(argv[i]);
+		} else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+			++i;
+			only = argv[i];
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+
+	for (u32 i = 0; i < VALUE_COUNT; ++i) {
+		for (u32 e = 0; e < 16; ++e) {
+			inputMatrices[i].elems[e] = 10.0f * randomUnit();
+			otherMatrices[i].elems[e] = 10.0f * randomUnit();
+		}
+		inputVectors[i] = vec4(10.0f * randomUnit(), 10.0f * randomUnit(), 10.0f * randomUnit(), 1.0f);
+		inputAngles[i] = 4.0f * (f32) PI * randomUnit();
+		inputX[i] = 10.0f * randomUnit();
+		inputY[i] = 10.0f * randomUnit();
+		inputZ[i] = 10.0f * randomUnit();
+		for (u32 e = 0; e < 12; ++e) {
+			inputAffines[i].elems[e] = 10.0f * randomUnit();
+			otherAffines[i].elems[e] = 10.0f * randomUnit();
+		}
+		Transform* transforms[2] = {inputTransforms + i, otherTransforms + i};
+		for (u32 t = 0; t < 2; ++t) {
+			Quat rotation = normalizeQuat(quat(randomUnit(), randomUnit(), randomUnit(), randomUnit()));
+			Vec3 translation = vec3(10.0f * randomUnit(), 10.0f * randomUnit(), 10.0f * randomUnit());
+			*transforms[t] = transform(rotation, translation, 1.0f + 0.5f * randomUnit());
+		}
+	}
+
+#if UT_SIMD_WASM
+	const char* simd = "wasm simd128";
+#elif UT_SIMD_SSE
+	const char* simd = "SSE";
+#else
+	const char* simd = "none";
+#endif
+	printf("F32x4 instructions: %s\n", simd);
+	printf("%-24s %10s %14s\n", "function", "ns/call", "calls/s");
+	for (u32 benchmarkIndex = 0; benchmarkIndex < ArrayCount(benchmarks); ++benchmarkIndex) {
+		Benchmark* benchmark = benchmarks + benchmarkIndex;
+		if (only && !strstr(benchmark->name, only)) {
+			continue;
+		}
+		// once to warm up the caches
+		benchmark->run();
+		u64 callCount = 0;
+		u64 startTime = timeNowNanoseconds();
+		u64 endTime = startTime + (u64) (secondsPerBenchmark * 1e9);
+		u64 now = startTime;
+		while (now < endTime) {
+			benchmark->run();
+			callCount += VALUE_COUNT;
+			now = timeNowNanoseconds();
+		}
+		double nanoseconds = (double) (now - startTime);
+		printf(
+			"%-24s %10.2f %14.0f\n", benchmark->name,
+			nanoseconds / (double) callCount, (double) callCount * 1e9 / nanoseconds);
+	}
+	printf("checksum %08x\n", checksumOutputs());
+	return 0;
+}
@@ -0,0 +1,196 @@
+// Checks that the functions in util_math.h which promise the same bits as
+// another function do so: the SIMD Mat4 functions against their scalar
+// reference versions, and the batched and Mat34 functions against mulM4() and
+// mulM4V4(). Every check runs over random matrices and vectors. Build with:
+//
+//   cc -std=gnu11 -O2 -ffp-contract=off -o math-bits-check tools/math_bits_check.c -lm
+//   cl /O2 /Femath-bits-check tools/math_bits_check.c
+//
+// and with -DUT_NO_SIMD to check the F32x4 fallback. The promises only hold if
+// the compiler keeps multiplies and adds separate, see the top of util_math.h;
+// leaving out -ffp-contract=off with -march=native on a machine with FMA makes
+// this check fail. Pass "--count N" to change the number of random inputs (the
+// default is 200000). The program exits nonzero if any result differs.
+
+#include "../util_math.h"
+
+#define ArrayCount(A) (sizeof(A) / sizeof((A)[0]))
+
+static u32 randomState = 0x2545f491;
+
+// uniform in [-2, 2)
+static f32 randomF32(void) {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return (f32) (randomState >> 8) * (4.0f / (f32) (1 << 24)) - 2.0f;
+}
+
+static Mat4 randomM4(void) {
+	Mat4 m;
+	for (u32 i = 0; i < 16; ++i) {
+		m.elems[i] = randomF32();
+	}
+	return m;
+}
+
+static Mat34 randomM34(void) {
+	Mat34 m;
+	for (u32 i = 0; i < 12; ++i) {
+		m.elems[i] = randomF32();
+	}
+	return m;
+}
+
+// Equal bits, or both NaN: the scalar and SIMD versions may disagree on the
+// sign of a NaN.
+static b32 sameF32(f32 a, f32 b) {
+	if (isnan(a) && isnan(b)) {
+		return TRUE;
+	}
+	return memcmp(&a, &b, 4) == 0;
+}
+
+static b32 sameF32s(const f32* a, const f32* b, u32 count) {
+	for (u32 i = 0; i < count; ++i) {
+		if (!sameF32(a[i], b[i])) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+typedef struct Check {
+	const char* name;
+	u64 mismatchCount;
+} Check;
+
+enum {
+	CHECK_MUL_M4,
+	CHECK_MUL_M4_V4,
+	CHECK_TRANSPOSE_M4,
+	CHECK_INVERSE_M4,
+	CHECK_MUL_M4_BATCH,
+	CHECK_TRANSFORM_POINTS_M4,
+	CHECK_TRANSFORM_DIRECTIONS_M4,
+	CHECK_MUL_M34,
+	CHECK_MUL_M4_M34,
+	CHECK_COUNT
+};
+
+// matrices per call to mulM4Batch(), and points per call to transformPointsM4(),
+// which is not a multiple of 4 so the scalar tail runs too
+#define BATCH_SIZE 67
+
+int main(int argc, char* argv[]) {
+	u32 count = 200000;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+			++i;
+			count = (u32) atoi(argv[i]);
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+
+	Check checks[CHECK_COUNT] = {
+		[CHECK_MUL_M4] = {"mulM4 vs mulM4Scalar"},
+		[CHECK_MUL_M4_V4] = {"mulM4V4 vs mulM4V4Scalar"},
+		[CHECK_TRANSPOSE_M4] = {"transposeM4 vs transposeM4Scalar"},
+		[CHECK_INVERSE_M4] = {"inverseM4 vs inverseM4Scalar"},
+		[CHECK_MUL_M4_BATCH] = {"mulM4Batch vs mulM4"},
+		[CHECK_TRANSFORM_POINTS_M4] = {"transformPointsM4 vs mulM4V4"},
+		[CHECK_TRANSFORM_DIRECTIONS_M4] = {"transformDirectionsM4 vs mulM4V4"},
+		[CHECK_MUL_M34] = {"mulM34 vs mulM4"},
+		[CHECK_MUL_M4_M34] = {"mulM4M34 vs mulM4"},
+	};
+
+	for (u32 n = 0; n < count; ++n) {
+		Mat4 a = randomM4();
+		Mat4 b = randomM4();
+		Vec4 v = vec4(randomF32(), randomF32(), randomF32(), randomF32());
+
+		Mat4 simd = mulM4(a, b);
+		Mat4 scalar = mulM4Scalar(a, b);
+		checks[CHECK_MUL_M4].mismatchCount += !sameF32s(simd.elems, scalar.elems, 16);
+
+		Vec4 simdV = mulM4V4(a, v);
+		Vec4 scalarV = mulM4V4Scalar(a, v);
+		checks[CHECK_MUL_M4_V4].mismatchCount += !sameF32s(&simdV.x, &scalarV.x, 4);
+
+		simd = transposeM4(a);
+		scalar = transposeM4Scalar(a);
+		checks[CHECK_TRANSPOSE_M4].mismatchCount += !sameF32s(simd.elems, scalar.elems, 16);
+
+		simd = inverseM4(a);
+		scalar = inverseM4Scalar(a);
+		checks[CHECK_INVERSE_M4].mismatchCount += !sameF32s(simd.elems, scalar.elems, 16);
+
+		Mat34 a34 = randomM34();
+		Mat34 b34 = randomM34();
+		Mat4 a34As4 = m4FromM34(&a34);
+		Mat4 b34As4 = m4FromM34(&b34);
+		Mat34 product34 = mulM34(&a34, &b34);
+		simd = mulM4(a34As4, b34As4);
+		checks[CHECK_MUL_M34].mismatchCount += !sameF32s(product34.elems, simd.elems, 12);
+
+		Mat4 product = mulM4M34(&a, &b34);
+		simd = mulM4(a, b34As4);
+		checks[CHECK_MUL_M4_M34].mismatchCount += !sameF32s(product.elems, simd.elems, 16);
+	}
+
+	u32 batchCount = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+	Mat4 models[BATCH_SIZE];
+	Mat4 results[BATCH_SIZE];
+	f32 inputs[3][BATCH_SIZE];
+	f32 outputs[3][BATCH_SIZE];
+	Vec3Streams in = vec3Streams(inputs[0], inputs[1], inputs[2]);
+	Vec3Streams out = vec3Streams(outputs[0], outputs[1], outputs[2]);
+	for (u32 n = 0; n < batchCount; ++n) {
+		Mat4 m = randomM4();
+		for (u32 i = 0; i < BATCH_SIZE; ++i) {
+			models[i] = randomM4();
+			inputs[0][i] = randomF32();
+			inputs[1][i] = randomF32();
+			inputs[2][i] = randomF32();
+		}
+
+		mulM4Batch(&m, models, results, BATCH_SIZE);
+		for (u32 i = 0; i < BATCH_SIZE; ++i) {
+			Mat4 expected = mulM4(m, models[i]);
+			checks[CHECK_MUL_M4_BATCH].mismatchCount += !sameF32s(results[i].elems, expected.elems, 16);
+		}
+
+		for (u32 w = 0; w <= 1; ++w) {
+			if (w) {
+				transformPointsM4(&m, in, out, BATCH_SIZE);
+			} else {
+				transformDirectionsM4(&m, in, out, BATCH_SIZE);
+			}
+			u32 checkIndex = w ? CHECK_TRANSFORM_POINTS_M4 : CHECK_TRANSFORM_DIRECTIONS_M4;
+			for (u32 i = 0; i < BATCH_SIZE; ++i) {
+				Vec4 expected = mulM4V4(m, vec4(inputs[0][i], inputs[1][i], inputs[2][i], (f32) w));
+				f32 actual[3] = {outputs[0][i], outputs[1][i], outputs[2][i]};
+				checks[checkIndex].mismatchCount += !sameF32s(actual, &expected.x, 3);
+			}
+		}
+	}
+
+#if defined(UT_SIMD_WASM)
+	const char* backend = "wasm simd128";
+#elif defined(UT_SIMD_SSE)
+	const char* backend = "SSE2";
+#else
+	const char* backend = "scalar";
+#endif
+	printf("F32x4 backend: %s, %u random inputs per check\n", backend, count);
+	int result = 0;
+	for (u32 i = 0; i < ArrayCount(checks); ++i) {
+		printf("%-36s %10llu mismatches\n", checks[i].name, (unsigned long long) checks[i].mismatchCount);
+		if (checks[i].mismatchCount) {
+			result = 1;
+		}
+	}
+	return result;
+}
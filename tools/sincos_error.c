@@ -0,0 +1,153 @@
+// Error report for sinCosF32() in util_math.h, against sin() and cos() from the
+// C library in double precision, which are exact to well below float precision.
+// The angles are every float (or every Nth float with "--step N") in each range
+// of magnitudes, both positive and negative. For comparison, the report also
+// shows the error of sinf() and cosf() over the same angles. Build with:
+//
+//   cc -std=gnu11 -O2 -ffp-contract=off -o sincos-error tools/sincos_error.c -lm
+//   cl /O2 /Fesincos-error tools/sincos_error.c
+//
+// The program also checks that sinCosF32x4() and sinCosBatch() give exactly the
+// same bits as sinCosF32(), and exits nonzero if they do not, or if an error is
+// above SINCOS_MAX_ERROR. Every float takes a few minutes. Leaving out
+// -ffp-contract=off lets gcc fuse the polynomials into FMAs where the target has
+// them (e.g. -march=native), and then the results no longer match.
+
+#include <float.h>
+
+#include "../util_math.h"
+
+#define ArrayCount(A) (sizeof(A) / sizeof((A)[0]))
+
+typedef struct ErrorStats {
+	u64 angleCount;
+	// absolute error, and error in units in the last place of the exact result
+	double maxError;
+	double maxUlps;
+	f32 maxErrorAngle;
+	f32 maxUlpsAngle;
+} ErrorStats;
+
+// The distance between the float nearest to exact and the next float away from
+// zero.
+static double ulpOf(double exact) {
+	f32 nearest = fabsf((f32) exact);
+	if (nearest < FLT_MIN) {
+		return ldexp(1.0, -149);
+	}
+	int exponent;
+	frexpf(nearest, &exponent);
+	return ldexp(1.0, exponent - 24);
+}
+
+static void addError(ErrorStats* stats, f32 angle, f32 result, double exact) {
+	double error = fabs((double) result - exact);
+	double ulps = error / ulpOf(exact);
+	if (error > stats->maxError) {
+		stats->maxError = error;
+		stats->maxErrorAngle = angle;
+	}
+	if (ulps > stats->maxUlps) {
+		stats->maxUlps = ulps;
+		stats->maxUlpsAngle = angle;
+	}
+}
+
+typedef struct AngleRange {
+	const char* name;
+	// the bit patterns of the smallest and largest positive angle in the range
+	u32 first;
+	u32 last;
+} AngleRange;
+
+#define CHUNK_SIZE 1024
+
+int main(int argc, char* argv[]) {
+	u32 step = 1;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--step") == 0 && i + 1 < argc) {
+			++i;
+			step = (u32) atoi(argv[i]);
+			if (step == 0) {
+				step = 1;
+			}
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+
+	f32 limits[] = {(f32) (PI / 4.0), (f32) (2.0 * PI), 256.0f, SINCOS_FAST_LIMIT, FLT_MAX};
+	u32 limitBits[ArrayCount(limits)];
+	for (u32 i = 0; i < ArrayCount(limits); ++i) {
+		memcpy(limitBits + i, limits + i, 4);
+	}
+	AngleRange ranges[] = {
+		{"[0, pi/4]", 0, limitBits[0]},
+		{"(pi/4, 2 pi]", limitBits[0] + 1, limitBits[1]},
+		{"(2 pi, 256]", limitBits[1] + 1, limitBits[2]},
+		{"(256, 8192]", limitBits[2] + 1, limitBits[3]},
+		{"beyond 8192 (sinf)", limitBits[3] + 1, limitBits[4]},
+	};
+
+	printf("every %u%s float, positive and negative; errors of sin and cos together\n", step, step == 1 ? "st" : "th");
+	printf(
+		"%-20s %12s | %10s %8s %14s | %10s %8s\n",
+		"|angle|", "angles", "max error", "ulps", "at", "sinf error", "ulps");
+	int result = 0;
+	u64 mismatchCount = 0;
+	double maxFastError = 0.0;
+	for (u32 rangeIndex = 0; rangeIndex < ArrayCount(ranges); ++rangeIndex) {
+		AngleRange* range = ranges + rangeIndex;
+		ErrorStats ours = {0};
+		ErrorStats libm = {0};
+		f32 angles[CHUNK_SIZE];
+		f32 sines[CHUNK_SIZE];
+		f32 cosines[CHUNK_SIZE];
+		u64 bits = range->first;
+		while (bits <= range->last) {
+			u32 count = 0;
+			while (count < CHUNK_SIZE && bits <= range->last) {
+				u32 angleBits = (u32) bits | (count & 1 ? 0x80000000 : 0);
+				memcpy(angles + count, &angleBits, 4);
+				++count;
+				bits += step;
+			}
+			sinCosBatch(angles, sines, cosines, count);
+			for (u32 i = 0; i < count; ++i) {
+				f32 angle = angles[i];
+				f32 s, c;
+				sinCosF32(angle, &s, &c);
+				if (memcmp(&s, sines + i, 4) != 0 || memcmp(&c, cosines + i, 4) != 0) {
+					if (mismatchCount == 0) {
+						printf("sinCosBatch() differs from sinCosF32() at %.9g\n", angle);
+					}
+					++mismatchCount;
+				}
+				double exactSin = sin((double) angle);
+				double exactCos = cos((double) angle);
+				addError(&ours, angle, s, exactSin);
+				addError(&ours, angle, c, exactCos);
+				addError(&libm, angle, sinf(angle), exactSin);
+				addError(&libm, angle, cosf(angle), exactCos);
+			}
+			ours.angleCount += count;
+		}
+		printf(
+			"%-20s %12llu | %10.3g %8.2f %14.9g | %10.3g %8.2f\n",
+			range->name, (unsigned long long) ours.angleCount,
+			ours.maxError, ours.maxUlps, ours.maxErrorAngle, libm.maxError, libm.maxUlps);
+		if (range->last <= limitBits[3] && ours.maxError > maxFastError) {
+			maxFastError = ours.maxError;
+		}
+	}
+	printf("max error up to SINCOS_FAST_LIMIT: %.3g (SINCOS_MAX_ERROR is %.3g)\n", maxFastError, SINCOS_MAX_ERROR);
+	if (maxFastError > SINCOS_MAX_ERROR) {
+		result = 1;
+	}
+	if (mismatchCount) {
+		printf("%llu angles where sinCosBatch() differs from sinCosF32()\n", (unsigned long long) mismatchCount);
+		result = 1;
+	}
+	return result;
+}
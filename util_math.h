@@ -0,0 +1,1009 @@
+// The parts of util.h that do not depend on emscripten or OpenGL: the basic
+// types, error reporting and the vector and matrix math. Including this on its
+// own builds with any C compiler, so the math can be profiled natively, see
+// tools/math_benchmark.c.
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pick a SIMD instruction set for the F32x4 type used by the Mat4 functions.
+// Define UT_NO_SIMD to use the scalar code on every platform.
+#if !defined(UT_NO_SIMD) && defined(__wasm_simd128__)
+#define UT_SIMD_WASM 1
+#include <wasm_simd128.h>
+#elif !defined(UT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define UT_SIMD_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Several functions below promise the same bits as another function, like the
+// SIMD Mat4 functions and their scalar reference versions. That only holds if
+// the compiler keeps every multiply and add separate: build with
+// -ffp-contract=off on gcc and clang, which otherwise fuse them into FMAs
+// (gcc by default in gnu modes, clang within an expression) wherever the
+// target has FMA, e.g. with -march=native. MSVC only fuses with /fp:fast or
+// /fp:contract. tools/math_bits_check.c checks the promises.
+
+typedef int8_t i8;
+typedef uint8_t u8;
+typedef int16_t i16;
+typedef uint16_t u16;
+typedef int32_t i32;
+typedef uint32_t u32;
+typedef int64_t i64;
+typedef uint64_t u64;
+
+typedef float f32;
+typedef double f64;
+
+typedef u32 b32;
+#define FALSE 0
+#define TRUE 1
+
+#define StringifyHelper(X) #X
+#define Stringify(X) StringifyHelper(X)
+
+// use a lot of digits to support constant propagation
+#define PI 3.14159265358979323846264338327950288419716939937510582097494459230781640628620899862
+
+typedef void (*FExitError)();
+
+static void defaultExitError() {
+	exit(1);
+}
+
+FExitError exitError = defaultExitError;
+
+#define LogError(Message, ...) \
+	fprintf(stderr, __FILE__ "@" Stringify(__LINE__) ": " Message, ##__VA_ARGS__);
+
+#define FatalError(Message, ...) \
+	LogError(Message, ##__VA_ARGS__); \
+	exitError()
+
+inline static f32 degToRad(f32 deg) {
+	return deg * ((f32) (PI / 180.0));
+}
+
+inline static f32 radToDeg(f32 rad) {
+	return rad * ((f32) (180.0 / PI));
+}
+
+typedef struct Vec3 {
+	f32 x, y, z;
+} Vec3;
+
+typedef struct Vec4 {
+	f32 x, y, z, w;
+} Vec4;
+
+typedef struct ColorRgba8 {
+	u8 r, g, b, a;
+} ColorRgba8;
+
+typedef struct ColorRgbF32 {
+	f32 r, g, b;
+} ColorRgbF32;
+
+typedef struct ColorRgbaF32 {
+	f32 r, g, b, a;
+} ColorRgbaF32;
+
+inline static Vec3 vec3(f32 x, f32 y, f32 z) {
+	Vec3 v = {x, y, z};
+	return v;
+}
+
+inline static Vec4 vec4(f32 x, f32 y, f32 z, f32 w) {
+	Vec4 v = {x, y, z, w};
+	return v;
+}
+
+inline static f32 dotV4(Vec4 a, Vec4 b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+typedef struct Mat4 {
+	f32 elems[16];
+} Mat4;
+
+inline static u32 indexM4(u32 r, u32 c) {
+	assert(r <= 3);
+	assert(c <= 3);
+	return r * 4 + c;
+}
+
+inline static f32 getM4(const Mat4* m, u32 r, u32 c) {
+	return m->elems[indexM4(r, c)];
+}
+
+inline static void setM4(Mat4* m, u32 r, u32 c, f32 value) {
+	m->elems[indexM4(r, c)] = value;
+}
+
+inline static Mat4 mat4(
+		f32 m00, f32 m01, f32 m02, f32 m03,
+		f32 m10, f32 m11, f32 m12, f32 m13,
+		f32 m20, f32 m21, f32 m22, f32 m23,
+		f32 m30, f32 m31, f32 m32, f32 m33) {
+	Mat4 m = {{
+		m00, m01, m02, m03,
+		m10, m11, m12, m13,
+		m20, m21, m22, m23,
+		m30, m31, m32, m33,
+	}};
+	return m;
+}
+
+inline static Vec4 rowM4(const Mat4* m, u32 row) {
+	Vec4 v = {
+		getM4(m, row, 0),
+		getM4(m, row, 1),
+		getM4(m, row, 2),
+		getM4(m, row, 3),
+	};
+	return v;
+}
+
+inline static Vec4 columnM4(const Mat4* m, u32 column) {
+	Vec4 v = {
+		getM4(m, 0, column),
+		getM4(m, 1, column),
+		getM4(m, 2, column),
+		getM4(m, 3, column),
+	};
+	return v;
+}
+
+// A vector of 4 floats, in one SIMD register where there is one. The Mat4
+// functions below are written once on top of these, so every platform does the
+// same float operations in the same order: lane for lane, the SIMD and scalar
+// results are identical, as long as the compiler does not fuse a multiply and
+// an add into an FMA (it does not by default on x86-64 or wasm).
+#if UT_SIMD_WASM
+
+typedef v128_t F32x4;
+
+inline static F32x4 f32x4Load(const f32* values) { return wasm_v128_load(values); }
+inline static void f32x4Store(f32* values, F32x4 v) { wasm_v128_store(values, v); }
+inline static F32x4 f32x4Splat(f32 value) { return wasm_f32x4_splat(value); }
+inline static F32x4 f32x4Add(F32x4 a, F32x4 b) { return wasm_f32x4_add(a, b); }
+inline static F32x4 f32x4Sub(F32x4 a, F32x4 b) { return wasm_f32x4_sub(a, b); }
+inline static F32x4 f32x4Mul(F32x4 a, F32x4 b) { return wasm_f32x4_mul(a, b); }
+inline static F32x4 f32x4Div(F32x4 a, F32x4 b) { return wasm_f32x4_div(a, b); }
+
+// Lanes compare to a mask of all ones when true, and all zeros when false.
+inline static F32x4 f32x4Greater(F32x4 a, F32x4 b) { return wasm_f32x4_gt(a, b); }
+inline static b32 f32x4AnyTrue(F32x4 mask) { return wasm_v128_any_true(mask); }
+
+// Operations on the bits of each lane, as a u32.
+inline static F32x4 f32x4SplatBits(u32 bits) { return wasm_i32x4_splat((i32) bits); }
+inline static F32x4 f32x4And(F32x4 a, F32x4 b) { return wasm_v128_and(a, b); }
+inline static F32x4 f32x4Xor(F32x4 a, F32x4 b) { return wasm_v128_xor(a, b); }
+inline static F32x4 f32x4EqualBits(F32x4 a, F32x4 b) { return wasm_i32x4_eq(a, b); }
+#define F32x4ShiftBitsLeft(V, N) wasm_i32x4_shl((V), (N))
+
+// lanes A[I0], A[I1], B[I2], B[I3], like _mm_shuffle_ps()
+#define F32x4Shuffle(A, B, I0, I1, I2, I3) \
+	wasm_i32x4_shuffle((A), (B), (I0), (I1), (I2) + 4, (I3) + 4)
+
+#elif UT_SIMD_SSE
+
+typedef __m128 F32x4;
+
+inline static F32x4 f32x4Load(const f32* values) { return _mm_loadu_ps(values); }
+inline static void f32x4Store(f32* values, F32x4 v) { _mm_storeu_ps(values, v); }
+inline static F32x4 f32x4Splat(f32 value) { return _mm_set1_ps(value); }
+inline static F32x4 f32x4Add(F32x4 a, F32x4 b) { return _mm_add_ps(a, b); }
+inline static F32x4 f32x4Sub(F32x4 a, F32x4 b) { return _mm_sub_ps(a, b); }
+inline static F32x4 f32x4Mul(F32x4 a, F32x4 b) { return _mm_mul_ps(a, b); }
+inline static F32x4 f32x4Div(F32x4 a, F32x4 b) { return _mm_div_ps(a, b); }
+
+inline static F32x4 f32x4Greater(F32x4 a, F32x4 b) { return _mm_cmpgt_ps(a, b); }
+inline static b32 f32x4AnyTrue(F32x4 mask) { return _mm_movemask_ps(mask) != 0; }
+
+inline static F32x4 f32x4SplatBits(u32 bits) { return _mm_castsi128_ps(_mm_set1_epi32((i32) bits)); }
+inline static F32x4 f32x4And(F32x4 a, F32x4 b) { return _mm_and_ps(a, b); }
+inline static F32x4 f32x4Xor(F32x4 a, F32x4 b) { return _mm_xor_ps(a, b); }
+
+inline static F32x4 f32x4EqualBits(F32x4 a, F32x4 b) {
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_castps_si128(a), _mm_castps_si128(b)));
+}
+
+#define F32x4ShiftBitsLeft(V, N) \
+	_mm_castsi128_ps(_mm_slli_epi32(_mm_castps_si128(V), (N)))
+
+#define F32x4Shuffle(A, B, I0, I1, I2, I3) \
+	_mm_shuffle_ps((A), (B), _MM_SHUFFLE((I3), (I2), (I1), (I0)))
+
+#else
+
+typedef struct F32x4 {
+	f32 lanes[4];
+} F32x4;
+
+inline static F32x4 f32x4Load(const f32* values) {
+	F32x4 v = {{values[0], values[1], values[2], values[3]}};
+	return v;
+}
+
+inline static void f32x4Store(f32* values, F32x4 v) {
+	values[0] = v.lanes[0];
+	values[1] = v.lanes[1];
+	values[2] = v.lanes[2];
+	values[3] = v.lanes[3];
+}
+
+inline static F32x4 f32x4Splat(f32 value) {
+	F32x4 v = {{value, value, value, value}};
+	return v;
+}
+
+inline static F32x4 f32x4Add(F32x4 a, F32x4 b) {
+	F32x4 v = {{a.lanes[0] + b.lanes[0], a.lanes[1] + b.lanes[1], a.lanes[2] + b.lanes[2], a.lanes[3] + b.lanes[3]}};
+	return v;
+}
+
+inline static F32x4 f32x4Sub(F32x4 a, F32x4 b) {
+	F32x4 v = {{a.lanes[0] - b.lanes[0], a.lanes[1] - b.lanes[1], a.lanes[2] - b.lanes[2], a.lanes[3] - b.lanes[3]}};
+	return v;
+}
+
+inline static F32x4 f32x4Mul(F32x4 a, F32x4 b) {
+	F32x4 v = {{a.lanes[0] * b.lanes[0], a.lanes[1] * b.lanes[1], a.lanes[2] * b.lanes[2], a.lanes[3] * b.lanes[3]}};
+	return v;
+}
+
+inline static F32x4 f32x4Div(F32x4 a, F32x4 b) {
+	F32x4 v = {{a.lanes[0] / b.lanes[0], a.lanes[1] / b.lanes[1], a.lanes[2] / b.lanes[2], a.lanes[3] / b.lanes[3]}};
+	return v;
+}
+
+// the lanes of v as u32s, and back
+inline static void ut__f32x4ToBits(F32x4 v, u32* bits) {
+	memcpy(bits, v.lanes, 16);
+}
+
+inline static F32x4 ut__f32x4FromBits(const u32* bits) {
+	F32x4 v;
+	memcpy(v.lanes, bits, 16);
+	return v;
+}
+
+inline static F32x4 f32x4Greater(F32x4 a, F32x4 b) {
+	u32 bits[4];
+	for (u32 i = 0; i < 4; ++i) {
+		bits[i] = a.lanes[i] > b.lanes[i] ? 0xFFFFFFFF : 0;
+	}
+	return ut__f32x4FromBits(bits);
+}
+
+inline static b32 f32x4AnyTrue(F32x4 mask) {
+	u32 bits[4];
+	ut__f32x4ToBits(mask, bits);
+	return (bits[0] | bits[1] | bits[2] | bits[3]) != 0;
+}
+
+inline static F32x4 f32x4SplatBits(u32 bits) {
+	u32 lanes[4] = {bits, bits, bits, bits};
+	return ut__f32x4FromBits(lanes);
+}
+
+inline static F32x4 f32x4And(F32x4 a, F32x4 b) {
+	u32 aBits[4], bBits[4];
+	ut__f32x4ToBits(a, aBits);
+	ut__f32x4ToBits(b, bBits);
+	for (u32 i = 0; i < 4; ++i) {
+		aBits[i] &= bBits[i];
+	}
+	return ut__f32x4FromBits(aBits);
+}
+
+inline static F32x4 f32x4Xor(F32x4 a, F32x4 b) {
+	u32 aBits[4], bBits[4];
+	ut__f32x4ToBits(a, aBits);
+	ut__f32x4ToBits(b, bBits);
+	for (u32 i = 0; i < 4; ++i) {
+		aBits[i] ^= bBits[i];
+	}
+	return ut__f32x4FromBits(aBits);
+}
+
+inline static F32x4 f32x4EqualBits(F32x4 a, F32x4 b) {
+	u32 aBits[4], bBits[4];
+	ut__f32x4ToBits(a, aBits);
+	ut__f32x4ToBits(b, bBits);
+	for (u32 i = 0; i < 4; ++i) {
+		aBits[i] = aBits[i] == bBits[i] ? 0xFFFFFFFF : 0;
+	}
+	return ut__f32x4FromBits(aBits);
+}
+
+inline static F32x4 ut__f32x4ShiftBitsLeft(F32x4 v, u32 count) {
+	u32 bits[4];
+	ut__f32x4ToBits(v, bits);
+	for (u32 i = 0; i < 4; ++i) {
+		bits[i] <<= count;
+	}
+	return ut__f32x4FromBits(bits);
+}
+
+#define F32x4ShiftBitsLeft(V, N) ut__f32x4ShiftBitsLeft((V), (N))
+
+inline static F32x4 ut__f32x4Shuffle(F32x4 a, F32x4 b, u32 i0, u32 i1, u32 i2, u32 i3) {
+	F32x4 v = {{a.lanes[i0], a.lanes[i1], b.lanes[i2], b.lanes[i3]}};
+	return v;
+}
+
+#define F32x4Shuffle(A, B, I0, I1, I2, I3) \
+	ut__f32x4Shuffle((A), (B), (I0), (I1), (I2), (I3))
+
+#endif
+
+inline static F32x4 f32x4FromV4(Vec4 v) {
+	return f32x4Load(&v.x);
+}
+
+inline static Vec4 v4FromF32x4(F32x4 v) {
+	Vec4 result;
+	f32x4Store(&result.x, v);
+	return result;
+}
+
+// Sine and cosine of the same angle, for building rotations, in one go.
+//
+// The angle is reduced to r in [-pi/4, pi/4] by subtracting the nearest
+// multiple q of pi/2, in three parts so that the first two products are exact
+// (Cody and Waite). Minimax polynomials for sin(r) and cos(r) (from Cephes)
+// then give both results, swapped and negated depending on q. Compared with
+// sin() and cos() in double precision, over every float in the fast range, the
+// error is at most SINCOS_MAX_ERROR (7.82e-8 measured, less than one unit in
+// the last place of 1.0), and below one unit in the last place of the result
+// where |radians| <= pi/4; tools/sincos_error.c prints the full report.
+// Angles beyond SINCOS_FAST_LIMIT and infinities go to sinf() and cosf(), so
+// the results hold over the whole float range.
+//
+// Built with -ffp-contract=off (see the top of this file), sinCosF32(),
+// sinCosF32x4() and sinCosBatch() compute the same bits for every angle that is
+// not a NaN. With fused multiply-adds the scalar polynomials round differently.
+#define SINCOS_FAST_LIMIT 8192.0f
+#define SINCOS_MAX_ERROR 8.0e-8f
+
+#define UT_SINCOS_TWO_OVER_PI 0.636619772367581343f
+// adding this rounds a float below 2^22 to an integer, held in the low bits
+#define UT_SINCOS_ROUND 12582912.0f
+#define UT_SINCOS_PI_OVER_2_A 1.5703125f
+#define UT_SINCOS_PI_OVER_2_B 4.837512969970703125e-4f
+#define UT_SINCOS_PI_OVER_2_C 7.54978995489188216e-8f
+#define UT_SINCOS_SIN_1 -1.9515295891e-4f
+#define UT_SINCOS_SIN_2 8.3321608736e-3f
+#define UT_SINCOS_SIN_3 -1.6666654611e-1f
+#define UT_SINCOS_COS_1 2.443315711809948e-5f
+#define UT_SINCOS_COS_2 -1.388731625493765e-3f
+#define UT_SINCOS_COS_3 4.166664568298827e-2f
+
+inline static void sinCosF32(f32 radians, f32* s, f32* c) {
+	// a NaN goes through the polynomials and comes out as a NaN
+	if (fabsf(radians) > SINCOS_FAST_LIMIT) {
+		*s = sinf(radians);
+		*c = cosf(radians);
+		return;
+	}
+	f32 rounded = radians * UT_SINCOS_TWO_OVER_PI + UT_SINCOS_ROUND;
+	f32 q = rounded - UT_SINCOS_ROUND;
+	f32 r = radians - q * UT_SINCOS_PI_OVER_2_A;
+	r = r - q * UT_SINCOS_PI_OVER_2_B;
+	r = r - q * UT_SINCOS_PI_OVER_2_C;
+	f32 r2 = r * r;
+
+	f32 sinR = UT_SINCOS_SIN_1;
+	sinR = sinR * r2 + UT_SINCOS_SIN_2;
+	sinR = sinR * r2 + UT_SINCOS_SIN_3;
+	sinR = sinR * r2 * r + r;
+	f32 cosR = UT_SINCOS_COS_1;
+	cosR = cosR * r2 + UT_SINCOS_COS_2;
+	cosR = cosR * r2 + UT_SINCOS_COS_3;
+	cosR = cosR * r2 * r2 - 0.5f * r2 + 1.0f;
+
+	// The quadrant is the low two bits of q. Odd quadrants swap sin and cos,
+	// without a branch, since the quadrants of random angles are unpredictable.
+	u32 quadrant, sinBits, cosBits;
+	memcpy(&quadrant, &rounded, 4);
+	memcpy(&sinBits, &sinR, 4);
+	memcpy(&cosBits, &cosR, 4);
+	u32 swapBits = (sinBits ^ cosBits) & (0 - (quadrant & 1));
+	sinBits ^= swapBits ^ ((quadrant << 30) & 0x80000000);
+	cosBits ^= swapBits ^ (((quadrant + 1) << 30) & 0x80000000);
+	memcpy(s, &sinBits, 4);
+	memcpy(c, &cosBits, 4);
+}
+
+// sinCosF32() for 4 angles at a time.
+inline static void sinCosF32x4(F32x4 radians, F32x4* s, F32x4* c) {
+	F32x4 magnitude = f32x4And(radians, f32x4SplatBits(0x7FFFFFFF));
+	if (f32x4AnyTrue(f32x4Greater(magnitude, f32x4Splat(SINCOS_FAST_LIMIT)))) {
+		f32 angles[4], sines[4], cosines[4];
+		f32x4Store(angles, radians);
+		for (u32 i = 0; i < 4; ++i) {
+			sinCosF32(angles[i], sines + i, cosines + i);
+		}
+		*s = f32x4Load(sines);
+		*c = f32x4Load(cosines);
+		return;
+	}
+	F32x4 rounded = f32x4Add(f32x4Mul(radians, f32x4Splat(UT_SINCOS_TWO_OVER_PI)), f32x4Splat(UT_SINCOS_ROUND));
+	F32x4 q = f32x4Sub(rounded, f32x4Splat(UT_SINCOS_ROUND));
+	F32x4 r = f32x4Sub(radians, f32x4Mul(q, f32x4Splat(UT_SINCOS_PI_OVER_2_A)));
+	r = f32x4Sub(r, f32x4Mul(q, f32x4Splat(UT_SINCOS_PI_OVER_2_B)));
+	r = f32x4Sub(r, f32x4Mul(q, f32x4Splat(UT_SINCOS_PI_OVER_2_C)));
+	F32x4 r2 = f32x4Mul(r, r);
+
+	F32x4 sinR = f32x4Splat(UT_SINCOS_SIN_1);
+	sinR = f32x4Add(f32x4Mul(sinR, r2), f32x4Splat(UT_SINCOS_SIN_2));
+	sinR = f32x4Add(f32x4Mul(sinR, r2), f32x4Splat(UT_SINCOS_SIN_3));
+	sinR = f32x4Add(f32x4Mul(f32x4Mul(sinR, r2), r), r);
+	F32x4 cosR = f32x4Splat(UT_SINCOS_COS_1);
+	cosR = f32x4Add(f32x4Mul(cosR, r2), f32x4Splat(UT_SINCOS_COS_2));
+	cosR = f32x4Add(f32x4Mul(cosR, r2), f32x4Splat(UT_SINCOS_COS_3));
+	cosR = f32x4Sub(f32x4Mul(f32x4Mul(cosR, r2), r2), f32x4Mul(f32x4Splat(0.5f), r2));
+	cosR = f32x4Add(cosR, f32x4Splat(1.0f));
+
+	F32x4 one = f32x4SplatBits(1);
+	F32x4 swap = f32x4EqualBits(f32x4And(rounded, one), one);
+	F32x4 swapBits = f32x4And(f32x4Xor(sinR, cosR), swap);
+	F32x4 signBit = f32x4SplatBits(0x80000000);
+	F32x4 sinSign = f32x4And(F32x4ShiftBitsLeft(rounded, 30), signBit);
+	// rounded + 1 is q + 1 in the low bits, like (quadrant + 1) in sinCosF32()
+	F32x4 cosSign = f32x4And(F32x4ShiftBitsLeft(f32x4Add(rounded, f32x4Splat(1.0f)), 30), signBit);
+	*s = f32x4Xor(f32x4Xor(sinR, swapBits), sinSign);
+	*c = f32x4Xor(f32x4Xor(cosR, swapBits), cosSign);
+}
+
+// sines[i] and cosines[i] of radians[i] for count angles, 8 at a time as two
+// independent sinCosF32x4() calls, so the polynomials of one hide the latency
+// of the other.
+inline static void sinCosBatch(const f32* radians, f32* sines, f32* cosines, u32 count) {
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		F32x4 s0, c0, s1, c1;
+		sinCosF32x4(f32x4Load(radians + i), &s0, &c0);
+		sinCosF32x4(f32x4Load(radians + i + 4), &s1, &c1);
+		f32x4Store(sines + i, s0);
+		f32x4Store(cosines + i, c0);
+		f32x4Store(sines + i + 4, s1);
+		f32x4Store(cosines + i + 4, c1);
+	}
+	for (; i < count; ++i) {
+		sinCosF32(radians[i], sines + i, cosines + i);
+	}
+}
+
+// The columns of the matrix whose rows are r0 to r3, in place.
+#define UtTransposeF32x4(R0, R1, R2, R3) \
+	do { \
+		F32x4 ut__t0 = F32x4Shuffle((R0), (R1), 0, 1, 0, 1); \
+		F32x4 ut__t1 = F32x4Shuffle((R0), (R1), 2, 3, 2, 3); \
+		F32x4 ut__t2 = F32x4Shuffle((R2), (R3), 0, 1, 0, 1); \
+		F32x4 ut__t3 = F32x4Shuffle((R2), (R3), 2, 3, 2, 3); \
+		(R0) = F32x4Shuffle(ut__t0, ut__t2, 0, 2, 0, 2); \
+		(R1) = F32x4Shuffle(ut__t0, ut__t2, 1, 3, 1, 3); \
+		(R2) = F32x4Shuffle(ut__t1, ut__t3, 0, 2, 0, 2); \
+		(R3) = F32x4Shuffle(ut__t1, ut__t3, 1, 3, 1, 3); \
+	} while (0)
+
+// The reference versions of the Mat4 functions below, one element at a time.
+// Built with -ffp-contract=off (see the top of this file), they compute exactly
+// the same bits as the SIMD versions, apart from the sign of a NaN.
+
+inline static Mat4 mulM4Scalar(Mat4 a, Mat4 b) {
+	Vec4 r0 = rowM4(&a, 0);
+	Vec4 r1 = rowM4(&a, 1);
+	Vec4 r2 = rowM4(&a, 2);
+	Vec4 r3 = rowM4(&a, 3);
+	Vec4 c0 = columnM4(&b, 0);
+	Vec4 c1 = columnM4(&b, 1);
+	Vec4 c2 = columnM4(&b, 2);
+	Vec4 c3 = columnM4(&b, 3);
+	return mat4(
+		dotV4(r0, c0),  dotV4(r0, c1),  dotV4(r0, c2),  dotV4(r0, c3),
+		dotV4(r1, c0),  dotV4(r1, c1),  dotV4(r1, c2),  dotV4(r1, c3),
+		dotV4(r2, c0),  dotV4(r2, c1),  dotV4(r2, c2),  dotV4(r2, c3),
+		dotV4(r3, c0),  dotV4(r3, c1),  dotV4(r3, c2),  dotV4(r3, c3));
+}
+
+inline static Vec4 mulM4V4Scalar(Mat4 m, Vec4 v) {
+	return vec4(
+		dotV4(rowM4(&m, 0), v),
+		dotV4(rowM4(&m, 1), v),
+		dotV4(rowM4(&m, 2), v),
+		dotV4(rowM4(&m, 3), v));
+}
+
+inline static Mat4 transposeM4Scalar(Mat4 m) {
+	Mat4 result;
+	for (u32 r = 0; r < 4; ++r) {
+		for (u32 c = 0; c < 4; ++c) {
+			setM4(&result, c, r, getM4(&m, r, c));
+		}
+	}
+	return result;
+}
+
+// The row and column pairs of the 2x2 determinants in inverseM4Scalar().
+static const u8 ut__inversePairs[6][2] = {{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}};
+
+inline static Mat4 inverseM4Scalar(Mat4 m) {
+	// 2x2 determinants of columns p and q, in rows 0 and 1 (s) and 2 and 3 (c)
+	f32 s[6], c[6];
+	for (u32 i = 0; i < 6; ++i) {
+		u32 p = ut__inversePairs[i][0];
+		u32 q = ut__inversePairs[i][1];
+		s[i] = getM4(&m, 0, p) * getM4(&m, 1, q) - getM4(&m, 1, p) * getM4(&m, 0, q);
+		c[i] = getM4(&m, 2, p) * getM4(&m, 3, q) - getM4(&m, 3, p) * getM4(&m, 2, q);
+	}
+	f32 det =
+		((s[0] * c[5] - s[1] * c[4]) + s[2] * c[3]) +
+		((c[0] * s[5] - c[1] * s[4]) + c[2] * s[3]);
+	f32 invDet = 1.0f / det;
+
+	// each element of the adjugate is three products of an element and a 2x2
+	// determinant; these are their column and determinant indices, by row
+	static const u8 terms[4][3][2] = {
+		{{1, 5}, {2, 4}, {3, 3}},
+		{{0, 5}, {2, 2}, {3, 1}},
+		{{0, 4}, {1, 2}, {3, 0}},
+		{{0, 3}, {1, 1}, {2, 0}},
+	};
+	static const u8 sourceRows[4] = {1, 0, 3, 2};
+	Mat4 result;
+	for (u32 r = 0; r < 4; ++r) {
+		for (u32 col = 0; col < 4; ++col) {
+			u32 sourceRow = sourceRows[col];
+			const f32* dets = col < 2 ? c : s;
+			f32 cofactor =
+				(getM4(&m, sourceRow, terms[r][0][0]) * dets[terms[r][0][1]] -
+				getM4(&m, sourceRow, terms[r][1][0]) * dets[terms[r][1][1]]) +
+				getM4(&m, sourceRow, terms[r][2][0]) * dets[terms[r][2][1]];
+			setM4(&result, r, col, cofactor * (((r + col) & 1) ? -invDet : invDet));
+		}
+	}
+	return result;
+}
+
+// One row of a * b, from that row of a and the rows of b.
+inline static F32x4 ut__mulRowM4(F32x4 row, F32x4 b0, F32x4 b1, F32x4 b2, F32x4 b3) {
+	F32x4 sum = f32x4Mul(F32x4Shuffle(row, row, 0, 0, 0, 0), b0);
+	sum = f32x4Add(sum, f32x4Mul(F32x4Shuffle(row, row, 1, 1, 1, 1), b1));
+	sum = f32x4Add(sum, f32x4Mul(F32x4Shuffle(row, row, 2, 2, 2, 2), b2));
+	return f32x4Add(sum, f32x4Mul(F32x4Shuffle(row, row, 3, 3, 3, 3), b3));
+}
+
+inline static Mat4 mulM4(Mat4 a, Mat4 b) {
+	F32x4 b0 = f32x4Load(b.elems + 0);
+	F32x4 b1 = f32x4Load(b.elems + 4);
+	F32x4 b2 = f32x4Load(b.elems + 8);
+	F32x4 b3 = f32x4Load(b.elems + 12);
+	Mat4 result;
+	f32x4Store(result.elems + 0, ut__mulRowM4(f32x4Load(a.elems + 0), b0, b1, b2, b3));
+	f32x4Store(result.elems + 4, ut__mulRowM4(f32x4Load(a.elems + 4), b0, b1, b2, b3));
+	f32x4Store(result.elems + 8, ut__mulRowM4(f32x4Load(a.elems + 8), b0, b1, b2, b3));
+	f32x4Store(result.elems + 12, ut__mulRowM4(f32x4Load(a.elems + 12), b0, b1, b2, b3));
+	return result;
+}
+
+// m * v, with v as a column vector.
+inline static Vec4 mulM4V4(Mat4 m, Vec4 v) {
+	F32x4 c0 = f32x4Load(m.elems + 0);
+	F32x4 c1 = f32x4Load(m.elems + 4);
+	F32x4 c2 = f32x4Load(m.elems + 8);
+	F32x4 c3 = f32x4Load(m.elems + 12);
+	UtTransposeF32x4(c0, c1, c2, c3);
+	F32x4 sum = f32x4Mul(c0, f32x4Splat(v.x));
+	sum = f32x4Add(sum, f32x4Mul(c1, f32x4Splat(v.y)));
+	sum = f32x4Add(sum, f32x4Mul(c2, f32x4Splat(v.z)));
+	sum = f32x4Add(sum, f32x4Mul(c3, f32x4Splat(v.w)));
+	return v4FromF32x4(sum);
+}
+
+inline static Mat4 transposeM4(Mat4 m) {
+	F32x4 r0 = f32x4Load(m.elems + 0);
+	F32x4 r1 = f32x4Load(m.elems + 4);
+	F32x4 r2 = f32x4Load(m.elems + 8);
+	F32x4 r3 = f32x4Load(m.elems + 12);
+	UtTransposeF32x4(r0, r1, r2, r3);
+	Mat4 result;
+	f32x4Store(result.elems + 0, r0);
+	f32x4Store(result.elems + 4, r1);
+	f32x4Store(result.elems + 8, r2);
+	f32x4Store(result.elems + 12, r3);
+	return result;
+}
+
+// The 2x2 determinants of columns P and Q of rows 2 and 3 in lanes 0 and 1,
+// and of rows 0 and 1 in lanes 2 and 3.
+#define UtInverseDeterminants(R0, R1, R2, R3, P, Q) \
+	f32x4Sub( \
+		f32x4Mul(F32x4Shuffle((R2), (R0), P, P, P, P), F32x4Shuffle((R3), (R1), Q, Q, Q, Q)), \
+		f32x4Mul(F32x4Shuffle((R3), (R1), P, P, P, P), F32x4Shuffle((R2), (R0), Q, Q, Q, Q)))
+
+// The inverse by cofactors, the same way as inverseM4Scalar(), with one output
+// row per vector. A singular matrix gives infinities or NaNs.
+inline static Mat4 inverseM4(Mat4 m) {
+	F32x4 r0 = f32x4Load(m.elems + 0);
+	F32x4 r1 = f32x4Load(m.elems + 4);
+	F32x4 r2 = f32x4Load(m.elems + 8);
+	F32x4 r3 = f32x4Load(m.elems + 12);
+
+	F32x4 d0 = UtInverseDeterminants(r0, r1, r2, r3, 0, 1);
+	F32x4 d1 = UtInverseDeterminants(r0, r1, r2, r3, 0, 2);
+	F32x4 d2 = UtInverseDeterminants(r0, r1, r2, r3, 0, 3);
+	F32x4 d3 = UtInverseDeterminants(r0, r1, r2, r3, 1, 2);
+	F32x4 d4 = UtInverseDeterminants(r0, r1, r2, r3, 1, 3);
+	F32x4 d5 = UtInverseDeterminants(r0, r1, r2, r3, 2, 3);
+
+	// lanes 0 and 2 of the halves of the determinant, added together
+	F32x4 half = f32x4Mul(d0, F32x4Shuffle(d5, d5, 2, 3, 0, 1));
+	half = f32x4Sub(half, f32x4Mul(d1, F32x4Shuffle(d4, d4, 2, 3, 0, 1)));
+	half = f32x4Add(half, f32x4Mul(d2, F32x4Shuffle(d3, d3, 2, 3, 0, 1)));
+	F32x4 det = f32x4Add(F32x4Shuffle(half, half, 2, 3, 0, 1), half);
+	F32x4 invDet = f32x4Div(f32x4Splat(1.0f), det);
+	F32x4 negInvDet = f32x4Mul(invDet, f32x4Splat(-1.0f));
+	// the signs of the cofactors alternate like a checkerboard
+	F32x4 evenSign = F32x4Shuffle(invDet, negInvDet, 0, 0, 0, 0);
+	evenSign = F32x4Shuffle(evenSign, evenSign, 0, 2, 0, 2);
+	F32x4 oddSign = F32x4Shuffle(evenSign, evenSign, 1, 0, 1, 0);
+
+	// column k of m as (m[1][k], m[0][k], m[3][k], m[2][k])
+	F32x4 t0 = F32x4Shuffle(r0, r1, 0, 1, 0, 1);
+	F32x4 t1 = F32x4Shuffle(r0, r1, 2, 3, 2, 3);
+	F32x4 t2 = F32x4Shuffle(r2, r3, 0, 1, 0, 1);
+	F32x4 t3 = F32x4Shuffle(r2, r3, 2, 3, 2, 3);
+	F32x4 k0 = F32x4Shuffle(t0, t2, 2, 0, 2, 0);
+	F32x4 k1 = F32x4Shuffle(t0, t2, 3, 1, 3, 1);
+	F32x4 k2 = F32x4Shuffle(t1, t3, 2, 0, 2, 0);
+	F32x4 k3 = F32x4Shuffle(t1, t3, 3, 1, 3, 1);
+
+	Mat4 result;
+	F32x4 row;
+	row = f32x4Add(f32x4Sub(f32x4Mul(k1, d5), f32x4Mul(k2, d4)), f32x4Mul(k3, d3));
+	f32x4Store(result.elems + 0, f32x4Mul(row, evenSign));
+	row = f32x4Add(f32x4Sub(f32x4Mul(k0, d5), f32x4Mul(k2, d2)), f32x4Mul(k3, d1));
+	f32x4Store(result.elems + 4, f32x4Mul(row, oddSign));
+	row = f32x4Add(f32x4Sub(f32x4Mul(k0, d4), f32x4Mul(k1, d2)), f32x4Mul(k3, d0));
+	f32x4Store(result.elems + 8, f32x4Mul(row, evenSign));
+	row = f32x4Add(f32x4Sub(f32x4Mul(k0, d3), f32x4Mul(k1, d1)), f32x4Mul(k2, d0));
+	f32x4Store(result.elems + 12, f32x4Mul(row, oddSign));
+	return result;
+}
+
+// Positions or directions as structure-of-arrays: the x, y and z of element i
+// are x[i], y[i] and z[i], so 4 elements at a time fill one F32x4.
+typedef struct Vec3Streams {
+	f32* x;
+	f32* y;
+	f32* z;
+} Vec3Streams;
+
+inline static Vec3Streams vec3Streams(f32* x, f32* y, f32* z) {
+	Vec3Streams streams = {x, y, z};
+	return streams;
+}
+
+// The streams starting at element index, to hand one chunk to a thread.
+inline static Vec3Streams vec3StreamsAt(Vec3Streams streams, u32 index) {
+	return vec3Streams(streams.x + index, streams.y + index, streams.z + index);
+}
+
+// One of chunkCount ranges that split count elements between threads. The
+// ranges start at multiples of 16 elements, so two threads never write into the
+// same 64 byte cache line of a stream.
+inline static void batchChunkRange(u32 count, u32 chunkIndex, u32 chunkCount, u32* first, u32* chunkSize) {
+	assert(chunkIndex < chunkCount);
+	u32 blockCount = (count + 15) / 16;
+	u32 begin = (u32) ((u64) blockCount * chunkIndex / chunkCount) * 16;
+	u32 end = (u32) ((u64) blockCount * (chunkIndex + 1) / chunkCount) * 16;
+	*first = begin < count ? begin : count;
+	*chunkSize = (end < count ? end : count) - *first;
+}
+
+// out[i] = m * (in[i], w) for count elements. Only the top three rows of m are
+// used, so it is meant for affine transforms. The results have the same bits
+// as mulM4V4(m, vec4(x, y, z, w)). out may be the same streams as in.
+inline static void ut__transformStreamsM4(const Mat4* m, f32 w, Vec3Streams in, Vec3Streams out, u32 count) {
+	F32x4 rows[3][4];
+	for (u32 r = 0; r < 3; ++r) {
+		for (u32 c = 0; c < 4; ++c) {
+			f32 value = m->elems[r * 4 + c];
+			rows[r][c] = f32x4Splat(c == 3 ? value * w : value);
+		}
+	}
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		F32x4 x = f32x4Load(in.x + i);
+		F32x4 y = f32x4Load(in.y + i);
+		F32x4 z = f32x4Load(in.z + i);
+		F32x4 results[3];
+		for (u32 r = 0; r < 3; ++r) {
+			F32x4 sum = f32x4Mul(rows[r][0], x);
+			sum = f32x4Add(sum, f32x4Mul(rows[r][1], y));
+			sum = f32x4Add(sum, f32x4Mul(rows[r][2], z));
+			results[r] = f32x4Add(sum, rows[r][3]);
+		}
+		f32x4Store(out.x + i, results[0]);
+		f32x4Store(out.y + i, results[1]);
+		f32x4Store(out.z + i, results[2]);
+	}
+	for (; i < count; ++i) {
+		f32 x = in.x[i];
+		f32 y = in.y[i];
+		f32 z = in.z[i];
+		f32 results[3];
+		for (u32 r = 0; r < 3; ++r) {
+			const f32* row = m->elems + r * 4;
+			results[r] = row[0] * x + row[1] * y + row[2] * z + row[3] * w;
+		}
+		out.x[i] = results[0];
+		out.y[i] = results[1];
+		out.z[i] = results[2];
+	}
+}
+
+// Transform count points (w = 1) by m.
+inline static void transformPointsM4(const Mat4* m, Vec3Streams in, Vec3Streams out, u32 count) {
+	ut__transformStreamsM4(m, 1.0f, in, out, count);
+}
+
+// Transform count directions (w = 0) by m, which leaves out the translation.
+inline static void transformDirectionsM4(const Mat4* m, Vec3Streams in, Vec3Streams out, u32 count) {
+	ut__transformStreamsM4(m, 0.0f, in, out, count);
+}
+
+// results[i] = m * models[i] for count matrices, with the same bits as mulM4().
+// The rows of m are broadcast once for the whole batch instead of per matrix.
+inline static void mulM4Batch(const Mat4* m, const Mat4* models, Mat4* results, u32 count) {
+	F32x4 splats[16];
+	for (u32 i = 0; i < 16; ++i) {
+		splats[i] = f32x4Splat(m->elems[i]);
+	}
+	for (u32 i = 0; i < count; ++i) {
+		F32x4 b0 = f32x4Load(models[i].elems + 0);
+		F32x4 b1 = f32x4Load(models[i].elems + 4);
+		F32x4 b2 = f32x4Load(models[i].elems + 8);
+		F32x4 b3 = f32x4Load(models[i].elems + 12);
+		for (u32 r = 0; r < 4; ++r) {
+			F32x4 sum = f32x4Mul(splats[r * 4 + 0], b0);
+			sum = f32x4Add(sum, f32x4Mul(splats[r * 4 + 1], b1));
+			sum = f32x4Add(sum, f32x4Mul(splats[r * 4 + 2], b2));
+			sum = f32x4Add(sum, f32x4Mul(splats[r * 4 + 3], b3));
+			f32x4Store(results[i].elems + r * 4, sum);
+		}
+	}
+}
+
+inline static Mat4 translateM4(Vec3 v) {
+	return mat4(
+		1.0f, 0.0f, 0.0f, v.x,
+		0.0f, 1.0f, 0.0f, v.y,
+		0.0f, 0.0f, 1.0f, v.z,
+		0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+inline static Mat4 rotationXAxisM4(f32 radians) {
+	f32 s, c;
+	sinCosF32(radians, &s, &c);
+	return mat4(
+		1.0f,  0.0f,  0.0f,  0.0f,
+		0.0f,  c,     -s,    0.0f,
+		0.0f,  s,     c,     0.0f,
+		0.0f,  0.0f,  0.0f,  1.0f);
+}
+
+inline static Mat4 rotationYAxisM4(f32 radians) {
+	f32 s, c;
+	sinCosF32(radians, &s, &c);
+	return mat4(
+		c,     0.0f,  -s,    0.0f,
+		0.0f,  1.0f,  0.0f,  0.0f,
+		s,     0.0f,  c,     0.0f,
+		0.0f,  0.0f,  0.0f,  1.0f);
+}
+
+inline static Mat4 rotationZAxisM4(f32 radians) {
+	f32 s, c;
+	sinCosF32(radians, &s, &c);
+	return mat4(
+		c,     -s,    0.0f,  0.0f,
+		s,     c,     0.0f,  0.0f,
+		0.0f,  0.0f,  1.0f,  0.0f,
+		0.0f,  0.0f,  0.0f,  1.0f);
+}
+
+inline static Mat4 perspectiveM4(f32 fieldOfView, f32 aspectRatio, f32 near, f32 far) {
+	f32 t = tanf(0.5f * fieldOfView);
+	f32 m00 = 1.0f / (aspectRatio * t);
+	f32 m11 = 1.0f / t;
+	f32 m22 = -(far + near) / (far - near);
+	f32 m23 = -2.0f * far * near / (far - near);
+	return mat4(
+		m00,  0.0f, 0.0f,  0.0f,
+		0.0f, m11,  0.0f,  0.0f,
+		0.0f, 0.0f, m22,   m23,
+		0.0f, 0.0f, -1.0f, 0.0f);
+}
+
+// An affine transform as the top three rows of a Mat4, in the same row-major
+// order; the bottom row is always (0, 0, 0, 1) and is never stored or
+// uploaded. Composing two of them takes 3 rows of products instead of 4.
+// mulM34() and mulM4M34() still multiply by the constant bottom row of the
+// right-hand matrix, so that their results have the same bits as mulM4().
+typedef struct Mat34 {
+	f32 elems[12];
+} Mat34;
+
+// the implicit bottom row of every Mat34
+static const f32 ut__bottomRowM34[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+inline static Mat34 identityM34(void) {
+	Mat34 m = {{
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+	}};
+	return m;
+}
+
+inline static Mat34 m34FromM4(const Mat4* m) {
+	assert(m->elems[12] == 0.0f && m->elems[13] == 0.0f && m->elems[14] == 0.0f && m->elems[15] == 1.0f);
+	Mat34 result;
+	memcpy(result.elems, m->elems, sizeof(result.elems));
+	return result;
+}
+
+inline static Mat4 m4FromM34(const Mat34* m) {
+	Mat4 result;
+	memcpy(result.elems, m->elems, sizeof(m->elems));
+	result.elems[12] = 0.0f;
+	result.elems[13] = 0.0f;
+	result.elems[14] = 0.0f;
+	result.elems[15] = 1.0f;
+	return result;
+}
+
+// a * b, with the same bits as the top three rows of mulM4() on the Mat4s.
+inline static Mat34 mulM34(const Mat34* a, const Mat34* b) {
+	F32x4 b0 = f32x4Load(b->elems + 0);
+	F32x4 b1 = f32x4Load(b->elems + 4);
+	F32x4 b2 = f32x4Load(b->elems + 8);
+	F32x4 b3 = f32x4Load(ut__bottomRowM34);
+	Mat34 result;
+	f32x4Store(result.elems + 0, ut__mulRowM4(f32x4Load(a->elems + 0), b0, b1, b2, b3));
+	f32x4Store(result.elems + 4, ut__mulRowM4(f32x4Load(a->elems + 4), b0, b1, b2, b3));
+	f32x4Store(result.elems + 8, ut__mulRowM4(f32x4Load(a->elems + 8), b0, b1, b2, b3));
+	return result;
+}
+
+// a * b for a full matrix a, like a projection, and an affine b, with the same
+// bits as mulM4().
+inline static Mat4 mulM4M34(const Mat4* a, const Mat34* b) {
+	F32x4 b0 = f32x4Load(b->elems + 0);
+	F32x4 b1 = f32x4Load(b->elems + 4);
+	F32x4 b2 = f32x4Load(b->elems + 8);
+	F32x4 b3 = f32x4Load(ut__bottomRowM34);
+	Mat4 result;
+	f32x4Store(result.elems + 0, ut__mulRowM4(f32x4Load(a->elems + 0), b0, b1, b2, b3));
+	f32x4Store(result.elems + 4, ut__mulRowM4(f32x4Load(a->elems + 4), b0, b1, b2, b3));
+	f32x4Store(result.elems + 8, ut__mulRowM4(f32x4Load(a->elems + 8), b0, b1, b2, b3));
+	f32x4Store(result.elems + 12, ut__mulRowM4(f32x4Load(a->elems + 12), b0, b1, b2, b3));
+	return result;
+}
+
+inline static Vec3 transformPointM34(const Mat34* m, Vec3 p) {
+	const f32* e = m->elems;
+	return vec3(
+		e[0] * p.x + e[1] * p.y + e[2] * p.z + e[3],
+		e[4] * p.x + e[5] * p.y + e[6] * p.z + e[7],
+		e[8] * p.x + e[9] * p.y + e[10] * p.z + e[11]);
+}
+
+// A rotation as a unit quaternion x i + y j + z k + w.
+typedef struct Quat {
+	f32 x, y, z, w;
+} Quat;
+
+inline static Quat quat(f32 x, f32 y, f32 z, f32 w) {
+	Quat q = {x, y, z, w};
+	return q;
+}
+
+inline static Quat identityQuat(void) {
+	return quat(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// A rotation by radians around unitAxis, counterclockwise when looking down the
+// axis towards the origin.
+inline static Quat quatAxisAngle(Vec3 unitAxis, f32 radians) {
+	f32 s, c;
+	sinCosF32(0.5f * radians, &s, &c);
+	return quat(unitAxis.x * s, unitAxis.y * s, unitAxis.z * s, c);
+}
+
+// The rotation by b followed by the rotation by a.
+inline static Quat mulQuat(Quat a, Quat b) {
+	return quat(
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+// Products of quaternions slowly drift away from unit length; renormalize
+// every so often.
+inline static Quat normalizeQuat(Quat q) {
+	f32 scale = 1.0f / sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+	return quat(q.x * scale, q.y * scale, q.z * scale, q.w * scale);
+}
+
+inline static Vec3 rotateQuat(Quat q, Vec3 v) {
+	// v + w t + (q.xyz x t), with t = 2 (q.xyz x v)
+	f32 tx = 2.0f * (q.y * v.z - q.z * v.y);
+	f32 ty = 2.0f * (q.z * v.x - q.x * v.z);
+	f32 tz = 2.0f * (q.x * v.y - q.y * v.x);
+	return vec3(
+		v.x + q.w * tx + (q.y * tz - q.z * ty),
+		v.y + q.w * ty + (q.z * tx - q.x * tz),
+		v.z + q.w * tz + (q.x * ty - q.y * tx));
+}
+
+// Scale uniformly, then rotate, then translate: 8 floats, which upload as two
+// vec4s (the rotation, then the translation and scale), against 12 for a Mat34
+// and 16 for a Mat4. Scaling the same along every axis keeps the composition
+// of two Transforms a Transform.
+typedef struct Transform {
+	Quat rotation;
+	Vec3 translation;
+	f32 scale;
+} Transform;
+
+inline static Transform transform(Quat rotation, Vec3 translation, f32 scale) {
+	Transform t = {rotation, translation, scale};
+	return t;
+}
+
+// b followed by a.
+inline static Transform mulTransform(const Transform* a, const Transform* b) {
+	Vec3 moved = rotateQuat(a->rotation, b->translation);
+	return transform(
+		mulQuat(a->rotation, b->rotation),
+		vec3(
+			a->translation.x + a->scale * moved.x,
+			a->translation.y + a->scale * moved.y,
+			a->translation.z + a->scale * moved.z),
+		a->scale * b->scale);
+}
+
+inline static Vec3 transformPoint(const Transform* t, Vec3 p) {
+	Vec3 rotated = rotateQuat(t->rotation, p);
+	return vec3(
+		t->scale * rotated.x + t->translation.x,
+		t->scale * rotated.y + t->translation.y,
+		t->scale * rotated.z + t->translation.z);
+}
+
+inline static Mat34 m34FromTransform(const Transform* t) {
+	Quat q = t->rotation;
+	f32 s = 2.0f * t->scale;
+	f32 xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	f32 xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	f32 wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	Mat34 m = {{
+		t->scale - s * (yy + zz), s * (xy - wz),            s * (xz + wy),            t->translation.x,
+		s * (xy + wz),            t->scale - s * (xx + zz), s * (yz - wx),            t->translation.y,
+		s * (xz - wy),            s * (yz + wx),            t->scale - s * (xx + yy), t->translation.z,
+	}};
+	return m;
+}
@@ -0,0 +1,336 @@
+#include "util.h"
+
+// A stress test for how many objects per frame the WASM to WebGL path can
+// keep up with: cubeCount cubes, each spinning around its own axis, drawn with
+// one glDrawElementsInstanced() call. Every frame the CPU computes a Mat34 per
+// cube and streams all of them to the GPU through a vertex attribute with a
+// divisor of 1. The arrow keys (or + and -) double and halve the number of
+// cubes, and the window title shows the frame rate and the CPU time per frame.
+
+typedef struct Vertex {
+	Vec3 position;
+	ColorRgba8 color;
+} Vertex;
+
+// Where a cube is and how it spins, set when the number of cubes changes.
+typedef struct Cube {
+	Vec3 position;
+	Vec3 spinAxis;
+	// kept in [0, 2 pi), so the half angles stay well inside the range where
+	// sinCosBatch() is fast no matter how long the page runs
+	f32 spinRadians;
+	f32 radiansPerSecond;
+} Cube;
+
+#define INITIAL_CUBE_COUNT 100000
+#define MAX_CUBE_COUNT (1 << 20)
+#define CUBE_SPACING 1.5f
+
+GLuint program;
+GLint unifViewProjection;
+GLuint vertexBuffer, indexBuffer, instanceBuffer;
+GLuint vao;
+
+// the ID of the canvas element on the HTML page
+const char* canvasId = "canvas";
+
+i32 canvasWidth, canvasHeight;
+
+u32 cubeCount;
+// cubes along each side of the grid
+u32 gridSide;
+u32 cubeCapacity;
+Cube* cubes;
+// per cube: the half angles of its rotation this frame, their sines and
+// cosines, and the Mat34 that is uploaded
+f32* halfAngles;
+f32* sines;
+f32* cosines;
+Mat34* models;
+
+static EM_BOOL canvasResizedCallback(int eventType, const void* reserved, void* userData) {
+	double width, height;
+	UtEmCheckResult(emscripten_get_element_css_size(canvasId, &width, &height));
+	canvasWidth = (i32) width;
+	canvasHeight = (i32) height;
+	glViewport(0, 0, canvasWidth, canvasHeight);
+	return EM_TRUE;
+}
+
+static u32 randomState = 0x9e3779b9;
+
+static f32 randomUnit() {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return (f32) (randomState >> 8) * (2.0f / (f32) (1 << 24)) - 1.0f;
+}
+
+static void setCubeCount(u32 count) {
+	if (count < 1) {
+		count = 1;
+	}
+	if (count > MAX_CUBE_COUNT) {
+		count = MAX_CUBE_COUNT;
+	}
+	if (count == cubeCount) {
+		return;
+	}
+	if (count > cubeCapacity) {
+		cubeCapacity = count;
+		cubes = realloc(cubes, cubeCapacity * sizeof(Cube));
+		halfAngles = realloc(halfAngles, cubeCapacity * sizeof(f32));
+		sines = realloc(sines, cubeCapacity * sizeof(f32));
+		cosines = realloc(cosines, cubeCapacity * sizeof(f32));
+		models = realloc(models, cubeCapacity * sizeof(Mat34));
+		if (!cubes || !halfAngles || !sines || !cosines || !models) {
+			FatalError("Out of memory for %u cubes\n", count);
+		}
+	}
+	cubeCount = count;
+
+	// a cube of cubes, centered on the origin
+	gridSide = (u32) ceilf(cbrtf((f32) cubeCount));
+	f32 center = 0.5f * (f32) (gridSide - 1);
+	randomState = 0x9e3779b9;
+	for (u32 i = 0; i < cubeCount; ++i) {
+		Cube* cube = cubes + i;
+		u32 x = i % gridSide;
+		u32 y = (i / gridSide) % gridSide;
+		u32 z = i / (gridSide * gridSide);
+		cube->position = vec3(
+			CUBE_SPACING * ((f32) x - center),
+			CUBE_SPACING * ((f32) y - center),
+			CUBE_SPACING * ((f32) z - center));
+		Vec3 axis = vec3(randomUnit(), randomUnit(), randomUnit());
+		f32 length = sqrtf(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+		if (length < 0.001f) {
+			axis = vec3(0.0f, 1.0f, 0.0f);
+			length = 1.0f;
+		}
+		cube->spinAxis = vec3(axis.x / length, axis.y / length, axis.z / length);
+		cube->spinRadians = (f32) PI * (randomUnit() + 1.0f);
+		cube->radiansPerSecond = (f32) PI * (0.5f + 0.25f * randomUnit());
+	}
+	printf("%u cubes\n", cubeCount);
+}
+
+static EM_BOOL keyDownCallback(int eventType, const EmscriptenKeyboardEvent* keyEvent, void* userData) {
+	const char* key = keyEvent->key;
+	if (strcmp(key, "ArrowUp") == 0 || strcmp(key, "+") == 0 || strcmp(key, "=") == 0) {
+		setCubeCount(cubeCount * 2);
+		return EM_TRUE;
+	}
+	if (strcmp(key, "ArrowDown") == 0 || strcmp(key, "-") == 0) {
+		setCubeCount(cubeCount / 2);
+		return EM_TRUE;
+	}
+	return EM_FALSE;
+}
+
+f64 lastTimeMillis;
+
+// frames and CPU time since the window title was last updated
+f64 statsStartMillis;
+u32 statsFrameCount;
+f64 statsCpuMillis;
+
+static void mainLoop(void* arg) {
+	f64 timeMillis = emscripten_get_now();
+	f32 seconds = (f32) ((timeMillis - lastTimeMillis) / 1000.0);
+	lastTimeMillis = timeMillis;
+
+	// spin every cube: one batch of sines and cosines for all of their
+	// quaternions, then a Mat34 each
+	for (u32 i = 0; i < cubeCount; ++i) {
+		Cube* cube = cubes + i;
+		cube->spinRadians = fmodf(cube->spinRadians + cube->radiansPerSecond * seconds, (f32) (2.0 * PI));
+		halfAngles[i] = 0.5f * cube->spinRadians;
+	}
+	sinCosBatch(halfAngles, sines, cosines, cubeCount);
+	f32 cubeScale = CUBE_SPACING / 2.0f;
+	for (u32 i = 0; i < cubeCount; ++i) {
+		Vec3 axis = cubes[i].spinAxis;
+		f32 s = sines[i];
+		Transform t = transform(quat(axis.x * s, axis.y * s, axis.z * s, cosines[i]), cubes[i].position, cubeScale);
+		models[i] = m34FromTransform(&t);
+	}
+
+	f32 aspectRatio = (f32) canvasWidth / (f32) canvasHeight;
+	f32 gridExtent = CUBE_SPACING * (f32) gridSide;
+	f32 distance = 1.2f * gridExtent + 2.0f;
+	Mat4 perspective = perspectiveM4(degToRad(60.0f), aspectRatio, 0.1f, distance + gridExtent);
+	Mat34 view = identityM34();
+	view.elems[11] = -distance;
+	Mat4 viewProjection = mulM4M34(&perspective, &view);
+
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+
+	glUseProgram(program);
+	glUniformMatrix4fv(unifViewProjection, 1, GL_TRUE, viewProjection.elems);
+	// replace the whole buffer every frame, so the driver can hand out new
+	// storage instead of waiting for the previous frame to stop using it
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, cubeCount * sizeof(Mat34), models, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(vao);
+	glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, NULL, (GLsizei) cubeCount);
+	glBindVertexArray(0);
+
+	statsCpuMillis += emscripten_get_now() - timeMillis;
+	statsFrameCount += 1;
+	f64 statsMillis = timeMillis - statsStartMillis;
+	if (statsMillis >= 1000.0) {
+		f64 framesPerSecond = statsFrameCount * 1000.0 / statsMillis;
+		f64 cpuMillisPerFrame = statsCpuMillis / statsFrameCount;
+		char title[128];
+		snprintf(
+			title, sizeof(title), "%u cubes: %.1f fps, %.2f ms CPU per frame, %.1f M cubes/s",
+			cubeCount, framesPerSecond, cpuMillisPerFrame, cubeCount * framesPerSecond / 1e6);
+		emscripten_set_window_title(title);
+		statsStartMillis = timeMillis;
+		statsFrameCount = 0;
+		statsCpuMillis = 0.0;
+	}
+}
+
+int main() {
+	EmscriptenWebGLContextAttributes contextAttribs = {
+		.alpha = EM_TRUE,
+		.depth = EM_TRUE,
+		.stencil = EM_FALSE,
+		.antialias = EM_TRUE,
+		.premultipliedAlpha = EM_TRUE,
+		.preserveDrawingBuffer = EM_FALSE,
+		.preferLowPowerToHighPerformance = EM_FALSE,
+		.failIfMajorPerformanceCaveat = EM_FALSE,
+		.majorVersion = 2,
+		.minorVersion = 0,
+		.enableExtensionsByDefault = EM_FALSE,
+		.explicitSwapControl = EM_FALSE,
+	};
+	EMSCRIPTEN_WEBGL_CONTEXT_HANDLE context = emscripten_webgl_create_context(canvasId, &contextAttribs);
+	if (context < 0) {
+		EMSCRIPTEN_RESULT result = (EMSCRIPTEN_RESULT) context;
+		FatalError("Failed to create WebGL context: %s (%d)\n", ut_emResultToString(result), result);
+	}
+	emscripten_webgl_make_context_current(context);
+
+	GLuint vertShader = glCreateShader(GL_VERTEX_SHADER);
+	GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
+	program = glCreateProgram();
+
+	const char* vertShaderSource =
+		"#version 300 es\n"
+		"\n"
+		"uniform mat4 viewProjection;\n"
+		"\n"
+		"layout(location = 0) in mediump vec3 vertexPosition;\n"
+		"layout(location = 1) in mediump vec4 vertexColor;\n"
+		"// the rows of the cube's Mat34, see ut_glInstanceAttribM34()\n"
+		"layout(location = 2) in highp mat3x4 model;\n"
+		"\n"
+		"out mediump vec3 vertColor;\n"
+		"\n"
+		"void main() {\n"
+		"    vec3 world = vec4(vertexPosition, 1.0f) * model;\n"
+		"    gl_Position = viewProjection * vec4(world, 1.0f);\n"
+		"    vertColor = vertexColor.rgb;\n"
+		"}\n";
+
+	const char* fragShaderSource =
+		"#version 300 es\n"
+		"\n"
+		"in mediump vec3 vertColor;\n"
+		"\n"
+		"out mediump vec4 fragColor;\n"
+		"\n"
+		"void main() {\n"
+		"    fragColor = vec4(vertColor, 1.0f);\n"
+		"}\n";
+
+	b32 success =
+		ut_glCompileShader("cubes-vert", vertShader, vertShaderSource) &
+		ut_glCompileShader("cubes-frag", fragShader, fragShaderSource);
+	if (!success) {
+		exitError();
+	}
+	if (!ut_glLinkProgram("cubes", program, vertShader, fragShader)) {
+		exitError();
+	}
+	unifViewProjection = glGetUniformLocation(program, "viewProjection");
+	assert(unifViewProjection != -1);
+
+	glDeleteShader(vertShader);
+	glDeleteShader(fragShader);
+
+	glGenBuffers(1, &vertexBuffer);
+	glGenBuffers(1, &indexBuffer);
+	glGenBuffers(1, &instanceBuffer);
+	glGenVertexArrays(1, &vao);
+
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	GLuint positionIndex = 0, colorIndex = 1, modelIndex = 2;
+	glVertexAttribPointer(positionIndex, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, position));
+	glEnableVertexAttribArray(positionIndex);
+	glVertexAttribPointer(colorIndex, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*) offsetof(Vertex, color));
+	glEnableVertexAttribArray(colorIndex);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	ut_glInstanceAttribM34(modelIndex, sizeof(Mat34), 0);
+	glBindVertexArray(0);
+
+	const Vertex cubeVertices[8] = {
+		{ .position = {-0.5f, -0.5f, -0.5f}, .color = {  0,   0,   0, 255} },
+		{ .position = {-0.5f, -0.5f,  0.5f}, .color = {  0,   0, 255, 255} },
+		{ .position = {-0.5f,  0.5f, -0.5f}, .color = {  0, 255,   0, 255} },
+		{ .position = {-0.5f,  0.5f,  0.5f}, .color = {  0, 255, 255, 255} },
+		{ .position = { 0.5f, -0.5f, -0.5f}, .color = {255,   0,   0, 255} },
+		{ .position = { 0.5f, -0.5f,  0.5f}, .color = {255,   0, 255, 255} },
+		{ .position = { 0.5f,  0.5f, -0.5f}, .color = {255, 255,   0, 255} },
+		{ .position = { 0.5f,  0.5f,  0.5f}, .color = {255, 255, 255, 255} },
+	};
+	const u16 cubeIndices[36] = {
+		0, 1, 3,
+		6, 0, 2,
+		5, 0, 4,
+		6, 4, 0,
+		0, 3, 2,
+		5, 1, 0,
+		3, 1, 5,
+		7, 4, 6,
+		4, 7, 5,
+		7, 6, 2,
+		7, 2, 3,
+		7, 3, 5,
+	};
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	EmscriptenFullscreenStrategy fullscreenStrategy = {
+		.scaleMode = EMSCRIPTEN_FULLSCREEN_SCALE_STRETCH,
+		.canvasResolutionScaleMode = EMSCRIPTEN_FULLSCREEN_CANVAS_SCALE_STDDEF,
+		.filteringMode = EMSCRIPTEN_FULLSCREEN_FILTERING_NEAREST,
+		.canvasResizedCallback = canvasResizedCallback,
+		.canvasResizedCallbackUserData = NULL,
+	};
+	emscripten_enter_soft_fullscreen(canvasId, &fullscreenStrategy);
+	UtEmCheckResult(emscripten_set_keydown_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, NULL, EM_TRUE, keyDownCallback));
+
+	setCubeCount(INITIAL_CUBE_COUNT);
+	lastTimeMillis = emscripten_get_now();
+	statsStartMillis = lastTimeMillis;
+	emscripten_set_main_loop_arg(mainLoop, NULL, 0, EM_TRUE);
+
+	UtEmCheckResult(emscripten_webgl_destroy_context(context));
+	return 0;
+}